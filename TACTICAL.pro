@@ -34,6 +34,15 @@ unix {
     INCLUDEPATH += tracking_algorithms/Correlation/TuringTracking
 }
 
+# openmp, for the parallel loops in the segmentation and optical flow
+unix {
+    QMAKE_CXXFLAGS += -fopenmp
+    QMAKE_LFLAGS += -fopenmp
+}
+win32 {
+    QMAKE_CXXFLAGS += /openmp
+}
+
 # gsl
 win32 {
     INCLUDEPATH += C:\TACTICAL\gsl-1.8-lib\include
@@ -111,6 +120,12 @@ SOURCES += main.cpp \
         utilities\utilities.cpp \
         ConvertUTF.c \
         tracking_algorithms/Optical_Flow/KLT/KLT.cpp \
+        tracking_algorithms/Optical_Flow/LK_OpenCV/LK_OpenCV.cpp \
+        tracking_algorithms/Optical_Flow/Horn_Schunck/Horn_Schunck.cpp \
+        tracking_algorithms/Optical_Flow/Flow_Analysis/Flow_Analysis.cpp \
+        tracking_algorithms/Optical_Flow/Flow_Frame/Flow_Frame.cpp \
+        tracking_algorithms/Optical_Flow/Sparse_To_Dense/Sparse_To_Dense.cpp \
+        tracking_algorithms/Optical_Flow/Flow_Engine/Flow_Engine.cpp \
         avi/AVILibrary.cpp \
         segmentation\segment.cpp \
         FFTLibrary.cpp \
@@ -124,9 +139,21 @@ HEADERS += mainwindow.h \
         SimpleIni.h \
         ConvertUTF.h \
         tracking_algorithms/Optical_Flow/KLT/KLT.h \
+        tracking_algorithms/Optical_Flow/LK_OpenCV/LK_OpenCV.h \
+        tracking_algorithms/Optical_Flow/Horn_Schunck/Horn_Schunck.h \
+        tracking_algorithms/Optical_Flow/Flow_Analysis/Flow_Analysis.h \
+        tracking_algorithms/Optical_Flow/Flow_Frame/Flow_Frame.h \
+        tracking_algorithms/Optical_Flow/Sparse_To_Dense/Sparse_To_Dense.h \
+        tracking_algorithms/Optical_Flow/Flow_Engine/Flow_Engine.h \
         avi/AVILibrary.h \
         segmentation.h \
         FFTLibrary.h \
         VideoDisplay.h
 
+# farneback optical flow needs OpenCV 2
+unix {
+    SOURCES += tracking_algorithms/Optical_Flow/Farneback/Farneback.cpp
+    HEADERS += tracking_algorithms/Optical_Flow/Farneback/Farneback.h
+}
+
 FORMS += mainwindow.ui
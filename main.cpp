@@ -76,6 +76,7 @@
 #include "tracking_algorithms/Blob/SIFT/kdtree.h"
 #include "tracking_algorithms/Blob/SIFT/utils.h"
 #include "tracking_algorithms/Blob/SIFT/xform.h"
+#include "tracking_algorithms/Blob/SIFT/featstore.h"
 
 // blob :: surf
 #include "tracking_algorithms/Blob/OpenSURF/surflib.h"
@@ -96,6 +97,7 @@
 #define NN_SQ_DIST_RATIO_THR 0.49
 #define SIFT_MIN_RANSAC_FEATURES 4
 #define COLOR_SWATCH_SZIE 16
+#define SIFT_FEATURE_STORE_FRAMES 2
 
 #undef main
 
@@ -822,8 +824,13 @@ void runBlobSIFT ()
     cvNamedWindow("Transformed", 1);
 
     struct feature *feat1, *feat2, *feat;
-    struct feature **nbrs;
-    struct kd_node *kdRoot;
+    struct kd_flat_tree *kdTree;
+    int *nbrs, *nNbrs;
+    float *nbrDist;
+
+    // every frame but the first and last is in two pairs, so keep the
+    // features (and kd tree) of the last frames instead of extracting twice
+    struct feature_store *featureStore = feature_store_init(SIFT_FEATURE_STORE_FRAMES);
     CvPoint pt1, pt2;
     double d0, d1;
     int n1, n2, k, m=0;
@@ -847,33 +854,41 @@ void runBlobSIFT ()
 
         stacked = stack_imgs(imgA, imgB);
 
-        n1 = sift_features(imgA, &feat1);
-        n2 = sift_features(imgB, &feat2);
-        kdRoot = kdtree_build(feat2, n2);
+        n1 = feature_store_get(featureStore, i, imgA, &feat1, NULL);
+        n2 = feature_store_get(featureStore, i+1, imgB, &feat2, &kdTree);
+
+        // find the two nearest neighbours of every feature of imgA at once
+        nbrs = (int *) malloc(2 * n1 * sizeof(int));
+        nbrDist = (float *) malloc(2 * n1 * sizeof(float));
+        nNbrs = (int *) malloc(n1 * sizeof(int));
+        kdtree_flat_bbf_knn_batch(kdTree, feat1, n1, 2, KDTREE_BBF_MAX_NN_CHKS, nbrs, nbrDist, nNbrs);
 
         int j=0;
         for (j=0; j<n1; j++) {
             feat = feat1 + j;
-            k = kdtree_bbf_knn(kdRoot, feat, 2, &nbrs, KDTREE_BBF_MAX_NN_CHKS);
+            k = nNbrs[j];
 
             if (k == 2) {
-                d0 = descr_dist_sq(feat, nbrs[0]);
-                d1 = descr_dist_sq(feat, nbrs[1]);
+                d0 = nbrDist[2*j];
+                d1 = nbrDist[2*j+1];
 
                 if (d0 < d1 * NN_SQ_DIST_RATIO_THR) {
+                    struct feature *match = kdTree->features + nbrs[2*j];
 
                     pt1 = cvPoint(cvRound(feat->x), cvRound(feat->y));
-                    pt2 = cvPoint(cvRound(nbrs[0]->x), cvRound(nbrs[0]->y));
+                    pt2 = cvPoint(cvRound(match->x), cvRound(match->y));
                     pt2.y += imgA->height;
                     cvLine(stacked, pt1, pt2, CV_RGB(255, 0, 255), 1, 8, 0);
                     m++;
-                    feat1[j].fwd_match = nbrs[0];
+                    feat1[j].fwd_match = match;
                 }
             }
-
-            free(nbrs);
         }
 
+        free(nbrs);
+        free(nbrDist);
+        free(nNbrs);
+
         cout << "Found " << m << " total matches\n";
 
         cvShowImage("Matches", stacked);
@@ -890,7 +905,6 @@ void runBlobSIFT ()
         if (doRANSAC) {
 
             // now, do RANSAC
-            feat1[j].fwd_match = nbrs[0];
             {
                 CvMat *H;
                 printf("n1 = %d\n", n1);
@@ -940,12 +954,11 @@ void runBlobSIFT ()
         cvReleaseImage(&stacked);
         cvReleaseImage(&imgA);
         cvReleaseImage(&imgB);
-        kdtree_release(kdRoot);
-        free(feat1);
-        free(feat2);
         siftCount = 0;
         frameNumberSIFT++;
     }
+
+    feature_store_release(&featureStore);
 **/
  } // end runBlobSIFT
 
@@ -53,6 +53,7 @@
 #define OPTICAL_FLOW_KLT 0
 #define OPTICAL_FLOW_HS 1
 #define OPTICAL_FLOW_FB 2
+#define OPTICAL_FLOW_KLT_DENSE 3
 
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -69,6 +70,17 @@ MainWindow::MainWindow(QWidget *parent)
     // instantiations
     utilities = new Utilities();
     klt = new KLT();
+    kltEngine = new KLTEngine(klt);
+    hsEngine = new HornSchunckEngine();
+    sdEngine = new SparseToDenseEngine(klt);
+#ifdef unix
+    fbEngine = new FarnebackEngine();
+#endif
+    flowPipeline = new FlowPipeline();
+    videoSegmentation = new VideoSegmentation();
+
+    // keep the display interactive on large frames
+    hsEngine->hornSchunck.timeBudget = 0.05;
     imageFunctions = new ImageFunctions();
 
     ui->setupUi(this);
@@ -180,6 +192,14 @@ MainWindow::~MainWindow()
     delete ui;
     delete utilities;
     delete imageFunctions;
+    delete flowPipeline;
+    delete videoSegmentation;
+    delete kltEngine;
+    delete hsEngine;
+    delete sdEngine;
+#ifdef unix
+    delete fbEngine;
+#endif
     delete klt;
     delete avi;
     //delete turingTracking;
@@ -715,6 +735,9 @@ void MainWindow::openImageDirectory()
 {
     QString fileName = QFileDialog::getOpenFileName(this, tr("Select the first image or a movie file"));
 
+    // the frames of the new source do not follow on from the old ones
+    videoSegmentation->reset();
+
     // first look and see if we have an avi file
     string t = fileName.toStdString();
 
@@ -1476,7 +1499,7 @@ void MainWindow::updateImageNumber(int value)
 
     if (segment == true) {
 
-        processed = segmentation(frame, sigma, k, minSize);
+        processed = videoSegmentation->segment(frame, sigma, k, minSize);
         freeProcessedImage = true;
 
     }
@@ -1487,6 +1510,9 @@ void MainWindow::updateImageNumber(int value)
     //
     /////////////////////////////////////////////////////////////////
 
+    // the dominant motion of a dense engine, shown in the status bar
+    char flowMsg[128] = "";
+
     if (opticalFlow == true) {
 
         // klt
@@ -1501,13 +1527,7 @@ void MainWindow::updateImageNumber(int value)
             klt->winSize = kltWindowSize;
             klt->numLevels = kltNumLevels;
 
-            // call klt
-            klt->lkOpticalFlow(frame);
-            printf("End KLT\n");
-
-            if (klt->lkInitialized) {
-                klt->drawFeatures(frame);
-            }
+            flowPipeline->setEngine(kltEngine);
 
             // try setting the processed image flag to false
             freeProcessedImage = false;
@@ -1515,11 +1535,46 @@ void MainWindow::updateImageNumber(int value)
         // horn-schunck
         } else if (opticalFlowAlgorithm == OPTICAL_FLOW_HS) {
 
+            flowPipeline->setEngine(hsEngine);
+
         // farneback
         } else if (opticalFlowAlgorithm == OPTICAL_FLOW_FB) {
 
+#ifdef unix
+            flowPipeline->setEngine(fbEngine);
+#else
+            flowPipeline->setEngine(NULL);
+            sprintf(flowMsg, "  ::  Farneback needs OpenCV 2, not run");
+#endif
+
+        // dense flow from the klt features
+        } else if (opticalFlowAlgorithm == OPTICAL_FLOW_KLT_DENSE) {
+
+            klt->quality = kltQuality;
+            klt->minDistance = (double)kltMinDist;
+            klt->winSize = kltWindowSize;
+            klt->numLevels = kltNumLevels;
+
+            flowPipeline->setEngine(sdEngine);
+
         }
 
+        // the frame is made grey, and its pyramid built, once for the engine
+        flowPipeline->process(frame);
+        flowPipeline->draw(frame);
+
+        FlowAnalysis *analysis = flowPipeline->getAnalysis();
+        if (analysis != NULL) {
+            sprintf(flowMsg, "  ::  motion %.2f %.2f, %d moving", analysis->getTranslationX(),
+                    analysis->getTranslationY(), analysis->getMovingPixels());
+        }
+
+    } else {
+
+        // the next frame tracked does not follow on from the last one
+        flowPipeline->setEngine(NULL);
+        flowPipeline->reset();
+
     }
 
     ///////////////////////////////////////////////////////////////////////////
@@ -1632,7 +1687,7 @@ void MainWindow::updateImageNumber(int value)
     }
 
     // update the status bar
-    QString msg3 = fileName;
+    QString msg3 = fileName + flowMsg;
     ui->statusBar->showMessage(msg3);
 
     // release the current frame if we are loading from files
@@ -48,6 +48,7 @@
 //#include "tracking_algorithms/correlation/TuringTracking.h"
 
 #include "tracking_algorithms/Optical_Flow/KLT/KLT.h"
+#include "tracking_algorithms/Optical_Flow/Flow_Engine/Flow_Engine.h"
 
 // avi functions
 #include "avi/AVILibrary.h"
@@ -87,6 +88,18 @@ public:
 
     KLT *klt;
 
+    // optical flow engines, fed one grey frame and pyramid per frame
+    FlowPipeline *flowPipeline;
+    KLTEngine *kltEngine;
+    HornSchunckEngine *hsEngine;
+    SparseToDenseEngine *sdEngine;
+#ifdef unix
+    FarnebackEngine *fbEngine;
+#endif
+
+    // the segmentation keeps the last frame of the video
+    VideoSegmentation *videoSegmentation;
+
     AVILibrary *avi;
 
 private:
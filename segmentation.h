@@ -1,7 +1,51 @@
 #ifndef SEGMENTATION_H
 #define SEGMENTATION_H
 
+#include "segment-stats.h"
+
+class smooth_workspace;
+class video_segmenter;
+
 // segmentation
 IplImage *segmentation (IplImage *imageIn, float sigma, float k, float min_size);
 
+// segment label map: a 32-bit, single channel image holding the segment of
+// each pixel, numbered from 0 to *num_segments-1.  If stats is not NULL it
+// receives the statistics of each segment, to be freed with delete [].  A
+// workspace passed in keeps the smoothing buffers from call to call.
+IplImage *segmentationLabels (IplImage *imageIn, float sigma, float k, float min_size,
+                              int *num_segments, segment_stats **stats = NULL,
+                              smooth_workspace *ws = NULL);
+
+// a workspace for segmentationLabels, for one thread at a time
+smooth_workspace *segmentationWorkspace ();
+void releaseSegmentationWorkspace (smooth_workspace **ws);
+
+// random colour for each segment of a label map
+IplImage *segmentationColours (IplImage *labels, int num_segments);
+
+// segmentation of consecutive video frames: segments of the previous frame
+// that did not change are carried over, and each segment keeps its colour
+// while it is tracked.  Keep one for each video source, used from one thread.
+class VideoSegmentation
+{
+    public:
+
+        VideoSegmentation();
+        ~VideoSegmentation();
+
+        // colours of the segments of the next frame; starts again when the
+        // parameters change
+        IplImage *segment (IplImage *imageIn, float sigma, float k, float min_size);
+
+        // the next frame does not follow on from the last one
+        void reset ();
+
+    private:
+
+        video_segmenter *segmenter;
+        float params[3];
+
+};
+
 #endif // SEGMENTATION_H
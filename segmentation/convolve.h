@@ -25,12 +25,19 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
 #include <algorithm>
 #include <cmath>
 #include "image.h"
+#include "misc.h"
+
+/* vector extensions, used for color images if available */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define CONVOLVE_USE_SSE2
+#endif
 
 using namespace std;
 
 /* convolve src with mask.  dst is flipped! */
 static void convolve_even(image<float> *src, image<float> *dst, 
-			  vector<float> &mask) {
+			  const vector<float> &mask) {
   int width = src->width();
   int height = src->height();
   int len = mask.size();
@@ -48,9 +55,58 @@ static void convolve_even(image<float> *src, image<float> *dst,
   }
 }
 
+/* convolve the three channels of src with mask.  dst is flipped! */
+static void convolve_even(image<rgbf> *src, image<rgbf> *dst, 
+			  const vector<float> &mask) {
+  int width = src->width();
+  int height = src->height();
+  int len = mask.size();
+
+  // a few rows at a time, so that the writes to each row of dst are
+  // next to each other
+  const int block = 4;
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int y0 = 0; y0 < height; y0 += block) {
+    int y1 = min(y0 + block, height);
+    for (int x = 0; x < width; x++) {
+      for (int y = y0; y < y1; y++) {
+	const rgbf *s = imPtr(src, 0, y);
+#ifdef CONVOLVE_USE_SSE2
+	// one pixel per register; the same arithmetic as for image<float>
+	__m128 sum = _mm_mul_ps(_mm_set1_ps(mask[0]), _mm_loadu_ps(&s[x].r));
+	for (int i = 1; i < len; i++) {
+	  const rgbf &a = s[max(x-i,0)];
+	  const rgbf &b = s[min(x+i, width-1)];
+	  sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(mask[i]),
+					   _mm_add_ps(_mm_loadu_ps(&a.r),
+						      _mm_loadu_ps(&b.r))));
+	}
+	_mm_storeu_ps(&imRef(dst, y, x).r, sum);
+#else
+	rgbf sum;
+	sum.r = mask[0] * s[x].r;
+	sum.g = mask[0] * s[x].g;
+	sum.b = mask[0] * s[x].b;
+	sum.pad = 0;
+	for (int i = 1; i < len; i++) {
+	  const rgbf &a = s[max(x-i,0)];
+	  const rgbf &b = s[min(x+i, width-1)];
+	  sum.r += mask[i] * (a.r + b.r);
+	  sum.g += mask[i] * (a.g + b.g);
+	  sum.b += mask[i] * (a.b + b.b);
+	}
+	imRef(dst, y, x) = sum;
+#endif
+      }
+    }
+  }
+}
+
 /* convolve src with mask.  dst is flipped! */
 static void convolve_odd(image<float> *src, image<float> *dst, 
-			 vector<float> &mask) {
+			 const vector<float> &mask) {
   int width = src->width();
   int height = src->height();
   int len = mask.size();
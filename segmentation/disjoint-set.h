@@ -33,17 +33,20 @@ public:
   ~universe();
   int find(int x);  
   void join(int x, int y);
+  void link(int x, int y);
+  void recount();
   int size(int x) const { return elts[x].size; }
   int num_sets() const { return num; }
 
 private:
   uni_elt *elts;
-  int num;
+  int num, total;
 };
 
 universe::universe(int elements) {
   elts = new uni_elt[elements];
   num = elements;
+  total = elements;
   for (int i = 0; i < elements; i++) {
     elts[i].rank = 0;
     elts[i].size = 1;
@@ -64,6 +67,13 @@ int universe::find(int x) {
 }
 
 void universe::join(int x, int y) {
+  link(x, y);
+  num--;
+}
+
+// join without updating the number of sets, so that threads can join
+// elements of disjoint parts of the forest at the same time
+void universe::link(int x, int y) {
   if (elts[x].rank > elts[y].rank) {
     elts[y].p = x;
     elts[x].size += elts[y].size;
@@ -73,7 +83,14 @@ void universe::join(int x, int y) {
     if (elts[x].rank == elts[y].rank)
       elts[y].rank++;
   }
-  num--;
+}
+
+// count the sets again after calls to link()
+void universe::recount() {
+  num = 0;
+  for (int i = 0; i < total; i++)
+    if (elts[i].p == i)
+      num++;
 }
 
 #endif
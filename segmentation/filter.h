@@ -81,6 +81,95 @@ image<float> *smooth(image<uchar> *src, float sigma) {
   return dst;
 }
 
+/*
+ * Buffers and mask for gaussian smoothing, kept between calls so that
+ * images of the same size are smoothed without allocating.  The mask is
+ * made again only when sigma changes.
+ */
+class smooth_workspace {
+public:
+  smooth_workspace();
+  ~smooth_workspace();
+
+  /* normalized gaussian mask for sigma */
+  const vector<float> &mask(float sigma);
+
+  /* smooth the channels of a color image into dst, of the same size */
+  void smooth(image<rgb> *src, float sigma, image<rgbf> *dst);
+
+  /* smooth an image into dst, of the same size */
+  void smooth(image<float> *src, float sigma, image<float> *dst);
+
+private:
+  float mask_sigma;
+  vector<float> gauss;
+  image<rgbf> *color, *color_tmp;
+  image<float> *tmp;
+};
+
+/* an image of the given size, reusing im if it has that size */
+template <class T>
+static image<T> *resize_image(image<T> *im, int width, int height) {
+  if (im && (im->width() == width) && (im->height() == height))
+    return im;
+  delete im;
+  return new image<T>(width, height, false);
+}
+
+smooth_workspace::smooth_workspace() {
+  mask_sigma = -1;
+  color = NULL;
+  color_tmp = NULL;
+  tmp = NULL;
+}
+
+smooth_workspace::~smooth_workspace() {
+  delete color;
+  delete color_tmp;
+  delete tmp;
+}
+
+const vector<float> &smooth_workspace::mask(float sigma) {
+  if (sigma != mask_sigma) {
+    gauss = make_fgauss(sigma);
+    normalize(gauss);
+    mask_sigma = sigma;
+  }
+  return gauss;
+}
+
+void smooth_workspace::smooth(image<rgb> *src, float sigma,
+			      image<rgbf> *dst) {
+  int width = src->width();
+  int height = src->height();
+  color = resize_image(color, width, height);
+  color_tmp = resize_image(color_tmp, height, width);
+
+  // one pixel per rgbf, for convolve_even
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      rgbf &p = imRef(color, x, y);
+      p.r = imRef(src, x, y).r;
+      p.g = imRef(src, x, y).g;
+      p.b = imRef(src, x, y).b;
+      p.pad = 0;
+    }
+  }
+
+  convolve_even(color, color_tmp, mask(sigma));
+  convolve_even(color_tmp, dst, mask(sigma));
+}
+
+void smooth_workspace::smooth(image<float> *src, float sigma,
+			      image<float> *dst) {
+  tmp = resize_image(tmp, src->height(), src->width());
+  convolve_even(src, tmp, mask(sigma));
+  convolve_even(tmp, dst, mask(sigma));
+}
+
 /* compute laplacian */
 static image<float> *laplacian(image<float> *src) {
   int width = src->width();
@@ -31,6 +31,9 @@ typedef unsigned char uchar;
 
 typedef struct { uchar r, g, b; } rgb;
 
+/* float colour, padded so that a pixel fills one SSE register */
+typedef struct { float r, g, b, pad; } rgbf;
+
 inline bool operator==(const rgb &a, const rgb &b) {
   return ((a.r == b.r) && (a.g == b.g) && (a.b == b.b));
 }
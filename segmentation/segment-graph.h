@@ -21,18 +21,217 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
 
 #include <algorithm>
 #include <cmath>
+#include <cstring>
 #include "disjoint-set.h"
 
 // threshold function
 #define THRESHOLD(size, c) (c/size)
 
+/*
+ * Edges join a pixel to its right, lower, lower right and upper right
+ * neighbours.  An edge is packed into 32 bits: the index of the pixel in
+ * the low 30 bits and the direction of the neighbour in the top 2 bits.
+ *
+ * Weights are quantised to 16 bit fixed point, so the edges can be
+ * sorted by counting them into one bucket per weight.  A sorted graph
+ * only keeps the bucket boundaries, not a weight per edge.
+ */
+#define EDGE_DIRS 4
+#define EDGE_INDEX_BITS 30
+#define EDGE_INDEX_MASK ((1u << EDGE_INDEX_BITS) - 1)
+
+// fixed point steps per unit of weight, and number of weight buckets
+#define WEIGHT_SCALE 128.0f
+#define WEIGHT_BUCKETS 65536
+
+// weight of a missing edge (e.g. to the right of the last column)
+#define WEIGHT_NONE 0xffff
+
+enum { EDGE_RIGHT = 0, EDGE_DOWN, EDGE_DOWN_RIGHT, EDGE_UP_RIGHT };
+
+typedef unsigned int edge;
+
+static inline edge edge_pack(int a, int dir) {
+  return ((unsigned int)dir << EDGE_INDEX_BITS) | (unsigned int)a;
+}
+
+static inline int edge_a(edge e) {
+  return (int)(e & EDGE_INDEX_MASK);
+}
+
+static inline int edge_dir(edge e) {
+  return (int)(e >> EDGE_INDEX_BITS);
+}
+
+// quantise a weight, saturating below WEIGHT_NONE
+static inline unsigned short weight_quantise(float w) {
+  float q = w * WEIGHT_SCALE + 0.5f;
+  return (unsigned short)(q < WEIGHT_NONE ? (int)q : WEIGHT_NONE - 1);
+}
+
+/* edges of a grid graph, sorted by weight */
 typedef struct {
-  float w;
-  int a, b;
-} edge;
+  int width, height;
+  int num;                   // number of edges
+  edge *edges;               // edges in non-decreasing weight order
+  int *first;                // edges of weight w are edges[first[w]..first[w+1]-1]
+  int offset[EDGE_DIRS];     // index offset of the neighbour in each direction
+} grid_graph;
+
+/* index of the second pixel of an edge */
+static inline int edge_b(const grid_graph *g, edge e) {
+  return edge_a(e) + g->offset[edge_dir(e)];
+}
 
-bool operator<(const edge &a, const edge &b) {
-  return a.w < b.w;
+/* make a grid graph with room for num edges */
+grid_graph *new_grid_graph(int width, int height, int num) {
+  grid_graph *g = new grid_graph;
+  g->width = width;
+  g->height = height;
+  g->num = 0;
+  g->edges = new edge[num];
+  g->first = new int[WEIGHT_BUCKETS + 1];
+  g->offset[EDGE_RIGHT] = 1;
+  g->offset[EDGE_DOWN] = width;
+  g->offset[EDGE_DOWN_RIGHT] = width + 1;
+  g->offset[EDGE_UP_RIGHT] = 1 - width;
+  return g;
+}
+
+/* edges leaving rows y0 .. y1-1 in direction dir */
+typedef struct {
+  int dir, y0, y1;
+} edge_run;
+
+/*
+ * Sort some of the edges of a grid graph.
+ *
+ * Returns a grid graph with its edges in non-decreasing weight order.
+ *
+ * width, height: size of the grid.
+ * weights: quantised weight of the edge leaving pixel p in direction d
+ *   at weights[d*width*height + p], or WEIGHT_NONE if there is no edge.
+ * runs: the edges to include.
+ * num_runs: number of runs.
+ */
+grid_graph *sort_grid_graph(int width, int height, 
+			    const unsigned short *weights,
+			    const edge_run *runs, int num_runs) {
+  int num_vertices = width * height;
+
+  // count the edges of each weight
+  int *first = new int[WEIGHT_BUCKETS + 1];
+  memset(first, 0, (WEIGHT_BUCKETS + 1) * sizeof(int));
+  for (int r = 0; r < num_runs; r++) {
+    const unsigned short *w = weights + runs[r].dir * num_vertices;
+    for (int p = runs[r].y0 * width; p < runs[r].y1 * width; p++)
+      first[w[p] + 1]++;
+  }
+  first[WEIGHT_NONE + 1] = 0;
+  for (int w = 0; w < WEIGHT_BUCKETS; w++)
+    first[w + 1] += first[w];
+  grid_graph *g = new_grid_graph(width, height, first[WEIGHT_BUCKETS]);
+  g->num = first[WEIGHT_BUCKETS];
+
+  // place each edge after the lighter ones
+  int *next = new int[WEIGHT_BUCKETS];
+  memcpy(next, first, WEIGHT_BUCKETS * sizeof(int));
+  for (int r = 0; r < num_runs; r++) {
+    const unsigned short *w = weights + runs[r].dir * num_vertices;
+    for (int p = runs[r].y0 * width; p < runs[r].y1 * width; p++) {
+      if (w[p] != WEIGHT_NONE)
+	g->edges[next[w[p]]++] = edge_pack(p, runs[r].dir);
+    }
+  }
+  delete [] next;
+
+  delete [] g->first;
+  g->first = first;
+  return g;
+}
+
+/* sort all the edges of a grid graph */
+grid_graph *sort_grid_graph(int width, int height, 
+			    const unsigned short *weights) {
+  edge_run runs[EDGE_DIRS];
+  for (int d = 0; d < EDGE_DIRS; d++) {
+    runs[d].dir = d;
+    runs[d].y0 = 0;
+    runs[d].y1 = height;
+  }
+  return sort_grid_graph(width, height, weights, runs, EDGE_DIRS);
+}
+
+/* free a grid graph */
+void delete_grid_graph(grid_graph *g) {
+  delete [] g->edges;
+  delete [] g->first;
+  delete g;
+}
+
+/*
+ * Merge components along the edges of some graphs, lightest first.
+ *
+ * Returns the number of merges.  Components are merged with
+ * universe::link, so the caller must update the set count.
+ *
+ * graphs: grid graphs with sorted edges, over the same pixels.
+ * num_graphs: number of graphs.
+ * u: disjoint-set forest over the pixels.
+ * threshold: merge threshold of each component, by representative.
+ * c: constant for treshold function.
+ * held: NULL, or flags for the components whose edges are held back.
+ *   An edge touching a held component is not merged but added to
+ *   deferred, and both its components become held.  The merges that are
+ *   made then involve no component a held edge touches, so they are the
+ *   merges the serial algorithm makes whatever the held edges do later.
+ * deferred: with held, a graph with room for the edges of all the
+ *   graphs; receives the held edges, sorted.
+ */
+int merge_graphs(const grid_graph *const *graphs, int num_graphs, 
+		 universe *u, float *threshold, float c,
+		 unsigned char *held = NULL, grid_graph *deferred = NULL) {
+  int merges = 0;
+  if (held)
+    deferred->num = 0;
+
+  // for each edge, in non-decreasing weight order...
+  for (int wq = 0; wq < WEIGHT_NONE; wq++) {
+    float w = wq / WEIGHT_SCALE;
+    if (held)
+      deferred->first[wq] = deferred->num;
+
+    for (int k = 0; k < num_graphs; k++) {
+      const grid_graph *g = graphs[k];
+      for (int i = g->first[wq]; i < g->first[wq + 1]; i++) {
+	edge e = g->edges[i];
+
+	// components conected by this edge
+	int a = u->find(edge_a(e));
+	int b = u->find(edge_b(g, e));
+	if (a == b)
+	  continue;
+	if (held && (held[a] || held[b])) {
+	  held[a] = held[b] = 1;
+	  deferred->edges[deferred->num++] = e;
+	  continue;
+	}
+	if ((w <= threshold[a]) &&
+	    (w <= threshold[b])) {
+	  u->link(a, b);
+	  a = u->find(a);
+	  threshold[a] = w + THRESHOLD(u->size(a), c);
+	  merges++;
+	}
+      }
+    }
+  }
+
+  if (held) {
+    deferred->first[WEIGHT_NONE] = deferred->num;
+    deferred->first[WEIGHT_BUCKETS] = deferred->num;
+  }
+  return merges;
 }
 
 /*
@@ -40,15 +239,11 @@ bool operator<(const edge &a, const edge &b) {
  *
  * Returns a disjoint-set forest representing the segmentation.
  *
- * num_vertices: number of vertices in graph.
- * num_edges: number of edges in graph
- * edges: array of edges.
+ * g: grid graph with sorted edges.
  * c: constant for treshold function.
  */
-universe *segment_graph(int num_vertices, int num_edges, edge *edges, 
-			float c) { 
-  // sort edges by weight
-  std::sort(edges, edges + num_edges);
+universe *segment_graph(const grid_graph *g, float c) { 
+  int num_vertices = g->width * g->height;
 
   // make a disjoint-set forest
   universe *u = new universe(num_vertices);
@@ -58,25 +253,11 @@ universe *segment_graph(int num_vertices, int num_edges, edge *edges,
   for (int i = 0; i < num_vertices; i++)
     threshold[i] = THRESHOLD(1,c);
 
-  // for each edge, in non-decreasing weight order...
-  for (int i = 0; i < num_edges; i++) {
-    edge *pedge = &edges[i];
-    
-    // components conected by this edge
-    int a = u->find(pedge->a);
-    int b = u->find(pedge->b);
-    if (a != b) {
-      if ((pedge->w <= threshold[a]) &&
-	  (pedge->w <= threshold[b])) {
-	u->join(a, b);
-	a = u->find(a);
-	threshold[a] = pedge->w + THRESHOLD(u->size(a), c);
-      }
-    }
-  }
+  merge_graphs(&g, 1, u, threshold, c);
+  u->recount();
 
   // free up
-  delete threshold;
+  delete [] threshold;
   return u;
 }
 
@@ -24,6 +24,16 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
 #include "misc.h"
 #include "filter.h"
 #include "segment-graph.h"
+#include "segment-stats.h"
+
+/* vector extensions, used for the edge weights if available */
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define SEGMENT_USE_SSE2
+#endif
+
+/* fewest rows in a tile when segmenting in tiles */
+#define SEGMENT_MIN_TILE_ROWS 32
 
 // random color
 rgb random_rgb(){ 
@@ -37,116 +47,367 @@ rgb random_rgb(){
   return c;
 }
 
-// dissimilarity measure between pixels
-static inline float diff(image<float> *r, image<float> *g, image<float> *b,
-			 int x1, int y1, int x2, int y2) {
-  return sqrt(square(imRef(r, x1, y1)-imRef(r, x2, y2)) +
-	      square(imRef(g, x1, y1)-imRef(g, x2, y2)) +
-	      square(imRef(b, x1, y1)-imRef(b, x2, y2)));
+// dissimilarity measure between pixels, quantised
+static inline unsigned short diff(const rgbf &p, const rgbf &q) {
+  float dr = p.r - q.r, dg = p.g - q.g, db = p.b - q.b;
+  return weight_quantise(sqrt(dr*dr + dg*dg + db*db));
+}
+
+// dissimilarities between n pixels p and their neighbours q
+static void diff_row(const rgbf *p, const rgbf *q, int n, unsigned short *w) {
+  int x = 0;
+#ifdef SEGMENT_USE_SSE2
+  const __m128 scale = _mm_set1_ps(WEIGHT_SCALE);
+  const __m128 half = _mm_set1_ps(0.5f);
+  const __m128 top = _mm_set1_ps(WEIGHT_NONE - 1);
+  int wq[4];
+
+  // four pixels at a time; the same arithmetic as diff()
+  for (; x + 4 <= n; x += 4) {
+    __m128 d0 = _mm_sub_ps(_mm_loadu_ps(&p[x].r), _mm_loadu_ps(&q[x].r));
+    __m128 d1 = _mm_sub_ps(_mm_loadu_ps(&p[x+1].r), _mm_loadu_ps(&q[x+1].r));
+    __m128 d2 = _mm_sub_ps(_mm_loadu_ps(&p[x+2].r), _mm_loadu_ps(&q[x+2].r));
+    __m128 d3 = _mm_sub_ps(_mm_loadu_ps(&p[x+3].r), _mm_loadu_ps(&q[x+3].r));
+    d0 = _mm_mul_ps(d0, d0);
+    d1 = _mm_mul_ps(d1, d1);
+    d2 = _mm_mul_ps(d2, d2);
+    d3 = _mm_mul_ps(d3, d3);
+    _MM_TRANSPOSE4_PS(d0, d1, d2, d3);
+    __m128 s = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(d0, d1), d2));
+    s = _mm_min_ps(_mm_add_ps(_mm_mul_ps(s, scale), half), top);
+    _mm_storeu_si128((__m128i *)wq, _mm_cvttps_epi32(s));
+    w[x] = (unsigned short)wq[0];
+    w[x+1] = (unsigned short)wq[1];
+    w[x+2] = (unsigned short)wq[2];
+    w[x+3] = (unsigned short)wq[3];
+  }
+#endif
+  for (; x < n; x++)
+    w[x] = diff(p[x], q[x]);
 }
 
 /*
- * Segment an image
+ * Compute the quantised edge weights of a smoothed image, in the layout
+ * taken by sort_grid_graph.
+ */
+static void edge_weights(image<rgbf> *im, unsigned short *weights) {
+  static const int dx[EDGE_DIRS] = { 1, 0, 1, 1 };
+  static const int dy[EDGE_DIRS] = { 0, 1, 1, -1 };
+  int width = im->width();
+  int height = im->height();
+
+  for (int d = 0; d < EDGE_DIRS; d++) {
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int y = 0; y < height; y++) {
+      unsigned short *w = weights + d * width * height + y * width;
+      int n = 0;
+      if (y + dy[d] >= 0 && y + dy[d] < height) {
+	n = width - dx[d];
+	diff_row(imPtr(im, 0, y), imPtr(im, dx[d], y + dy[d]), n, w);
+      }
+      for (int x = n; x < width; x++)
+	w[x] = WEIGHT_NONE;
+    }
+  }
+}
+
+/*
+ * Segment a grid graph, continuing from a given forest
  *
- * Returns a color image representing the segmentation.
+ * width, height: size of the grid.
+ * weights: quantised edge weights, as taken by sort_grid_graph.
+ * u: disjoint-set forest over the pixels, each pixel on its own or in
+ *   components carried over from elsewhere.  Carried over components
+ *   must be connected and have their representative's children as
+ *   direct children.
+ * threshold: merge threshold of each component, by representative.
+ * c: constant for treshold function.
+ * min_size: minimum component size (enforced by post-processing stage).
+ * tiles: number of horizontal strips to segment concurrently.  The
+ *   result is the same as segmenting the whole image at once, apart
+ *   from the order of edges of equal weight, but the parallel share of
+ *   the work shrinks as components reaching the seams grow.
+ */
+void segment_edges(int width, int height, const unsigned short *weights,
+		   universe *u, float *threshold, float c, int min_size,
+		   int tiles) {
+  // split the image into strips of rows
+  tiles = max(1, min(tiles, height / SEGMENT_MIN_TILE_ROWS));
+  grid_graph **graphs = new grid_graph*[tiles + 1];
+  grid_graph **deferred = new grid_graph*[tiles + 1];
+  unsigned char *held = NULL;
+  if (tiles > 1) {
+    // the components on the rows either side of a seam are held back
+    // from the start
+    held = new unsigned char[width*height];
+    memset(held, 0, width*height);
+    for (int t = 1; t < tiles; t++) {
+      int y = t * height / tiles;
+      for (int p = (y - 1) * width; p < (y + 1) * width; p++)
+	held[u->find(p)] = 1;
+    }
+  }
+
+  // segment each tile on its own.  Tiles are disjoint parts of the
+  // forest, so they can be merged at the same time.  Edges that touch
+  // components reaching a seam are deferred (see merge_graphs).
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for (int t = 0; t < tiles; t++) {
+    int y0 = t * height / tiles, y1 = (t + 1) * height / tiles;
+    edge_run runs[EDGE_DIRS] = {
+      { EDGE_RIGHT, y0, y1 },
+      { EDGE_DOWN, y0, y1 - 1 },
+      { EDGE_DOWN_RIGHT, y0, y1 - 1 },
+      { EDGE_UP_RIGHT, y0 + 1, y1 }
+    };
+    graphs[t] = sort_grid_graph(width, height, weights, runs, EDGE_DIRS);
+    if (held) {
+      deferred[t] = new_grid_graph(width, height, graphs[t]->num);
+      merge_graphs(graphs + t, 1, u, threshold, c, held, deferred[t]);
+    } else {
+      merge_graphs(graphs + t, 1, u, threshold, c);
+    }
+  }
+
+  // then merge the deferred edges together with the edges crossing the
+  // seams, in weight order, which completes the serial algorithm
+  edge_run *seams = new edge_run[3 * (tiles - 1) + 1];
+  for (int t = 1; t < tiles; t++) {
+    int y = t * height / tiles;
+    edge_run *run = seams + 3 * (t - 1);
+    run[0].dir = EDGE_DOWN;       run[0].y0 = y - 1; run[0].y1 = y;
+    run[1].dir = EDGE_DOWN_RIGHT; run[1].y0 = y - 1; run[1].y1 = y;
+    run[2].dir = EDGE_UP_RIGHT;   run[2].y0 = y;     run[2].y1 = y + 1;
+  }
+  graphs[tiles] = sort_grid_graph(width, height, weights, seams, 3 * (tiles - 1));
+  if (held) {
+    deferred[tiles] = graphs[tiles];
+    merge_graphs(deferred, tiles + 1, u, threshold, c);
+    for (int t = 0; t < tiles; t++)
+      delete_grid_graph(deferred[t]);
+    delete [] held;
+  }
+  delete [] deferred;
+  delete [] seams;
+
+  // post process small components, taking the edges of all the graphs
+  // in weight order
+  for (int wq = 0; wq < WEIGHT_NONE; wq++) {
+    for (int t = 0; t <= tiles; t++) {
+      const grid_graph *graph = graphs[t];
+      for (int i = graph->first[wq]; i < graph->first[wq + 1]; i++) {
+	int a = u->find(edge_a(graph->edges[i]));
+	int b = u->find(edge_b(graph, graph->edges[i]));
+	if ((a != b) && ((u->size(a) < min_size) || (u->size(b) < min_size)))
+	  u->link(a, b);
+      }
+    }
+  }
+  for (int t = 0; t <= tiles; t++)
+    delete_grid_graph(graphs[t]);
+  delete [] graphs;
+  u->recount();
+}
+
+/*
+ * Segment the pixels of an image
+ *
+ * Returns a disjoint-set forest over the pixels, one set per segment.
  *
  * im: image to segment.
  * sigma: to smooth the image.
  * c: constant for treshold function.
  * min_size: minimum component size (enforced by post-processing stage).
- * num_ccs: number of connected components in the segmentation.
+ * tiles: number of strips to segment concurrently (see segment_edges).
+ * ws: NULL, or buffers to smooth the image with, kept between calls.
  */
-image<rgb> *segment_image(image<rgb> *im, float sigma, float c, int min_size,
-			  int *num_ccs) {
+universe *segment_pixels(image<rgb> *im, float sigma, float c, int min_size,
+			 int tiles, smooth_workspace *ws = NULL) {
   int width = im->width();
   int height = im->height();
 
-  image<float> *r = new image<float>(width, height);
-  image<float> *g = new image<float>(width, height);
-  image<float> *b = new image<float>(width, height);
+  // smooth the color channels
+  smooth_workspace local;
+  if (!ws)
+    ws = &local;
+  image<rgbf> *smooth_rgb = new image<rgbf>(width, height, false);
+  ws->smooth(im, sigma, smooth_rgb);
 
-  // smooth each color channel  
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      imRef(r, x, y) = imRef(im, x, y).r;
-      imRef(g, x, y) = imRef(im, x, y).g;
-      imRef(b, x, y) = imRef(im, x, y).b;
-    }
-  }
-  image<float> *smooth_r = smooth(r, sigma);
-  image<float> *smooth_g = smooth(g, sigma);
-  image<float> *smooth_b = smooth(b, sigma);
-  delete r;
-  delete g;
-  delete b;
- 
   // build graph
-  edge *edges = new edge[width*height*4];
-  int num = 0;
-  for (int y = 0; y < height; y++) {
-    for (int x = 0; x < width; x++) {
-      if (x < width-1) {
-	edges[num].a = y * width + x;
-	edges[num].b = y * width + (x+1);
-	edges[num].w = diff(smooth_r, smooth_g, smooth_b, x, y, x+1, y);
-	num++;
-      }
+  unsigned short *weights = new unsigned short[EDGE_DIRS*width*height];
+  edge_weights(smooth_rgb, weights);
+  delete smooth_rgb;
 
-      if (y < height-1) {
-	edges[num].a = y * width + x;
-	edges[num].b = (y+1) * width + x;
-	edges[num].w = diff(smooth_r, smooth_g, smooth_b, x, y, x, y+1);
-	num++;
-      }
+  // make a disjoint-set forest and init thresholds
+  universe *u = new universe(width*height);
+  float *threshold = new float[width*height];
+  for (int i = 0; i < width*height; i++)
+    threshold[i] = THRESHOLD(1,c);
+
+  segment_edges(width, height, weights, u, threshold, c, min_size, tiles);
+
+  delete [] threshold;
+  delete [] weights;
+
+  return u;
+}
 
-      if ((x < width-1) && (y < height-1)) {
-	edges[num].a = y * width + x;
-	edges[num].b = (y+1) * width + (x+1);
-	edges[num].w = diff(smooth_r, smooth_g, smooth_b, x, y, x+1, y+1);
-	num++;
+/*
+ * Label the segments of a forest
+ *
+ * Returns the number of segments.
+ *
+ * u: disjoint-set forest over the pixels of im.
+ * im: the segmented image.
+ * labels: image of the same size as im; receives the segment of each
+ *   pixel.  Segments are numbered from 0 in the order of their first
+ *   pixel.
+ * stats: NULL, or receives a new array with the statistics of each
+ *   segment, to be freed with delete [].
+ */
+int label_segments(universe *u, image<rgb> *im, image<int> *labels,
+		   segment_stats **stats) {
+  int width = im->width();
+  int height = im->height();
+  int num = u->num_sets();
+
+  // label of each component, by representative
+  int *id = new int[width*height];
+  memset(id, 0xff, width * height * sizeof(int));
+
+  segment_stats *st = NULL;
+  double *sums = NULL;
+  if (stats) {
+    st = new segment_stats[num];
+    sums = new double[5*num];
+    memset(sums, 0, 5 * num * sizeof(double));
+  }
+
+  // number the segments as they are met, and gather their statistics
+  int next = 0;
+  for (int y = 0; y < height; y++) {
+    for (int x = 0; x < width; x++) {
+      int comp = u->find(y * width + x);
+      int l = id[comp];
+      if (l < 0) {
+	l = id[comp] = next++;
+	if (st) {
+	  st[l].area = 0;
+	  st[l].x0 = st[l].x1 = x;
+	  st[l].y0 = y;
+	}
       }
+      imRef(labels, x, y) = l;
 
-      if ((x < width-1) && (y > 0)) {
-	edges[num].a = y * width + x;
-	edges[num].b = (y-1) * width + (x+1);
-	edges[num].w = diff(smooth_r, smooth_g, smooth_b, x, y, x+1, y-1);
-	num++;
+      if (st) {
+	segment_stats &r = st[l];
+	r.area++;
+	if (x < r.x0) r.x0 = x;
+	if (x > r.x1) r.x1 = x;
+	r.y1 = y;
+	double *sum = sums + 5*l;
+	rgb p = imRef(im, x, y);
+	sum[0] += x;
+	sum[1] += y;
+	sum[2] += p.r;
+	sum[3] += p.g;
+	sum[4] += p.b;
       }
     }
   }
-  delete smooth_r;
-  delete smooth_g;
-  delete smooth_b;
 
-  // segment
-  universe *u = segment_graph(width*height, num, edges, c);
-  
-  // post process small components
-  for (int i = 0; i < num; i++) {
-    int a = u->find(edges[i].a);
-    int b = u->find(edges[i].b);
-    if ((a != b) && ((u->size(a) < min_size) || (u->size(b) < min_size)))
-      u->join(a, b);
+  if (st) {
+    for (int l = 0; l < num; l++) {
+      double *sum = sums + 5*l;
+      st[l].cx = sum[0] / st[l].area;
+      st[l].cy = sum[1] / st[l].area;
+      st[l].r = sum[2] / st[l].area;
+      st[l].g = sum[3] / st[l].area;
+      st[l].b = sum[4] / st[l].area;
+    }
+    delete [] sums;
+    *stats = st;
   }
-  delete [] edges;
-  *num_ccs = u->num_sets();
 
-  image<rgb> *output = new image<rgb>(width, height);
+  delete [] id;
 
-  // pick random colors for each component
-  rgb *colors = new rgb[width*height];
-  for (int i = 0; i < width*height; i++)
+  return num;
+}
+
+/*
+ * Label the segments of an image
+ *
+ * Returns the number of segments.
+ *
+ * im: image to segment.
+ * sigma: to smooth the image.
+ * c: constant for treshold function.
+ * min_size: minimum component size (enforced by post-processing stage).
+ * labels, stats: as for label_segments.
+ * tiles: number of strips to segment concurrently (see segment_edges).
+ * ws: NULL, or buffers to smooth the image with, kept between calls.
+ */
+int segment_labels(image<rgb> *im, float sigma, float c, int min_size,
+		   image<int> *labels, segment_stats **stats = NULL,
+		   int tiles = 1, smooth_workspace *ws = NULL) {
+  universe *u = segment_pixels(im, sigma, c, min_size, tiles, ws);
+  int num = label_segments(u, im, labels, stats);
+  delete u;
+
+  return num;
+}
+
+/*
+ * Color a label map
+ *
+ * Returns a color image with a random color for each segment.
+ *
+ * labels: segment of each pixel, from 0 to num-1.
+ * num: number of segments.
+ */
+image<rgb> *color_labels(image<int> *labels, int num) {
+  int width = labels->width();
+  int height = labels->height();
+  image<rgb> *output = new image<rgb>(width, height, false);
+
+  // pick random colors for each segment
+  rgb *colors = new rgb[num];
+  for (int i = 0; i < num; i++)
     colors[i] = random_rgb();
-  
+
   for (int y = 0; y < height; y++) {
     for (int x = 0; x < width; x++) {
-      int comp = u->find(y * width + x);
-      imRef(output, x, y) = colors[comp];
+      imRef(output, x, y) = colors[imRef(labels, x, y)];
     }
-  }  
+  }
 
-  delete [] colors;  
-  delete u;
+  delete [] colors;
+
+  return output;
+}
+
+/*
+ * Segment an image
+ *
+ * Returns a color image representing the segmentation.
+ *
+ * im: image to segment.
+ * sigma: to smooth the image.
+ * c: constant for treshold function.
+ * min_size: minimum component size (enforced by post-processing stage).
+ * num_ccs: number of connected components in the segmentation.
+ * tiles: number of strips to segment concurrently (see segment_edges).
+ */
+image<rgb> *segment_image(image<rgb> *im, float sigma, float c, int min_size,
+			  int *num_ccs, int tiles = 1) {
+  image<int> *labels = new image<int>(im->width(), im->height(), false);
+  *num_ccs = segment_labels(im, sigma, c, min_size, labels, NULL, tiles);
+  image<rgb> *output = color_labels(labels, *num_ccs);
+  delete labels;
 
   return output;
 }
@@ -0,0 +1,14 @@
+/* statistics of image segments */
+
+#ifndef SEGMENT_STATS_H
+#define SEGMENT_STATS_H
+
+/* statistics of one segment */
+typedef struct {
+  int area;            /* number of pixels */
+  int x0, y0, x1, y1;  /* bounding box, inclusive */
+  float cx, cy;        /* centroid */
+  float r, g, b;       /* mean color, in the channel order of the input */
+} segment_stats;
+
+#endif
@@ -0,0 +1,280 @@
+/* segmentation of consecutive video frames */
+
+#ifndef SEGMENT_VIDEO
+#define SEGMENT_VIDEO
+
+#include <vector>
+#include <algorithm>
+#include "segment-image.h"
+
+/* default change of a smoothed pixel, in grey levels, above which its
+   segment is segmented again */
+#define SEGMENT_VIDEO_CHANGE 8.0f
+
+/*
+ * Segments consecutive frames of a video.
+ *
+ * Segments of the previous frame whose pixels all changed by no more
+ * than a given amount are carried over whole, with the thresholds they
+ * had, and the boundaries between them are kept.  Only the edges that
+ * touch the changed parts of the frame are sorted and merged, so a
+ * static scene segments the same way as its first frame.
+ *
+ * Each segment of a frame gets an id that it keeps while it is
+ * tracked: the id of the previous segment it overlaps most, unless
+ * another segment overlaps that one more, or else a new one.
+ */
+class video_segmenter {
+public:
+  video_segmenter(float sigma, float c, int min_size,
+		  float change = SEGMENT_VIDEO_CHANGE, int tiles = 1);
+  ~video_segmenter();
+
+  /* segment the next frame (see segment_labels) */
+  int segment(image<rgb> *im, image<int> *labels,
+	      segment_stats **stats = NULL);
+
+  /* id of each segment of the last frame */
+  const int *ids() const { return seg_ids; }
+
+  /* number of segments carried over into the last frame */
+  int carried() const { return num_carried; }
+
+  /* forget the previous frame */
+  void reset();
+
+private:
+  float sigma, c, change;
+  int min_size, tiles;
+
+  smooth_workspace ws;
+
+  // the previous frame, and a buffer for the next one
+  image<rgbf> *prev_smooth, *next_smooth;
+  image<int> *prev_labels;
+  int prev_num;
+  float *prev_threshold;
+  int *seg_ids;
+
+  int next_id;
+  int num_carried;
+};
+
+/* overlap of a segment with a segment of the previous frame */
+typedef struct {
+  int seg, prev, count;
+} segment_overlap;
+
+static inline bool operator<(const segment_overlap &a,
+			     const segment_overlap &b) {
+  return (a.seg < b.seg) || ((a.seg == b.seg) && (a.prev < b.prev));
+}
+
+/* a color for a segment id, the same in every frame */
+static inline rgb id_rgb(int id) {
+  unsigned int h = (unsigned int)id * 2654435761u;
+  rgb c;
+  c.r = (uchar)(h >> 24);
+  c.g = (uchar)(h >> 16);
+  c.b = (uchar)(h >> 8);
+  return c;
+}
+
+video_segmenter::video_segmenter(float sigma, float c, int min_size,
+				 float change, int tiles) {
+  this->sigma = sigma;
+  this->c = c;
+  this->min_size = min_size;
+  this->change = change;
+  this->tiles = tiles;
+  prev_smooth = NULL;
+  next_smooth = NULL;
+  prev_labels = NULL;
+  prev_threshold = NULL;
+  seg_ids = NULL;
+  prev_num = 0;
+  next_id = 0;
+  num_carried = 0;
+}
+
+video_segmenter::~video_segmenter() {
+  reset();
+  delete next_smooth;
+}
+
+void video_segmenter::reset() {
+  delete prev_smooth;
+  delete prev_labels;
+  delete [] prev_threshold;
+  delete [] seg_ids;
+  prev_smooth = NULL;
+  prev_labels = NULL;
+  prev_threshold = NULL;
+  seg_ids = NULL;
+  prev_num = 0;
+}
+
+int video_segmenter::segment(image<rgb> *im, image<int> *labels,
+			     segment_stats **stats) {
+  int width = im->width();
+  int height = im->height();
+  int n = width * height;
+
+  if (prev_smooth && ((prev_smooth->width() != width) ||
+		      (prev_smooth->height() != height)))
+    reset();
+
+  // smooth the color channels, into the buffer of the frame before last
+  image<rgbf> *smooth_rgb = resize_image(next_smooth, width, height);
+  next_smooth = NULL;
+  ws.smooth(im, sigma, smooth_rgb);
+
+  // build graph
+  unsigned short *weights = new unsigned short[EDGE_DIRS*n];
+  edge_weights(smooth_rgb, weights);
+
+  // make a disjoint-set forest and init thresholds
+  universe *u = new universe(n);
+  float *threshold = new float[n];
+  for (int i = 0; i < n; i++)
+    threshold[i] = THRESHOLD(1,c);
+
+  num_carried = 0;
+  if (prev_smooth) {
+    const int *prev = prev_labels->data;
+
+    // a segment has changed if any of its pixels has
+    unsigned char *changed = new unsigned char[prev_num];
+    memset(changed, 0, prev_num);
+    for (int i = 0; i < n; i++) {
+      const rgbf &p = smooth_rgb->data[i];
+      const rgbf &q = prev_smooth->data[i];
+      if ((fabs(p.r - q.r) > change) ||
+	  (fabs(p.g - q.g) > change) ||
+	  (fabs(p.b - q.b) > change))
+	changed[prev[i]] = 1;
+    }
+
+    // carry the other segments over, each pixel a child of the root as
+    // segment_edges requires
+    int *root = new int[prev_num];
+    memset(root, 0xff, prev_num * sizeof(int));
+    for (int i = 0; i < n; i++) {
+      int l = prev[i];
+      if (changed[l])
+	continue;
+      if (root[l] < 0) {
+	root[l] = i;
+	num_carried++;
+      } else {
+	u->join(root[l], i);
+	root[l] = u->find(i);
+      }
+    }
+    for (int l = 0; l < prev_num; l++)
+      if (root[l] >= 0)
+	threshold[root[l]] = prev_threshold[l];
+
+    // nor are the edges inside them or between them looked at again
+    int offset[EDGE_DIRS];
+    offset[EDGE_RIGHT] = 1;
+    offset[EDGE_DOWN] = width;
+    offset[EDGE_DOWN_RIGHT] = width + 1;
+    offset[EDGE_UP_RIGHT] = 1 - width;
+    for (int d = 0; d < EDGE_DIRS; d++) {
+      unsigned short *w = weights + d * n;
+      for (int i = 0; i < n; i++) {
+	if ((w[i] != WEIGHT_NONE) && !changed[prev[i]] &&
+	    !changed[prev[i + offset[d]]])
+	  w[i] = WEIGHT_NONE;
+      }
+    }
+
+    delete [] root;
+    delete [] changed;
+  }
+
+  segment_edges(width, height, weights, u, threshold, c, min_size, tiles);
+  int num = label_segments(u, im, labels, stats);
+  delete [] weights;
+
+  // keep the threshold of each segment
+  float *seg_threshold = new float[num];
+  for (int i = 0; i < n; i++)
+    if (u->find(i) == i)
+      seg_threshold[labels->data[i]] = threshold[i];
+  delete [] threshold;
+  delete u;
+
+  // pass the ids on
+  int *ids = new int[num];
+  if (prev_labels) {
+    // overlaps, counted over runs of pixels
+    std::vector<segment_overlap> overlaps;
+    const int *prev = prev_labels->data;
+    segment_overlap run = { labels->data[0], prev[0], 0 };
+    for (int i = 0; i < n; i++) {
+      if ((labels->data[i] != run.seg) || (prev[i] != run.prev)) {
+	overlaps.push_back(run);
+	run.seg = labels->data[i];
+	run.prev = prev[i];
+	run.count = 0;
+      }
+      run.count++;
+    }
+    overlaps.push_back(run);
+    std::sort(overlaps.begin(), overlaps.end());
+
+    // previous segment each segment overlaps most
+    int *best = new int[num];
+    int *best_count = new int[num];
+    memset(best_count, 0, num * sizeof(int));
+    for (size_t i = 0; i < overlaps.size(); ) {
+      segment_overlap o = overlaps[i++];
+      while ((i < overlaps.size()) && !(o < overlaps[i]))
+	o.count += overlaps[i++].count;
+      if (o.count > best_count[o.seg]) {
+	best[o.seg] = o.prev;
+	best_count[o.seg] = o.count;
+      }
+    }
+
+    // segment each previous segment is overlapped most by
+    int *claim = new int[prev_num];
+    int *claim_count = new int[prev_num];
+    memset(claim_count, 0, prev_num * sizeof(int));
+    for (int l = 0; l < num; l++) {
+      if (best_count[l] > claim_count[best[l]]) {
+	claim[best[l]] = l;
+	claim_count[best[l]] = best_count[l];
+      }
+    }
+
+    for (int l = 0; l < num; l++)
+      ids[l] = (claim[best[l]] == l) ? seg_ids[best[l]] : next_id++;
+
+    delete [] best;
+    delete [] best_count;
+    delete [] claim;
+    delete [] claim_count;
+  } else {
+    for (int l = 0; l < num; l++)
+      ids[l] = next_id++;
+  }
+
+  // remember this frame
+  next_smooth = prev_smooth;
+  delete [] prev_threshold;
+  delete [] seg_ids;
+  if (!prev_labels)
+    prev_labels = new image<int>(width, height, false);
+  memcpy(prev_labels->data, labels->data, n * sizeof(int));
+  prev_smooth = smooth_rgb;
+  prev_threshold = seg_threshold;
+  seg_ids = ids;
+  prev_num = num;
+
+  return num;
+}
+
+#endif
@@ -22,28 +22,150 @@ Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA  02111-1307 USA
 #include "misc.h"
 #include "pnmfile.h"
 #include "segment-image.h"
+#include "segment-video.h"
+#include "segmentation.h"
 
-IplImage *segmentation (IplImage *imageIn, float sigma, float k, float min_size)
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+// segment label map and the statistics of each segment
+IplImage *segmentationLabels (IplImage *imageIn, float sigma, float k, float min_size,
+                              int *num_segments, segment_stats **stats,
+                              smooth_workspace *ws)
 {
     image<rgb> *input = loadIplImageFromMemory(imageIn);
 
-    printf("processing\n");
-    int num_ccs;
-    image<rgb> *seg = segment_image(input, sigma, k, min_size, &num_ccs);
+    // one strip of rows per thread; the result does not depend on it
+    int tiles = 1;
+#ifdef _OPENMP
+    tiles = omp_get_max_threads();
+#endif
 
-    IplImage *out = cvCreateImage(cvGetSize(imageIn), 8, 3);
+    // smoothing buffers, the caller's if it keeps them from frame to frame
+    smooth_workspace local;
+    if (ws == NULL)
+        ws = &local;
+
+    image<int> *labels = new image<int>(input->width(), input->height(), false);
+    *num_segments = segment_labels(input, sigma, k, min_size, labels, stats, tiles, ws);
+
+    IplImage *out = cvCreateImage(cvGetSize(imageIn), IPL_DEPTH_32S, 1);
+    for (int y = 0; y < out->height; y++)
+        memcpy(out->imageData + out->widthStep*y, imPtr(labels, 0, y), out->width*sizeof(int));
+
+    delete labels;
+    delete input;
+
+    return out;
+
+} // end segmentationLabels
+
+smooth_workspace *segmentationWorkspace ()
+{
+    return new smooth_workspace();
 
-    int counter = 0;
+} // end segmentationWorkspace
+
+void releaseSegmentationWorkspace (smooth_workspace **ws)
+{
+    delete *ws;
+    *ws = NULL;
+
+} // end releaseSegmentationWorkspace
+
+// random colour for each segment of a label map
+IplImage *segmentationColours (IplImage *labels, int num_segments)
+{
+    rgb *colors = new rgb[num_segments];
+    for (int i = 0; i < num_segments; i++)
+        colors[i] = random_rgb();
+
+    IplImage *out = cvCreateImage(cvGetSize(labels), 8, 3);
     for (int y = 0; y < out->height; y++) {
+        const int *label = (const int*)(labels->imageData + labels->widthStep*y);
+        uchar *pixel = (uchar*)(out->imageData + out->widthStep*y);
         for (int x = 0; x < out->width; x++) {
-            ((uchar*)(out->imageData + out->widthStep*y))[x*3]   = imRef(seg, x, y).r;
-            ((uchar*)(out->imageData + out->widthStep*y))[x*3+1] = imRef(seg, x, y).g;
-            ((uchar*)(out->imageData + out->widthStep*y))[x*3+2] = imRef(seg, x, y).b;
-
+            pixel[x*3]   = colors[label[x]].r;
+            pixel[x*3+1] = colors[label[x]].g;
+            pixel[x*3+2] = colors[label[x]].b;
         }
     }
 
+    delete [] colors;
+
+    return out;
+
+} // end segmentationColours
+
+IplImage *segmentation (IplImage *imageIn, float sigma, float k, float min_size)
+{
+    printf("processing\n");
+    int num_ccs;
+    IplImage *labels = segmentationLabels(imageIn, sigma, k, min_size, &num_ccs);
+    IplImage *out = segmentationColours(labels, num_ccs);
+    cvReleaseImage(&labels);
+
     return out;
 
 } // end segmentation
 
+VideoSegmentation::VideoSegmentation()
+{
+    segmenter = NULL;
+    params[0] = params[1] = params[2] = 0;
+
+} // end constructor
+
+VideoSegmentation::~VideoSegmentation()
+{
+    delete segmenter;
+
+} // end destructor
+
+void VideoSegmentation::reset ()
+{
+    if (segmenter != NULL)
+        segmenter->reset();
+
+} // end reset
+
+// segmentation of consecutive video frames: segments that did not change
+// are carried over from the previous frame and keep their colour
+IplImage *VideoSegmentation::segment (IplImage *imageIn, float sigma, float k, float min_size)
+{
+    // start again when the parameters change
+    if (segmenter == NULL || params[0] != sigma || params[1] != k || params[2] != min_size) {
+        int tiles = 1;
+#ifdef _OPENMP
+        tiles = omp_get_max_threads();
+#endif
+        delete segmenter;
+        segmenter = new video_segmenter(sigma, k, min_size, SEGMENT_VIDEO_CHANGE, tiles);
+        params[0] = sigma;
+        params[1] = k;
+        params[2] = min_size;
+    }
+
+    image<rgb> *input = loadIplImageFromMemory(imageIn);
+    image<int> *labels = new image<int>(input->width(), input->height(), false);
+    segmenter->segment(input, labels);
+    const int *ids = segmenter->ids();
+
+    IplImage *out = cvCreateImage(cvGetSize(imageIn), 8, 3);
+    for (int y = 0; y < out->height; y++) {
+        uchar *pixel = (uchar*)(out->imageData + out->widthStep*y);
+        for (int x = 0; x < out->width; x++) {
+            rgb colour = id_rgb(ids[imRef(labels, x, y)]);
+            pixel[x*3]   = colour.r;
+            pixel[x*3+1] = colour.g;
+            pixel[x*3+2] = colour.b;
+        }
+    }
+
+    delete labels;
+    delete input;
+
+    return out;
+
+} // end segment
@@ -41,10 +41,11 @@ FastHessian::~FastHessian()
 FastHessian::FastHessian(std::vector<Ipoint> &ipts, 
                          const int octaves, const int intervals, const int init_sample, 
                          const float thres) 
-                         : ipts(ipts), m_det(NULL), i_width(0), i_height(0)
+                         : ipts(ipts), m_det(NULL), m_det_size(0), i_width(0), i_height(0)
 {
   // Save parameter set
   saveParameters(octaves, intervals, init_sample, thres);
+  memset(grid,0,sizeof(grid));
 }
 
 //-------------------------------------------------------
@@ -53,10 +54,11 @@ FastHessian::FastHessian(std::vector<Ipoint> &ipts,
 FastHessian::FastHessian(IplImage *img, std::vector<Ipoint> &ipts, 
                          const int octaves, const int intervals, const int init_sample, 
                          const float thres) 
-                         : ipts(ipts), m_det(NULL), i_width(0), i_height(0)
+                         : ipts(ipts), m_det(NULL), m_det_size(0), i_width(0), i_height(0)
 {
   // Save parameter set
   saveParameters(octaves, intervals, init_sample, thres);
+  memset(grid,0,sizeof(grid));
 
   // Set the current image
   setIntImage(img);
@@ -86,19 +88,42 @@ void FastHessian::setIntImage(IplImage *img)
 {
   // Change the source image
   this->img = img;
+  i_width = img->width;
+  i_height = img->height;
 
-  // Redefine width, height and det map only if image has changed size
-  if (img->width != i_width || img->height != i_height) 
+  // Lay out the sampling grid of each octave
+  int offset[4], size = 0;
+  bool changed = false;
+  for(int o=0; o < octaves; o++) 
   {
-    i_width = img->width;
-    i_height = img->height;
+    OctaveGrid g;
+    g.step = init_sample * fRound(pow(2.0f,o));
+    g.border = border_cache[o];
+    g.cols = max(0, (i_width - 2*g.border + g.step - 1) / g.step) + 2;
+    g.rows = max(0, (i_height - 2*g.border + g.step - 1) / g.step) + 2;
+
+    if (g.step != grid[o].step || g.cols != grid[o].cols || g.rows != grid[o].rows)
+      changed = true;
+    grid[o] = g;
+    offset[o] = size;
+    size += intervals * g.cols * g.rows;
+  }
 
+  // Redefine det map only if the layout has changed, so the ring of
+  // zeros around each layer is only cleared when it may have moved
+  if (size != m_det_size) 
+  {
     // Allocate space for determinant of hessian pyramid 
     if (m_det) delete [] m_det;
-    const int m_det_size = octaves*intervals*i_width*i_height;
-    m_det = new float [m_det_size];
-    memset(m_det,0,m_det_size*sizeof(float));
+    m_det = new float [size];
+    m_det_size = size;
+    changed = true;
   }
+  if (changed)
+    memset(m_det,0,m_det_size*sizeof(float));
+
+  for(int o=0; o < octaves; o++) 
+    grid[o].det = m_det + offset[o];
 }
 
 //-------------------------------------------------------
@@ -112,47 +137,78 @@ void FastHessian::getIpoints()
   // Calculate approximated determinant of hessian values
   buildDet();
 
+  // One task per row of 3x3x3 blocks of each octave and interval pair
+  vector<int> task_o, task_i, task_r;
   for(int o=0; o < octaves; o++) 
+    for(int i = 1; i < intervals-1; i += 2) 
+      for(int br = 1; br < grid[o].rows - 1; br += 2) 
+      {
+        task_o.push_back(o);
+        task_i.push_back(i);
+        task_r.push_back(br);
+      }
+
+  const int n_tasks = (int)task_o.size();
+  vector< vector<Ipoint> > found(n_tasks);
+
+  // 3x3x3 non-max suppression over whole image
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+  for(int t = 0; t < n_tasks; t++) 
+    findExtremaRow(task_o[t], task_i[t], task_r[t], found[t]);
+
+  // Collect the Ipoints in scan order
+  for(int t = 0; t < n_tasks; t++) 
+    ipts.insert(ipts.end(), found[t].begin(), found[t].end());
+}
+
+//-------------------------------------------------------
+
+//! Scan one row of 3x3x3 blocks of a layer pair for extrema
+void FastHessian::findExtremaRow(int o, int i, int br, std::vector<Ipoint> &found)
+{
+  const OctaveGrid &g = grid[o];
+  const int layer = g.cols * g.rows;
+  const int i_end = min(i+2, intervals-1);
+  const int r_end = min(br+2, g.rows-1);
+
+  for(int bc = 1; bc < g.cols - 1; bc += 2) 
   {
-    // For each octave double the sampling step of the previous
-    int step = init_sample * fRound(pow(2.0f,o));
-    int border = border_cache[o];
-
-    // 3x3x3 non-max suppression over whole image
-    for(int i = 1; i < intervals-1; i += 2) {
-      for(int r = border; r < i_height - border; r += 2*step) {
-        for(int c = border; c < i_width - border; c += 2*step) {
-
-          int i_max = -1, r_max = -1, c_max = -1;
-          float max_val = 0;
-
-          // Scan the pixels in this block to find the local extremum.
-          for (int ii = i; ii < min(i+2, intervals-1); ii += 1) {
-            for (int rr = r; rr < min(r+2*step, i_height - border); rr += step) {
-              for (int cc = c; cc < min(c+2*step, i_width - border); cc += step) {
-
-                float val = getVal(o, ii, cc, rr);
-                
-                // record the max value and its location
-                if (val > max_val) 
-                {
-                  max_val = val;
-                  i_max = ii;
-                  r_max = rr;
-                  c_max = cc;
-                }
-              }
-            }
-          }
+    const int c_end = min(bc+2, g.cols-1);
+    int i_max = -1, r_max = -1, c_max = -1;
+    float max_val = 0;
+
+    // Scan the samples in this block to find the local extremum.
+    for (int ii = i; ii < i_end; ii += 1) {
+      const float *det = g.det + ii*layer;
+      for (int rr = br; rr < r_end; rr += 1) {
+        for (int cc = bc; cc < c_end; cc += 1) {
 
-          // Check the block extremum is an extremum across boundaries.
-          if (max_val > thres && i_max != -1 && isExtremum(o, i_max, c_max, r_max)) 
+          float val = fabs(det[rr*g.cols + cc]);
+
+          // record the max value and its location
+          if (val > max_val) 
           {
-            interpolateExtremum(o, i_max, r_max, c_max);
+            max_val = val;
+            i_max = ii;
+            r_max = rr;
+            c_max = cc;
           }
         }
       }
-    }  
+    }
+
+    if (max_val <= thres || i_max == -1)
+      continue;
+
+    // Check the block extremum is an extremum across boundaries.
+    int r = g.border + (r_max - 1)*g.step;
+    int c = g.border + (c_max - 1)*g.step;
+    if (isExtremum(o, i_max, c, r)) 
+    {
+      interpolateExtremum(o, i_max, r, c, found);
+    }
   }
 }
 
@@ -161,52 +217,128 @@ void FastHessian::getIpoints()
 //! Calculate determinant of hessian responses
 void FastHessian::buildDet()
 {
-  int l, w, b, border, step;
-  float Dxx, Dyy, Dxy, inverse_area;
-
+  // One task per row of each layer, so all layers are computed at once
+  vector<int> task_o, task_i, task_r;
   for(int o=0; o<octaves; o++) 
+    for(int i=0; i<intervals; i++) 
+      for(int r = 1; r < grid[o].rows - 1; r++) 
+      {
+        task_o.push_back(o);
+        task_i.push_back(i);
+        task_r.push_back(r);
+      }
+
+  const int n_tasks = (int)task_o.size();
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 4)
+#endif
+  for(int t = 0; t < n_tasks; t++) 
   {
-    step = init_sample * fRound(pow(2.0f,o));
-    border = border_cache[o];
+    const OctaveGrid &g = grid[task_o[t]];
+    const int r = task_r[t];
 
-    for(int i=0; i<intervals; i++) {
+    float *row = g.det + (task_i[t]*g.rows + r)*g.cols + 1;
 
-      l = lobe_cache[o*intervals + i]; 
-      w = 3 * l;                      
-      b = w / 2;        
-      inverse_area = 1.0f/(w * w);     
+    if (img->depth == IPL_DEPTH_64F) 
+      buildDetRow<double>(task_o[t], task_i[t], g.border + (r - 1)*g.step, row);
+    else 
+      buildDetRow<float>(task_o[t], task_i[t], g.border + (r - 1)*g.step, row);
+  }
+}   
 
-      for(int r = border; r < i_height - border; r += step) 
-      {
-        for(int c = border; c < i_width - border; c += step) 
-        {
-          Dxx = BoxIntegral(img, r - l + 1, c - b, 2*l - 1, w)
-              - BoxIntegral(img, r - l + 1, c - l / 2, 2*l - 1, l)*3;
-          Dyy = BoxIntegral(img, r - b, c - l + 1, w, 2*l - 1)
-              - BoxIntegral(img, r - l / 2, c - l + 1, l, 2*l - 1)*3;
-          Dxy = + BoxIntegral(img, r - l, c + 1, l, l)
-                + BoxIntegral(img, r + 1, c - l, l, l)
-                - BoxIntegral(img, r - l, c - l, l, l)
-                - BoxIntegral(img, r + 1, c + 1, l, l);
-
-          // Normalise the filter responses with respect to their size
-          Dxx *= inverse_area;
-          Dyy *= inverse_area;
-          Dxy *= inverse_area;
-
-          // Get the sign of the laplacian
-          int lap_sign = (Dxx+Dyy >= 0 ? 1 : -1);
-
-          // Get the determinant of hessian response
-          float determinant = (Dxx*Dyy - 0.81f*Dxy*Dxy);
-
-          m_det[(o*intervals+i)*(i_width*i_height) + (r*i_width+c)] 
-          = (determinant < 0 ? 0 : lap_sign * determinant);
-        }
-      }
+//-------------------------------------------------------
+
+//! Offsets of the corners of a box, relative to a sample, in an image
+//! with the given row step.  Same corners as BoxIntegral reads.
+static inline void boxOffsets(int row, int col, int rows, int cols, int step, int *off)
+{
+  off[0] = (row - 1) * step + col - 1;
+  off[1] = (row - 1) * step + col + cols - 1;
+  off[2] = (row + rows - 1) * step + col - 1;
+  off[3] = (row + rows - 1) * step + col + cols - 1;
+}
+
+//-------------------------------------------------------
+
+//! Box sum from corner offsets, for boxes known to be inside the image
+template <class T>
+static inline float boxSum(const T *p, const int *off)
+{
+  return max(0.f, (float) (p[off[0]] - p[off[1]] - p[off[2]] + p[off[3]]));
+}
+
+//-------------------------------------------------------
+
+//! Calculate the responses in one row of one layer, from an integral
+//! image with elements of type T
+template <class T>
+void FastHessian::buildDetRow(int o, int i, int r, float *row)
+{
+  const OctaveGrid &g = grid[o];
+  const int l = lobe_cache[o*intervals + i]; 
+  const int w = 3 * l;                      
+  const int b = w / 2;        
+  const float inverse_area = 1.0f/(w * w);     
+  const T *data = (T *) img->imageData;
+  const int step = img->widthStep/sizeof(T);
+  float Dxx, Dyy, Dxy;
+
+  // All boxes lie within b+1 pixels above and left of the sample and b
+  // pixels below and right, so inside that range none of them is clipped
+  const bool row_inside = (r - b - 1 >= 0 && r + b < i_height);
+  const int c_first = b + 1, c_last = i_width - 1 - b;
+
+  // Corner offsets of the boxes for the unclipped case
+  int off[8][4];
+  boxOffsets(-l + 1, -b, 2*l - 1, w, step, off[0]);
+  boxOffsets(-l + 1, -(l / 2), 2*l - 1, l, step, off[1]);
+  boxOffsets(-b, -l + 1, w, 2*l - 1, step, off[2]);
+  boxOffsets(-(l / 2), -l + 1, l, 2*l - 1, step, off[3]);
+  boxOffsets(-l, 1, l, l, step, off[4]);
+  boxOffsets(1, -l, l, l, step, off[5]);
+  boxOffsets(-l, -l, l, l, step, off[6]);
+  boxOffsets(1, 1, l, l, step, off[7]);
+
+  for(int c = g.border; c < i_width - g.border; c += g.step, row++) 
+  {
+    if (row_inside && c >= c_first && c <= c_last) 
+    {
+      const T *p = data + r*step + c;
+
+      Dxx = boxSum(p, off[0]) - boxSum(p, off[1])*3;
+      Dyy = boxSum(p, off[2]) - boxSum(p, off[3])*3;
+      Dxy = + boxSum(p, off[4])
+            + boxSum(p, off[5])
+            - boxSum(p, off[6])
+            - boxSum(p, off[7]);
+    }
+    else 
+    {
+      Dxx = BoxIntegral(img, r - l + 1, c - b, 2*l - 1, w)
+          - BoxIntegral(img, r - l + 1, c - l / 2, 2*l - 1, l)*3;
+      Dyy = BoxIntegral(img, r - b, c - l + 1, w, 2*l - 1)
+          - BoxIntegral(img, r - l / 2, c - l + 1, l, 2*l - 1)*3;
+      Dxy = + BoxIntegral(img, r - l, c + 1, l, l)
+            + BoxIntegral(img, r + 1, c - l, l, l)
+            - BoxIntegral(img, r - l, c - l, l, l)
+            - BoxIntegral(img, r + 1, c + 1, l, l);
     }
+
+    // Normalise the filter responses with respect to their size
+    Dxx *= inverse_area;
+    Dyy *= inverse_area;
+    Dxy *= inverse_area;
+
+    // Get the sign of the laplacian
+    int lap_sign = (Dxx+Dyy >= 0 ? 1 : -1);
+
+    // Get the determinant of hessian response
+    float determinant = (Dxx*Dyy - 0.81f*Dxy*Dxy);
+
+    *row = (determinant < 0 ? 0 : lap_sign * determinant);
   }
-}   
+}
 
 //-------------------------------------------------------
 
@@ -238,10 +370,20 @@ int FastHessian::isExtremum(int octave, int interval, int c, int r)
 
 //-------------------------------------------------------
 
+//! Return the response at (c, r) in the storage of a layer
+inline float *FastHessian::getResponse(int o, int i, int c, int r)
+{
+  const OctaveGrid &g = grid[o];
+  return g.det + (i*g.rows + (r - g.border)/g.step + 1)*g.cols 
+               + (c - g.border)/g.step + 1;
+}
+
+//-------------------------------------------------------
+
 //! Return the value of the approximated determinant of hessian
 inline float FastHessian::getVal(int o, int i, int c, int r)
 {
-  return fabs(m_det[(o*intervals+i)*(i_width*i_height) + (r*i_width+c)]);
+  return fabs(*getResponse(o, i, c, r));
 }
 
 //-------------------------------------------------------
@@ -249,7 +391,7 @@ inline float FastHessian::getVal(int o, int i, int c, int r)
 //! Return the sign of the laplacian (trace of the hessian)
 inline int FastHessian::getLaplacian(int o, int i, int c, int r)
 {
-  float res = (m_det[(o*intervals+i)*(i_width*i_height) + (r*i_width+c)]);
+  float res = *getResponse(o, i, c, r);
 
   return (res >= 0 ? 1 : -1);
 }
@@ -258,7 +400,7 @@ inline int FastHessian::getLaplacian(int o, int i, int c, int r)
 
 //! Interpolates a scale-space extremum's location and scale to subpixel
 //! accuracy to form an image feature.   
-void FastHessian::interpolateExtremum(int octv, int intvl, int r, int c)
+void FastHessian::interpolateExtremum(int octv, int intvl, int r, int c, std::vector<Ipoint> &found)
 {
   double xi = 0, xr = 0, xc = 0;
   int step = init_sample * fRound(pow(2.0f,octv));
@@ -275,7 +417,7 @@ void FastHessian::interpolateExtremum(int octv, int intvl, int r, int c)
     ipt.y = static_cast<float>(r + step*xr);
     ipt.scale = static_cast<float>((1.2f/9.0f) * (3*(pow(2.0f, octv+1) * (intvl+xi+1)+1)));
     ipt.laplacian = getLaplacian(octv, intvl, c, r);
-    ipts.push_back(ipt);
+    found.push_back(ipt);
   }
 }
 
@@ -72,8 +72,18 @@ class FastHessian {
     //! Return the sign of the laplacian (trace of the hessian)
     inline int getLaplacian(int o, int i, int c, int r);
 
+    //! Return the response at (c, r) in the storage of a layer
+    inline float *getResponse(int o, int i, int c, int r);
+
+    //! Calculate the responses in one row of one layer
+    template <class T>
+    void buildDetRow(int o, int i, int r, float *row);
+
+    //! Scan one row of 3x3x3 blocks of a layer pair for extrema
+    void findExtremaRow(int o, int i, int br, std::vector<Ipoint> &found);
+
     //! Interpolation functions - adapted from Lowe's SIFT implementation
-    void interpolateExtremum(int octv, int intvl, int r, int c);
+    void interpolateExtremum(int octv, int intvl, int r, int c, std::vector<Ipoint> &found);
     void interpolateStep( int octv, int intvl, int r, int c, double* xi, double* xr, double* xc );
     CvMat* deriv3D( int octv, int intvl, int r, int c );
     CvMat* hessian3D(int octv, int intvl, int r, int c );
@@ -99,8 +109,22 @@ class FastHessian {
     //! Threshold value for blob resonses
     float thres;
 
+    //! Sampling grid of the responses of an octave.  Each layer holds only
+    //! the sampled positions, row by row, surrounded by a ring of zeros so
+    //! the neighbours of the outermost samples can be read unchecked.
+    struct OctaveGrid {
+      int step;        // sampling step in pixels
+      int border;      // image row and column of the first sample
+      int cols, rows;  // samples per row and per column, ring included
+      float *det;      // first layer; layer i starts i*cols*rows further on
+    };
+
+    //! Sampling grid of each octave (at most 4, see saveParameters)
+    OctaveGrid grid[4];
+
     //! Array stack of determinant of hessian values
     float *m_det;
+    int m_det_size;
 
 };
 
@@ -11,39 +11,82 @@
 #include "tracking_algorithms/Blob/OpenSURF/utils_surf.h"
 #include "tracking_algorithms/Blob/OpenSURF/integral.h"
 
-//! Computes the integral image of image img.  Assumes source image to be a 
-//! 32-bit floating point.  Returns IplImage of 32-bit float form.
-IplImage *Integral(IplImage *source)
+// Vector extensions, used for the column sums if available
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define INTEGRAL_USE_SSE2
+#endif
+
+//-------------------------------------------------------
+
+//! Adds row prev to row cur, element by element
+static inline void addRow(float *cur, const float *prev, int width)
 {
-  // convert the image to single channel 32f
-  IplImage *img = getGray(source);
-  IplImage *int_img = cvCreateImage(cvGetSize(img), IPL_DEPTH_32F, 1);
+  int j = 0;
+#ifdef INTEGRAL_USE_SSE2
+  for(; j + 4 <= width; j += 4)
+    _mm_storeu_ps(cur + j, _mm_add_ps(_mm_loadu_ps(cur + j), _mm_loadu_ps(prev + j)));
+#endif
+  for(; j < width; ++j)
+    cur[j] += prev[j];
+}
+
+//-------------------------------------------------------
+
+//! Adds row prev to row cur, element by element
+static inline void addRow(double *cur, const double *prev, int width)
+{
+  int j = 0;
+#ifdef INTEGRAL_USE_SSE2
+  for(; j + 2 <= width; j += 2)
+    _mm_storeu_pd(cur + j, _mm_add_pd(_mm_loadu_pd(cur + j), _mm_loadu_pd(prev + j)));
+#endif
+  for(; j < width; ++j)
+    cur[j] += prev[j];
+}
 
+//-------------------------------------------------------
+
+//! Sums the 32-bit float gray image img into int_img, whose elements are T
+template <class T>
+static void integralSum(const IplImage *img, IplImage *int_img)
+{
   // set up variables for data access
   int height = img->height;
   int width = img->width;
   int step = img->widthStep/sizeof(float);
-  float *data   = (float *) img->imageData;  
-  float *i_data = (float *) int_img->imageData;  
+  int i_step = int_img->widthStep/sizeof(T);
+  const float *data = (const float *) img->imageData;  
+  T *i_data = (T *) int_img->imageData;  
 
-  // first row only
-  float rs = 0.0f;
-  for(int j=0; j<width; j++) 
+  for(int i=0; i<height; ++i) 
   {
-    rs += data[j]; 
-    i_data[j] = rs;
-  }
-
-  // remaining cells are sum above and to the left
-  for(int i=1; i<height; ++i) 
-  {
-    rs = 0.0f;
+    // running sum along the row, which is inherently serial ...
+    T rs = 0;
     for(int j=0; j<width; ++j) 
     {
       rs += data[i*step+j]; 
-      i_data[i*step+j] = rs + i_data[(i-1)*step+j];
+      i_data[i*i_step+j] = rs;
     }
+
+    // ... plus the sum above, which is not
+    if (i > 0) 
+      addRow(i_data + i*i_step, i_data + (i-1)*i_step, width);
   }
+}
+
+//-------------------------------------------------------
+
+//! Computes the integral image of image img.  Assumes source image to be a 
+//! 32-bit floating point.  Returns IplImage of 32-bit float form.
+IplImage *Integral(IplImage *source)
+{
+  // convert the image to single channel 32f
+  IplImage *img = getGray(source);
+  IplImage *int_img = cvCreateImage(cvGetSize(img), IPL_DEPTH_32F, 1);
+
+  // cells are sum above and to the left
+  integralSum<float>(img, int_img);
 
   // release the gray image
   cvReleaseImage(&img);
@@ -52,3 +95,59 @@ IplImage *Integral(IplImage *source)
   return int_img;
 }
 
+//-------------------------------------------------------
+
+//! Constructor; depth is IPL_DEPTH_32F or IPL_DEPTH_64F
+IntegralImage::IntegralImage(const int depth)
+: depth(depth == IPL_DEPTH_64F ? IPL_DEPTH_64F : IPL_DEPTH_32F),
+  gray8(NULL), gray32(NULL), int_img(NULL)
+{
+}
+
+//-------------------------------------------------------
+
+//! Destructor
+IntegralImage::~IntegralImage()
+{
+  if (gray8) cvReleaseImage(&gray8);
+  if (gray32) cvReleaseImage(&gray32);
+  if (int_img) cvReleaseImage(&int_img);
+}
+
+//-------------------------------------------------------
+
+//! Compute the integral image of img and return it
+IplImage *IntegralImage::compute(IplImage *img)
+{
+  if (!img) error("Unable to create integral image.  No image supplied");
+
+  // Reallocate the buffers only if the frame has changed size
+  if (!int_img || int_img->width != img->width || int_img->height != img->height) 
+  {
+    if (gray8) cvReleaseImage(&gray8);
+    if (gray32) cvReleaseImage(&gray32);
+    if (int_img) cvReleaseImage(&int_img);
+    gray32 = cvCreateImage(cvGetSize(img), IPL_DEPTH_32F, 1);
+    int_img = cvCreateImage(cvGetSize(img), depth, 1);
+  }
+
+  // convert the image to single channel 32f, as getGray does
+  if (img->nChannels == 1) 
+    cvConvertScale(img, gray32, 1.0 / 255.0, 0);
+  else 
+  {
+    if (!gray8) gray8 = cvCreateImage(cvGetSize(img), IPL_DEPTH_8U, 1);
+    cvCvtColor(img, gray8, CV_BGR2GRAY);
+    cvConvertScale(gray8, gray32, 1.0 / 255.0, 0);
+  }
+
+  // cells are sum above and to the left
+  if (depth == IPL_DEPTH_64F) 
+    integralSum<double>(gray32, int_img);
+  else 
+    integralSum<float>(gray32, int_img);
+
+  return int_img;
+}
+
+//-------------------------------------------------------
@@ -29,12 +29,51 @@
 IplImage *Integral(IplImage *img);
 
 
+//-------------------------------------------------------
+// Integral image kept from frame to frame
+//  - compute() converts a frame to gray and sums it into
+//    buffers that are only reallocated when the frame size
+//    changes, so FastHessian and Surf can share one integral
+//    image per frame without any allocation.
+//  - The integral image is 32-bit float by default.  Large
+//    frames can use 64-bit double, whose sums stay exact
+//    further from the origin; BoxIntegral reads either.
+//-------------------------------------------------------
+
+class IntegralImage {
+
+  public:
+
+    //! Constructor; depth is IPL_DEPTH_32F or IPL_DEPTH_64F
+    IntegralImage(const int depth = IPL_DEPTH_32F);
+
+    //! Destructor
+    ~IntegralImage();
+
+    //! Compute the integral image of img and return it.  The returned
+    //! image is owned by this object and overwritten by the next call.
+    IplImage *compute(IplImage *img);
+
+    //! Return the last computed integral image, or NULL
+    IplImage *getImage() { return int_img; };
+
+  private:
+
+    //! Depth of the integral image
+    int depth;
+
+    //! Gray scale buffers and the integral image
+    IplImage *gray8, *gray32, *int_img;
+};
+
+
 //! Computes the sum of pixels within the rectangle specified by the top-left start
-//! co-ordinate and size
+//! co-ordinate and size, for an integral image with elements of type T
+template <class T>
 inline float BoxIntegral(IplImage *img, int row, int col, int rows, int cols) 
 {
-  float *data = (float *) img->imageData;
-  int step = img->widthStep/sizeof(float);
+  T *data = (T *) img->imageData;
+  int step = img->widthStep/sizeof(T);
 
   // The subtraction by one for row/col is because row/col is inclusive.
   int r1 = std::min(row,          img->height) - 1;
@@ -42,13 +81,24 @@ inline float BoxIntegral(IplImage *img, int row, int col, int rows, int cols)
   int r2 = std::min(row + rows,   img->height) - 1;
   int c2 = std::min(col + cols,   img->width)  - 1;
 
-  float A(0.0f), B(0.0f), C(0.0f), D(0.0f);
+  T A(0), B(0), C(0), D(0);
   if (r1 >= 0 && c1 >= 0) A = data[r1 * step + c1];
   if (r1 >= 0 && c2 >= 0) B = data[r1 * step + c2];
   if (r2 >= 0 && c1 >= 0) C = data[r2 * step + c1];
   if (r2 >= 0 && c2 >= 0) D = data[r2 * step + c2];
 
-  return std::max(0.f, A - B - C + D);
+  return std::max(0.f, (float) (A - B - C + D));
+}
+
+
+//! Computes the sum of pixels within the rectangle specified by the top-left start
+//! co-ordinate and size
+inline float BoxIntegral(IplImage *img, int row, int col, int rows, int cols) 
+{
+  if (img->depth == IPL_DEPTH_64F)
+    return BoxIntegral<double>(img, row, col, rows, cols);
+
+  return BoxIntegral<float>(img, row, col, rows, cols);
 }
 
 #endif
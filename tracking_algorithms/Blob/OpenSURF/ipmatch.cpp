@@ -0,0 +1,288 @@
+/***********************************************************
+*  --- OpenSURF ---                                        *
+*  This library is distributed under the GNU GPL. Please   *
+*  contact chris.evans@irisys.co.uk for more information.  *
+*                                                          *
+*  C. Evans, Research Into Robust Visual Features,         *
+*  MSc University of Bristol, 2008.                        *
+*                                                          *
+************************************************************/
+
+#include "cv.h"
+
+#include <vector>
+#include <algorithm>
+#include <float.h>
+
+#include "tracking_algorithms/Blob/OpenSURF/ipmatch.h"
+
+using namespace std;
+
+//-------------------------------------------------------
+
+//! Orders Ipoint indices by one descriptor component
+struct DescrLess {
+  const IpVec &ipts;
+  int dim;
+  DescrLess(const IpVec &ipts, int dim) : ipts(ipts), dim(dim) {};
+  bool operator()(int a, int b) const
+  {
+    return ipts[a].descriptor[dim] < ipts[b].descriptor[dim];
+  };
+};
+
+//-------------------------------------------------------
+
+//! Constructor builds the index over the descriptors of ipts
+IpMatcher::IpMatcher(IpVec &ipts, const int max_checks)
+: ipts(ipts), max_checks(max_checks), lap_filter(false), mutual(false),
+  gate_radius(0.f), gate_dx(0.f), gate_dy(0.f)
+{
+  int n = (int)ipts.size(), n_neg = 0;
+
+  // Group the Ipoints by sign of laplacian, negative first
+  idx.resize(n);
+  for (int i = 0; i < n; ++i)
+    if (ipts[i].laplacian < 0) idx[n_neg++] = i;
+  for (int i = 0, k = n_neg; i < n; ++i)
+    if (ipts[i].laplacian >= 0) idx[k++] = i;
+
+  root[0] = (n_neg > 0 ? build(0, n_neg) : -1);
+  root[1] = (n - n_neg > 0 ? build(n_neg, n - n_neg) : -1);
+}
+
+//-------------------------------------------------------
+
+//! Only match Ipoints whose laplacians have the same sign
+void IpMatcher::setLaplacianFilter(bool on)
+{
+  lap_filter = on;
+}
+
+//-------------------------------------------------------
+
+//! Keep only matches that are also nearest neighbours the other way
+void IpMatcher::setMutualCheck(bool on)
+{
+  mutual = on;
+}
+
+//-------------------------------------------------------
+
+//! Only match Ipoints near the predicted position of the query
+void IpMatcher::setSpatialGate(float radius, float dx, float dy)
+{
+  gate_radius = radius;
+  gate_dx = dx;
+  gate_dy = dy;
+}
+
+//-------------------------------------------------------
+
+//! Build the subtree over idx[first, first+count) and return its root
+int IpMatcher::build(int first, int count)
+{
+  int id = (int)nodes.size();
+  Node node;
+
+  nodes.push_back(node);
+  if (count <= MATCH_LEAF_SIZE)
+  {
+    nodes[id].dim = -1;
+    nodes[id].first = first;
+    nodes[id].count = count;
+    return id;
+  }
+
+  // Split on the component of largest variance
+  float best_var = -1.f;
+  int dim = 0;
+  for (int d = 0; d < 64; ++d)
+  {
+    float mean = 0.f, var = 0.f;
+    for (int i = first; i < first + count; ++i)
+      mean += ipts[idx[i]].descriptor[d];
+    mean /= count;
+    for (int i = first; i < first + count; ++i)
+    {
+      float diff = ipts[idx[i]].descriptor[d] - mean;
+      var += diff * diff;
+    }
+    if (var > best_var)
+    {
+      best_var = var;
+      dim = d;
+    }
+  }
+
+  // Split at the median
+  int half = count / 2;
+  nth_element(idx.begin() + first, idx.begin() + first + half,
+              idx.begin() + first + count, DescrLess(ipts, dim));
+
+  nodes[id].dim = dim;
+  nodes[id].val = ipts[idx[first + half]].descriptor[dim];
+  build(first, half);
+  nodes[id].right = build(first + half, count - half);
+  return id;
+}
+
+//-------------------------------------------------------
+
+//! Find the two nearest gated neighbours of a query Ipoint
+void IpMatcher::search(const Ipoint &q, vector<Branch> &queue,
+                       int nbr[2], float dist[2])
+{
+  const float px = q.x + gate_dx, py = q.y + gate_dy;
+  const float r_sq = gate_radius * gate_radius;
+  int checks = 0;
+
+  nbr[0] = nbr[1] = -1;
+  dist[0] = dist[1] = FLT_MAX;
+
+  // Start from the tree of the query's laplacian sign, or from both
+  queue.clear();
+  for (int s = 0; s < 2; ++s)
+  {
+    if (root[s] < 0 || (lap_filter && (s == 0) != (q.laplacian < 0)))
+      continue;
+    Branch b = { 0.f, root[s] };
+    queue.push_back(b);
+  }
+
+  while (!queue.empty() && checks < max_checks)
+  {
+    pop_heap(queue.begin(), queue.end());
+    Branch b = queue.back();
+    queue.pop_back();
+
+    // No point below this branch can beat the second best
+    if (b.bound >= dist[1]) break;
+
+    // Descend to a leaf, queueing the far side of each split
+    int n = b.node;
+    while (nodes[n].dim >= 0)
+    {
+      float diff = q.descriptor[nodes[n].dim] - nodes[n].val;
+      Branch far_side = { max(b.bound, diff * diff), 0 };
+      if (diff < 0)
+      {
+        far_side.node = nodes[n].right;
+        n = n + 1;
+      }
+      else
+      {
+        far_side.node = n + 1;
+        n = nodes[n].right;
+      }
+      if (far_side.bound < dist[1])
+      {
+        queue.push_back(far_side);
+        push_heap(queue.begin(), queue.end());
+      }
+    }
+
+    // Compare the descriptors in the leaf
+    for (int i = nodes[n].first; i < nodes[n].first + nodes[n].count; ++i)
+    {
+      const Ipoint &p = ipts[idx[i]];
+      if (r_sq > 0.f &&
+          (p.x - px) * (p.x - px) + (p.y - py) * (p.y - py) > r_sq)
+        continue;
+      ++checks;
+
+      // Partial distance; give up once past the second best
+      float sum = 0.f;
+      for (int d = 0; d < 64 && sum < dist[1]; d += 16)
+        for (int k = d; k < d + 16; ++k)
+          sum += (q.descriptor[k] - p.descriptor[k]) * (q.descriptor[k] - p.descriptor[k]);
+
+      if (sum < dist[0])
+      {
+        dist[1] = dist[0];
+        nbr[1] = nbr[0];
+        dist[0] = sum;
+        nbr[0] = idx[i];
+      }
+      else if (sum < dist[1])
+      {
+        dist[1] = sum;
+        nbr[1] = idx[i];
+      }
+    }
+  }
+}
+
+//-------------------------------------------------------
+
+//! Populate IpPairVec with the ipts matched to the indexed Ipoints
+void IpMatcher::getMatches(IpVec &ipts1, IpPairVec &matches)
+{
+  const int n = (int)ipts1.size();
+  vector<int> match(n);
+
+  matches.clear();
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+  {
+    vector<Branch> queue;
+    int nbr[2];
+    float dist[2];
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+    for (int i = 0; i < n; ++i)
+    {
+      search(ipts1[i], queue, nbr, dist);
+
+      // If match has a d1:d2 ratio < 0.65 ipoints are a match
+      match[i] = -1;
+      if (nbr[0] >= 0 && sqrt(dist[0]) / sqrt(dist[1]) < MATCH_RATIO)
+        match[i] = nbr[0];
+    }
+  }
+
+  // Drop matches whose indexed Ipoint prefers another query
+  if (mutual && n > 0)
+  {
+    IpMatcher rev(ipts1, max_checks);
+    rev.setLaplacianFilter(lap_filter);
+    rev.setSpatialGate(gate_radius, -gate_dx, -gate_dy);
+
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
+    {
+      vector<Branch> queue;
+      int nbr[2];
+      float dist[2];
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+      for (int i = 0; i < n; ++i)
+      {
+        if (match[i] < 0) continue;
+        rev.search(ipts[match[i]], queue, nbr, dist);
+        if (nbr[0] != i) match[i] = -1;
+      }
+    }
+  }
+
+  // Store the matches in query order
+  for (int i = 0; i < n; ++i)
+  {
+    if (match[i] < 0) continue;
+    Ipoint &m = ipts[match[i]];
+
+    // Store the change in position
+    ipts1[i].dx = m.x - ipts1[i].x;
+    ipts1[i].dy = m.y - ipts1[i].y;
+    matches.push_back(std::make_pair(ipts1[i], m));
+  }
+}
+
+//-------------------------------------------------------
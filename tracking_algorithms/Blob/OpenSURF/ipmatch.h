@@ -0,0 +1,119 @@
+/***********************************************************
+*  --- OpenSURF ---                                        *
+*  This library is distributed under the GNU GPL. Please   *
+*  contact chris.evans@irisys.co.uk for more information.  *
+*                                                          *
+*  C. Evans, Research Into Robust Visual Features,         *
+*  MSc University of Bristol, 2008.                        *
+*                                                          *
+************************************************************/
+
+#ifndef IPMATCH_H
+#define IPMATCH_H
+
+#include "tracking_algorithms/Blob/OpenSURF/ipoint.h"
+
+#include <vector>
+
+//! Default number of descriptors compared per query before the search stops
+static const int MATCH_MAX_CHECKS = 200;
+
+//! Maximum number of descriptors in a kd-tree leaf
+static const int MATCH_LEAF_SIZE = 8;
+
+//! Nearest to second nearest distance ratio below which a match is accepted
+static const float MATCH_RATIO = 0.65f;
+
+
+//-------------------------------------------------------
+// Approximate nearest-neighbour matcher
+//  - Indexes the descriptors of one IpVec in a kd-tree per
+//    sign of the laplacian and matches other IpVecs against
+//    it with a best-bin-first search.
+//  - Queries are spread over threads when OpenMP is on.
+//  - The indexed IpVec must outlive the matcher and must
+//    not be modified while it is in use.
+//-------------------------------------------------------
+
+class IpMatcher {
+
+  public:
+
+    //! Destructor
+    ~IpMatcher() {};
+
+    //! Constructor builds the index over the descriptors of ipts
+    IpMatcher(IpVec &ipts, const int max_checks = MATCH_MAX_CHECKS);
+
+    //! Only match Ipoints whose laplacians have the same sign
+    void setLaplacianFilter(bool on);
+
+    //! Only match Ipoints that lie within radius pixels of the query
+    //! position moved by (dx, dy).  A radius <= 0 disables the gate.
+    void setSpatialGate(float radius, float dx = 0.f, float dy = 0.f);
+
+    //! Only keep matches whose indexed Ipoint has the query as its own
+    //! nearest neighbour among the queries
+    void setMutualCheck(bool on);
+
+    //! Populate IpPairVec with the ipts matched to the indexed Ipoints.
+    //! Same output as getMatches(ipts, indexed ipts, matches).
+    void getMatches(IpVec &ipts, IpPairVec &matches);
+
+  private:
+
+    //---------------- Private Types ---------------------//
+
+    //! kd-tree node; a leaf has dim == -1
+    struct Node {
+      int dim;          // splitting dimension
+      float val;        // splitting value
+      int right;        // index of right child (left child is next node)
+      int first, count; // range of a leaf in idx
+    };
+
+    //! Entry of the best-bin-first queue
+    struct Branch {
+      float bound;      // lower bound on distance to any point below node
+      int node;
+      bool operator<(const Branch &rhs) const { return bound > rhs.bound; }
+    };
+
+    //---------------- Private Functions -----------------//
+
+    //! Build the subtree over idx[first, first+count) and return its root
+    int build(int first, int count);
+
+    //! Find the two nearest gated neighbours of a query Ipoint
+    void search(const Ipoint &q, std::vector<Branch> &queue,
+                int nbr[2], float dist[2]);
+
+    //---------------- Private Variables -----------------//
+
+    //! Indexed Ipoints
+    IpVec &ipts;
+
+    //! Indices into ipts, ordered by leaf
+    std::vector<int> idx;
+
+    //! Tree nodes in depth-first order
+    std::vector<Node> nodes;
+
+    //! Root of the tree over each sign of laplacian (-1, +1), or -1 if empty
+    int root[2];
+
+    //! Maximum descriptors compared per query
+    int max_checks;
+
+    //! Laplacian prefilter on/off
+    bool lap_filter;
+
+    //! Mutual consistency check on/off
+    bool mutual;
+
+    //! Spatial gate radius (<= 0 for off) and predicted motion
+    float gate_radius, gate_dx, gate_dy;
+};
+
+
+#endif
@@ -48,12 +48,17 @@ Surf::Surf(IplImage *img, IpVec &ipts)
 : ipts(ipts)
 {
   this->img = img;
+
+  // Sub-region weights are the same for every descriptor
+  for (int i = 0; i < 4; ++i)
+    for (int j = 0; j < 4; ++j)
+      gauss_s2[i][j] = gaussian(i+0.5f-2.0f, j+0.5f-2.0f, 1.5f);
 }
 
 //-------------------------------------------------------
 
 //! Describe all features in the supplied vector
-void Surf::getDescriptors(bool upright)
+void Surf::getDescriptors(bool upright, CvMat *desc_mat)
 {
   // Check there are Ipoints to be described
   if (!ipts.size()) return;
@@ -61,29 +66,29 @@ void Surf::getDescriptors(bool upright)
   // Get the size of the vector for fixed loop bounds
   int ipts_size = (int)ipts.size();
 
-  if (upright)
-  {
-    // U-SURF loop just gets descriptors
-    for (int i = 0; i < ipts_size; ++i)
-    {
-      // Set the Ipoint to be described
-      index = i;
+  if (desc_mat && (desc_mat->rows != ipts_size || desc_mat->cols != 64 
+                   || CV_MAT_TYPE(desc_mat->type) != CV_32FC1))
+    error("Descriptor matrix must be a 64 column CV_32FC1 with a row per Ipoint");
 
-      // Extract upright (i.e. not rotation invariant) descriptors
-      getDescriptor(true);
-    }
-  }
-  else
+  // Ipoints are independent, so they are spread over threads when OpenMP is on
+#ifdef _OPENMP
+#pragma omp parallel
+#endif
   {
-    // Main SURF-64 loop assigns orientations and gets descriptors
+    std::vector<float> gauss_lut;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
     for (int i = 0; i < ipts_size; ++i)
     {
-      // Set the Ipoint to be described
-      index = i;
+      // U-SURF just gets descriptors, SURF-64 assigns orientations first
+      if (!upright)
+        getOrientation(ipts[i]);
+      getDescriptor(ipts[i], upright, gauss_lut);
 
-      // Assign Orientations and extract rotation invariant descriptors
-      getOrientation();
-      getDescriptor(false);
+      if (desc_mat)
+        memcpy(desc_mat->data.ptr + i*desc_mat->step, ipts[i].descriptor, 64*sizeof(float));
     }
   }
 }
@@ -91,12 +96,11 @@ void Surf::getDescriptors(bool upright)
 //-------------------------------------------------------
 
 //! Assign the supplied Ipoint an orientation
-void Surf::getOrientation()
+void Surf::getOrientation(Ipoint &ipt)
 {
-  Ipoint *ipt = &ipts[index];
-  float gauss = 0.f, scale = ipt->scale;
-  const int s = fRound(scale), r = fRound(ipt->y), c = fRound(ipt->x);
-  std::vector<float> resX(109), resY(109), Ang(109);
+  float gauss = 0.f, scale = ipt.scale;
+  const int s = fRound(scale), r = fRound(ipt.y), c = fRound(ipt.x);
+  float resX[109], resY[109], Ang[109];
   const int id[] = {6,5,4,3,2,1,0,1,2,3,4,5,6};
 
   int idx = 0;
@@ -125,7 +129,7 @@ void Surf::getOrientation()
   for(ang1 = 0; ang1 < 2*pi;  ang1+=0.15f) {
     ang2 = ( ang1+pi/3.0f > 2*pi ? ang1-5.0f*pi/3.0f : ang1+pi/3.0f);
     sumX = sumY = 0.f; 
-    for(unsigned int k = 0; k < Ang.size(); ++k) 
+    for(int k = 0; k < idx; ++k) 
     {
       // get angle from the x-axis of the sample point
       const float & ang = Ang[k];
@@ -155,27 +159,32 @@ void Surf::getOrientation()
   }
 
   // assign orientation of the dominant response vector
-  ipt->orientation = orientation;
+  ipt.orientation = orientation;
 }
 
 //-------------------------------------------------------
 
 //! Get the modified descriptor. See Agrawal ECCV 08
 //! Modified descriptor contributed by Pablo Fernandez
-void Surf::getDescriptor(bool bUpright)
+void Surf::getDescriptor(Ipoint &ipt, bool bUpright, std::vector<float> &gauss_lut)
 {
-  int y, x, sample_x, sample_y, count=0;
+  int y, x, count=0;
   int i = 0, ix = 0, j = 0, jx = 0, xs = 0, ys = 0;
   float scale, *desc, dx, dy, mdx, mdy, co, si;
-  float gauss_s1 = 0.f, gauss_s2 = 0.f;
+  float gauss_s1 = 0.f;
   float rx = 0.f, ry = 0.f, rrx = 0.f, rry = 0.f, len = 0.f;
-  float cx = -0.5f, cy = 0.f; //Subregion centers for the 4x4 gaussian weighting
+  int cx = -1, cy = 0; //Subregion indices for the 4x4 gaussian weighting
 
-  Ipoint *ipt = &ipts[index];
-  scale = ipt->scale;
-  x = fRound(ipt->x);
-  y = fRound(ipt->y);  
-  desc = ipt->descriptor;
+  // Sample points and their haar responses.  Neighbouring sub-regions
+  // overlap, so the 24x24 samples are evaluated once up front rather
+  // than up to four times each in the loop below.
+  int sample_x[24][24], sample_y[24][24];
+  float res_x[24][24], res_y[24][24];
+
+  scale = ipt.scale;
+  x = fRound(ipt.x);
+  y = fRound(ipt.y);  
+  desc = ipt.descriptor;
 
   if (bUpright)
   {
@@ -184,10 +193,31 @@ void Surf::getDescriptor(bool bUpright)
   }
   else
   {
-    co = cos(ipt->orientation);
-    si = sin(ipt->orientation);
+    co = cos(ipt.orientation);
+    si = sin(ipt.orientation);
+  }
+
+  const int haar_s = 2*fRound(scale);
+  for (int k = -12; k < 12; ++k) 
+  {
+    for (int l = -12; l < 12; ++l) 
+    {
+      //Get coords of sample point on the rotated axis
+      int sx = fRound(x + (-l*scale*si + k*scale*co));
+      int sy = fRound(y + ( l*scale*co + k*scale*si));
+
+      sample_x[k+12][l+12] = sx;
+      sample_y[k+12][l+12] = sy;
+      res_x[k+12][l+12] = haarX(sy, sx, haar_s);
+      res_y[k+12][l+12] = haarY(sy, sx, haar_s);
+    }
   }
 
+  // The sample weights only depend on the squared distance to the
+  // sub-region centre; fill them in as they are first needed
+  const float sig = 2.5f*scale;
+  gauss_lut.assign(gauss_lut.size(), -1.f);
+
   i = -8;
 
   //Calculate descriptor for this interest point
@@ -196,13 +226,13 @@ void Surf::getDescriptor(bool bUpright)
     j = -8;
     i = i-4;
 
-    cx += 1.f;
-    cy = -0.5f;
+    cx += 1;
+    cy = -1;
 
     while(j < 12) 
     {
       dx=dy=mdx=mdy=0.f;
-      cy += 1.f;
+      cy += 1;
 
       j = j - 4;
 
@@ -216,14 +246,19 @@ void Surf::getDescriptor(bool bUpright)
       {
         for (int l = j; l < j + 9; ++l) 
         {
-          //Get coords of sample point on the rotated axis
-          sample_x = fRound(x + (-l*scale*si + k*scale*co));
-          sample_y = fRound(y + ( l*scale*co + k*scale*si));
+          const int gx = xs - sample_x[k+12][l+12];
+          const int gy = ys - sample_y[k+12][l+12];
+          const int d2 = gx*gx + gy*gy;
 
           //Get the gaussian weighted x and y responses
-          gauss_s1 = gaussian(xs-sample_x,ys-sample_y,2.5f*scale);
-          rx = haarX(sample_y, sample_x, 2*fRound(scale));
-          ry = haarY(sample_y, sample_x, 2*fRound(scale));
+          if (d2 >= (int)gauss_lut.size())
+            gauss_lut.resize(d2 + 1, -1.f);
+          if (gauss_lut[d2] < 0)
+            gauss_lut[d2] = gaussian(gx, gy, sig);
+          gauss_s1 = gauss_lut[d2];
+
+          rx = res_x[k+12][l+12];
+          ry = res_y[k+12][l+12];
 
           //Get the gaussian weighted x and y responses on rotated axis
           rrx = gauss_s1*(-rx*si + ry*co);
@@ -238,14 +273,14 @@ void Surf::getDescriptor(bool bUpright)
       }
 
       //Add the values to the descriptor vector
-      gauss_s2 = gaussian(cx-2.0f,cy-2.0f,1.5f);
+      const float g = gauss_s2[cx][cy];
 
-      desc[count++] = dx*gauss_s2;
-      desc[count++] = dy*gauss_s2;
-      desc[count++] = mdx*gauss_s2;
-      desc[count++] = mdy*gauss_s2;
+      desc[count++] = dx*g;
+      desc[count++] = dy*g;
+      desc[count++] = mdx*g;
+      desc[count++] = mdy*g;
 
-      len += (dx*dx + dy*dy + mdx*mdx + mdy*mdy) * gauss_s2*gauss_s2;
+      len += (dx*dx + dy*dy + mdx*mdx + mdy*mdy) * g*g;
 
       j += 9;
     }
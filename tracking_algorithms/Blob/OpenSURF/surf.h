@@ -24,18 +24,21 @@ class Surf {
     //! Standard Constructor (img is an integral image)
     Surf(IplImage *img, std::vector<Ipoint> &ipts);
 
-    //! Describe all features in the supplied vector
-    void getDescriptors(bool bUpright = false);
+    //! Describe all features in the supplied vector.  If desc_mat is
+    //! given (ipts.size() x 64, CV_32FC1) the descriptors are also written
+    //! to its rows, in the order of the vector.
+    void getDescriptors(bool bUpright = false, CvMat *desc_mat = NULL);
   
   private:
     
     //---------------- Private Functions -----------------//
 
-    //! Assign the current Ipoint an orientation
-    void getOrientation();
+    //! Assign an Ipoint an orientation
+    void getOrientation(Ipoint &ipt);
     
     //! Get the descriptor. See Agrawal ECCV 08
-    void getDescriptor(bool bUpright = false);
+    //! gauss_lut is scratch space for the sample weights
+    void getDescriptor(Ipoint &ipt, bool bUpright, std::vector<float> &gauss_lut);
 
     //! Calculate the value of the 2d gaussian at x,y
     inline float gaussian(int x, int y, float sig);
@@ -57,8 +60,8 @@ class Surf {
     //! Ipoints vector
     IpVec &ipts;
 
-    //! Index of current Ipoint in the vector
-    int index;
+    //! Gaussian weights of the 4x4 sub-regions of the descriptor
+    float gauss_s2[4][4];
 };
 
 
@@ -17,11 +17,13 @@
 #include "tracking_algorithms/Blob/OpenSURF/fasthessian.h"
 #include "tracking_algorithms/Blob/OpenSURF/surf.h"
 #include "tracking_algorithms/Blob/OpenSURF/ipoint.h"
+#include "tracking_algorithms/Blob/OpenSURF/ipmatch.h"
 #include "tracking_algorithms/Blob/OpenSURF/utils_surf.h"
 
 
-//! Library function builds vector of described interest points
-inline void surfDetDes(IplImage *img,  /* image to find Ipoints in */
+//! Library function builds vector of described interest points from an 
+//! integral image computed once per frame with IntegralImage::compute
+inline void surfDetDes(IntegralImage &int_img,  /* integral image to find Ipoints in */
                        std::vector<Ipoint> &ipts, /* reference to vector of Ipoints */
                        bool upright = false, /* run in rotation invariant mode? */
                        int octaves = OCTAVES, /* number of octaves to calculate */
@@ -29,45 +31,79 @@ inline void surfDetDes(IplImage *img,  /* image to find Ipoints in */
                        int init_sample = INIT_SAMPLE, /* initial sampling step */
                        float thres = THRES /* blob response threshold */)
 {
-  // Create integral-image representation of the image
-  IplImage *int_img = Integral(img);
-  
   // Create Fast Hessian Object
-  FastHessian fh(int_img, ipts, octaves, intervals, init_sample, thres);
+  FastHessian fh(int_img.getImage(), ipts, octaves, intervals, init_sample, thres);
  
   // Extract interest points and store in vector ipts
   fh.getIpoints();
   
   // Create Surf Descriptor Object
-  Surf des(int_img, ipts);
+  Surf des(int_img.getImage(), ipts);
 
   // Extract the descriptors for the ipts
   des.getDescriptors(upright);
-
-  // Deallocate the integral image
-  cvReleaseImage(&int_img);
 }
 
 
-//! Library function builds vector of interest points
-inline void surfDet(IplImage *img,  /* image to find Ipoints in */
+//! Library function builds vector of interest points from an integral image
+inline void surfDet(IntegralImage &int_img,  /* integral image to find Ipoints in */
                     std::vector<Ipoint> &ipts, /* reference to vector of Ipoints */
                     int octaves = OCTAVES, /* number of octaves to calculate */
                     int intervals = INTERVALS, /* number of intervals per octave */
                     int init_sample = INIT_SAMPLE, /* initial sampling step */
                     float thres = THRES /* blob response threshold */)
 {
-  // Create integral image representation of the image
-  IplImage *int_img = Integral(img);
-
   // Create Fast Hessian Object
-  FastHessian fh(int_img, ipts, octaves, intervals, init_sample, thres);
+  FastHessian fh(int_img.getImage(), ipts, octaves, intervals, init_sample, thres);
 
   // Extract interest points and store in vector ipts
   fh.getIpoints();
+}
+
+
+//! Library function describes interest points in vector from an integral image
+inline void surfDes(IntegralImage &int_img,  /* integral image to find Ipoints in */
+                    std::vector<Ipoint> &ipts, /* reference to vector of Ipoints */
+                    bool upright = false) /* run in rotation invariant mode? */
+{ 
+  // Create Surf Descriptor Object
+  Surf des(int_img.getImage(), ipts);
+
+  // Extract the descriptors for the ipts
+  des.getDescriptors(upright);
+}
+
+
+//! Library function builds vector of described interest points
+inline void surfDetDes(IplImage *img,  /* image to find Ipoints in */
+                       std::vector<Ipoint> &ipts, /* reference to vector of Ipoints */
+                       bool upright = false, /* run in rotation invariant mode? */
+                       int octaves = OCTAVES, /* number of octaves to calculate */
+                       int intervals = INTERVALS, /* number of intervals per octave */
+                       int init_sample = INIT_SAMPLE, /* initial sampling step */
+                       float thres = THRES /* blob response threshold */)
+{
+  // Create integral-image representation of the image
+  IntegralImage int_img;
+  int_img.compute(img);
+  
+  surfDetDes(int_img, ipts, upright, octaves, intervals, init_sample, thres);
+}
+
 
-  // Deallocate the integral image
-  cvReleaseImage(&int_img);
+//! Library function builds vector of interest points
+inline void surfDet(IplImage *img,  /* image to find Ipoints in */
+                    std::vector<Ipoint> &ipts, /* reference to vector of Ipoints */
+                    int octaves = OCTAVES, /* number of octaves to calculate */
+                    int intervals = INTERVALS, /* number of intervals per octave */
+                    int init_sample = INIT_SAMPLE, /* initial sampling step */
+                    float thres = THRES /* blob response threshold */)
+{
+  // Create integral image representation of the image
+  IntegralImage int_img;
+  int_img.compute(img);
+
+  surfDet(int_img, ipts, octaves, intervals, init_sample, thres);
 }
 
 
@@ -79,16 +115,10 @@ inline void surfDes(IplImage *img,  /* image to find Ipoints in */
                     bool upright = false) /* run in rotation invariant mode? */
 { 
   // Create integral image representation of the image
-  IplImage *int_img = Integral(img);
-
-  // Create Surf Descriptor Object
-  Surf des(int_img, ipts);
+  IntegralImage int_img;
+  int_img.compute(img);
 
-  // Extract the descriptors for the ipts
-  des.getDescriptors(upright);
-  
-  // Deallocate the integral image
-  cvReleaseImage(&int_img);
+  surfDes(int_img, ipts, upright);
 }
 
 
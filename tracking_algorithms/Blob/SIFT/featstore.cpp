@@ -0,0 +1,142 @@
+/*
+Functions and structures for keeping the SIFT features of the most
+recently seen frames of a sequence.
+*/
+
+#include "featstore.h"
+#include "sift.h"
+#include "imgfeatures.h"
+#include "kdtree.h"
+
+#include <stdlib.h>
+
+
+/************************* Local Function Prototypes *************************/
+
+static void release_entry( struct feature_store_entry* );
+
+
+/******************** Functions prototyped in featstore.h ********************/
+
+
+/*
+Creates an empty feature store.
+
+@param capacity number of frames to keep
+
+@return Returns a new feature store.
+*/
+struct feature_store* feature_store_init( int capacity )
+{
+	struct feature_store* store;
+	int i;
+
+	if( capacity < 1 )
+		capacity = 1;
+	store = (struct feature_store*) malloc( sizeof( struct feature_store ) );
+	store->entries = (struct feature_store_entry*)
+		calloc( capacity, sizeof( struct feature_store_entry ) );
+	store->capacity = capacity;
+	store->clock = 0;
+	store->ws = sift_workspace_init();
+	for( i = 0; i < capacity; i++ )
+		store->entries[i].frame = -1;
+
+	return store;
+}
+
+
+
+/*
+Looks up the features of a frame, extracting and indexing them on a miss.
+
+@param store a feature store
+@param frame index of the frame
+@param img the frame's image, or NULL
+@param feat pointer in which to return the frame's features
+@param kd_tree pointer in which to return the frame's kd tree, or NULL
+
+@return Returns the number of features, or -1 on a miss with no image.
+*/
+int feature_store_get( struct feature_store* store, int frame,
+					  IplImage* img, struct feature** feat,
+					  struct kd_flat_tree** kd_tree )
+{
+	struct feature_store_entry* entry = NULL;
+	int i;
+
+	store->clock++;
+
+	/* hit */
+	for( i = 0; i < store->capacity; i++ )
+		if( store->entries[i].frame == frame )
+		{
+			entry = store->entries + i;
+			break;
+		}
+
+	if( ! entry )
+	{
+		if( ! img )
+			return -1;
+
+		/* miss: take a free slot, or the least recently used one */
+		entry = store->entries;
+		for( i = 1; i < store->capacity; i++ )
+		{
+			if( entry->frame == -1 )
+				break;
+			if( store->entries[i].frame == -1  ||
+				store->entries[i].last_use < entry->last_use )
+				entry = store->entries + i;
+		}
+		release_entry( entry );
+
+		entry->n = sift_features_ws( img, &entry->feat, store->ws );
+		entry->kd_tree = ( entry->n > 0 )? kdtree_build_flat( entry->feat, entry->n ) : NULL;
+		entry->frame = frame;
+	}
+
+	entry->last_use = store->clock;
+	*feat = entry->feat;
+	if( kd_tree )
+		*kd_tree = entry->kd_tree;
+	return entry->n;
+}
+
+
+
+/*
+De-allocates a feature store and everything it holds.
+
+@param store pointer to a feature store
+*/
+void feature_store_release( struct feature_store** store )
+{
+	int i;
+
+	if( ! store  ||  ! *store )
+		return;
+	for( i = 0; i < (*store)->capacity; i++ )
+		release_entry( (*store)->entries + i );
+	sift_workspace_release( &(*store)->ws );
+	free( (*store)->entries );
+	free( *store );
+	*store = NULL;
+}
+
+
+/************************ Functions prototyped here **************************/
+
+/*
+Frees the features and kd tree of a slot and marks it free.
+*/
+static void release_entry( struct feature_store_entry* entry )
+{
+	kdtree_release_flat( &entry->kd_tree );
+	if( entry->feat )
+		free( entry->feat );
+	entry->feat = NULL;
+	entry->n = 0;
+	entry->frame = -1;
+}
@@ -0,0 +1,88 @@
+/**@file
+Functions and structures for keeping the SIFT features of the most
+recently seen frames of a sequence, so that each frame is extracted and
+indexed once even though it takes part in two consecutive frame pairs.
+*/
+
+
+#ifndef FEATSTORE_H
+#define FEATSTORE_H
+
+#include "cxcore.h"
+
+
+/********************************* Structures ********************************/
+
+struct feature;
+struct kd_flat_tree;
+struct sift_workspace;
+
+/** the features and kd tree of one frame */
+struct feature_store_entry
+{
+	int frame;                   /**< frame index, or -1 if the slot is free */
+	struct feature* feat;        /**< features extracted from the frame */
+	int n;                       /**< number of features */
+	struct kd_flat_tree* kd_tree; /**< kd tree over \a feat */
+	unsigned long last_use;      /**< time stamp for least-recently-used eviction */
+};
+
+
+/** a sliding store of per-frame features */
+struct feature_store
+{
+	struct feature_store_entry* entries;  /**< one slot per cached frame */
+	int capacity;                         /**< number of slots */
+	unsigned long clock;                  /**< incremented on every lookup */
+	struct sift_workspace* ws;            /**< scale space buffers shared by all frames */
+};
+
+
+/*************************** Function Prototypes *****************************/
+
+/**
+Creates an empty feature store.
+
+@param capacity number of frames to keep; 2 is enough for matching
+	consecutive frame pairs
+
+@return Returns a new feature store.
+*/
+extern struct feature_store* feature_store_init( int capacity );
+
+
+/**
+Looks up the features of a frame, extracting them with sift_features_ws() and
+building their kd tree if the frame is not in the store.  When the store is
+full, the least recently used frame is released to make room.
+
+Note that the kd tree is built as soon as the features are extracted, since
+building it reorders \a feat; pointers into a frame's features (e.g.
+fwd_match) stay valid until that frame is evicted.
+
+@param store a feature store
+@param frame index of the frame
+@param img the frame's image; may be NULL if the frame is known to be
+	in the store
+@param feat pointer in which to return the frame's features
+@param kd_tree pointer in which to return the frame's kd tree; may be NULL
+
+@return Returns the number of features, or -1 if the frame is not in the
+	store and \a img is NULL.  The features and kd tree remain owned by
+	the store.
+*/
+extern int feature_store_get( struct feature_store* store, int frame,
+							 IplImage* img, struct feature** feat,
+							 struct kd_flat_tree** kd_tree );
+
+
+/**
+De-allocates a feature store, including all the features and kd trees it
+holds.
+
+@param store pointer to a feature store
+*/
+extern void feature_store_release( struct feature_store** store );
+
+
+#endif
@@ -24,11 +24,9 @@ Copyright (C) 2006  Rob Hess <hess@eecs.oregonstate.edu>
 
 #include <stdio.h>
 
-struct bbf_data
-{
-	double d;
-	void* old_data;
-};
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 /************************* Local Function Prototypes *************************/
 
@@ -42,8 +40,13 @@ int partition_array( double*, int, double );
 void partition_features( struct kd_node* );
 struct kd_node* explore_to_leaf( struct kd_node*, struct feature*,
 								struct min_pq* );
-int insert_into_nbr_array( struct feature*, struct feature**, int, int );
+int insert_into_nbr_array( struct feature*, double, struct feature**, double*,
+						   int, int );
 int within_rect( CvPoint2D64f, CvRect );
+int count_kd_nodes( struct kd_node* );
+int flatten_kd_node( struct kd_node*, struct feature*, struct kd_flat_node*,
+					int );
+int insert_into_nbr_idx_array( int, float, int*, float*, int, int );
 
 
 /******************** Functions prototyped in keyptdb.h **********************/
@@ -96,7 +99,7 @@ int kdtree_bbf_knn( struct kd_node* kd_root, struct feature* feat, int k,
 	struct kd_node* expl;
 	struct min_pq* min_pq;
 	struct feature* tree_feat, ** _nbrs;
-	struct bbf_data* bbf_data;
+	double* _dists;
 	int i, t = 0, n = 0;
 
 	if( ! nbrs  ||  ! feat  ||  ! kd_root )
@@ -106,7 +109,10 @@ int kdtree_bbf_knn( struct kd_node* kd_root, struct feature* feat, int k,
 		return -1;
 	}
 
+	/* neighbor distances are kept beside the neighbors rather than in the
+	tree's features, so that the tree is not modified by a query */
 	_nbrs = (feature**) calloc( k, sizeof( struct feature* ) );
+	_dists = (double*) calloc( k, sizeof( double ) );
 	min_pq = minpq_init();
 	minpq_insert( min_pq, kd_root, 0 );
 	while( min_pq->n > 0  &&  t < max_nn_chks )
@@ -130,39 +136,20 @@ int kdtree_bbf_knn( struct kd_node* kd_root, struct feature* feat, int k,
 		for( i = 0; i < expl->n; i++ )
 		{
 			tree_feat = &expl->features[i];
-			bbf_data = (struct bbf_data*) malloc( sizeof( struct bbf_data ) );
-			if( ! bbf_data )
-			{
-				fprintf( stderr, "Warning: unable to allocate memory,"
-					" %s line %d\n", __FILE__, __LINE__ );
-				goto fail;
-			}
-			bbf_data->old_data = tree_feat->feature_data;
-			bbf_data->d = descr_dist_sq(feat, tree_feat);
-			tree_feat->feature_data = bbf_data;
-			n += insert_into_nbr_array( tree_feat, _nbrs, n, k );
+			n += insert_into_nbr_array( tree_feat, descr_dist_sq( feat, tree_feat ),
+										_nbrs, _dists, n, k );
 		}
 		t++;
 	}
 
 	minpq_release( &min_pq );
-	for( i = 0; i < n; i++ )
-	{
-		bbf_data = (struct bbf_data*) _nbrs[i]->feature_data;
-		_nbrs[i]->feature_data = bbf_data->old_data;
-		free( bbf_data );
-	}
+	free( _dists );
 	*nbrs = _nbrs;
 	return n;
 
 fail:
 	minpq_release( &min_pq );
-	for( i = 0; i < n; i++ )
-	{
-		bbf_data = (struct bbf_data*) _nbrs[i]->feature_data;
-		_nbrs[i]->feature_data = bbf_data->old_data;
-		free( bbf_data );
-	}
+	free( _dists );
 	free( _nbrs );
 	*nbrs = NULL;
 	return -1;
@@ -235,6 +222,254 @@ void kdtree_release( struct kd_node* kd_root )
 }
 
 
+
+/*
+Builds a read-only kd tree from the features in an array.  The tree is
+built as by kdtree_build() and then copied into an array of nodes, with the
+descriptors copied into a descriptor matrix in the order of the features.
+
+@param features an array of features
+@param n the number of features in features
+
+@return Returns a kd tree built from features or NULL on error.
+*/
+struct kd_flat_tree* kdtree_build_flat( struct feature* features, int n )
+{
+	struct kd_flat_tree* tree;
+	struct kd_node* kd_root;
+
+	kd_root = kdtree_build( features, n );
+	if( ! kd_root )
+		return NULL;
+
+	tree = (struct kd_flat_tree*) calloc( 1, sizeof( struct kd_flat_tree ) );
+	tree->n_nodes = count_kd_nodes( kd_root );
+	tree->nodes = (struct kd_flat_node*)
+		calloc( tree->n_nodes, sizeof( struct kd_flat_node ) );
+	flatten_kd_node( kd_root, features, tree->nodes, 0 );
+	kdtree_release( kd_root );
+
+	tree->features = features;
+	tree->n = n;
+	tree->descr = descr_matrix_build( features, n, 0 );
+	if( ! tree->descr )
+	{
+		kdtree_release_flat( &tree );
+		return NULL;
+	}
+
+	return tree;
+}
+
+
+
+/*
+Creates the scratch space for querying read-only kd trees.
+
+@return Returns a new query context.
+*/
+struct kd_query_ctx* kd_query_ctx_init( void )
+{
+	struct kd_query_ctx* ctx;
+
+	ctx = (struct kd_query_ctx*) calloc( 1, sizeof( struct kd_query_ctx ) );
+	ctx->min_pq = minpq_init();
+	return ctx;
+}
+
+
+
+/*
+De-allocates a query context.
+
+@param ctx pointer to a query context
+*/
+void kd_query_ctx_release( struct kd_query_ctx** ctx )
+{
+	if( ! ctx  ||  ! *ctx )
+		return;
+	minpq_release( &(*ctx)->min_pq );
+	free( (*ctx)->dist );
+	free( *ctx );
+	*ctx = NULL;
+}
+
+
+
+/*
+Finds a descriptor's approximate k nearest neighbors in a read-only kd tree
+using Best Bin First search.  The priority queue and leaf distance buffer
+come from ctx and only grow, so a query does not normally allocate.
+
+@param tree a read-only kd tree
+@param descr descriptor for whose neighbors to search
+@param k number of neighbors to find
+@param max_nn_chks search is cut off after examining this many tree entries
+@param ctx query context
+@param nbrs array in which to store the indices of the neighbors
+@param nbr_dist array in which to store the neighbors' distances, or NULL
+
+@return Returns the number of neighbors found, or -1 on error.
+*/
+int kdtree_flat_bbf_knn( struct kd_flat_tree* tree, const float* descr,
+						int k, int max_nn_chks, struct kd_query_ctx* ctx,
+						int* nbrs, float* nbr_dist )
+{
+	struct kd_flat_node* nodes, * expl, * unexpl;
+	float dist_buf[64], * dist;
+	int i, t = 0, n = 0;
+
+	if( ! tree  ||  ! descr  ||  ! ctx  ||  ! nbrs )
+	{
+		fprintf( stderr, "Warning: NULL pointer error, %s, line %d\n",
+				__FILE__, __LINE__ );
+		return -1;
+	}
+	if( k <= 0 )
+	{
+		fprintf( stderr, "Warning: no neighbors requested, %s, line %d\n",
+				__FILE__, __LINE__ );
+		return -1;
+	}
+	if( ! nbr_dist )
+	{
+		if( k > 64 )
+		{
+			fprintf( stderr, "Warning: too many neighbors requested without" \
+					" a distance array, %s, line %d\n", __FILE__, __LINE__ );
+			return -1;
+		}
+		nbr_dist = dist_buf;
+	}
+
+	nodes = tree->nodes;
+	ctx->min_pq->n = 0;
+	minpq_insert( ctx->min_pq, nodes, 0 );
+	while( ctx->min_pq->n > 0  &&  t < max_nn_chks )
+	{
+		expl = (struct kd_flat_node*)minpq_extract_min( ctx->min_pq );
+
+		/* explore to leaf, queueing the branches not taken */
+		while( expl->ki >= 0 )
+		{
+			double kv = expl->kv, q = descr[expl->ki];
+
+			if( q <= kv )
+			{
+				unexpl = nodes + expl->right;
+				expl = expl + 1;
+			}
+			else
+			{
+				unexpl = expl + 1;
+				expl = nodes + expl->right;
+			}
+			/* same key as explore_to_leaf(), so that the search visits the
+			same leaves as kdtree_bbf_knn() */
+			if( minpq_insert( ctx->min_pq, unexpl, ABS( kv - q ) ) )
+				return -1;
+		}
+
+		/* distances to every row of the leaf in one pass */
+		if( expl->n > ctx->dist_nallocd )
+		{
+			free( ctx->dist );
+			ctx->dist_nallocd = MAX( expl->n, 2 * ctx->dist_nallocd );
+			ctx->dist = (float*) malloc( ctx->dist_nallocd * sizeof( float ) );
+		}
+		dist = ctx->dist;
+		descr_dist_sq_batch( descr, tree->descr, expl->first, expl->n, dist );
+		for( i = 0; i < expl->n; i++ )
+			n += insert_into_nbr_idx_array( expl->first + i, dist[i],
+											nbrs, nbr_dist, n, k );
+		t++;
+	}
+
+	return n;
+}
+
+
+
+/*
+Finds the approximate k nearest neighbors of every feature in an array.
+Each thread has its own query context, and every feature's neighbors go
+to their own slots of the output arrays, so the result does not depend on
+the number of threads.
+
+@param tree a read-only kd tree
+@param feat array of features
+@param n number of features
+@param k number of neighbors to find for each feature
+@param max_nn_chks search is cut off after examining this many tree entries
+@param nbrs array of n*k neighbor indices
+@param nbr_dist array of n*k neighbor distances, or NULL
+@param n_nbrs array of n neighbor counts
+
+@return Returns 0 on success or -1 on error.
+*/
+int kdtree_flat_bbf_knn_batch( struct kd_flat_tree* tree, struct feature* feat,
+							  int n, int k, int max_nn_chks, int* nbrs,
+							  float* nbr_dist, int* n_nbrs )
+{
+	int err = 0;
+
+	if( ! tree  ||  ! feat  ||  ! nbrs  ||  ! n_nbrs )
+	{
+		fprintf( stderr, "Warning: NULL pointer error, %s, line %d\n",
+				__FILE__, __LINE__ );
+		return -1;
+	}
+	if( k <= 0 )
+	{
+		fprintf( stderr, "Warning: no neighbors requested, %s, line %d\n",
+				__FILE__, __LINE__ );
+		return -1;
+	}
+
+#ifdef _OPENMP
+#pragma omp parallel reduction(|:err)
+#endif
+	{
+		struct kd_query_ctx* ctx = kd_query_ctx_init();
+		int i;
+
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 16)
+#endif
+		for( i = 0; i < n; i++ )
+		{
+			n_nbrs[i] = kdtree_flat_bbf_knn( tree, feat[i].descr, k, max_nn_chks,
+											ctx, nbrs + (size_t)i * k,
+											( nbr_dist )? nbr_dist + (size_t)i * k : NULL );
+			if( n_nbrs[i] < 0 )
+				err = 1;
+		}
+
+		kd_query_ctx_release( &ctx );
+	}
+
+	return ( err )? -1 : 0;
+}
+
+
+
+/*
+De-allocates a read-only kd tree.  The features it was built from are
+not freed.
+
+@param tree pointer to a read-only kd tree
+*/
+void kdtree_release_flat( struct kd_flat_tree** tree )
+{
+	if( ! tree  ||  ! *tree )
+		return;
+	free( (*tree)->nodes );
+	descr_matrix_release( &(*tree)->descr );
+	free( *tree );
+	*tree = NULL;
+}
+
+
 /************************ Functions prototyped here **************************/
 
 
@@ -572,43 +807,35 @@ struct kd_node* explore_to_leaf( struct kd_node* kd_node, struct feature* feat,
 Inserts a feature into the nearest-neighbor array so that the array remains
 in order of increasing descriptor distance from the search feature.
 
-@param feat feature to be inderted into the array; it's feature_data field
-	should be a pointer to a bbf_data with d equal to the squared descriptor
-	distance between feat and the search feature
+@param feat feature to be inserted into the array
+@param d squared descriptor distance between feat and the search feature
 @param nbrs array of nearest neighbors neighbors
+@param dists distances of the elements of nbrs
 @param n number of elements already in nbrs and
 @param k maximum number of elements in nbrs
 
 @return If feat was successfully inserted into nbrs, returns 1; otherwise
 	returns 0.
 */
-int insert_into_nbr_array( struct feature* feat, struct feature** nbrs,
-						  int n, int k )
+int insert_into_nbr_array( struct feature* feat, double d,
+						  struct feature** nbrs, double* dists, int n, int k )
 {
-	struct bbf_data* fdata, * ndata;
-	double dn, df;
 	int i, ret = 0;
 
 	if( n == 0 )
 	{
 		nbrs[0] = feat;
+		dists[0] = d;
 		return 1;
 	}
 
 	/* check at end of array */
-	fdata = (struct bbf_data*)feat->feature_data;
-	df = fdata->d;
-	ndata = (struct bbf_data*)nbrs[n-1]->feature_data;
-	dn = ndata->d;
-	if( df >= dn )
+	if( d >= dists[n-1] )
 	{
 		if( n == k )
-		{
-			feat->feature_data = fdata->old_data;
-			free( fdata );
 			return 0;
-		}
 		nbrs[n] = feat;
+		dists[n] = d;
 		return 1;
 	}
 
@@ -616,25 +843,21 @@ int insert_into_nbr_array( struct feature* feat, struct feature** nbrs,
 	if( n < k )
 	{
 		nbrs[n] = nbrs[n-1];
+		dists[n] = dists[n-1];
 		ret = 1;
 	}
-	else
-	{
-		nbrs[n-1]->feature_data = ndata->old_data;
-		free( ndata );
-	}
 	i = n-2;
 	while( i >= 0 )
 	{
-		ndata = (struct bbf_data*)nbrs[i]->feature_data;
-		dn = ndata->d;
-		if( dn <= df )
+		if( dists[i] <= d )
 			break;
 		nbrs[i+1] = nbrs[i];
+		dists[i+1] = dists[i];
 		i--;
 	}
 	i++;
 	nbrs[i] = feat;
+	dists[i] = d;
 
 	return ret;
 }
@@ -657,3 +880,100 @@ int within_rect( CvPoint2D64f pt, CvRect rect )
 		return 0;
 	return 1;
 }
+
+
+
+/*
+Counts the nodes of a kd tree.
+
+@param kd_node root of a kd tree
+
+@return Returns the number of nodes in the tree.
+*/
+int count_kd_nodes( struct kd_node* kd_node )
+{
+	if( ! kd_node )
+		return 0;
+	return 1 + count_kd_nodes( kd_node->kd_left ) +
+		count_kd_nodes( kd_node->kd_right );
+}
+
+
+
+/*
+Copies a kd tree into an array of nodes in depth-first order.
+
+@param kd_node root of the subtree to be copied
+@param features the array of features from which the tree was built
+@param nodes array of nodes
+@param i index in nodes at which to store kd_node
+
+@return Returns the index following the last node of the subtree.
+*/
+int flatten_kd_node( struct kd_node* kd_node, struct feature* features,
+					struct kd_flat_node* nodes, int i )
+{
+	struct kd_flat_node* node = nodes + i;
+	int next;
+
+	node->first = (int)( kd_node->features - features );
+	node->n = kd_node->n;
+	if( kd_node->leaf )
+	{
+		node->ki = -1;
+		node->kv = 0;
+		node->right = -1;
+		return i + 1;
+	}
+
+	node->ki = kd_node->ki;
+	node->kv = kd_node->kv;
+	next = flatten_kd_node( kd_node->kd_left, features, nodes, i + 1 );
+	node->right = next;
+	return flatten_kd_node( kd_node->kd_right, features, nodes, next );
+}
+
+
+
+/*
+Inserts a tree row into a nearest-neighbor index array so that the array
+remains in order of increasing descriptor distance from the search
+descriptor.
+
+@param idx row of the tree to be inserted
+@param d squared descriptor distance of the row
+@param nbrs array of nearest neighbor rows
+@param dists distances of the elements of nbrs
+@param n number of elements already in nbrs
+@param k maximum number of elements in nbrs
+
+@return If idx was inserted and nbrs grew, returns 1; otherwise returns 0.
+*/
+int insert_into_nbr_idx_array( int idx, float d, int* nbrs, float* dists,
+							  int n, int k )
+{
+	int i, ret = 0;
+
+	if( n > 0  &&  d >= dists[n-1] )
+	{
+		if( n == k )
+			return 0;
+		nbrs[n] = idx;
+		dists[n] = d;
+		return 1;
+	}
+
+	if( n < k )
+		ret = 1;
+	else
+		n--;
+	for( i = n - 1; i >= 0  &&  dists[i] > d; i-- )
+	{
+		nbrs[i+1] = nbrs[i];
+		dists[i+1] = dists[i];
+	}
+	nbrs[i+1] = idx;
+	dists[i+1] = d;
+
+	return ret;
+}
@@ -25,14 +25,26 @@ that accompanied this distribution.
 #include <cxcore.h>
 #include <cv.h>
 
+#include <string.h>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
 /************************* Local Function Prototypes *************************/
 
-IplImage* create_init_img( IplImage*, int, double );
-IplImage* convert_to_gray32( IplImage* );
-IplImage*** build_gauss_pyr( IplImage*, int, int, double );
-IplImage* downsample( IplImage* );
-IplImage*** build_dog_pyr( IplImage***, int, int );
-CvSeq* scale_space_extrema( IplImage***, int, int, double, int, CvMemStorage*);
+void size_workspace( struct sift_workspace*, IplImage*, int, int );
+void size_thread_bufs( struct sift_workspace* );
+void release_thread_bufs( struct sift_workspace* );
+void create_init_img( struct sift_workspace*, IplImage*, double );
+void convert_to_gray32( IplImage*, IplImage*, IplImage* );
+void build_scale_space( struct sift_workspace*, double );
+void smooth_and_subtract( IplImage*, IplImage*, IplImage*, double,
+						 struct sift_workspace* );
+void subtract_rows( CvMat*, int, IplImage*, IplImage*, IplImage*, int, int );
+CvSeq* scale_space_extrema( struct sift_workspace*, double, int );
+void row_extrema( IplImage***, int, int, int, int, double, int,
+				 struct sift_thread_buf* );
 int is_extremum( IplImage***, int, int, int, int );
 struct feature* interp_extremum( IplImage***, int, int, int, int, int, double);
 void interp_step( IplImage***, int, int, int, int, double*, double*, double* );
@@ -43,20 +55,21 @@ struct feature* new_feature( void );
 int is_too_edge_like( IplImage*, int, int, int );
 void calc_feature_scales( CvSeq*, double, int );
 void adjust_for_img_dbl( CvSeq* );
-void calc_feature_oris( CvSeq*, IplImage*** );
-double* ori_hist( IplImage*, int, int, int, int, double );
-int calc_grad_mag_ori( IplImage*, int, int, double*, double* );
+void calc_grad_imgs( struct sift_workspace*, CvSeq* );
+void grad_mag_ori_img( IplImage*, IplImage*, IplImage* );
+void calc_feature_oris( CvSeq*, struct sift_workspace* );
+void ori_hist( IplImage*, IplImage*, int, int, int, int, double, double* );
 void smooth_ori_hist( double*, int );
 double dominant_ori( double*, int );
 void add_good_ori_features( CvSeq*, double*, int, double, struct feature* );
 struct feature* clone_feature( struct feature* );
-void compute_descriptors( CvSeq*, IplImage***, int, int );
-double*** descr_hist( IplImage*, int, int, double, double, int, int );
-void interp_hist_entry( double***, double, double, double, double, int, int);
-void hist_to_descr( double***, int, int, struct feature* );
-void normalize_descr( struct feature* );
+void compute_descriptors( CvSeq*, struct sift_workspace*, int, int );
+double* descr_hist( IplImage*, IplImage*, int, int, double, double, int, int,
+				   struct sift_thread_buf* );
+void interp_hist_entry( double*, double, double, double, double, int, int);
+void hist_to_descr( double*, int, int, struct feature* );
+void normalize_descr( double*, int );
 int feature_cmp( void*, void*, void* );
-void release_descr_hist( double****, int );
 void release_pyr( IplImage****, int, int );
 
 
@@ -111,11 +124,68 @@ int _sift_features( IplImage* img, struct feature** feat, int intvls,
 				   double sigma, double contr_thr, int curv_thr,
 				   int img_dbl, int descr_width, int descr_hist_bins )
 {
-	IplImage* init_img;
-	IplImage*** gauss_pyr, *** dog_pyr;
-	CvMemStorage* storage;
+	struct sift_workspace* ws;
+	int n;
+
+	ws = sift_workspace_init();
+	n = _sift_features_ws( img, feat, intvls, sigma, contr_thr, curv_thr,
+		img_dbl, descr_width, descr_hist_bins, ws );
+	sift_workspace_release( &ws );
+	return n;
+}
+
+
+
+/**
+Creates an empty workspace for _sift_features_ws().
+
+@return Returns a new SIFT workspace.
+*/
+struct sift_workspace* sift_workspace_init( void )
+{
+	return (struct sift_workspace*) calloc( 1, sizeof( struct sift_workspace ) );
+}
+
+
+
+/**
+Finds SIFT features in an image using default parameter values, building
+the scale space in the buffers of a workspace.
+
+@param img the image in which to detect features
+@param feat a pointer to an array in which to store detected features
+@param ws a workspace created by sift_workspace_init()
+
+@return Returns the number of features stored in \a feat or -1 on failure
+@see _sift_features_ws()
+*/
+int sift_features_ws( IplImage* img, struct feature** feat,
+					 struct sift_workspace* ws )
+{
+	return _sift_features_ws( img, feat, SIFT_INTVLS, SIFT_SIGMA,
+		SIFT_CONTR_THR, SIFT_CURV_THR, SIFT_IMG_DBL, SIFT_DESCR_WIDTH,
+		SIFT_DESCR_HIST_BINS, ws );
+}
+
+
+
+/**
+Finds SIFT features in an image using user-specified parameter values,
+building the scale space in the buffers of a workspace.  The parameters
+are those of _sift_features().
+
+@param ws a workspace created by sift_workspace_init()
+
+@return Returns the number of keypoints stored in \a feat or -1 on failure
+@see _sift_features()
+*/
+int _sift_features_ws( IplImage* img, struct feature** feat, int intvls,
+					  double sigma, double contr_thr, int curv_thr,
+					  int img_dbl, int descr_width, int descr_hist_bins,
+					  struct sift_workspace* ws )
+{
 	CvSeq* features;
-	int octvs, i, n = 0;
+	int i, n = 0;
 
 	/* check arguments */
 	if( ! img )
@@ -124,20 +194,22 @@ int _sift_features( IplImage* img, struct feature** feat, int intvls,
 	if( ! feat )
 		fatal_error( "NULL pointer error, %s, line %d",  __FILE__, __LINE__ );
 
+	if( ! ws )
+		fatal_error( "NULL pointer error, %s, line %d",  __FILE__, __LINE__ );
+
 	/* build scale space pyramid; smallest dimension of top level is ~4 pixels */
-	init_img = create_init_img( img, img_dbl, sigma );
-	octvs = log( (float)(MIN(init_img->width, init_img->height)) ) / log(2.f) - 2;
-	gauss_pyr = build_gauss_pyr( init_img, octvs, intvls, sigma );
-	dog_pyr = build_dog_pyr( gauss_pyr, octvs, intvls );
-
-	storage = cvCreateMemStorage( 0 );
-	features = scale_space_extrema( dog_pyr, octvs, intvls, contr_thr,
-		curv_thr, storage );
+	size_workspace( ws, img, img_dbl, intvls );
+	create_init_img( ws, img, sigma );
+	build_scale_space( ws, sigma );
+
+	cvClearMemStorage( ws->storage );
+	features = scale_space_extrema( ws, contr_thr, curv_thr );
 	calc_feature_scales( features, sigma, intvls );
 	if( img_dbl )
 		adjust_for_img_dbl( features );
-	calc_feature_oris( features, gauss_pyr );
-	compute_descriptors( features, gauss_pyr, descr_width, descr_hist_bins );
+	calc_grad_imgs( ws, features );
+	calc_feature_oris( features, ws );
+	compute_descriptors( features, ws, descr_width, descr_hist_bins );
 
 	/* sort features by decreasing scale and move from CvSeq to array */
 	cvSeqSort( features, (CvCmpFunc)feature_cmp, NULL );
@@ -150,45 +222,189 @@ int _sift_features( IplImage* img, struct feature** feat, int intvls,
 		(*feat)[i].feature_data = NULL;
 	}
 
-	cvReleaseMemStorage( &storage );
-	cvReleaseImage( &init_img );
-	release_pyr( &gauss_pyr, octvs, intvls + 3 );
-	release_pyr( &dog_pyr, octvs, intvls + 2 );
 	return n;
 }
 
 
+
+/**
+De-allocates a SIFT workspace and all the buffers it holds.
+
+@param ws pointer to a workspace
+*/
+void sift_workspace_release( struct sift_workspace** ws )
+{
+	if( ! ws  ||  ! *ws )
+		return;
+
+	if( (*ws)->gauss_pyr )
+		release_pyr( &(*ws)->gauss_pyr, (*ws)->octvs, (*ws)->intvls + 3 );
+	if( (*ws)->dog_pyr )
+		release_pyr( &(*ws)->dog_pyr, (*ws)->octvs, (*ws)->intvls + 2 );
+	if( (*ws)->grad_mag )
+		release_pyr( &(*ws)->grad_mag, (*ws)->octvs, (*ws)->intvls + 3 );
+	if( (*ws)->grad_ori )
+		release_pyr( &(*ws)->grad_ori, (*ws)->octvs, (*ws)->intvls + 3 );
+	if( (*ws)->gray8 )
+		cvReleaseImage( &(*ws)->gray8 );
+	if( (*ws)->gray32 )
+		cvReleaseImage( &(*ws)->gray32 );
+	if( (*ws)->storage )
+		cvReleaseMemStorage( &(*ws)->storage );
+	release_thread_bufs( *ws );
+	free( *ws );
+	*ws = NULL;
+}
+
+
 /************************ Functions prototyped here **************************/
 
 /*
-Converts an image to 8-bit grayscale and Gaussian-smooths it.  The image is
-optionally doubled in size prior to smoothing.
+(Re-)allocates the pyramids of a workspace unless they already fit images of
+the given size and scale space parameters.
 
+@param ws a SIFT workspace
 @param img input image
 @param img_dbl if true, image is doubled in size prior to smoothing
+@param intvls number of intervals per octave
+*/
+void size_workspace( struct sift_workspace* ws, IplImage* img, int img_dbl,
+					int intvls )
+{
+	int w, h, i, o;
+
+	if( ! ws->storage )
+		ws->storage = cvCreateMemStorage( 0 );
+	size_thread_bufs( ws );
+
+	if( ws->gauss_pyr  &&  ws->width == img->width  &&
+		ws->height == img->height  &&  ws->img_dbl == img_dbl  &&
+		ws->intvls == intvls )
+		return;
+
+	if( ws->gauss_pyr )
+		release_pyr( &ws->gauss_pyr, ws->octvs, ws->intvls + 3 );
+	if( ws->dog_pyr )
+		release_pyr( &ws->dog_pyr, ws->octvs, ws->intvls + 2 );
+	if( ws->grad_mag )
+		release_pyr( &ws->grad_mag, ws->octvs, ws->intvls + 3 );
+	if( ws->grad_ori )
+		release_pyr( &ws->grad_ori, ws->octvs, ws->intvls + 3 );
+	if( ws->gray32 )
+		cvReleaseImage( &ws->gray32 );
+	if( ws->gray8 )
+		cvReleaseImage( &ws->gray8 );
+
+	ws->width = img->width;
+	ws->height = img->height;
+	ws->img_dbl = img_dbl;
+	ws->intvls = intvls;
+	ws->gray32 = cvCreateImage( cvGetSize(img), IPL_DEPTH_32F, 1 );
+
+	w = ( img_dbl )? img->width * 2 : img->width;
+	h = ( img_dbl )? img->height * 2 : img->height;
+	ws->octvs = log( (float)(MIN(w, h)) ) / log(2.f) - 2;
+
+	ws->gauss_pyr = (IplImage***) calloc( ws->octvs, sizeof( IplImage** ) );
+	ws->dog_pyr = (IplImage***) calloc( ws->octvs, sizeof( IplImage** ) );
+	ws->grad_mag = (IplImage***) calloc( ws->octvs, sizeof( IplImage** ) );
+	ws->grad_ori = (IplImage***) calloc( ws->octvs, sizeof( IplImage** ) );
+	for( o = 0; o < ws->octvs; o++ )
+	{
+		ws->gauss_pyr[o] = (IplImage**) calloc( intvls + 3, sizeof( IplImage* ) );
+		ws->dog_pyr[o] = (IplImage**) calloc( intvls + 2, sizeof( IplImage* ) );
+
+		/* gradient images are only allocated for levels that hold features */
+		ws->grad_mag[o] = (IplImage**) calloc( intvls + 3, sizeof( IplImage* ) );
+		ws->grad_ori[o] = (IplImage**) calloc( intvls + 3, sizeof( IplImage* ) );
+		for( i = 0; i < intvls + 3; i++ )
+			ws->gauss_pyr[o][i] = cvCreateImage( cvSize( w, h ), IPL_DEPTH_32F, 1 );
+		for( i = 0; i < intvls + 2; i++ )
+			ws->dog_pyr[o][i] = cvCreateImage( cvSize( w, h ), IPL_DEPTH_32F, 1 );
+
+		/* each octave is half the size of the previous one */
+		w /= 2;
+		h /= 2;
+	}
+}
+
+
+
+/*
+Makes sure a workspace has scratch space for every thread that may run
+in a parallel region.
+
+@param ws a SIFT workspace
+*/
+void size_thread_bufs( struct sift_workspace* ws )
+{
+	int n = 1;
+
+#ifdef _OPENMP
+	n = omp_get_max_threads();
+#endif
+	if( ws->thread_bufs  &&  ws->n_threads >= n )
+		return;
+
+	release_thread_bufs( ws );
+	ws->thread_bufs = (struct sift_thread_buf*)
+		calloc( n, sizeof( struct sift_thread_buf ) );
+	ws->n_threads = n;
+}
+
+
+
+/*
+De-allocates the per-thread scratch space of a workspace.
+
+@param ws a SIFT workspace
+*/
+void release_thread_bufs( struct sift_workspace* ws )
+{
+	int i;
+
+	for( i = 0; i < ws->n_threads; i++ )
+	{
+		if( ws->thread_bufs[i].band )
+			cvReleaseMat( &ws->thread_bufs[i].band );
+		free( ws->thread_bufs[i].found );
+		free( ws->thread_bufs[i].hist );
+		free( ws->thread_bufs[i].weights );
+	}
+	free( ws->thread_bufs );
+	ws->thread_bufs = NULL;
+	ws->n_threads = 0;
+}
+
+
+
+/*
+Converts an image to 32-bit grayscale and Gaussian-smooths it into the base
+of a workspace's Gaussian pyramid.  The image is optionally doubled in size
+prior to smoothing.
+
+@param ws a SIFT workspace sized for img
+@param img input image
 @param sigma total std of Gaussian smoothing
 */
-IplImage* create_init_img( IplImage* img, int img_dbl, double sigma )
+void create_init_img( struct sift_workspace* ws, IplImage* img, double sigma )
 {
-	IplImage* gray, * dbl;
+	IplImage* base = ws->gauss_pyr[0][0];
 	float sig_diff;
 
-	gray = convert_to_gray32( img );
-	if( img_dbl )
+	if( img->nChannels != 1  &&  ! ws->gray8 )
+		ws->gray8 = cvCreateImage( cvGetSize(img), IPL_DEPTH_8U, 1 );
+	convert_to_gray32( img, ws->gray8, ws->gray32 );
+	if( ws->img_dbl )
 	{
 		sig_diff = sqrt( sigma * sigma - SIFT_INIT_SIGMA * SIFT_INIT_SIGMA * 4 );
-		dbl = cvCreateImage( cvSize( img->width*2, img->height*2 ),
-			IPL_DEPTH_32F, 1 );
-		cvResize( gray, dbl, CV_INTER_CUBIC );
-		cvSmooth( dbl, dbl, CV_GAUSSIAN, 0, 0, sig_diff, sig_diff );
-		cvReleaseImage( &gray );
-		return dbl;
+		cvResize( ws->gray32, base, CV_INTER_CUBIC );
+		cvSmooth( base, base, CV_GAUSSIAN, 0, 0, sig_diff, sig_diff );
 	}
 	else
 	{
 		sig_diff = sqrt( sigma * sigma - SIFT_INIT_SIGMA * SIFT_INIT_SIGMA );
-		cvSmooth( gray, gray, CV_GAUSSIAN, 0, 0, sig_diff, sig_diff );
-		return gray;
+		cvSmooth( ws->gray32, base, CV_GAUSSIAN, 0, 0, sig_diff, sig_diff );
 	}
 }
 
@@ -198,193 +414,277 @@ IplImage* create_init_img( IplImage* img, int img_dbl, double sigma )
 Converts an image to 32-bit grayscale
 
 @param img a 3-channel 8-bit color (BGR) or 8-bit gray image
-
-@return Returns a 32-bit grayscale image
+@param gray8 8-bit gray buffer the size of img; only used if img is color
+@param gray32 32-bit gray image the size of img in which to store the result
 */
-IplImage* convert_to_gray32( IplImage* img )
+void convert_to_gray32( IplImage* img, IplImage* gray8, IplImage* gray32 )
 {
-	IplImage* gray8, * gray32;
-
-	gray32 = cvCreateImage( cvGetSize(img), IPL_DEPTH_32F, 1 );
-
-	if( img->nChannels == 1 ) {
-		gray8 = cvCloneImage( img );
-	}
-	else {
-		gray8 = cvCreateImage( cvGetSize(img), IPL_DEPTH_8U, 1 );
+	if( img->nChannels == 1 )
+		cvConvertScale( img, gray32, 1.0 / 255.0, 0 );
+	else
+	{
 		cvCvtColor( img, gray8, CV_BGR2GRAY );
+		cvConvertScale( gray8, gray32, 1.0 / 255.0, 0 );
 	}
-	cvConvertScale( gray8, gray32, 1.0 / 255.0, 0 );
-
-	cvReleaseImage( &gray8 );
-	return gray32;
 }
 
 
 
 /*
-Builds Gaussian scale space pyramid from an image
+Builds the Gaussian and difference of Gaussians scale space pyramids of a
+workspace from the base image already stored in gauss_pyr[0][0].  Each
+level depends on the one before it and each octave on the previous octave,
+so the levels are built in order and the parallelism is within a level.
 
-@param base base image of the pyramid
-@param octvs number of octaves of scale space
-@param intvls number of intervals per octave
+@param ws a SIFT workspace
 @param sigma amount of Gaussian smoothing per octave
-
-@return Returns a Gaussian scale space pyramid as an octvs x (intvls + 3) array
 */
-IplImage*** build_gauss_pyr( IplImage* base, int octvs,
-							int intvls, double sigma )
+void build_scale_space( struct sift_workspace* ws, double sigma )
 {
-	IplImage*** gauss_pyr;
-	double* sig = (double*) calloc( intvls + 3, sizeof(double));
-	double sig_total, sig_prev, k;
-	int i, o;
-
-	gauss_pyr = (IplImage***) calloc( octvs, sizeof( IplImage** ) );
-	for( i = 0; i < octvs; i++ )
-		gauss_pyr[i] = (IplImage**) calloc( intvls + 3, sizeof( IplImage* ) );
+	IplImage*** gauss_pyr = ws->gauss_pyr;
+	IplImage*** dog_pyr = ws->dog_pyr;
+	double sig, sig_total, sig_prev, k;
+	int i, o, intvls = ws->intvls;
 
 	/*
-		precompute Gaussian sigmas using the following formula:
+		Gaussian sigmas are given by the following formula:
 
 		\sigma_{total}^2 = \sigma_{i}^2 + \sigma_{i-1}^2
 	*/
-	sig[0] = sigma;
 	k = pow( 2.0, 1.0 / intvls );
-	for( i = 1; i < intvls + 3; i++ )
+	for( o = 0; o < ws->octvs; o++ )
 	{
-		sig_prev = pow( k, i - 1 ) * sigma;
-		sig_total = sig_prev * k;
-		sig[i] = sqrt( sig_total * sig_total - sig_prev * sig_prev );
-	}
+		/* base of new octvave is halved image from end of previous octave */
+		if( o > 0 )
+			cvResize( gauss_pyr[o-1][intvls], gauss_pyr[o][0], CV_INTER_NN );
 
-	for( o = 0; o < octvs; o++ )
-		for( i = 0; i < intvls + 3; i++ )
+		/* blur each level to create the next one and the DoG between them */
+		for( i = 1; i < intvls + 3; i++ )
 		{
-			if( o == 0  &&  i == 0 )
-				gauss_pyr[o][i] = cvCloneImage(base);
+			sig_prev = pow( k, i - 1 ) * sigma;
+			sig_total = sig_prev * k;
+			sig = sqrt( sig_total * sig_total - sig_prev * sig_prev );
+			smooth_and_subtract( gauss_pyr[o][i-1], gauss_pyr[o][i],
+				dog_pyr[o][i-1], sig, ws );
+		}
+	}
+}
 
-			/* base of new octvave is halved image from end of previous octave */
-			else if( i == 0 )
-				gauss_pyr[o][i] = downsample( gauss_pyr[o-1][intvls] );
 
-			/* blur the current octave's last image to create the next one */
-			else
-			{
-				gauss_pyr[o][i] = cvCreateImage( cvGetSize(gauss_pyr[o][i-1]),
-					IPL_DEPTH_32F, 1 );
-				cvSmooth( gauss_pyr[o][i-1], gauss_pyr[o][i],
-					CV_GAUSSIAN, 0, 0, sig[i], sig[i] );
-			}
+
+/*
+Gaussian-smooths one pyramid level into the next and stores the difference
+between the two in the DoG pyramid while the smoothed rows are still in
+cache.  Large levels are split into bands of rows that are smoothed in
+parallel; each band is smoothed together with a halo of rows as wide as the
+kernel radius, so the result is identical to smoothing the whole level.
+
+@param src pyramid level to smooth
+@param dst image in which to store the smoothed level
+@param dog image in which to store dst - src
+@param sig std of Gaussian smoothing
+@param ws a SIFT workspace
+*/
+void smooth_and_subtract( IplImage* src, IplImage* dst, IplImage* dog,
+						 double sig, struct sift_workspace* ws )
+{
+	/* kernel radius cvSmooth() picks for a 32-bit image */
+	int rad = ( cvRound( sig * 4 * 2 + 1 ) | 1 ) / 2;
+	int w = src->width, h = src->height;
+	int n_bands = MIN( ws->n_threads, h / ( SIFT_BAND_MIN_RADII * ( rad + 1 ) ) );
+	int b;
+
+	if( n_bands <= 1 )
+	{
+		cvSmooth( src, dst, CV_GAUSSIAN, 0, 0, sig, sig );
+		subtract_rows( NULL, 0, src, dst, dog, 0, h );
+		return;
+	}
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static) num_threads(n_bands)
+#endif
+	for( b = 0; b < n_bands; b++ )
+	{
+		struct sift_thread_buf* buf;
+		CvMat src_band, band;
+		int r0 = b * h / n_bands, r1 = ( b + 1 ) * h / n_bands;
+		int h0 = MAX( r0 - rad, 0 ), h1 = MIN( r1 + rad, h );
+
+#ifdef _OPENMP
+		buf = ws->thread_bufs + omp_get_thread_num();
+#else
+		buf = ws->thread_bufs;
+#endif
+		if( ! buf->band  ||  buf->band->rows < h1 - h0  ||  buf->band->cols < w )
+		{
+			if( buf->band )
+				cvReleaseMat( &buf->band );
+			buf->band = cvCreateMat( h1 - h0, ws->gauss_pyr[0][0]->width, CV_32FC1 );
 		}
 
-	free( sig );
-	return gauss_pyr;
+		cvGetSubRect( src, &src_band, cvRect( 0, h0, w, h1 - h0 ) );
+		cvGetSubRect( buf->band, &band, cvRect( 0, 0, w, h1 - h0 ) );
+		cvSmooth( &src_band, &band, CV_GAUSSIAN, 0, 0, sig, sig );
+		subtract_rows( &band, h0, src, dst, dog, r0, r1 );
+	}
 }
 
 
 
 /*
-Downsamples an image to a quarter of its size (half in each dimension)
-using nearest-neighbor interpolation
-
-@param img an image
-
-@return Returns an image whose dimensions are half those of img
+Copies smoothed rows into a pyramid level and computes the matching rows of
+a DoG level.
+
+@param band smoothed rows, or NULL if dst already holds them
+@param band_r0 image row of the first row of band
+@param src pyramid level that was smoothed
+@param dst smoothed pyramid level
+@param dog DoG level in which to store dst - src
+@param r0 first row to process
+@param r1 one past the last row to process
 */
-IplImage* downsample( IplImage* img )
+void subtract_rows( CvMat* band, int band_r0, IplImage* src, IplImage* dst,
+				   IplImage* dog, int r0, int r1 )
 {
-	IplImage* smaller = cvCreateImage( cvSize(img->width / 2, img->height / 2),
-		img->depth, img->nChannels );
-	cvResize( img, smaller, CV_INTER_NN );
+	const float* s, * p;
+	float* g, * d;
+	int r, c, w = src->width;
 
-	return smaller;
+	for( r = r0; r < r1; r++ )
+	{
+		p = (float*)( src->imageData + r * src->widthStep );
+		g = (float*)( dst->imageData + r * dst->widthStep );
+		d = (float*)( dog->imageData + r * dog->widthStep );
+		if( band )
+		{
+			s = (float*)( band->data.ptr + ( r - band_r0 ) * band->step );
+			memcpy( g, s, w * sizeof(float) );
+		}
+		for( c = 0; c < w; c++ )
+			d[c] = g[c] - p[c];
+	}
 }
 
 
 
 /*
-Builds a difference of Gaussians scale space pyramid by subtracting adjacent
-intervals of a Gaussian pyramid
+Detects features at extrema in DoG scale space.  Bad features are discarded
+based on contrast and ratio of principal curvatures.  The rows of all the
+octaves and intervals are divided among threads in contiguous blocks, and the
+features each thread finds are appended in thread order, so the sequence is
+the same as a serial scan would produce.
 
-@param gauss_pyr Gaussian scale-space pyramid
-@param octvs number of octaves of scale space
-@param intvls number of intervals per octave
+@param ws a SIFT workspace holding a DoG scale space pyramid
+@param contr_thr low threshold on feature contrast
+@param curv_thr high threshold on feature ratio of principal curvatures
 
-@return Returns a difference of Gaussians scale space pyramid as an
-	octvs x (intvls + 2) array
+@return Returns an array of detected features whose scales, orientations,
+	and descriptors are yet to be determined.
 */
-IplImage*** build_dog_pyr( IplImage*** gauss_pyr, int octvs, int intvls )
+CvSeq* scale_space_extrema( struct sift_workspace* ws, double contr_thr,
+						   int curv_thr )
 {
-	IplImage*** dog_pyr;
-	int i, o;
-
-	dog_pyr = (IplImage***) calloc( octvs, sizeof( IplImage** ) );
-	for( i = 0; i < octvs; i++ )
-		dog_pyr[i] = (IplImage**) calloc( intvls + 2, sizeof(IplImage*) );
+	IplImage*** dog_pyr = ws->dog_pyr;
+	CvSeq* features;
+	int octvs = ws->octvs, intvls = ws->intvls;
+	int o, t, j, n_rows = 0;
 
+	/* rows of every octave and interval, excluding the border */
 	for( o = 0; o < octvs; o++ )
-		for( i = 0; i < intvls + 2; i++ )
+		n_rows += intvls * MAX( dog_pyr[o][0]->height - 2 * SIFT_IMG_BORDER, 0 );
+	for( t = 0; t < ws->n_threads; t++ )
+		ws->thread_bufs[t].n_found = 0;
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(ws->n_threads)
+#endif
+	{
+		struct sift_thread_buf* buf;
+		int k, oc, rows, row;
+
+#ifdef _OPENMP
+		buf = ws->thread_bufs + omp_get_thread_num();
+#pragma omp for schedule(static)
+#else
+		buf = ws->thread_bufs;
+#endif
+		for( k = 0; k < n_rows; k++ )
+		{
+			/* map k back to an octave, interval and row */
+			row = k;
+			for( oc = 0; ; oc++ )
+			{
+				rows = MAX( dog_pyr[oc][0]->height - 2 * SIFT_IMG_BORDER, 0 );
+				if( row < intvls * rows )
+					break;
+				row -= intvls * rows;
+			}
+			row_extrema( dog_pyr, oc, 1 + row / rows,
+				SIFT_IMG_BORDER + row % rows, intvls, contr_thr, curv_thr, buf );
+		}
+	}
+
+	features = cvCreateSeq( 0, sizeof(CvSeq), sizeof(struct feature), ws->storage );
+	for( t = 0; t < ws->n_threads; t++ )
+		for( j = 0; j < ws->thread_bufs[t].n_found; j++ )
 		{
-			dog_pyr[o][i] = cvCreateImage( cvGetSize(gauss_pyr[o][i]),
-				IPL_DEPTH_32F, 1 );
-			cvSub( gauss_pyr[o][i+1], gauss_pyr[o][i], dog_pyr[o][i], NULL );
+			cvSeqPush( features, ws->thread_bufs[t].found[j] );
+			free( ws->thread_bufs[t].found[j] );
 		}
 
-	return dog_pyr;
+	return features;
 }
 
 
 
 /*
-Detects features at extrema in DoG scale space.  Bad features are discarded
-based on contrast and ratio of principal curvatures.
+Detects features at extrema in one row of a DoG level.
 
 @param dog_pyr DoG scale space pyramid
-@param octvs octaves of scale space represented by dog_pyr
+@param o octave of the row
+@param i interval of the row
+@param r image row
 @param intvls intervals per octave
 @param contr_thr low threshold on feature contrast
 @param curv_thr high threshold on feature ratio of principal curvatures
-@param storage memory storage in which to store detected features
-
-@return Returns an array of detected features whose scales, orientations,
-	and descriptors are yet to be determined.
+@param buf thread scratch space to which detected features are appended
 */
-CvSeq* scale_space_extrema( IplImage*** dog_pyr, int octvs, int intvls,
-						   double contr_thr, int curv_thr,
-						   CvMemStorage* storage )
+void row_extrema( IplImage*** dog_pyr, int o, int i, int r, int intvls,
+				 double contr_thr, int curv_thr, struct sift_thread_buf* buf )
 {
-	CvSeq* features;
 	double prelim_contr_thr = 0.5 * contr_thr / intvls;
 	struct feature* feat;
 	struct detection_data* ddata;
-	int o, i, r, c;
+	int c;
 
-	features = cvCreateSeq( 0, sizeof(CvSeq), sizeof(struct feature), storage );
-	for( o = 0; o < octvs; o++ )
-		for( i = 1; i <= intvls; i++ )
-			for(r = SIFT_IMG_BORDER; r < dog_pyr[o][0]->height-SIFT_IMG_BORDER; r++)
-				for(c = SIFT_IMG_BORDER; c < dog_pyr[o][0]->width-SIFT_IMG_BORDER; c++)
-					/* perform preliminary check on contrast */
-					if( ABS( pixval32f( dog_pyr[o][i], r, c ) ) > prelim_contr_thr )
-						if( is_extremum( dog_pyr, o, i, r, c ) )
+	for(c = SIFT_IMG_BORDER; c < dog_pyr[o][0]->width-SIFT_IMG_BORDER; c++)
+		/* perform preliminary check on contrast */
+		if( ABS( pixval32f( dog_pyr[o][i], r, c ) ) > prelim_contr_thr )
+			if( is_extremum( dog_pyr, o, i, r, c ) )
+			{
+				feat = interp_extremum(dog_pyr, o, i, r, c, intvls, contr_thr);
+				if( feat )
+				{
+					ddata = feat_detection_data( feat );
+					if( ! is_too_edge_like( dog_pyr[ddata->octv][ddata->intvl],
+						ddata->r, ddata->c, curv_thr ) )
+					{
+						if( buf->n_found == buf->nallocd )
 						{
-							feat = interp_extremum(dog_pyr, o, i, r, c, intvls, contr_thr);
-							if( feat )
-							{
-								ddata = feat_detection_data( feat );
-								if( ! is_too_edge_like( dog_pyr[ddata->octv][ddata->intvl],
-									ddata->r, ddata->c, curv_thr ) )
-								{
-									cvSeqPush( features, feat );
-								}
-								else
-									free( ddata );
-								free( feat );
-							}
+							buf->nallocd = ( buf->nallocd )? 2 * buf->nallocd : 64;
+							buf->found = (struct feature**) realloc( buf->found,
+								buf->nallocd * sizeof( struct feature* ) );
 						}
-
-	return features;
+						buf->found[buf->n_found++] = feat;
+					}
+					else
+					{
+						free( ddata );
+						free( feat );
+					}
+				}
+			}
 }
 
 
@@ -775,40 +1075,122 @@ void adjust_for_img_dbl( CvSeq* features )
 
 
 
+/*
+Computes the gradient magnitude and orientation images of every Gaussian
+pyramid level that holds a feature.  The images are kept in the workspace
+and shared by orientation assignment and descriptor computation, so the
+square root and arctangent of each pixel are evaluated once.
+
+@param ws a SIFT workspace holding a Gaussian scale space pyramid
+@param features array of features
+*/
+void calc_grad_imgs( struct sift_workspace* ws, CvSeq* features )
+{
+	IplImage* img;
+	struct detection_data* ddata;
+	char* needed;
+	int i, o, n = ws->intvls + 3;
+
+	needed = (char*) calloc( ws->octvs * n, sizeof( char ) );
+	for( i = 0; i < features->total; i++ )
+	{
+		ddata = feat_detection_data( CV_GET_SEQ_ELEM( struct feature, features, i ) );
+		needed[ddata->octv * n + ddata->intvl] = 1;
+	}
+
+	for( o = 0; o < ws->octvs; o++ )
+		for( i = 0; i < n; i++ )
+			if( needed[o * n + i] )
+			{
+				img = ws->gauss_pyr[o][i];
+				if( ! ws->grad_mag[o][i] )
+				{
+					ws->grad_mag[o][i] = cvCreateImage( cvGetSize(img), IPL_DEPTH_32F, 1 );
+					ws->grad_ori[o][i] = cvCreateImage( cvGetSize(img), IPL_DEPTH_32F, 1 );
+				}
+				grad_mag_ori_img( img, ws->grad_mag[o][i], ws->grad_ori[o][i] );
+			}
+
+	free( needed );
+}
+
+
+
+/*
+Calculates the gradient magnitude and orientation at every interior pixel of
+an image.  Border pixels have no valid gradient; their magnitude is set to 0.
+
+@param img image
+@param mag output image of gradient magnitudes
+@param ori output image of gradient orientations in [-PI, PI]
+*/
+void grad_mag_ori_img( IplImage* img, IplImage* mag, IplImage* ori )
+{
+	int r, w = img->width, h = img->height;
+
+	cvZero( mag );
+	cvZero( ori );
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(static)
+#endif
+	for( r = 1; r < h - 1; r++ )
+	{
+		const float* above = (float*)( img->imageData + ( r - 1 ) * img->widthStep );
+		const float* row = (float*)( img->imageData + r * img->widthStep );
+		const float* below = (float*)( img->imageData + ( r + 1 ) * img->widthStep );
+		float* m = (float*)( mag->imageData + r * mag->widthStep );
+		float* a = (float*)( ori->imageData + r * ori->widthStep );
+		double dx, dy;
+		int c;
+
+		for( c = 1; c < w - 1; c++ )
+		{
+			dx = row[c+1] - row[c-1];
+			dy = above[c] - below[c];
+			m[c] = (float)sqrt( dx*dx + dy*dy );
+			a[c] = (float)atan2( dy, dx );
+		}
+	}
+}
+
+
+
 /*
 Computes a canonical orientation for each image feature in an array.  Based
 on Section 5 of Lowe's paper.  This function adds features to the array when
 there is more than one dominant orientation at a given feature location.
 
 @param features an array of image features
-@param gauss_pyr Gaussian scale space pyramid
+@param ws a SIFT workspace holding the gradient images of the levels at
+	which the features were detected
 */
-void calc_feature_oris( CvSeq* features, IplImage*** gauss_pyr )
+void calc_feature_oris( CvSeq* features, struct sift_workspace* ws )
 {
 	struct feature* feat;
 	struct detection_data* ddata;
-	double* hist;
+	double hist[SIFT_ORI_HIST_BINS];
 	double omax;
 	int i, j, n = features->total;
 
+	feat = (feature*) malloc( sizeof( struct feature ) );
 	for( i = 0; i < n; i++ )
 	{
-		feat = (feature*) malloc( sizeof( struct feature ) );
 		cvSeqPopFront( features, feat );
 		ddata = feat_detection_data( feat );
-		hist = ori_hist( gauss_pyr[ddata->octv][ddata->intvl],
-						ddata->r, ddata->c, SIFT_ORI_HIST_BINS,
-						cvRound( SIFT_ORI_RADIUS * ddata->scl_octv ),
-						SIFT_ORI_SIG_FCTR * ddata->scl_octv );
+		ori_hist( ws->grad_mag[ddata->octv][ddata->intvl],
+				 ws->grad_ori[ddata->octv][ddata->intvl],
+				 ddata->r, ddata->c, SIFT_ORI_HIST_BINS,
+				 cvRound( SIFT_ORI_RADIUS * ddata->scl_octv ),
+				 SIFT_ORI_SIG_FCTR * ddata->scl_octv, hist );
 		for( j = 0; j < SIFT_ORI_SMOOTH_PASSES; j++ )
 			smooth_ori_hist( hist, SIFT_ORI_HIST_BINS );
 		omax = dominant_ori( hist, SIFT_ORI_HIST_BINS );
 		add_good_ori_features( features, hist, SIFT_ORI_HIST_BINS,
 								omax * SIFT_ORI_PEAK_RATIO, feat );
 		free( ddata );
-		free( feat );
-		free( hist );
 	}
+	free( feat );
 }
 
 
@@ -816,66 +1198,38 @@ void calc_feature_oris( CvSeq* features, IplImage*** gauss_pyr )
 /*
 Computes a gradient orientation histogram at a specified pixel.
 
-@param img image
+@param mag gradient magnitude image
+@param ori gradient orientation image
 @param r pixel row
 @param c pixel col
 @param n number of histogram bins
 @param rad radius of region over which histogram is computed
 @param sigma std for Gaussian weighting of histogram entries
-
-@return Returns an n-element array containing an orientation histogram
+@param hist n-element array in which to store an orientation histogram
 	representing orientations between 0 and 2 PI.
 */
-double* ori_hist( IplImage* img, int r, int c, int n, int rad, double sigma)
+void ori_hist( IplImage* mag, IplImage* ori, int r, int c, int n, int rad,
+			  double sigma, double* hist )
 {
-	double* hist;
-	double mag, ori, w, exp_denom, PI2 = CV_PI * 2.0;
-	int bin, i, j;
+	double w, exp_denom, PI2 = CV_PI * 2.0;
+	int bin, i, j, i0, i1, j0, j1;
 
-	hist = (double*) calloc( n, sizeof( double ) );
+	memset( hist, 0, n * sizeof( double ) );
 	exp_denom = 2.0 * sigma * sigma;
-	for( i = -rad; i <= rad; i++ )
-		for( j = -rad; j <= rad; j++ )
-			if( calc_grad_mag_ori( img, r + i, c + j, &mag, &ori ) )
-			{
-				w = exp( -( i*i + j*j ) / exp_denom );
-				bin = cvRound( n * ( ori + CV_PI ) / PI2 );
-				bin = ( bin < n )? bin : 0;
-				hist[bin] += w * mag;
-			}
-
-	return hist;
-}
-
-
-
-/*
-Calculates the gradient magnitude and orientation at a given pixel.
-
-@param img image
-@param r pixel row
-@param c pixel col
-@param mag output as gradient magnitude at pixel (r,c)
-@param ori output as gradient orientation at pixel (r,c)
-
-@return Returns 1 if the specified pixel is a valid one and sets mag and
-	ori accordingly; otherwise returns 0
-*/
-int calc_grad_mag_ori( IplImage* img, int r, int c, double* mag, double* ori )
-{
-	double dx, dy;
-
-	if( r > 0  &&  r < img->height - 1  &&  c > 0  &&  c < img->width - 1 )
-	{
-		dx = pixval32f( img, r, c+1 ) - pixval32f( img, r, c-1 );
-		dy = pixval32f( img, r-1, c ) - pixval32f( img, r+1, c );
-		*mag = sqrt( dx*dx + dy*dy );
-		*ori = atan2( dy, dx );
-		return 1;
-	}
 
-	else
-		return 0;
+	/* only interior pixels have a gradient */
+	i0 = MAX( -rad, 1 - r );
+	i1 = MIN( rad, mag->height - 2 - r );
+	j0 = MAX( -rad, 1 - c );
+	j1 = MIN( rad, mag->width - 2 - c );
+	for( i = i0; i <= i1; i++ )
+		for( j = j0; j <= j1; j++ )
+		{
+			w = exp( -( i*i + j*j ) / exp_denom );
+			bin = cvRound( n * ( pixval32f( ori, r + i, c + j ) + CV_PI ) / PI2 );
+			bin = ( bin < n )? bin : 0;
+			hist[bin] += w * pixval32f( mag, r + i, c + j );
+		}
 }
 
 
@@ -997,28 +1351,45 @@ struct feature* clone_feature( struct feature* feat )
 
 /*
 Computes feature descriptors for features in an array.  Based on Section 6
-of Lowe's paper.
+of Lowe's paper.  Features are independent of one another and are spread
+over threads, each with its own histogram buffer.
 
 @param features array of features
-@param gauss_pyr Gaussian scale space pyramid
+@param ws a SIFT workspace holding the gradient images of the levels at
+	which the features were detected
 @param d width of 2D array of orientation histograms
 @param n number of bins per orientation histogram
 */
-void compute_descriptors( CvSeq* features, IplImage*** gauss_pyr, int d, int n)
+void compute_descriptors( CvSeq* features, struct sift_workspace* ws, int d,
+						 int n )
 {
-	struct feature* feat;
-	struct detection_data* ddata;
-	double*** hist;
-	int i, k = features->total;
+	int k = features->total;
 
-	for( i = 0; i < k; i++ )
+#ifdef _OPENMP
+#pragma omp parallel num_threads(ws->n_threads)
+#endif
 	{
-		feat = CV_GET_SEQ_ELEM( struct feature, features, i );
-		ddata = feat_detection_data( feat );
-		hist = descr_hist( gauss_pyr[ddata->octv][ddata->intvl], ddata->r,
-			ddata->c, feat->ori, ddata->scl_octv, d, n );
-		hist_to_descr( hist, d, n, feat );
-		release_descr_hist( &hist, d );
+		struct sift_thread_buf* buf;
+		struct feature* feat;
+		struct detection_data* ddata;
+		double* hist;
+		int i;
+
+#ifdef _OPENMP
+		buf = ws->thread_bufs + omp_get_thread_num();
+#pragma omp for schedule(dynamic, 16)
+#else
+		buf = ws->thread_bufs;
+#endif
+		for( i = 0; i < k; i++ )
+		{
+			feat = CV_GET_SEQ_ELEM( struct feature, features, i );
+			ddata = feat_detection_data( feat );
+			hist = descr_hist( ws->grad_mag[ddata->octv][ddata->intvl],
+				ws->grad_ori[ddata->octv][ddata->intvl], ddata->r, ddata->c,
+				feat->ori, ddata->scl_octv, d, n, buf );
+			hist_to_descr( hist, d, n, feat );
+		}
 	}
 }
 
@@ -1028,31 +1399,28 @@ void compute_descriptors( CvSeq* features, IplImage*** gauss_pyr, int d, int n)
 Computes the 2D array of orientation histograms that form the feature
 descriptor.  Based on Section 6.1 of Lowe's paper.
 
-@param img image used in descriptor computation
+@param mag gradient magnitude image of the level of the feature
+@param grad_ori gradient orientation image of the level of the feature
 @param r row coord of center of orientation histogram array
 @param c column coord of center of orientation histogram array
 @param ori canonical orientation of feature whose descr is being computed
 @param scl scale relative to img of feature whose descr is being computed
 @param d width of 2d array of orientation histograms
 @param n bins per orientation histogram
+@param buf thread scratch space holding the histogram and weight buffers
 
-@return Returns a d x d array of n-bin orientation histograms.
+@return Returns a d x d array of n-bin orientation histograms, stored in
+	row-major order in the histogram buffer of \a buf.
 */
-double*** descr_hist( IplImage* img, int r, int c, double ori,
-					 double scl, int d, int n )
+double* descr_hist( IplImage* mag, IplImage* grad_ori, int r, int c,
+				   double ori, double scl, int d, int n,
+				   struct sift_thread_buf* buf )
 {
-	double*** hist;
-	double cos_t, sin_t, hist_width, exp_denom, r_rot, c_rot, grad_mag,
-		grad_ori, w, rbin, cbin, obin, bins_per_rad, PI2 = 2.0 * CV_PI;
-	int radius, i, j;
-
-	hist = (double***) calloc( d, sizeof( double** ) );
-	for( i = 0; i < d; i++ )
-	{
-		hist[i] = (double**) calloc( d, sizeof( double* ) );
-		for( j = 0; j < d; j++ )
-			hist[i][j] = (double*) calloc( n, sizeof( double ) );
-	}
+	double cos_t, sin_t, hist_width, exp_denom, r_rot, c_rot, g_ori,
+		w, rbin, cbin, obin, bins_per_rad, PI2 = 2.0 * CV_PI;
+	double* hist, * wt;
+	const float* m_row, * o_row;
+	int radius, i, j, i0, i1, j0, j1;
 
 	cos_t = cos( ori );
 	sin_t = sin( ori );
@@ -1060,8 +1428,39 @@ double*** descr_hist( IplImage* img, int r, int c, double ori,
 	exp_denom = d * d * 0.5;
 	hist_width = SIFT_DESCR_SCL_FCTR * scl;
 	radius = hist_width * sqrt(2.f) * ( d + 1.0 ) * 0.5 + 0.5;
-	for( i = -radius; i <= radius; i++ )
-		for( j = -radius; j <= radius; j++ )
+
+	if( buf->hist_len < d * d * n )
+	{
+		buf->hist_len = d * d * n;
+		buf->hist = (double*) realloc( buf->hist, buf->hist_len * sizeof( double ) );
+	}
+	if( buf->weights_len < radius + 1 )
+	{
+		buf->weights_len = radius + 1;
+		buf->weights = (double*) realloc( buf->weights,
+			buf->weights_len * sizeof( double ) );
+	}
+	hist = buf->hist;
+	wt = buf->weights;
+	memset( hist, 0, d * d * n * sizeof( double ) );
+
+	/*
+	Rotation preserves distance from the center, so the Gaussian weight of a
+	sample is separable in its unrotated offsets: wt[|i|] * wt[|j|].
+	*/
+	for( i = 0; i <= radius; i++ )
+		wt[i] = exp( -( i * i ) / ( hist_width * hist_width * exp_denom ) );
+
+	/* only interior pixels have a gradient */
+	i0 = MAX( -radius, 1 - r );
+	i1 = MIN( radius, mag->height - 2 - r );
+	j0 = MAX( -radius, 1 - c );
+	j1 = MIN( radius, mag->width - 2 - c );
+	for( i = i0; i <= i1; i++ )
+	{
+		m_row = (float*)( mag->imageData + ( r + i ) * mag->widthStep ) + c;
+		o_row = (float*)( grad_ori->imageData + ( r + i ) * grad_ori->widthStep ) + c;
+		for( j = j0; j <= j1; j++ )
 		{
 			/*
 			Calculate sample's histogram array coords rotated relative to ori.
@@ -1074,19 +1473,19 @@ double*** descr_hist( IplImage* img, int r, int c, double ori,
 			cbin = c_rot + d / 2 - 0.5;
 
 			if( rbin > -1.0  &&  rbin < d  &&  cbin > -1.0  &&  cbin < d )
-				if( calc_grad_mag_ori( img, r + i, c + j, &grad_mag, &grad_ori ))
-				{
-					grad_ori -= ori;
-					while( grad_ori < 0.0 )
-						grad_ori += PI2;
-					while( grad_ori >= PI2 )
-						grad_ori -= PI2;
-
-					obin = grad_ori * bins_per_rad;
-					w = exp( -(c_rot * c_rot + r_rot * r_rot) / exp_denom );
-					interp_hist_entry( hist, rbin, cbin, obin, grad_mag * w, d, n );
-				}
+			{
+				g_ori = o_row[j] - ori;
+				while( g_ori < 0.0 )
+					g_ori += PI2;
+				while( g_ori >= PI2 )
+					g_ori -= PI2;
+
+				obin = g_ori * bins_per_rad;
+				w = wt[ABS(i)] * wt[ABS(j)];
+				interp_hist_entry( hist, rbin, cbin, obin, m_row[j] * w, d, n );
+			}
 		}
+	}
 
 	return hist;
 }
@@ -1097,7 +1496,7 @@ double*** descr_hist( IplImage* img, int r, int c, double ori,
 Interpolates an entry into the array of orientation histograms that form
 the feature descriptor.
 
-@param hist 2D array of orientation histograms
+@param hist d x d array of n-bin orientation histograms in row-major order
 @param rbin sub-bin row coordinate of entry
 @param cbin sub-bin column coordinate of entry
 @param obin sub-bin orientation coordinate of entry
@@ -1105,11 +1504,11 @@ the feature descriptor.
 @param d width of 2D array of orientation histograms
 @param n number of bins per orientation histogram
 */
-void interp_hist_entry( double*** hist, double rbin, double cbin,
+void interp_hist_entry( double* hist, double rbin, double cbin,
 					   double obin, double mag, int d, int n )
 {
 	double d_r, d_c, d_o, v_r, v_c, v_o;
-	double** row, * h;
+	double* row, * h;
 	int r0, c0, o0, rb, cb, ob, r, c, o;
 
 	r0 = cvFloor( rbin );
@@ -1130,14 +1529,14 @@ void interp_hist_entry( double*** hist, double rbin, double cbin,
 		if( rb >= 0  &&  rb < d )
 		{
 			v_r = mag * ( ( r == 0 )? 1.0 - d_r : d_r );
-			row = hist[rb];
+			row = hist + rb * d * n;
 			for( c = 0; c <= 1; c++ )
 			{
 				cb = c0 + c;
 				if( cb >= 0  &&  cb < d )
 				{
 					v_c = v_r * ( ( c == 0 )? 1.0 - d_c : d_c );
-					h = row[cb];
+					h = row + cb * n;
 					for( o = 0; o <= 1; o++ )
 					{
 						ob = ( o0 + o ) % n;
@@ -1156,31 +1555,30 @@ void interp_hist_entry( double*** hist, double rbin, double cbin,
 Converts the 2D array of orientation histograms into a feature's descriptor
 vector.
 
-@param hist 2D array of orientation histograms
+@param hist d x d array of n-bin orientation histograms in row-major order;
+	it is normalized in place
 @param d width of hist
 @param n bins per histogram
 @param feat feature into which to store descriptor
 */
-void hist_to_descr( double*** hist, int d, int n, struct feature* feat )
+void hist_to_descr( double* hist, int d, int n, struct feature* feat )
 {
-	int int_val, i, r, c, o, k = 0;
-
-	for( r = 0; r < d; r++ )
-		for( c = 0; c < d; c++ )
-			for( o = 0; o < n; o++ )
-				feat->descr[k++] = hist[r][c][o];
+	double* descr = hist;
+	int int_val, i, k = d * d * n;
 
+	/* normalize in double precision; only the final integer values are
+	stored in the feature */
 	feat->d = k;
-	normalize_descr( feat );
+	normalize_descr( descr, k );
 	for( i = 0; i < k; i++ )
-		if( feat->descr[i] > SIFT_DESCR_MAG_THR )
-			feat->descr[i] = SIFT_DESCR_MAG_THR;
-	normalize_descr( feat );
+		if( descr[i] > SIFT_DESCR_MAG_THR )
+			descr[i] = SIFT_DESCR_MAG_THR;
+	normalize_descr( descr, k );
 
 	/* convert floating-point descriptor to integer valued descriptor */
 	for( i = 0; i < k; i++ )
 	{
-		int_val = SIFT_INT_DESCR_FCTR * feat->descr[i];
+		int_val = SIFT_INT_DESCR_FCTR * descr[i];
 		feat->descr[i] = MIN( 255, int_val );
 	}
 }
@@ -1188,23 +1586,24 @@ void hist_to_descr( double*** hist, int d, int n, struct feature* feat )
 
 
 /*
-Normalizes a feature's descriptor vector to unitl length
+Normalizes a descriptor vector to unit length
 
-@param feat feature
+@param descr descriptor
+@param d descriptor length
 */
-void normalize_descr( struct feature* feat )
+void normalize_descr( double* descr, int d )
 {
 	double cur, len_inv, len_sq = 0.0;
-	int i, d = feat->d;
+	int i;
 
 	for( i = 0; i < d; i++ )
 	{
-		cur = feat->descr[i];
+		cur = descr[i];
 		len_sq += cur*cur;
 	}
 	len_inv = 1.0 / sqrt( len_sq );
 	for( i = 0; i < d; i++ )
-		feat->descr[i] *= len_inv;
+		descr[i] *= len_inv;
 }
 
 
@@ -1234,27 +1633,6 @@ int feature_cmp( void* feat1, void* feat2, void* param )
 
 
 
-/*
-De-allocates memory held by a descriptor histogram
-
-@param hist pointer to a 2D array of orientation histograms
-@param d width of hist
-*/
-void release_descr_hist( double**** hist, int d )
-{
-	int i, j;
-
-	for( i = 0; i < d; i++)
-	{
-		for( j = 0; j < d; j++ )
-			free( (*hist)[i][j] );
-		free( (*hist)[i] );
-	}
-	free( *hist );
-	*hist = NULL;
-}
-
-
 /*
 De-allocates memory held by a scale space pyramid
 
@@ -1,4 +1,3 @@
-
 ///////////////////////////////////////////////////////////////////////////////
 //
 // Code was adapted from Damien Stewart's blog at opencv.damienstewart.net
@@ -17,16 +16,20 @@
 #include<string>
 #include<sstream>
 
+#include "Farneback.h"
+
 using namespace std;
 
 #pragma warning(disable : 4996)
 
-IplImage *image1 = NULL;
-
 #define FARNEBECK 1
 
 int outNumF = 0;
 
+// the flow object used by runFarneback, and what it makes of the flow
+static Farneback *farneback = NULL;
+static FlowAnalysis flowAnalysis;
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // forward declarations
@@ -35,25 +38,180 @@ int outNumF = 0;
 
 string itos3(int i);
 
+
 ///////////////////////////////////////////////////////////////////////////////
 //
-// allocateOnDemand
+// constructor
 //
 ///////////////////////////////////////////////////////////////////////////////
 
-inline static void allocateOnDemand( IplImage **img, CvSize size, int depth, int channels )
+Farneback::Farneback()
 {
-	if (*img != NULL) {
-		return;
-	}
+    // a real pyramid, each level half the one below; calcOpticalFlowFarneback
+    //  asserts pyrScale < 1
+    pyrScale = 0.5;
+    levels = 3;
+    winSize = 15;
+    iterations = 3;
+    polyN = 5;
+    polySigma = 1.2;
+    flags = cv::OPTFLOW_FARNEBACK_GAUSSIAN;
 
-	*img = cvCreateImage( size, depth, channels );
-	if (*img == NULL) {
-		fprintf(stderr, "Error: Couldn't allocate image.  Out of memory?\n");
-		exit(-1);
-	}
+    warmStart = true;
+
+    current = 0;
+    haveFrame = false;
+    flowValid = false;
+
+} // end constructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// destructor
+//
+///////////////////////////////////////////////////////////////////////////////
+
+Farneback::~Farneback()
+{
+
+} // end destructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// computeFlow
+//
+// Computes the flow from imgA to imgB.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+const cv::Mat &Farneback::computeFlow (IplImage *imgA, IplImage *imgB)
+{
+    toGrey(imgA, grey[0]);
+    toGrey(imgB, grey[1]);
+    calcFlow(grey[0], grey[1]);
+
+    // the next frame pair does not follow on from this one
+    haveFrame = false;
+
+    return flow;
+
+} // end computeFlow
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// computeFlow
+//
+// Computes the flow from the previous frame to this one.  Each frame is
+//  converted to grey once, and the previous flow seeds the next pair.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+bool Farneback::computeFlow (IplImage *frame)
+{
+    int previous = current;
+    current = 1 - current;
+    toGrey(frame, grey[current]);
+
+    if (haveFrame == false || grey[previous].size() != grey[current].size()) {
+        haveFrame = true;
+        flowValid = false;
+        return false;
+    }
+
+    calcFlow(grey[previous], grey[current]);
+
+    return true;
+
+} // end computeFlow
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// computeFlow
+//
+// Computes the flow between two frames made grey by the caller.  Their
+//  pyramids are not used, since cv::calcOpticalFlowFarneback builds its own
+//  with pyrScale.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+bool Farneback::computeFlow (const FlowFrame *previous, const FlowFrame *current)
+{
+    // the frames the other computeFlow keeps do not follow on from these
+    haveFrame = false;
+
+    if (previous == NULL || previous->isValid() == false ||
+        previous->getWidth() != current->getWidth() || previous->getHeight() != current->getHeight()) {
+        flowValid = false;
+        return false;
+    }
+
+    calcFlow(cv::cvarrToMat(previous->getGrey()), cv::cvarrToMat(current->getGrey()));
+
+    return true;
+
+} // end computeFlow
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// reset
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void Farneback::reset ()
+{
+    haveFrame = false;
+    flowValid = false;
+
+} // end reset
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// toGrey
+//
+// Converts an image to 8-bit grey, reusing the buffer.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void Farneback::toGrey (IplImage *img, cv::Mat &grey)
+{
+    cv::Mat src = cv::cvarrToMat(img);
+
+    if (src.channels() == 3) {
+        cv::cvtColor(src, grey, CV_BGR2GRAY);
+    } else {
+        src.copyTo(grey);
+    }
+
+} // end toGrey
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// calcFlow
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void Farneback::calcFlow (const cv::Mat &greyA, const cv::Mat &greyB)
+{
+    int calcFlags = flags;
+
+    // seed with the last flow, which create() leaves alone if it fits
+    if (warmStart == true && flowValid == true && flow.size() == greyA.size()) {
+        calcFlags |= cv::OPTFLOW_USE_INITIAL_FLOW;
+    }
+    flow.create(greyA.size(), CV_32FC2);
+
+    cv::calcOpticalFlowFarneback(greyA, greyB, flow, pyrScale, levels, winSize, iterations, polyN, polySigma, calcFlags);
+    flowValid = true;
+
+} // end calcFlow
 
-}
 
 ///////////////////////////////////////////////////////////////////////////////
 //
@@ -67,6 +225,10 @@ void initFarneback()
     cvNamedWindow("Image 2",  CV_WINDOW_AUTOSIZE);
     cvNamedWindow("GFB Flow", CV_WINDOW_AUTOSIZE);
 
+    if (farneback == NULL) {
+        farneback = new Farneback();
+    }
+
 }
 
 
@@ -82,6 +244,9 @@ void endFarneback()
     cvDestroyWindow("Image 2");
     cvDestroyWindow("GFB Flow");
 
+    delete farneback;
+    farneback = NULL;
+
 }
 
 
@@ -91,119 +256,47 @@ void endFarneback()
 //
 ///////////////////////////////////////////////////////////////////////////////
 
-int runFarneback(IplImage *image1, IplImage *image2)
+int runFarneback(IplImage *image1, IplImage *image2, bool display, bool save)
 {
 #ifdef FARNEBECK 
-    IplImage *image1_grey = NULL, *image2_grey = NULL;
-    IplImage *flow = NULL;
-    IplImage *velx = NULL, *vely = NULL, *vel = NULL;
-
-    int imageCounter = 0;
-    int c = 0;
-    bool loadedRef = false;
-
-    CvSize image1_size, image2_size;
-    image1_size.height = image1->height;
-    image1_size.width = image1->width;
-    image2_size.height= image2->height;
-    image2_size.width = image2->width;
-
-    // convert both images to 1 channel, 8-bit grayscale
-    allocateOnDemand(&image1_grey, image1_size, IPL_DEPTH_8U, 1);
-    allocateOnDemand(&image2_grey, image2_size, IPL_DEPTH_8U, 1);
-    cvConvertImage(image1, image1_grey, 0);
-    cvConvertImage(image2, image2_grey, 0);
-
-    // show the images
-    cvShowImage("Image 1", image1);
-    cvShowImage("Image 2", image2);
-    cvWaitKey(10);
-		
-    // Now show the greyscale versions
-    cvShowImage("Image 1", image1_grey);
-    cvShowImage("Image 2", image2_grey);
-    cvWaitKey(10);
-
-    // Setup our velocity(x) and velocity(y) images and flow scratch area
-    allocateOnDemand(&velx, image1_size, IPL_DEPTH_32F, 1);
-    allocateOnDemand(&vely, image1_size, IPL_DEPTH_32F, 1);
-    allocateOnDemand(&vel, image1_size, IPL_DEPTH_8U, 3);
-    allocateOnDemand(&flow, image1_size, IPL_DEPTH_32F, 2);
-
-    // Run GFB optical flow analysis
-    cv::Mat im1 = cv::cvarrToMat(image1_grey), im2 = cv::cvarrToMat(image2_grey);
-    cv::Mat _flow = cv::cvarrToMat(flow);
-    cv::calcOpticalFlowFarneback( im1, im2, _flow, 0.5, 2, 5, 2, 7, 1.5, cv::OPTFLOW_FARNEBACK_GAUSSIAN);
-    cv::calcOpticalFlowFarneback( im1, im2, _flow, 0.5, 2, 10, 2, 14, 2.0, cv::OPTFLOW_FARNEBACK_GAUSSIAN);
-
-    float pyrScale = 1.0;
-    int levels = 5;
-    int winSize = 20;
-    int iterations = 4;
-    int polyN = 14;
-    float polySigma = 3.0;
-
-    cv::calcOpticalFlowFarneback( im1, im2, _flow, pyrScale, levels, winSize, iterations, polyN, polySigma, cv::OPTFLOW_FARNEBACK_GAUSSIAN);
-
-    // Extract from flow field, velx and vely
-    for (int y = 0; y<flow->height; y++) {
-
-        float *vx = (float*)(velx->imageData + velx->widthStep*y);
-        float *vy = (float*)(vely->imageData + vely->widthStep*y);
-        const float* f = (const float*)(flow->imageData + flow->widthStep*y);
-        for (int x = 0; x < flow->width; x++) {
-            vx[x] = f[2*x];
-            vy[x] = f[2*x+1];
-        }
-    }
-
-    // Clear the previous pixels
-    cvZero(vel);
-
-    int count=0;
+    static IplImage *vel = NULL;
 
-    // Workout what pixels shifted from image1_grey compared to the extracted flow data
-    for (int y = 0; y < image1_grey->height; y++) {
-        for (int x = 0; x < image1_grey->width; x++) {
-
-            double dx = cvGetReal2D(velx, y, x);
-            double dy = cvGetReal2D(vely, y, x);
+    if (farneback == NULL) {
+        farneback = new Farneback();
+    }
 
-            CvPoint p = cvPoint(x, y);
-				
-            // This function sets a basic threshold for drawing on the image
-            double l = sqrt(dx*dx + dy*dy);
-            if (l > 1) {
-                //CvPoint p2 = cvPoint(p.x + (int)(dx * 10 + .5), p.y + (int)(dy * 10 + .5));
-                CvPoint p2 = cvPoint(p.x + (int)(dx), p.y + (int)(dy));
-                cvLine(vel, p, p2, CV_RGB(0,255,0), 1, 8);
-                count++;
+    // Run GFB optical flow analysis, once per pair
+    const cv::Mat &flow = farneback->computeFlow(image1, image2);
 
-                // draw these on the original images
-                cvCircle(image1, p,  3, CV_RGB(0,255,0), -1, 8, 0);
-                cvCircle(image2, p2, 3, CV_RGB(0,255,0), -1, 8, 0);
+    // the x and y of each pixel are interleaved
+    flowAnalysis.analyse(flow.ptr<float>(0), flow.ptr<float>(0) + 1, flow.cols, flow.rows, (int)(flow.step / sizeof(float)), 2);
 
-            }
+    if (display == true || save == true) {
+        if (vel != NULL && (vel->width != flow.cols || vel->height != flow.rows)) {
+            cvReleaseImage(&vel);
+        }
+        if (vel == NULL) {
+            vel = cvCreateImage(cvSize(flow.cols, flow.rows), IPL_DEPTH_8U, 3);
         }
-    }
-
-    cvShowImage("Image 1", image1);
-    cvShowImage("Image 2", image2);
 
-    cvShowImage("GFB Flow", vel);
+        // Clear the previous pixels, and draw the flow of each block
+        cvZero(vel);
+        flowAnalysis.draw(vel);
+    }
 
-    // save the output to /tmp
-    string fileName = "/tmp/out" + itos3(outNumF) + ".bmp";
-    cvSaveImage(fileName.c_str(), vel);
-    outNumF++;
+    if (display == true) {
+        cvShowImage("Image 1", image1);
+        cvShowImage("Image 2", image2);
+        cvShowImage("GFB Flow", vel);
+        cvWaitKey(10);
+    }
 
-    // free the allocated memory
-    cvReleaseImage(&velx);
-    cvReleaseImage(&vely);
-    cvReleaseImage(&vel);
-    cvReleaseImage(&flow);
-    cvReleaseImage(&image2);
-    cvReleaseImage(&image2_grey);
+    if (save == true) {
+        // save the output to /tmp
+        string fileName = "/tmp/out" + itos3(outNumF) + ".bmp";
+        cvSaveImage(fileName.c_str(), vel);
+        outNumF++;
+    }
 
 #else
 
@@ -215,6 +308,18 @@ int runFarneback(IplImage *image1, IplImage *image2)
 }
 
 
+///////////////////////////////////////////////////////////////////////////////
+//
+// getFarnebackAnalysis
+//
+///////////////////////////////////////////////////////////////////////////////
+
+FlowAnalysis *getFarnebackAnalysis ()
+{
+    return &flowAnalysis;
+}
+
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // itos
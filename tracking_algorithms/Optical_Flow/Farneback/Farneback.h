@@ -1,4 +1,3 @@
-
 #ifndef FARNEBACK_H
 #define FARNEBACK_H
 
@@ -7,8 +6,77 @@
 #include <math.h>
 #include <stdio.h>
 
+#include "tracking_algorithms/Optical_Flow/Flow_Analysis/Flow_Analysis.h"
+#include "tracking_algorithms/Optical_Flow/Flow_Frame/Flow_Frame.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// Farneback
+//
+// Dense optical flow with cv::calcOpticalFlowFarneback.  The grey images and
+//  the flow field are kept between calls, and the flow of one frame pair can
+//  seed the next one (OPTFLOW_USE_INITIAL_FLOW).
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class Farneback
+{
+    public:
+
+        // parameters of cv::calcOpticalFlowFarneback
+        double pyrScale;
+        int levels;
+        int winSize;
+        int iterations;
+        int polyN;
+        double polySigma;
+        int flags;
+
+        // start each pair from the flow of the previous one
+        bool warmStart;
+
+        Farneback();
+        ~Farneback();
+
+        // flow from imgA to imgB (8-bit grey or BGR); returns a CV_32FC2 field
+        //  that stays owned by the object until the next call
+        const cv::Mat &computeFlow (IplImage *imgA, IplImage *imgB);
+
+        // flow from the previous frame to this one; returns false for the
+        //  first frame
+        bool computeFlow (IplImage *frame);
+
+        // flow between two frames already made grey, used without a copy;
+        //  returns false if there is no previous frame
+        bool computeFlow (const FlowFrame *previous, const FlowFrame *current);
+
+        // the last flow field
+        const cv::Mat &getFlow () const { return flow; }
+        bool hasFlow () const { return flowValid; }
+
+        // forget the previous frame and flow
+        void reset ();
+
+    private:
+
+        void toGrey (IplImage *img, cv::Mat &grey);
+        void calcFlow (const cv::Mat &greyA, const cv::Mat &greyB);
+
+        cv::Mat grey[2];
+        cv::Mat flow;
+
+        int current;
+        bool haveFrame;
+        bool flowValid;
+
+};
+
 void initFarneback ();
 void endFarneback ();
-int runFarneback (IplImage *imgA, IplImage *imgB);
+// display shows the images and the flow, save writes the flow to /tmp
+int runFarneback (IplImage *imgA, IplImage *imgB, bool display = true, bool save = false);
+
+// what runFarneback made of its last flow
+FlowAnalysis *getFarnebackAnalysis ();
 
 #endif
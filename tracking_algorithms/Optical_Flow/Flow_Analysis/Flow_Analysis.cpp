@@ -0,0 +1,602 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Flow_Analysis
+//
+// Post-processing of dense optical flow, shared by Horn_Schunck and
+//  Farneback.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Flow_Analysis.h"
+
+#include<algorithm>
+
+// vector extensions, used for the pixel passes if available
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FA_USE_SSE2
+#endif
+
+using namespace std;
+
+// coefficients of the arctangent polynomial, in degrees, as in cvFastArctan
+#define FA_ATAN_P1 ( 0.9997878412794807f * 57.29577951308232f)
+#define FA_ATAN_P3 (-0.3258083974640975f * 57.29577951308232f)
+#define FA_ATAN_P5 ( 0.1555786518463281f * 57.29577951308232f)
+#define FA_ATAN_P7 (-0.04432655554792128f * 57.29577951308232f)
+#define FA_ATAN_EPS 1e-20f
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// helpers
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// direction of (x, y) in degrees, from 0 to 360
+static inline float fastAtan2 (float y, float x)
+{
+    float ax = fabsf(x), ay = fabsf(y);
+    float c = min(ax, ay) / (max(ax, ay) + FA_ATAN_EPS);
+    float c2 = c * c;
+    float a = (((FA_ATAN_P7 * c2 + FA_ATAN_P5) * c2 + FA_ATAN_P3) * c2 + FA_ATAN_P1) * c;
+
+    if (ax < ay) {
+        a = 90.0f - a;
+    }
+    if (x < 0) {
+        a = 180.0f - a;
+    }
+    if (y < 0) {
+        a = 360.0f - a;
+    }
+    return a;
+
+} // end fastAtan2
+
+
+#ifdef FA_USE_SSE2
+
+static inline __m128 blend (__m128 m, __m128 a, __m128 b)
+{
+    return _mm_or_ps(_mm_and_ps(m, a), _mm_andnot_ps(m, b));
+}
+
+// fastAtan2 for four pixels
+static inline __m128 fastAtan2 (__m128 y, __m128 x)
+{
+    const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    const __m128 zero = _mm_setzero_ps();
+
+    __m128 ax = _mm_and_ps(x, absMask), ay = _mm_and_ps(y, absMask);
+    __m128 c = _mm_div_ps(_mm_min_ps(ax, ay), _mm_add_ps(_mm_max_ps(ax, ay), _mm_set1_ps(FA_ATAN_EPS)));
+    __m128 c2 = _mm_mul_ps(c, c);
+    __m128 a = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(FA_ATAN_P7), c2), _mm_set1_ps(FA_ATAN_P5));
+    a = _mm_add_ps(_mm_mul_ps(a, c2), _mm_set1_ps(FA_ATAN_P3));
+    a = _mm_add_ps(_mm_mul_ps(a, c2), _mm_set1_ps(FA_ATAN_P1));
+    a = _mm_mul_ps(a, c);
+
+    a = blend(_mm_cmplt_ps(ax, ay), _mm_sub_ps(_mm_set1_ps(90.0f), a), a);
+    a = blend(_mm_cmplt_ps(x, zero), _mm_sub_ps(_mm_set1_ps(180.0f), a), a);
+    a = blend(_mm_cmplt_ps(y, zero), _mm_sub_ps(_mm_set1_ps(360.0f), a), a);
+    return a;
+
+} // end fastAtan2
+
+// the low byte of each lane of a comparison, into four bytes of dst
+static inline void storeMask (uchar *dst, __m128 m)
+{
+    __m128i p = _mm_packs_epi32(_mm_castps_si128(m), _mm_setzero_si128());
+    p = _mm_packs_epi16(p, _mm_setzero_si128());
+    int bytes = _mm_cvtsi128_si32(p);
+    memcpy(dst, &bytes, 4);
+
+} // end storeMask
+
+// sum of the four lanes
+static inline float sum4 (__m128 v)
+{
+    float f[4];
+    _mm_storeu_ps(f, v);
+    return (f[0] + f[1]) + (f[2] + f[3]);
+
+} // end sum4
+
+#endif
+
+
+// solves the symmetric 3x3 system m x = b by elimination; returns false if
+//  it is singular
+static bool solve3 (double m[3][3], double b[3], double x[3])
+{
+    double a[3][4];
+    for (int i = 0; i < 3; i++) {
+        for (int j = 0; j < 3; j++) {
+            a[i][j] = m[i][j];
+        }
+        a[i][3] = b[i];
+    }
+
+    double scale = max(fabs(m[0][0]), max(fabs(m[1][1]), fabs(m[2][2])));
+    for (int c = 0; c < 3; c++) {
+        int p = c;
+        for (int r = c + 1; r < 3; r++) {
+            if (fabs(a[r][c]) > fabs(a[p][c])) {
+                p = r;
+            }
+        }
+        if (fabs(a[p][c]) <= 1e-12 * scale) {
+            return false;
+        }
+        for (int j = 0; j < 4; j++) {
+            swap(a[c][j], a[p][j]);
+        }
+        for (int r = c + 1; r < 3; r++) {
+            double f = a[r][c] / a[c][c];
+            for (int j = c; j < 4; j++) {
+                a[r][j] -= f * a[c][j];
+            }
+        }
+    }
+
+    for (int i = 2; i >= 0; i--) {
+        double s = a[i][3];
+        for (int j = i + 1; j < 3; j++) {
+            s -= a[i][j] * x[j];
+        }
+        x[i] = s / a[i][i];
+    }
+    return true;
+
+} // end solve3
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// constructor
+//
+///////////////////////////////////////////////////////////////////////////////
+
+FlowAnalysis::FlowAnalysis()
+{
+    blockSize = 16;
+    threshold = 1.0;
+    wantPolar = false;
+    wantMask = true;
+    relativeMask = false;
+    fitIterations = 3;
+
+    width = 0;
+    height = 0;
+    countedSize = 0;
+    blocksWide = 0;
+    blocksHigh = 0;
+
+    magnitude = NULL;
+    orientation = NULL;
+    mask = NULL;
+    blockX = NULL;
+    blockY = NULL;
+
+    translation[0] = translation[1] = 0;
+    for (int i = 0; i < 6; i++) {
+        affine[i] = 0;
+    }
+    moving = 0;
+
+} // end constructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// destructor
+//
+///////////////////////////////////////////////////////////////////////////////
+
+FlowAnalysis::~FlowAnalysis()
+{
+    cvReleaseImage(&magnitude);
+    cvReleaseImage(&orientation);
+    cvReleaseImage(&mask);
+    cvReleaseImage(&blockX);
+    cvReleaseImage(&blockY);
+
+} // end destructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// allocate
+//
+// Sizes the outputs for a field of the given size, making only the wanted
+//  maps.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowAnalysis::allocate (int w, int h)
+{
+    int size = max(blockSize, 1);
+    int wide = (w + size - 1) / size;
+    int high = (h + size - 1) / size;
+
+    bool resized = (w != width || h != height);
+
+    if (resized == true) {
+        cvReleaseImage(&magnitude);
+        cvReleaseImage(&orientation);
+        cvReleaseImage(&mask);
+        width = w;
+        height = h;
+    }
+
+    if (wantPolar == true && magnitude == NULL) {
+        magnitude = cvCreateImage(cvSize(w, h), IPL_DEPTH_32F, 1);
+        orientation = cvCreateImage(cvSize(w, h), IPL_DEPTH_32F, 1);
+    }
+    if (wantPolar == false) {
+        cvReleaseImage(&magnitude);
+        cvReleaseImage(&orientation);
+    }
+
+    if (wantMask == true && mask == NULL) {
+        mask = cvCreateImage(cvSize(w, h), IPL_DEPTH_8U, 1);
+    }
+    if (wantMask == false) {
+        cvReleaseImage(&mask);
+    }
+
+    if (blockX == NULL || blockX->width != wide || blockX->height != high) {
+        cvReleaseImage(&blockX);
+        cvReleaseImage(&blockY);
+        blockX = cvCreateImage(cvSize(wide, high), IPL_DEPTH_32F, 1);
+        blockY = cvCreateImage(cvSize(wide, high), IPL_DEPTH_32F, 1);
+        resized = true;
+    }
+
+    // pixels in each block, fewer at the right and bottom edges
+    if (resized == true || blockSize != countedSize) {
+        blocksWide = wide;
+        blocksHigh = high;
+        countedSize = blockSize;
+
+        blockCount.resize(wide * high);
+        for (int by = 0; by < high; by++) {
+            for (int bx = 0; bx < wide; bx++) {
+                blockCount[by * wide + bx] = (min((bx + 1) * size, w) - bx * size) *
+                                             (min((by + 1) * size, h) - by * size);
+            }
+        }
+        rowMoving.resize(high);
+    }
+
+} // end allocate
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// analyse
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowAnalysis::analyse (IplImage *velx, IplImage *vely)
+{
+    analyse((const float*)velx->imageData, (const float*)vely->imageData,
+            velx->width, velx->height, velx->widthStep / sizeof(float), 1);
+
+} // end analyse
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// analyse
+//
+// One pass over the pixels, a block row per thread: the sums of each block,
+//  the moving pixels, and the maps if wanted.  The dominant motion is then
+//  fitted to the blocks.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowAnalysis::analyse (const float *flowX, const float *flowY, int w, int h,
+                            int rowStep, int pixelStep)
+{
+    allocate(w, h);
+
+    int size = max(blockSize, 1);
+    float t2 = (float)(threshold * threshold);
+    bool maskHere = (wantMask == true && relativeMask == false);
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic)
+#endif
+    for (int by = 0; by < blocksHigh; by++) {
+        float *sumX = (float*)(blockX->imageData + by * blockX->widthStep);
+        float *sumY = (float*)(blockY->imageData + by * blockY->widthStep);
+        int y0 = by * size, y1 = min(y0 + size, h);
+        int count = 0;
+
+        for (int b = 0; b < blocksWide; b++) {
+            sumX[b] = 0;
+            sumY[b] = 0;
+        }
+
+        for (int y = y0; y < y1; y++) {
+            const float *fx = flowX + y * rowStep;
+            const float *fy = flowY + y * rowStep;
+            float *mag = NULL, *ang = NULL;
+            uchar *m = NULL;
+            if (wantPolar == true) {
+                mag = (float*)(magnitude->imageData + y * magnitude->widthStep);
+                ang = (float*)(orientation->imageData + y * orientation->widthStep);
+            }
+            if (maskHere == true) {
+                m = (uchar*)(mask->imageData + y * mask->widthStep);
+            }
+
+            for (int b = 0; b < blocksWide; b++) {
+                int x = b * size, x1 = min(x + size, w);
+                float sx = 0, sy = 0;
+
+#ifdef FA_USE_SSE2
+                const __m128 t2v = _mm_set1_ps(t2);
+                __m128 sxv = _mm_setzero_ps(), syv = _mm_setzero_ps();
+                __m128i countv = _mm_setzero_si128();
+
+                for (; x + 4 <= x1; x += 4) {
+                    __m128 u, v;
+                    if (pixelStep == 1) {
+                        u = _mm_loadu_ps(fx + x);
+                        v = _mm_loadu_ps(fy + x);
+                    } else {
+                        __m128 lo = _mm_loadu_ps(fx + 2 * x), hi = _mm_loadu_ps(fx + 2 * x + 4);
+                        u = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+                        v = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+                    }
+                    sxv = _mm_add_ps(sxv, u);
+                    syv = _mm_add_ps(syv, v);
+
+                    __m128 m2 = _mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v));
+                    __m128 moves = _mm_cmpgt_ps(m2, t2v);
+                    countv = _mm_sub_epi32(countv, _mm_castps_si128(moves));
+
+                    if (mag != NULL) {
+                        _mm_storeu_ps(mag + x, _mm_sqrt_ps(m2));
+                        _mm_storeu_ps(ang + x, fastAtan2(v, u));
+                    }
+                    if (m != NULL) {
+                        storeMask(m + x, moves);
+                    }
+                }
+
+                int c4[4];
+                _mm_storeu_si128((__m128i*)c4, countv);
+                count += c4[0] + c4[1] + c4[2] + c4[3];
+                sx = sum4(sxv);
+                sy = sum4(syv);
+#endif
+
+                for (; x < x1; x++) {
+                    float u = fx[pixelStep * x], v = fy[pixelStep * x];
+                    float m2 = u * u + v * v;
+                    bool moves = (m2 > t2);
+                    sx += u;
+                    sy += v;
+                    count += moves;
+
+                    if (mag != NULL) {
+                        mag[x] = sqrtf(m2);
+                        ang[x] = fastAtan2(v, u);
+                    }
+                    if (m != NULL) {
+                        m[x] = moves ? 255 : 0;
+                    }
+                }
+
+                sumX[b] += sx;
+                sumY[b] += sy;
+            }
+        }
+
+        for (int b = 0; b < blocksWide; b++) {
+            sumX[b] /= blockCount[by * blocksWide + b];
+            sumY[b] /= blockCount[by * blocksWide + b];
+        }
+        rowMoving[by] = count;
+    }
+
+    moving = 0;
+    for (int by = 0; by < blocksHigh; by++) {
+        moving += rowMoving[by];
+    }
+
+    fitDominant();
+
+    if (wantMask == true && relativeMask == true) {
+        relativePass(flowX, flowY, rowStep, pixelStep);
+    }
+
+} // end analyse
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// fitDominant
+//
+// Fits an affine field to the block means by least squares, weighting each
+//  block by its pixels, then reweights the blocks that are further than the
+//  threshold from the fit (Huber) so that moving objects count for less.
+//  The translation is the mean of the blocks with the final weights.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowAnalysis::fitDominant ()
+{
+    int n = blocksWide * blocksHigh;
+    int size = max(blockSize, 1);
+    vector<double> weight(n, 1.0);
+
+    for (int pass = 0; pass <= max(fitIterations, 0); pass++) {
+        double m[3][3] = {{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+        double bu[3] = {0, 0, 0}, bv[3] = {0, 0, 0};
+        double su = 0, sv = 0, sw = 0;
+
+        for (int by = 0; by < blocksHigh; by++) {
+            const float *mx = (const float*)(blockX->imageData + by * blockX->widthStep);
+            const float *my = (const float*)(blockY->imageData + by * blockY->widthStep);
+            double cy = (by * size + min((by + 1) * size, height) - 1) * 0.5;
+            for (int bx = 0; bx < blocksWide; bx++) {
+                double cx = (bx * size + min((bx + 1) * size, width) - 1) * 0.5;
+                double w = weight[by * blocksWide + bx] * blockCount[by * blocksWide + bx];
+                double p[3] = {cx, cy, 1};
+                for (int i = 0; i < 3; i++) {
+                    for (int j = 0; j < 3; j++) {
+                        m[i][j] += w * p[i] * p[j];
+                    }
+                    bu[i] += w * p[i] * mx[bx];
+                    bv[i] += w * p[i] * my[bx];
+                }
+                su += w * mx[bx];
+                sv += w * my[bx];
+                sw += w;
+            }
+        }
+
+        translation[0] = (sw > 0) ? su / sw : 0;
+        translation[1] = (sw > 0) ? sv / sw : 0;
+        if (solve3(m, bu, affine) == false || solve3(m, bv, affine + 3) == false) {
+            // too few blocks for an affine field
+            affine[0] = affine[1] = affine[3] = affine[4] = 0;
+            affine[2] = translation[0];
+            affine[5] = translation[1];
+        }
+
+        if (pass == max(fitIterations, 0)) {
+            break;
+        }
+
+        // reweight against this fit
+        for (int by = 0; by < blocksHigh; by++) {
+            const float *mx = (const float*)(blockX->imageData + by * blockX->widthStep);
+            const float *my = (const float*)(blockY->imageData + by * blockY->widthStep);
+            double cy = (by * size + min((by + 1) * size, height) - 1) * 0.5;
+            for (int bx = 0; bx < blocksWide; bx++) {
+                double cx = (bx * size + min((bx + 1) * size, width) - 1) * 0.5;
+                double du = mx[bx] - (affine[0] * cx + affine[1] * cy + affine[2]);
+                double dv = my[bx] - (affine[3] * cx + affine[4] * cy + affine[5]);
+                double r = sqrt(du * du + dv * dv);
+                weight[by * blocksWide + bx] = (r <= threshold) ? 1.0 : threshold / r;
+            }
+        }
+    }
+
+} // end fitDominant
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// relativePass
+//
+// Marks the pixels whose flow differs from the dominant motion by more than
+//  the threshold.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowAnalysis::relativePass (const float *flowX, const float *flowY, int rowStep, int pixelStep)
+{
+    float t2 = (float)(threshold * threshold);
+    float a0 = (float)affine[0], a1 = (float)affine[1], a2 = (float)affine[2];
+    float a3 = (float)affine[3], a4 = (float)affine[4], a5 = (float)affine[5];
+    vector<int> rowCount(height);
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int y = 0; y < height; y++) {
+        const float *fx = flowX + y * rowStep;
+        const float *fy = flowY + y * rowStep;
+        uchar *m = (uchar*)(mask->imageData + y * mask->widthStep);
+        float ru = a1 * y + a2, rv = a4 * y + a5;
+        int count = 0;
+        int x = 0;
+
+#ifdef FA_USE_SSE2
+        const __m128 t2v = _mm_set1_ps(t2);
+        const __m128 a0v = _mm_set1_ps(a0), a3v = _mm_set1_ps(a3);
+        const __m128 ruv = _mm_set1_ps(ru), rvv = _mm_set1_ps(rv);
+        __m128 xs = _mm_setr_ps(0, 1, 2, 3);
+        __m128i countv = _mm_setzero_si128();
+
+        for (; x + 4 <= width; x += 4) {
+            __m128 u, v;
+            if (pixelStep == 1) {
+                u = _mm_loadu_ps(fx + x);
+                v = _mm_loadu_ps(fy + x);
+            } else {
+                __m128 lo = _mm_loadu_ps(fx + 2 * x), hi = _mm_loadu_ps(fx + 2 * x + 4);
+                u = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(2, 0, 2, 0));
+                v = _mm_shuffle_ps(lo, hi, _MM_SHUFFLE(3, 1, 3, 1));
+            }
+            u = _mm_sub_ps(u, _mm_add_ps(_mm_mul_ps(a0v, xs), ruv));
+            v = _mm_sub_ps(v, _mm_add_ps(_mm_mul_ps(a3v, xs), rvv));
+            xs = _mm_add_ps(xs, _mm_set1_ps(4));
+
+            __m128 moves = _mm_cmpgt_ps(_mm_add_ps(_mm_mul_ps(u, u), _mm_mul_ps(v, v)), t2v);
+            countv = _mm_sub_epi32(countv, _mm_castps_si128(moves));
+            storeMask(m + x, moves);
+        }
+
+        int c4[4];
+        _mm_storeu_si128((__m128i*)c4, countv);
+        count += c4[0] + c4[1] + c4[2] + c4[3];
+#endif
+
+        for (; x < width; x++) {
+            float u = fx[pixelStep * x] - (a0 * x + ru);
+            float v = fy[pixelStep * x] - (a3 * x + rv);
+            bool moves = (u * u + v * v > t2);
+            m[x] = moves ? 255 : 0;
+            count += moves;
+        }
+
+        rowCount[y] = count;
+    }
+
+    moving = 0;
+    for (int y = 0; y < height; y++) {
+        moving += rowCount[y];
+    }
+
+} // end relativePass
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// draw
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowAnalysis::draw (IplImage *dst, double scale)
+{
+    int size = max(blockSize, 1);
+
+    for (int by = 0; by < blocksHigh; by++) {
+        const float *mx = (const float*)(blockX->imageData + by * blockX->widthStep);
+        const float *my = (const float*)(blockY->imageData + by * blockY->widthStep);
+        int cy = (by * size + min((by + 1) * size, height) - 1) / 2;
+        for (int bx = 0; bx < blocksWide; bx++) {
+            int cx = (bx * size + min((bx + 1) * size, width) - 1) / 2;
+            if (mx[bx] * mx[bx] + my[bx] * my[bx] > threshold * threshold) {
+                CvPoint p = cvPoint(cx, cy);
+                CvPoint p2 = cvPoint(cvRound(cx + scale * mx[bx]), cvRound(cy + scale * my[bx]));
+                cvCircle(dst, p, 1, CV_RGB(0,255,0), -1, 8, 0);
+                cvLine(dst, p, p2, CV_RGB(0,255,0), 1, 8);
+            }
+        }
+    }
+
+    // the dominant translation, from the centre
+    CvPoint c = cvPoint(width / 2, height / 2);
+    CvPoint c2 = cvPoint(cvRound(c.x + scale * translation[0]), cvRound(c.y + scale * translation[1]));
+    cvCircle(dst, c, 3, CV_RGB(255,0,0), -1, 8, 0);
+    cvLine(dst, c, c2, CV_RGB(255,0,0), 2, 8);
+
+} // end draw
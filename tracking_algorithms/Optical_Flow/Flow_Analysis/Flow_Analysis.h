@@ -0,0 +1,109 @@
+#ifndef FLOW_ANALYSIS_H
+#define FLOW_ANALYSIS_H
+
+#include "cv.h"
+#include <math.h>
+#include <stdio.h>
+
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FlowAnalysis
+//
+// Reduces a dense flow field to what the servo loop uses: magnitude and
+//  orientation maps, the field averaged over blocks, the dominant motion of
+//  the scene (a translation and an affine field fitted to the blocks) and a
+//  mask of the moving pixels.  The per-pixel work is one pass, split over
+//  threads when built with OpenMP (as TACTICAL.pro does) and using SSE2 when
+//  the target has it; the maps and the mask are only made if asked for, and
+//  nothing is drawn or saved unless draw is called.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class FlowAnalysis
+{
+    public:
+
+        // side of the blocks the field is averaged over, in pixels
+        int blockSize;
+
+        // a pixel moves if its flow is longer than this, in pixels; blocks
+        //  further than this from the dominant motion count for less in it
+        double threshold;
+
+        // make the magnitude and orientation maps
+        bool wantPolar;
+
+        // make the motion mask, against zero or against the dominant motion;
+        //  the latter takes a second pass over the pixels
+        bool wantMask;
+        bool relativeMask;
+
+        // reweighting passes of the dominant motion fit
+        int fitIterations;
+
+        FlowAnalysis();
+        ~FlowAnalysis();
+
+        // flow as two planes of 32-bit floats with the same layout, as from
+        //  HornSchunck
+        void analyse (IplImage *velx, IplImage *vely);
+
+        // flow as rows of floats rowStep apart; pixelStep is 1 for separate
+        //  planes, or 2 for interleaved x and y with flowY == flowX + 1, as
+        //  from Farneback
+        void analyse (const float *flowX, const float *flowY, int width, int height,
+                      int rowStep, int pixelStep);
+
+        // 32-bit float maps of the flow length, and its direction in degrees
+        //  from 0 to 360, or NULL if not wanted
+        IplImage *getMagnitude () { return magnitude; }
+        IplImage *getOrientation () { return orientation; }
+
+        // 8-bit map, 255 where the pixel moves, or NULL if not wanted
+        IplImage *getMask () { return mask; }
+
+        // 32-bit float mean flow of each block, one pixel per block
+        IplImage *getBlockX () { return blockX; }
+        IplImage *getBlockY () { return blockY; }
+
+        // dominant translation, in pixels
+        double getTranslationX () const { return translation[0]; }
+        double getTranslationY () const { return translation[1]; }
+
+        // dominant affine motion: the flow at (x, y) is
+        //  (a[0]*x + a[1]*y + a[2], a[3]*x + a[4]*y + a[5])
+        const double *getAffine () const { return affine; }
+
+        // pixels that move by the mask's test
+        int getMovingPixels () const { return moving; }
+
+        // draws the block field, and the dominant motion from the centre
+        void draw (IplImage *dst, double scale = 1.0);
+
+    private:
+
+        void allocate (int width, int height);
+        void fitDominant ();
+        void relativePass (const float *flowX, const float *flowY, int rowStep, int pixelStep);
+
+        int width, height;
+        int blocksWide, blocksHigh;
+        int countedSize;
+
+        IplImage *magnitude, *orientation;
+        IplImage *mask;
+        IplImage *blockX, *blockY;
+
+        // pixels in each block, and the moving pixels in each block row
+        std::vector<int> blockCount;
+        std::vector<int> rowMoving;
+
+        double translation[2];
+        double affine[6];
+        int moving;
+
+};
+
+#endif
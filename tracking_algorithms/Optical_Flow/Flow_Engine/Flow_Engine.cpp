@@ -0,0 +1,412 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Flow_Engine
+//
+// The optical flow algorithms behind one interface, and the pipeline that
+//  feeds them shared frames.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Flow_Engine.h"
+
+#include<algorithm>
+
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// KLTEngine
+//
+///////////////////////////////////////////////////////////////////////////////
+
+KLTEngine::KLTEngine(KLT *klt)
+{
+    this->klt = klt;
+
+} // end constructor
+
+
+int KLTEngine::getLevels () const
+{
+    return max(klt->numLevels, 1);
+
+} // end getLevels
+
+
+void KLTEngine::process (const FlowFrame *previous, const FlowFrame *current)
+{
+    klt->lkOpticalFlow(previous, current);
+
+} // end process
+
+
+void KLTEngine::draw (IplImage *dst)
+{
+    if (klt->lkInitialized) {
+        klt->drawFeatures(dst);
+    }
+
+} // end draw
+
+
+void KLTEngine::reset ()
+{
+    klt->reset(0);
+
+} // end reset
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// LKOpenCVEngine
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void LKOpenCVEngine::process (const FlowFrame *previous, const FlowFrame *current)
+{
+    runLKOpenCV(previous, current);
+
+} // end process
+
+
+void LKOpenCVEngine::draw (IplImage *dst)
+{
+    drawLKOpenCV(dst);
+
+} // end draw
+
+
+void LKOpenCVEngine::reset ()
+{
+    resetLKOpenCV();
+
+} // end reset
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// HornSchunckEngine
+//
+///////////////////////////////////////////////////////////////////////////////
+
+HornSchunckEngine::HornSchunckEngine()
+{
+    haveFlow = false;
+
+} // end constructor
+
+
+void HornSchunckEngine::process (const FlowFrame *previous, const FlowFrame *current)
+{
+    if (previous == NULL || previous->getWidth() != current->getWidth() ||
+        previous->getHeight() != current->getHeight()) {
+        reset();
+        return;
+    }
+
+    hornSchunck.computeFlow(previous, current);
+    analysis.analyse(hornSchunck.getVelX(), hornSchunck.getVelY());
+    haveFlow = true;
+
+} // end process
+
+
+void HornSchunckEngine::draw (IplImage *dst)
+{
+    if (haveFlow == true) {
+        analysis.draw(dst);
+    }
+
+} // end draw
+
+
+void HornSchunckEngine::reset ()
+{
+    hornSchunck.reset();
+    haveFlow = false;
+
+} // end reset
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SparseToDenseEngine
+//
+///////////////////////////////////////////////////////////////////////////////
+
+SparseToDenseEngine::SparseToDenseEngine(KLT *klt)
+{
+    this->klt = klt;
+    haveFlow = false;
+
+} // end constructor
+
+
+int SparseToDenseEngine::getLevels () const
+{
+    // the interpolation compares the image two levels up
+    return max(klt->numLevels, 3);
+
+} // end getLevels
+
+
+void SparseToDenseEngine::process (const FlowFrame *previous, const FlowFrame *current)
+{
+    // the first frame only finds the features
+    bool tracking = klt->lkInitialized && previous != NULL;
+
+    klt->lkOpticalFlow(previous, current);
+    haveFlow = false;
+
+    // too few tracks give no flow, rather than a motion of zero
+    if (tracking == true) {
+        haveFlow = sparseToDense.computeFlow(klt->lkPoints[1], klt->lkPoints[0], klt->lkFeatureError, klt->lkTracked, previous, current);
+    }
+    if (haveFlow == true) {
+        analysis.analyse(sparseToDense.getVelX(), sparseToDense.getVelY());
+    }
+
+} // end process
+
+
+void SparseToDenseEngine::draw (IplImage *dst)
+{
+    if (haveFlow == true) {
+        analysis.draw(dst);
+    }
+    if (klt->lkInitialized) {
+        klt->drawFeatures(dst);
+    }
+
+} // end draw
+
+
+void SparseToDenseEngine::reset ()
+{
+    klt->reset(0);
+    sparseToDense.refiner.reset();
+    haveFlow = false;
+
+} // end reset
+
+
+#ifdef unix
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FarnebackEngine
+//
+///////////////////////////////////////////////////////////////////////////////
+
+FarnebackEngine::FarnebackEngine()
+{
+    haveFlow = false;
+
+} // end constructor
+
+
+void FarnebackEngine::process (const FlowFrame *previous, const FlowFrame *current)
+{
+    haveFlow = farneback.computeFlow(previous, current);
+
+    if (haveFlow == true) {
+        // the x and y of each pixel are interleaved
+        const cv::Mat &flow = farneback.getFlow();
+        analysis.analyse(flow.ptr<float>(0), flow.ptr<float>(0) + 1, flow.cols, flow.rows, (int)(flow.step / sizeof(float)), 2);
+    }
+
+} // end process
+
+
+void FarnebackEngine::draw (IplImage *dst)
+{
+    if (haveFlow == true) {
+        analysis.draw(dst);
+    }
+
+} // end draw
+
+
+void FarnebackEngine::reset ()
+{
+    farneback.reset();
+    haveFlow = false;
+
+} // end reset
+
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// constructor
+//
+///////////////////////////////////////////////////////////////////////////////
+
+FlowPipeline::FlowPipeline()
+{
+    current = 0;
+
+} // end constructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// destructor
+//
+///////////////////////////////////////////////////////////////////////////////
+
+FlowPipeline::~FlowPipeline()
+{
+
+} // end destructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// addEngine
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowPipeline::addEngine (FlowEngine *engine)
+{
+    if (engine != NULL && hasEngine(engine) == false) {
+        engines.push_back(engine);
+    }
+
+} // end addEngine
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// removeEngine
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowPipeline::removeEngine (FlowEngine *engine)
+{
+    vector<FlowEngine *>::iterator it = find(engines.begin(), engines.end(), engine);
+
+    if (it != engines.end()) {
+        engine->reset();
+        engines.erase(it);
+    }
+
+} // end removeEngine
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// setEngine
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowPipeline::setEngine (FlowEngine *engine)
+{
+    if (engines.size() == 1 && engines[0] == engine) {
+        return;
+    }
+
+    while (engines.empty() == false) {
+        removeEngine(engines.back());
+    }
+    addEngine(engine);
+
+} // end setEngine
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// hasEngine
+//
+///////////////////////////////////////////////////////////////////////////////
+
+bool FlowPipeline::hasEngine (FlowEngine *engine) const
+{
+    return find(engines.begin(), engines.end(), engine) != engines.end();
+
+} // end hasEngine
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// process
+//
+// The frame is made grey and its pyramid built here once; the engines only
+//  read it.  A frame of another size does not follow on from the last one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowPipeline::process (IplImage *frame)
+{
+    int levels = 1;
+    for (size_t i = 0; i < engines.size(); i++) {
+        levels = max(levels, engines[i]->getLevels());
+    }
+
+    int previous = current;
+    current = 1 - current;
+    frames[current].set(frame, levels);
+
+    const FlowFrame *last = &frames[previous];
+    if (last->isValid() == false || last->getWidth() != frame->width || last->getHeight() != frame->height) {
+        last = NULL;
+    }
+
+    for (size_t i = 0; i < engines.size(); i++) {
+        engines[i]->process(last, &frames[current]);
+    }
+
+} // end process
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// draw
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowPipeline::draw (IplImage *dst)
+{
+    for (size_t i = 0; i < engines.size(); i++) {
+        engines[i]->draw(dst);
+    }
+
+} // end draw
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// getAnalysis
+//
+///////////////////////////////////////////////////////////////////////////////
+
+FlowAnalysis *FlowPipeline::getAnalysis ()
+{
+    for (size_t i = 0; i < engines.size(); i++) {
+        if (engines[i]->getAnalysis() != NULL) {
+            return engines[i]->getAnalysis();
+        }
+    }
+    return NULL;
+
+} // end getAnalysis
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// reset
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowPipeline::reset ()
+{
+    frames[0].clear();
+    frames[1].clear();
+
+    for (size_t i = 0; i < engines.size(); i++) {
+        engines[i]->reset();
+    }
+
+} // end reset
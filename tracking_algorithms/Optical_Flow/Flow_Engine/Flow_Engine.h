@@ -0,0 +1,258 @@
+#ifndef FLOW_ENGINE_H
+#define FLOW_ENGINE_H
+
+#include "cv.h"
+#include <stdio.h>
+
+#include <vector>
+
+#include "tracking_algorithms/Optical_Flow/Flow_Frame/Flow_Frame.h"
+#include "tracking_algorithms/Optical_Flow/Flow_Analysis/Flow_Analysis.h"
+#include "tracking_algorithms/Optical_Flow/KLT/KLT.h"
+#include "tracking_algorithms/Optical_Flow/LK_OpenCV/LK_OpenCV.h"
+#include "tracking_algorithms/Optical_Flow/Horn_Schunck/Horn_Schunck.h"
+#include "tracking_algorithms/Optical_Flow/Sparse_To_Dense/Sparse_To_Dense.h"
+
+// Farneback needs the OpenCV 2 interface, as in main.cpp
+#ifdef unix
+#include "tracking_algorithms/Optical_Flow/Farneback/Farneback.h"
+#endif
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FlowEngine
+//
+// What the interactive pipeline needs of an optical flow algorithm.  Each
+//  call gets the previous and the current frame, already grey with their
+//  pyramids, and the engine keeps whatever it tracks or solves for from one
+//  call to the next.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class FlowEngine
+{
+    public:
+
+        virtual ~FlowEngine() {}
+
+        virtual const char *getName () const = 0;
+
+        // pyramid levels wanted in the frames, counting the image itself
+        virtual int getLevels () const = 0;
+
+        // previous is NULL on the first frame, or after a reset
+        virtual void process (const FlowFrame *previous, const FlowFrame *current) = 0;
+
+        // draws the last result over a frame
+        virtual void draw (IplImage *dst) = 0;
+
+        // forget the previous frames
+        virtual void reset () = 0;
+
+        // what a dense engine made of its last flow, or NULL
+        virtual FlowAnalysis *getAnalysis () { return NULL; }
+
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// KLTEngine
+//
+// The KLT tracker, which stays owned by the caller so that its parameters
+//  can be set from the GUI.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class KLTEngine : public FlowEngine
+{
+    public:
+
+        KLTEngine(KLT *klt);
+
+        const char *getName () const { return "KLT"; }
+        int getLevels () const;
+        void process (const FlowFrame *previous, const FlowFrame *current);
+        void draw (IplImage *dst);
+        void reset ();
+
+    private:
+
+        KLT *klt;
+
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// LKOpenCVEngine
+//
+// OpenCV's example LK tracker, whose state lives in LK_OpenCV.cpp; there is
+//  only ever one.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class LKOpenCVEngine : public FlowEngine
+{
+    public:
+
+        const char *getName () const { return "LK_OpenCV"; }
+        int getLevels () const { return 4; }
+        void process (const FlowFrame *previous, const FlowFrame *current);
+        void draw (IplImage *dst);
+        void reset ();
+
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// HornSchunckEngine
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class HornSchunckEngine : public FlowEngine
+{
+    public:
+
+        // set the solver parameters on these
+        HornSchunck hornSchunck;
+        FlowAnalysis analysis;
+
+        HornSchunckEngine();
+
+        const char *getName () const { return "Horn-Schunck"; }
+        int getLevels () const { return hornSchunck.levels; }
+        void process (const FlowFrame *previous, const FlowFrame *current);
+        void draw (IplImage *dst);
+        void reset ();
+        FlowAnalysis *getAnalysis () { return haveFlow == true ? &analysis : NULL; }
+
+    private:
+
+        bool haveFlow;
+
+};
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SparseToDenseEngine
+//
+// Dense flow interpolated from the features the KLT tracker follows.  The
+//  tracker is run here, so it should not also be in the pipeline through a
+//  KLTEngine.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class SparseToDenseEngine : public FlowEngine
+{
+    public:
+
+        SparseToDense sparseToDense;
+        FlowAnalysis analysis;
+
+        SparseToDenseEngine(KLT *klt);
+
+        const char *getName () const { return "KLT dense"; }
+        int getLevels () const;
+        void process (const FlowFrame *previous, const FlowFrame *current);
+        void draw (IplImage *dst);
+        void reset ();
+        FlowAnalysis *getAnalysis () { return haveFlow == true ? &analysis : NULL; }
+
+    private:
+
+        KLT *klt;
+        bool haveFlow;
+
+};
+
+
+#ifdef unix
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FarnebackEngine
+//
+// Uses the shared grey images only; cv::calcOpticalFlowFarneback builds its
+//  own pyramid.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class FarnebackEngine : public FlowEngine
+{
+    public:
+
+        Farneback farneback;
+        FlowAnalysis analysis;
+
+        FarnebackEngine();
+
+        const char *getName () const { return "Farneback"; }
+        int getLevels () const { return 1; }
+        void process (const FlowFrame *previous, const FlowFrame *current);
+        void draw (IplImage *dst);
+        void reset ();
+        FlowAnalysis *getAnalysis () { return haveFlow == true ? &analysis : NULL; }
+
+    private:
+
+        bool haveFlow;
+
+};
+
+#endif
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FlowPipeline
+//
+// Makes each video frame grey and builds its pyramid once, as deep as the
+//  deepest engine wants, then runs every engine on it against the frame
+//  before.  The engines are not owned by the pipeline.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class FlowPipeline
+{
+    public:
+
+        FlowPipeline();
+        ~FlowPipeline();
+
+        void addEngine (FlowEngine *engine);
+
+        // the engine is reset, so it starts afresh if it is added again
+        void removeEngine (FlowEngine *engine);
+
+        // runs this engine only, or none for NULL
+        void setEngine (FlowEngine *engine);
+
+        bool hasEngine (FlowEngine *engine) const;
+
+        // an 8-bit BGR or grey frame, following on from the last one
+        void process (IplImage *frame);
+
+        // draws every engine's result over the frame
+        void draw (IplImage *dst);
+
+        // the next frame does not follow on from the last one
+        void reset ();
+
+        const FlowFrame *getCurrent () const { return &frames[current]; }
+
+        // the dense result of the first engine that has one, or NULL
+        FlowAnalysis *getAnalysis ();
+
+    private:
+
+        FlowFrame frames[2];
+        int current;
+
+        std::vector<FlowEngine *> engines;
+
+};
+
+#endif
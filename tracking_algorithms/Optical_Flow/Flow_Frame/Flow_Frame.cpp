@@ -0,0 +1,148 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Flow_Frame
+//
+// The grey image and pyramid of a frame, shared by the optical flow engines.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Flow_Frame.h"
+
+#include<algorithm>
+
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// constructor
+//
+///////////////////////////////////////////////////////////////////////////////
+
+FlowFrame::FlowFrame()
+{
+    grey = NULL;
+    pyramid = NULL;
+
+    levels = 0;
+    valid = false;
+
+} // end constructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// destructor
+//
+///////////////////////////////////////////////////////////////////////////////
+
+FlowFrame::~FlowFrame()
+{
+    cvReleaseImage(&grey);
+    cvReleaseMat(&pyramid);
+
+} // end destructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// allocate
+//
+// Sizes the grey image and the pyramid buffer.  Each level is
+//  ((w+1)/2, (h+1)/2) of the one below, with rows padded to 8 bytes, which
+//  is what cvCalcOpticalFlowPyrLK expects of a ready pyramid.  The buffer is
+//  only made again if the frame size changes or more levels are wanted.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowFrame::allocate (int width, int height, int levels)
+{
+    bool sameSize = grey != NULL && grey->width == width && grey->height == height;
+
+    if (sameSize == true && (int)sizes.size() >= levels) {
+        return;
+    }
+
+    if (sameSize == false) {
+        cvReleaseImage(&grey);
+        grey = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 1);
+    }
+
+    sizes.assign(1, cvSize(width, height));
+    steps.assign(1, 0);
+    offsets.assign(1, 0);
+
+    int bytes = 0;
+    CvSize size = cvSize(width, height);
+    for (int l = 1; l < levels; l++) {
+        size.width = (size.width + 1) >> 1;
+        size.height = (size.height + 1) >> 1;
+
+        int step = (size.width + 7) & ~7;
+        sizes.push_back(size);
+        steps.push_back(step);
+        offsets.push_back(bytes);
+        bytes += step * size.height;
+    }
+
+    // cvCalcOpticalFlowPyrLK also checks the buffer against a third of the
+    //  image, whatever the levels, and takes its size from rows times step,
+    //  which is 0 for a single row
+    int rowBytes = (width + 7) & ~7;
+    bytes = max(bytes, rowBytes * height / 3);
+
+    cvReleaseMat(&pyramid);
+    pyramid = cvCreateMat(max((bytes + rowBytes - 1) / rowBytes, 2), rowBytes, CV_8UC1);
+
+} // end allocate
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// set
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void FlowFrame::set (IplImage *frame, int levels)
+{
+    levels = max(levels, 1);
+    allocate(frame->width, frame->height, levels);
+
+    if (frame->nChannels == 3) {
+        cvCvtColor(frame, grey, CV_BGR2GRAY);
+    } else {
+        cvCopy(frame, grey);
+    }
+
+    for (int l = 1; l < levels; l++) {
+        CvMat below = getLevel(l - 1);
+        CvMat level = getLevel(l);
+        cvPyrDown(&below, &level);
+    }
+
+    this->levels = levels;
+    valid = true;
+
+} // end set
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// getLevel
+//
+///////////////////////////////////////////////////////////////////////////////
+
+CvMat FlowFrame::getLevel (int level) const
+{
+    CvMat header;
+
+    if (level == 0) {
+        cvGetMat(grey, &header);
+    } else {
+        header = cvMat(sizes[level].height, sizes[level].width, CV_8UC1, pyramid->data.ptr + offsets[level]);
+        header.step = steps[level];
+    }
+
+    return header;
+
+} // end getLevel
@@ -0,0 +1,66 @@
+#ifndef FLOW_FRAME_H
+#define FLOW_FRAME_H
+
+#include "cv.h"
+#include <stdio.h>
+
+#include <vector>
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// FlowFrame
+//
+// One video frame as the optical flow engines see it: the 8-bit grey image
+//  and a Gaussian pyramid above it, made once per frame and shared by every
+//  engine.  The pyramid levels sit in one buffer laid out as
+//  cvCalcOpticalFlowPyrLK lays out its own, so it can be passed to that with
+//  CV_LKFLOW_PYR_A_READY and CV_LKFLOW_PYR_B_READY.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class FlowFrame
+{
+    public:
+
+        FlowFrame();
+        ~FlowFrame();
+
+        // converts an 8-bit BGR or grey frame and builds levels - 1 levels
+        //  above it, each half the size of the one below
+        void set (IplImage *frame, int levels);
+
+        // marks the frame as empty, keeping the buffers
+        void clear () { valid = false; }
+        bool isValid () const { return valid; }
+
+        int getWidth () const { return grey != NULL ? grey->width : 0; }
+        int getHeight () const { return grey != NULL ? grey->height : 0; }
+
+        // levels built, counting the grey image as level 0
+        int getLevels () const { return levels; }
+
+        // the grey image, and the buffer holding levels 1 and up
+        IplImage *getGrey () const { return grey; }
+        CvMat *getPyramid () const { return pyramid; }
+
+        // a header for one level, 0 being the grey image
+        CvMat getLevel (int level) const;
+
+    private:
+
+        void allocate (int width, int height, int levels);
+
+        IplImage *grey;
+        CvMat *pyramid;
+
+        // size and byte offset of each level in the pyramid buffer
+        std::vector<CvSize> sizes;
+        std::vector<int> steps;
+        std::vector<int> offsets;
+
+        int levels;
+        bool valid;
+
+};
+
+#endif
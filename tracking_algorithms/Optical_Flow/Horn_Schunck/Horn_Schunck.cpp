@@ -1,4 +1,3 @@
-
 ///////////////////////////////////////////////////////////////////////////////
 //
 // Horn_Schunck
@@ -9,6 +8,9 @@
 //     by Gary Bradski and Adrian Kaehler
 //     Published by O'Reilly Media, October 3, 2008
 //
+// The flow itself is now computed by the HornSchunck class below instead of
+//  cvCalcOpticalFlowHS.
+//
 ///////////////////////////////////////////////////////////////////////////////
 
 #include "Horn_Schunck.h"
@@ -16,22 +18,619 @@
 #include<iostream>
 #include<string>
 #include<sstream>
+#include<algorithm>
+
+// vector extensions, used for the sweeps if available
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define HS_USE_SSE2
+#endif
 
 using namespace std;
 
 #define CVX_GRAY50 cvScalar(100)
 #define CVX_WHITE  cvScalar(255)
 
+#define DEBUG_HS 0
+
 string itos2(int i);
 
 int outNum = 0;
 
+// the flow object used by runHornSchunck, and what it makes of the flow
+static HornSchunck *hornSchunck = NULL;
+static FlowAnalysis flowAnalysis;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// helpers
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// blurs with a 5-tap binomial filter and drops every other row and column;
+//  dst is (w+1)/2 by (h+1)/2
+static void halveImage (const float *src, int w, int h, float *dst)
+{
+    int dw = (w + 1) / 2, dh = (h + 1) / 2;
+    vector<float> rows(dw * h);
+
+    for (int y = 0; y < h; y++) {
+        const float *s = src + y * w;
+        float *r = &rows[y * dw];
+        for (int x = 0; x < dw; x++) {
+            int c = 2 * x;
+            r[x] = (s[max(c - 2, 0)] + 4 * s[max(c - 1, 0)] + 6 * s[c] +
+                    4 * s[min(c + 1, w - 1)] + s[min(c + 2, w - 1)]) * (1.0f / 16);
+        }
+    }
+
+    for (int y = 0; y < dh; y++) {
+        int c = 2 * y;
+        const float *r0 = &rows[max(c - 2, 0) * dw];
+        const float *r1 = &rows[max(c - 1, 0) * dw];
+        const float *r2 = &rows[c * dw];
+        const float *r3 = &rows[min(c + 1, h - 1) * dw];
+        const float *r4 = &rows[min(c + 2, h - 1) * dw];
+        float *d = dst + y * dw;
+        for (int x = 0; x < dw; x++) {
+            d[x] = (r0[x] + 4 * r1[x] + 6 * r2[x] + 4 * r3[x] + r4[x]) * (1.0f / 16);
+        }
+    }
+
+} // end halveImage
+
+
+// bilinear sample at (x, y), clamped to the image
+static inline float sample (const float *img, int w, int h, int stride, float x, float y)
+{
+    x = min(max(x, 0.0f), (float)(w - 1));
+    y = min(max(y, 0.0f), (float)(h - 1));
+
+    int x0 = (int)x, y0 = (int)y;
+    int x1 = min(x0 + 1, w - 1), y1 = min(y0 + 1, h - 1);
+    float fx = x - x0, fy = y - y0;
+    const float *r0 = img + y0 * stride;
+    const float *r1 = img + y1 * stride;
+
+    return (1 - fy) * ((1 - fx) * r0[x0] + fx * r0[x1]) +
+           fy * ((1 - fx) * r1[x0] + fx * r1[x1]);
+
+} // end sample
+
+
+// copies the outermost pixels of a plane into its border
+static void setBorder (float *p, int width, int height, int stride)
+{
+    for (int y = 1; y <= height; y++) {
+        p[y * stride] = p[y * stride + 1];
+        p[y * stride + width + 1] = p[y * stride + width];
+    }
+    memcpy(p, p + stride, stride * sizeof(float));
+    memcpy(p + (height + 1) * stride, p + height * stride, stride * sizeof(float));
+
+} // end setBorder
+
+
+// samples a flow plane of the level below at the pixels halveImage keeps, with
+//  a [1 2 1] filter, and halves it; both planes have a one pixel border
+static void halveFlow (const float *fine, int fineStride, float *coarse,
+                       int width, int height, int stride)
+{
+    for (int y = 0; y < height; y++) {
+        const float *f = fine + (2 * y + 1) * fineStride + 1;
+        float *c = coarse + (y + 1) * stride + 1;
+        for (int x = 0; x < width; x++) {
+            const float *p = f + 2 * x;
+            c[x] = (p[-fineStride - 1] + 2 * p[-fineStride] + p[-fineStride + 1] +
+                    2 * p[-1] + 4 * p[0] + 2 * p[1] +
+                    p[fineStride - 1] + 2 * p[fineStride] + p[fineStride + 1]) * (1.0f / 32);
+        }
+    }
+    setBorder(coarse, width, height, stride);
+
+} // end halveFlow
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// constructor
+//
+///////////////////////////////////////////////////////////////////////////////
+
+HornSchunck::HornSchunck()
+{
+    lambda = 0.001;
+    levels = 4;
+    omega = 1.8;
+    warps = 1;
+    warmLevels = 2;
+    maxSweeps = 50;
+    epsilon = 0.01;
+    timeBudget = 0;
+    warmStart = true;
+
+    velx = NULL;
+    vely = NULL;
+    grey = NULL;
+
+    flowValid = false;
+    sweeps = 0;
+
+} // end constructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// destructor
+//
+///////////////////////////////////////////////////////////////////////////////
+
+HornSchunck::~HornSchunck()
+{
+    cvReleaseImage(&velx);
+    cvReleaseImage(&vely);
+    cvReleaseImage(&grey);
+
+} // end destructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// reset
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void HornSchunck::reset ()
+{
+    flowValid = false;
+
+} // end reset
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// setFlow
+//
+// Seeds the warm start, so that the next pair only refines this flow.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void HornSchunck::setFlow (IplImage *flowX, IplImage *flowY)
+{
+    allocate(flowX->width, flowX->height);
+
+    Level &level = pyramid[0];
+    for (int y = 0; y < level.height; y++) {
+        memcpy(&level.u[(y + 1) * level.stride + 1], flowX->imageData + flowX->widthStep * y, level.width * sizeof(float));
+        memcpy(&level.v[(y + 1) * level.stride + 1], flowY->imageData + flowY->widthStep * y, level.width * sizeof(float));
+    }
+    setBorder(&level.u[0], level.width, level.height, level.stride);
+    setBorder(&level.v[0], level.width, level.height, level.stride);
+
+    flowValid = true;
+
+} // end setFlow
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// allocate
+//
+// Sizes the pyramid and the output images for frames of the given size.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void HornSchunck::allocate (int width, int height)
+{
+    int numLevels = max(levels, 1);
+
+    if (velx != NULL && velx->width == width && velx->height == height &&
+        (int)pyramid.size() == numLevels) {
+        return;
+    }
+
+    cvReleaseImage(&velx);
+    cvReleaseImage(&vely);
+    cvReleaseImage(&grey);
+    velx = cvCreateImage(cvSize(width, height), IPL_DEPTH_32F, 1);
+    vely = cvCreateImage(cvSize(width, height), IPL_DEPTH_32F, 1);
+    grey = cvCreateImage(cvSize(width, height), IPL_DEPTH_8U, 1);
+
+    pyramid.resize(numLevels);
+    for (int l = 0; l < numLevels; l++) {
+        Level &level = pyramid[l];
+        level.width = width;
+        level.height = height;
+        level.stride = width + 2;
+
+        int size = width * height;
+        int padded = (width + 2) * (height + 2);
+        level.imgA.assign(size, 0);
+        level.imgB.assign(size, 0);
+        level.warped.assign(size, 0);
+        level.u.assign(padded, 0);
+        level.v.assign(padded, 0);
+        level.u0.assign(padded, 0);
+        level.v0.assign(padded, 0);
+        level.ix.assign(padded, 0);
+        level.iy.assign(padded, 0);
+        level.it.assign(padded, 0);
+        level.alpha.assign(padded, 0);
+
+        width = (width + 1) / 2;
+        height = (height + 1) / 2;
+    }
+
+    flowValid = false;
+
+} // end allocate
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// toFloat
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void HornSchunck::toFloat (IplImage *img, vector<float> &dst)
+{
+    CvMat header, *src = cvGetMat(img, &header);
+
+    if (img->nChannels == 3) {
+        cvCvtColor(img, grey, CV_BGR2GRAY);
+        src = cvGetMat(grey, &header);
+    }
+
+    toFloat(src, dst);
+
+} // end toFloat
+
+
+void HornSchunck::toFloat (const CvMat *img, vector<float> &dst)
+{
+    for (int y = 0; y < img->rows; y++) {
+        const uchar *s = img->data.ptr + img->step * y;
+        float *d = &dst[y * img->cols];
+        for (int x = 0; x < img->cols; x++) {
+            d[x] = s[x];
+        }
+    }
+
+} // end toFloat
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// prepareLevel
+//
+// Warps the second image by the current flow and linearises the data term
+//  around it.  The sweeps then solve
+//
+//    u = ubar - Ix * (Ix*ubar + Iy*vbar + It) * alpha
+//
+//  with It taken relative to the current flow and
+//  alpha = 1 / (1/lambda + Ix^2 + Iy^2), as in cvCalcOpticalFlowHS.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void HornSchunck::prepareLevel (Level &level)
+{
+    int w = level.width, h = level.height, stride = level.stride;
+    const float *u = &level.u[stride + 1];
+    const float *v = &level.v[stride + 1];
+    float lambdaInv = (float)(1.0 / lambda);
+
+    // warp, and average the images for the gradients
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int y = 0; y < h; y++) {
+        for (int x = 0; x < w; x++) {
+            int p = y * w + x, q = y * stride + x;
+            float b = sample(&level.imgB[0], w, h, w, x + u[q], y + v[q]);
+            level.warped[p] = b;
+        }
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int y = 0; y < h; y++) {
+        const float *a = &level.imgA[0];
+        const float *b = &level.warped[0];
+        int ym = max(y - 1, 0) * w, yc = y * w, yp = min(y + 1, h - 1) * w;
+        for (int x = 0; x < w; x++) {
+            int xm = max(x - 1, 0), xp = min(x + 1, w - 1);
+
+            // sobel of the mean image, scaled by 1/8
+            float gx = (a[ym + xp] + b[ym + xp]) + 2 * (a[yc + xp] + b[yc + xp]) + (a[yp + xp] + b[yp + xp]) -
+                       (a[ym + xm] + b[ym + xm]) - 2 * (a[yc + xm] + b[yc + xm]) - (a[yp + xm] + b[yp + xm]);
+            float gy = (a[yp + xm] + b[yp + xm]) + 2 * (a[yp + x] + b[yp + x]) + (a[yp + xp] + b[yp + xp]) -
+                       (a[ym + xm] + b[ym + xm]) - 2 * (a[ym + x] + b[ym + x]) - (a[ym + xp] + b[ym + xp]);
+            gx *= 1.0f / 16;
+            gy *= 1.0f / 16;
+
+            int q = (y + 1) * stride + x + 1;
+            float gt = b[yc + x] - a[yc + x];
+            level.ix[q] = gx;
+            level.iy[q] = gy;
+            level.it[q] = gt - gx * u[y * stride + x] - gy * v[y * stride + x];
+            level.alpha[q] = 1 / (lambdaInv + gx * gx + gy * gy);
+        }
+    }
+
+} // end prepareLevel
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// sweep
+//
+// Updates the pixels of one colour of the checkerboard, which only depend on
+//  pixels of the other colour, so rows can be updated at the same time.
+//  Returns the largest change.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+float HornSchunck::sweep (Level &level, int colour)
+{
+    int w = level.width, h = level.height, stride = level.stride;
+    float om = (float)omega;
+    vector<float> rowChange(h);
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int y = 0; y < h; y++) {
+        int row = (y + 1) * stride + 1;
+        float *u = &level.u[row];
+        float *v = &level.v[row];
+        const float *ix = &level.ix[row];
+        const float *iy = &level.iy[row];
+        const float *it = &level.it[row];
+        const float *alpha = &level.alpha[row];
+        float change = 0;
+        int x = (colour + y) & 1;
+
+#ifdef HS_USE_SSE2
+        // four pixels of the colour, from eight in a row
+        const __m128 quarter = _mm_set1_ps(0.25f);
+        const __m128 omv = _mm_set1_ps(om);
+        const __m128 absMask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+        __m128 changev = _mm_setzero_ps();
+
+#define HS_EVEN(p) _mm_shuffle_ps(_mm_loadu_ps(p), _mm_loadu_ps((p) + 4), _MM_SHUFFLE(2, 0, 2, 0))
+#define HS_ODD(p)  _mm_shuffle_ps(_mm_loadu_ps(p), _mm_loadu_ps((p) + 4), _MM_SHUFFLE(3, 1, 3, 1))
+
+        for (; x + 7 <= w; x += 8) {
+            __m128 uc = HS_EVEN(u + x), vc = HS_EVEN(v + x);
+            __m128 ub = _mm_add_ps(_mm_add_ps(HS_EVEN(u + x - 1), HS_ODD(u + x)),
+                                   _mm_add_ps(HS_EVEN(u + x - stride), HS_EVEN(u + x + stride)));
+            __m128 vb = _mm_add_ps(_mm_add_ps(HS_EVEN(v + x - 1), HS_ODD(v + x)),
+                                   _mm_add_ps(HS_EVEN(v + x - stride), HS_EVEN(v + x + stride)));
+            ub = _mm_mul_ps(ub, quarter);
+            vb = _mm_mul_ps(vb, quarter);
+
+            __m128 gx = HS_EVEN(ix + x), gy = HS_EVEN(iy + x);
+            __m128 t = _mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, ub), _mm_mul_ps(gy, vb)), HS_EVEN(it + x));
+            t = _mm_mul_ps(t, HS_EVEN(alpha + x));
+
+            __m128 du = _mm_mul_ps(omv, _mm_sub_ps(_mm_sub_ps(ub, _mm_mul_ps(gx, t)), uc));
+            __m128 dv = _mm_mul_ps(omv, _mm_sub_ps(_mm_sub_ps(vb, _mm_mul_ps(gy, t)), vc));
+            changev = _mm_max_ps(changev, _mm_max_ps(_mm_and_ps(du, absMask), _mm_and_ps(dv, absMask)));
+            uc = _mm_add_ps(uc, du);
+            vc = _mm_add_ps(vc, dv);
+
+            // store the pixels of this colour only; the others may be read
+            //  by the neighbouring rows
+            _mm_store_ss(u + x, uc);
+            _mm_store_ss(u + x + 2, _mm_shuffle_ps(uc, uc, _MM_SHUFFLE(1, 1, 1, 1)));
+            _mm_store_ss(u + x + 4, _mm_shuffle_ps(uc, uc, _MM_SHUFFLE(2, 2, 2, 2)));
+            _mm_store_ss(u + x + 6, _mm_shuffle_ps(uc, uc, _MM_SHUFFLE(3, 3, 3, 3)));
+            _mm_store_ss(v + x, vc);
+            _mm_store_ss(v + x + 2, _mm_shuffle_ps(vc, vc, _MM_SHUFFLE(1, 1, 1, 1)));
+            _mm_store_ss(v + x + 4, _mm_shuffle_ps(vc, vc, _MM_SHUFFLE(2, 2, 2, 2)));
+            _mm_store_ss(v + x + 6, _mm_shuffle_ps(vc, vc, _MM_SHUFFLE(3, 3, 3, 3)));
+        }
+
+#undef HS_EVEN
+#undef HS_ODD
+
+        float c4[4];
+        _mm_storeu_ps(c4, changev);
+        change = max(max(c4[0], c4[1]), max(c4[2], c4[3]));
+#endif
+
+        for (; x < w; x += 2) {
+            float ub = ((u[x - 1] + u[x + 1]) + (u[x - stride] + u[x + stride])) * 0.25f;
+            float vb = ((v[x - 1] + v[x + 1]) + (v[x - stride] + v[x + stride])) * 0.25f;
+            float t = (ix[x] * ub + iy[x] * vb + it[x]) * alpha[x];
+            float du = om * ((ub - ix[x] * t) - u[x]);
+            float dv = om * ((vb - iy[x] * t) - v[x]);
+            change = max(change, max(fabsf(du), fabsf(dv)));
+            u[x] += du;
+            v[x] += dv;
+        }
+
+        rowChange[y] = change;
+    }
+
+    setBorder(&level.u[0], w, h, stride);
+    setBorder(&level.v[0], w, h, stride);
+
+    return *max_element(rowChange.begin(), rowChange.end());
+
+} // end sweep
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// computeFlow
+//
+// Computes the flow from imgA to imgB.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void HornSchunck::computeFlow (IplImage *imgA, IplImage *imgB)
+{
+    allocate(imgA->width, imgA->height);
+    int numLevels = (int)pyramid.size();
+
+    // image pyramids
+    toFloat(imgA, pyramid[0].imgA);
+    toFloat(imgB, pyramid[0].imgB);
+    for (int l = 1; l < numLevels; l++) {
+        Level &fine = pyramid[l - 1];
+        halveImage(&fine.imgA[0], fine.width, fine.height, &pyramid[l].imgA[0]);
+        halveImage(&fine.imgB[0], fine.width, fine.height, &pyramid[l].imgB[0]);
+    }
+
+    solve();
+
+} // end computeFlow
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// computeFlow
+//
+// Computes the flow from frameA to frameB.  The shared pyramids are halved
+//  the same way as halveImage, but rounded to 8 bits; levels above the ones
+//  the frames have are halved here.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void HornSchunck::computeFlow (const FlowFrame *frameA, const FlowFrame *frameB)
+{
+    allocate(frameA->getWidth(), frameA->getHeight());
+    int numLevels = (int)pyramid.size();
+    int shared = min(frameA->getLevels(), frameB->getLevels());
+
+    for (int l = 0; l < numLevels; l++) {
+        if (l < shared) {
+            CvMat levelA = frameA->getLevel(l), levelB = frameB->getLevel(l);
+            toFloat(&levelA, pyramid[l].imgA);
+            toFloat(&levelB, pyramid[l].imgB);
+        } else {
+            Level &fine = pyramid[l - 1];
+            halveImage(&fine.imgA[0], fine.width, fine.height, &pyramid[l].imgA[0]);
+            halveImage(&fine.imgB[0], fine.width, fine.height, &pyramid[l].imgB[0]);
+        }
+    }
+
+    solve();
+
+} // end computeFlow
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// solve
+//
+// Solves for the flow on the pyramid, coarse to fine.  Without a previous
+//  flow the pass starts at the coarsest level from zero; with one it starts
+//  warmLevels from the bottom, from the previous flow, since the flow of
+//  consecutive pairs differs little.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void HornSchunck::solve ()
+{
+    int64 start = cvGetTickCount();
+    double ticksPerSecond = cvGetTickFrequency() * 1e6;
+
+    int numLevels = (int)pyramid.size();
+
+    // the coarsest level solved starts from the previous flow, halved down
+    //  to it, or from zero
+    int top = numLevels - 1;
+    if (warmStart == true && flowValid == true) {
+        top = min(max(warmLevels, 1), numLevels) - 1;
+        pyramid[0].u0 = pyramid[0].u;
+        pyramid[0].v0 = pyramid[0].v;
+        for (int l = 1; l <= top; l++) {
+            Level &fine = pyramid[l - 1], &coarse = pyramid[l];
+            halveFlow(&fine.u0[0], fine.stride, &coarse.u0[0], coarse.width, coarse.height, coarse.stride);
+            halveFlow(&fine.v0[0], fine.stride, &coarse.v0[0], coarse.width, coarse.height, coarse.stride);
+        }
+    } else {
+        fill(pyramid[top].u0.begin(), pyramid[top].u0.end(), 0.0f);
+        fill(pyramid[top].v0.begin(), pyramid[top].v0.end(), 0.0f);
+    }
+
+    sweeps = 0;
+    for (int l = top; l >= 0; l--) {
+        Level &level = pyramid[l];
+        int stride = level.stride;
+
+        // starting flow, from the level above
+        if (l == top) {
+            level.u = level.u0;
+            level.v = level.v0;
+        } else {
+            Level &coarse = pyramid[l + 1];
+            for (int y = 0; y < level.height; y++) {
+                float cy = y * 0.5f;
+                for (int x = 0; x < level.width; x++) {
+                    float cx = x * 0.5f;
+                    int q = (y + 1) * stride + x + 1;
+                    level.u[q] = 2 * sample(&coarse.u[coarse.stride + 1], coarse.width, coarse.height, coarse.stride, cx, cy);
+                    level.v[q] = 2 * sample(&coarse.v[coarse.stride + 1], coarse.width, coarse.height, coarse.stride, cx, cy);
+                }
+            }
+        }
+        setBorder(&level.u[0], level.width, level.height, stride);
+        setBorder(&level.v[0], level.width, level.height, stride);
+
+        for (int warp = 0; warp < max(warps, 1); warp++) {
+            prepareLevel(level);
+
+            for (int s = 0; s < maxSweeps; s++) {
+                float change = sweep(level, 0);
+                change = max(change, sweep(level, 1));
+                sweeps++;
+
+                if (change < epsilon) {
+                    break;
+                }
+                if (timeBudget > 0 && (cvGetTickCount() - start) / ticksPerSecond > timeBudget) {
+                    break;
+                }
+            }
+        }
+    }
+
+    // finest flow out
+    Level &level = pyramid[0];
+    for (int y = 0; y < level.height; y++) {
+        float *px = (float*)(velx->imageData + velx->widthStep * y);
+        float *py = (float*)(vely->imageData + vely->widthStep * y);
+        memcpy(px, &level.u[(y + 1) * level.stride + 1], level.width * sizeof(float));
+        memcpy(py, &level.v[(y + 1) * level.stride + 1], level.width * sizeof(float));
+    }
+
+    flowValid = true;
+
+} // end solve
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// initHornSchunck
+//
+///////////////////////////////////////////////////////////////////////////////
+
 void initHornSchunck ()
 {
 
     cvNamedWindow("OpticalFlow0");
     cvNamedWindow("OpticalFlow1");
     cvNamedWindow("Flow Results");
+
+    if (hornSchunck == NULL) {
+        hornSchunck = new HornSchunck();
+    }
 }
 
 void endHornSchunck ()
@@ -41,57 +640,68 @@ void endHornSchunck ()
     cvDestroyWindow("OpticalFlow1");
     cvDestroyWindow("Flow Results");
 
+    delete hornSchunck;
+    hornSchunck = NULL;
+
 }
 
-int runHornSchunck (IplImage *imgA, IplImage *imgB)
+int runHornSchunck (IplImage *imgA, IplImage *imgB, bool display, bool save)
 {
-    IplImage* velx = cvCreateImage(cvGetSize(imgA), IPL_DEPTH_32F, 1);
-    printf("HS::created velx\n");
+    static IplImage *imgC = NULL;
 
-    IplImage* vely = cvCreateImage(cvGetSize(imgA), IPL_DEPTH_32F, 1);
-    printf("HS::created vely\n");
-
-    IplImage* imgC = cvCreateImage(cvGetSize(imgA), IPL_DEPTH_8U, 3);
-    printf("HS::created imgc\n");
-
-    cvShowImage("OpticalFlow0", imgA);
-    cvShowImage("OpticalFlow1", imgB);
+    if (hornSchunck == NULL) {
+        hornSchunck = new HornSchunck();
+    }
 
     // call the actual Horn and Schunck algorithm
-    cvCalcOpticalFlowHS(imgA, imgB, 0, velx, vely, 0.10, cvTermCriteria(CV_TERMCRIT_ITER | CV_TERMCRIT_EPS, imgA->width, 1e-6));
-
-    // how show what we are looking at
-    cvZero(imgC);
-    int step = 4;
-    for (int y=0; y<imgC->height; y += step) {
-        float *px = (float*) (velx->imageData + y * velx->widthStep);
-        float *py = (float*) (vely->imageData + y * vely->widthStep);
-        for (int x=0; x<imgC->width; x += step) {
-            if (px[x]>1 && py[x]>1) {
-                cvCircle(imgC, cvPoint(x, y), 2, CVX_GRAY50, -1);
-                cvLine(imgC, cvPoint(x, y), cvPoint( x+px[x]/2, y+py[x]/2 ), CV_RGB(255,0,0), 1, 0);
-            }
+    hornSchunck->computeFlow(imgA, imgB);
+    flowAnalysis.analyse(hornSchunck->getVelX(), hornSchunck->getVelY());
+    if (DEBUG_HS) {
+        printf("HS::%d sweeps, motion %.2f %.2f, %d moving\n", hornSchunck->getSweeps(),
+               flowAnalysis.getTranslationX(), flowAnalysis.getTranslationY(), flowAnalysis.getMovingPixels());
+    }
+
+    if (display == true || save == true) {
+        if (imgC != NULL && (imgC->width != imgA->width || imgC->height != imgA->height)) {
+            cvReleaseImage(&imgC);
+        }
+        if (imgC == NULL) {
+            imgC = cvCreateImage(cvGetSize(imgA), IPL_DEPTH_8U, 3);
         }
+
+        // how show what we are looking at
+        cvZero(imgC);
+        flowAnalysis.draw(imgC);
     }
 
-    // show tracking
-    cvShowImage("Flow Results",imgC);
+    if (display == true) {
+        cvShowImage("OpticalFlow0", imgA);
+        cvShowImage("OpticalFlow1", imgB);
+
+        // show tracking
+        cvShowImage("Flow Results",imgC);
+        cvWaitKey(10);
+    }
 
-    // save the output to /tmp
-    string fileName = "/tmp/out" + itos2(outNum) + ".bmp";
-    cvSaveImage(fileName.c_str(), imgC);
-    outNum++;
-    
-    cvWaitKey(10);
+    if (save == true) {
+        // save the output to /tmp
+        string fileName = "/tmp/out" + itos2(outNum) + ".bmp";
+        cvSaveImage(fileName.c_str(), imgC);
+        outNum++;
+    }
 
     // release memory
     cvReleaseImage( &imgA );
     cvReleaseImage( &imgB );
-    cvReleaseImage( &imgC );
 
     return 0;
 }
 
+FlowAnalysis *getHornSchunckAnalysis ()
+{
+    return &flowAnalysis;
+}
+
 ///////////////////////////////////////////////////////////////////////////////
 //
 // itos
@@ -1,4 +1,3 @@
-
 #ifndef HORN_SCHUNCK_H
 #define HORN_SCHUNCK_H
 
@@ -7,8 +6,115 @@
 #include <math.h>
 #include <stdio.h>
 
+#include <vector>
+
+#include "tracking_algorithms/Optical_Flow/Flow_Analysis/Flow_Analysis.h"
+#include "tracking_algorithms/Optical_Flow/Flow_Frame/Flow_Frame.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// HornSchunck
+//
+// Dense Horn and Schunck optical flow, solved coarse to fine on an image
+//  pyramid with red-black successive over-relaxation.  Each level warps the
+//  second image by the flow so far and solves for the rest.  The flow of one
+//  frame pair can seed the next one, and the solver stops on a residual or a
+//  time budget.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class HornSchunck
+{
+    public:
+
+        // weight of the data term against smoothness, as for
+        //  cvCalcOpticalFlowHS; warping needs more smoothness than a single
+        //  solve, so this is well below the 0.10 used with that
+        double lambda;
+
+        // pyramid levels, 1 for the full image only
+        int levels;
+
+        // over-relaxation factor, 1 for plain Gauss-Seidel
+        double omega;
+
+        // times each level warps the second image by the flow and solves
+        //  again
+        int warps;
+
+        // sweeps per warp at most
+        int maxSweeps;
+
+        // a level stops when no velocity changes by more than this in a sweep
+        double epsilon;
+
+        // seconds per frame pair, 0 for no limit; every level still gets one
+        //  sweep
+        double timeBudget;
+
+        // start from the flow of the previous pair, solving only the bottom
+        //  warmLevels levels of the pyramid
+        bool warmStart;
+        int warmLevels;
+
+        HornSchunck();
+        ~HornSchunck();
+
+        // flow from imgA to imgB, 8-bit grey or BGR of the same size
+        void computeFlow (IplImage *imgA, IplImage *imgB);
+
+        // flow between two frames made grey with their pyramids, whose levels
+        //  are used in place of the ones made here
+        void computeFlow (const FlowFrame *frameA, const FlowFrame *frameB);
+
+        // 32-bit float velocities of the last pair, owned by the object
+        IplImage *getVelX () { return velx; }
+        IplImage *getVelY () { return vely; }
+
+        // sweeps made over all levels for the last pair
+        int getSweeps () const { return sweeps; }
+
+        // forget the previous flow
+        void reset ();
+
+        // start the next pair from this flow, as if it were the previous
+        //  one; two 32-bit float planes the size of the next frames
+        void setFlow (IplImage *flowX, IplImage *flowY);
+
+    private:
+
+        // one pyramid level; the flow and coefficient planes have a one
+        //  pixel border so that every pixel has four neighbours
+        struct Level {
+            int width, height, stride;
+            std::vector<float> imgA, imgB, warped;
+            std::vector<float> u, v, u0, v0;
+            std::vector<float> ix, iy, it, alpha;
+        };
+
+        void allocate (int width, int height);
+        void toFloat (IplImage *img, std::vector<float> &dst);
+        void toFloat (const CvMat *img, std::vector<float> &dst);
+        void solve ();
+        void prepareLevel (Level &level);
+        float sweep (Level &level, int colour);
+
+        std::vector<Level> pyramid;
+
+        IplImage *velx, *vely;
+        IplImage *grey;
+
+        bool flowValid;
+        int sweeps;
+
+};
+
 void initHornSchunck ();
 void endHornSchunck ();
-int runHornSchunck (IplImage *imgA, IplImage *imgB);
+// display shows the images and the flow, save writes the flow to /tmp
+int runHornSchunck (IplImage *imgA, IplImage *imgB, bool display = true, bool save = false);
+
+// what runHornSchunck made of its last flow
+FlowAnalysis *getHornSchunckAnalysis ();
 
 #endif
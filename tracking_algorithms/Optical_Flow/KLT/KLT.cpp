@@ -9,6 +9,10 @@
 
 #include "KLT.h"
 
+#include<algorithm>
+
+using namespace std;
+
 #define DEBUG_KLT 1
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -30,6 +34,14 @@ KLT::KLT()
     lkFlags = 0;
     lkRanOnce = false;
 
+    lkCurrent = 0;
+    lkCount = 0;
+    lkTracked = 0;
+    lkPoints[0] = (CvPoint2D32f *)cvAlloc(MAX_COUNT * sizeof(lkPoints[0][0]));
+    lkPoints[1] = (CvPoint2D32f *)cvAlloc(MAX_COUNT * sizeof(lkPoints[0][0]));
+    lkStatus = (char *)cvAlloc(MAX_COUNT);
+    lkFeatureError = (float *)cvAlloc(MAX_COUNT * sizeof(lkFeatureError[0]));
+
     count = 0;
 
     printf("KLT :: out constructor\n");
@@ -49,6 +61,10 @@ KLT::KLT()
 
 KLT::~KLT()
 {
+    cvFree(&lkPoints[1]);
+    cvFree(&lkPoints[0]);
+    cvFree(&lkStatus);
+    cvFree(&lkFeatureError);
 
 } // end destructor
 
@@ -57,85 +73,143 @@ KLT::~KLT()
 //
 // lkOpticalFlow
 //
-// This function takes in an RGB image.  This needs to be changed to take in
-//  the grayscale image instead.
+// This function takes in a BGR image, makes it grey with its pyramid, and
+//  tracks the features from the previous one.
 //
 ///////////////////////////////////////////////////////////////////////////////
 
 void KLT::lkOpticalFlow (IplImage *frame)
 {
-    printf("KLT is starting....%d\n", count);
-    printf("frame is [%d,%d] and %d channels\n", frame->height, frame->width, frame->nChannels);
-
-    // initialize our buffers
-    if (lkInitialized == false) {
-        lkImage = cvCreateImage(cvGetSize(frame), 8, 3);
-        lkImage->origin = frame->origin;
-        lkGrey = cvCreateImage(cvGetSize(frame), 8, 1);
-        lkPrevGrey = cvCreateImage(cvGetSize(frame), 8, 1);
-        lkPyramid = cvCreateImage(cvGetSize(frame), 8, 1);
-        lkPrevPyramid = cvCreateImage(cvGetSize(frame), 8, 1);
-        lkPoints[0] = (CvPoint2D32f *)cvAlloc(MAX_COUNT * sizeof(lkPoints[0][0]));
-        lkPoints[1] = (CvPoint2D32f *)cvAlloc(MAX_COUNT * sizeof(lkPoints[0][0]));
-        lkStatus = (char *)cvAlloc(MAX_COUNT);
-        lkFeatureError = (float *)cvAlloc(MAX_COUNT);
-    }
+    int previous = lkCurrent;
+    lkCurrent = 1 - lkCurrent;
+
+    lkFrames[lkCurrent].set(frame, max(numLevels, 1));
+    lkOpticalFlow(&lkFrames[previous], &lkFrames[lkCurrent]);
+
+} // end lkOpticalFlow
+
 
-    cvCopy(frame, lkImage, 0);
-    cvCvtColor(lkImage, lkGrey, CV_BGR2GRAY);
+///////////////////////////////////////////////////////////////////////////////
+//
+// lkOpticalFlow
+//
+// Finds the features on the first frame, and tracks them from then on.  The
+//  pyramids of both frames are already made, so cvCalcOpticalFlowPyrLK only
+//  tracks; features it loses are dropped, and once fewer than MIN_COUNT are
+//  left new ones are found away from them.
+//
+///////////////////////////////////////////////////////////////////////////////
 
+void KLT::lkOpticalFlow (const FlowFrame *previous, const FlowFrame *current)
+{
     if (DEBUG_KLT) {
-        printf("end copy and convert color...\n");
+        printf("KLT is starting....%d\n", count);
     }
 
-    if (lkInitialized == false) printf("init is FALSE\n");
-    if (lkInitialized == true)  printf("init is TRUE\n");
+    bool havePrevious = previous != NULL && previous->isValid() == true &&
+                        previous->getWidth() == current->getWidth() &&
+                        previous->getHeight() == current->getHeight();
 
-    if (lkInitialized == false) {
+    if (lkInitialized == false || havePrevious == false) {
 
-        printf("klt :: here1\n");
+        lkCount = findFeatures(current->getGrey(), 0);
+        lkTracked = 0;
 
-        IplImage *eig  = cvCreateImage(cvGetSize(lkGrey), 32, 1);
-        IplImage *temp = cvCreateImage(cvGetSize(lkGrey), 32, 1);
+        lkInitialized = true;
 
-        lkCount = MAX_COUNT;
+        if (DEBUG_KLT) {
+            printf("lkCount = %d\n", lkCount);
+        }
+
+    } else {
+
+        // the levels above the image, as many as both pyramids have
+        int maxLevel = min(max(numLevels, 1), min(previous->getLevels(), current->getLevels())) - 1;
+        lkFlags = CV_LKFLOW_PYR_A_READY | CV_LKFLOW_PYR_B_READY;
+
+        CV_SWAP(lkPoints[0], lkPoints[1], lkSwapPoints);
+
+        if (lkCount > 0) {
+            cvCalcOpticalFlowPyrLK(previous->getGrey(), current->getGrey(), previous->getPyramid(), current->getPyramid(),
+                lkPoints[1], lkPoints[0], lkCount, cvSize(winSize, winSize), maxLevel, lkStatus, lkFeatureError,
+                cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 20, 0.03), lkFlags);
+        }
+
+        // keep the features that were found, in both frames
+        int k = 0;
+        for (int i = 0; i < lkCount; i++) {
+            if (lkStatus[i] == 0) {
+                continue;
+            }
+            lkPoints[0][k] = lkPoints[0][i];
+            lkPoints[1][k] = lkPoints[1][i];
+            lkFeatureError[k] = lkFeatureError[i];
+            k++;
+        }
+        lkCount = k;
+        lkTracked = k;
+
+        if (lkCount < MIN_COUNT) {
+            lkCount = findFeatures(current->getGrey(), lkCount);
+
+            if (DEBUG_KLT) {
+                printf("KLT :: %d tracked, now %d features\n", lkTracked, lkCount);
+            }
+        }
 
-        cvGoodFeaturesToTrack(lkGrey, eig, temp, lkPoints[1], &lkCount, quality, minDistance, 0, 3, 0, 0.04);
+        lkRanOnce = true;
 
-        cvFindCornerSubPix(lkGrey, lkPoints[1], lkCount, cvSize(winSize, winSize), cvSize(-1,-1),
-            cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 20, 0.03));
+    }
 
-        printf("klt :: here2\n");
-        printf("lkCount = %d\n", lkCount);
+    count++;
 
-        cvReleaseImage(&eig);
-        cvReleaseImage(&temp);
+} // end lkOpticalFlow
 
-        lkInitialized = true;
 
-        printf("klt :: here3\n");
-        printf("lkCount = %d\n", lkCount);
+///////////////////////////////////////////////////////////////////////////////
+//
+// findFeatures
+//
+// Finds features on a grey image after the first start, and at least
+//  minDistance from them.  The new features have not moved, so they are in
+//  both lkPoints.  Returns the number of features there are now.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+int KLT::findFeatures (IplImage *grey, int start)
+{
+    IplImage *eig  = cvCreateImage(cvGetSize(grey), 32, 1);
+    IplImage *temp = cvCreateImage(cvGetSize(grey), 32, 1);
+    IplImage *mask = NULL;
+
+    if (start > 0) {
+        mask = cvCreateImage(cvGetSize(grey), 8, 1);
+        cvSet(mask, cvScalar(255));
+        for (int i = 0; i < start; i++) {
+            cvCircle(mask, cvPointFrom32f(lkPoints[0][i]), cvRound(minDistance), cvScalar(0), -1, 8, 0);
+        }
+    }
 
-    } else if (lkCount > 0) {
+    int found = MAX_COUNT - start;
 
-        cvCalcOpticalFlowPyrLK(lkPrevGrey, lkGrey, lkPrevPyramid, lkPyramid, lkPoints[0],
-            lkPoints[1], lkCount, cvSize(winSize, winSize), 3, lkStatus, 0,
-            cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 20, 0.03), lkFlags);
-        lkFlags |= CV_LKFLOW_PYR_A_READY;
+    cvGoodFeaturesToTrack(grey, eig, temp, lkPoints[0] + start, &found, quality, minDistance, mask, 3, 0, 0.04);
 
-        lkRanOnce = true;
+    if (found > 0) {
+        cvFindCornerSubPix(grey, lkPoints[0] + start, found, cvSize(winSize, winSize), cvSize(-1,-1),
+            cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS, 20, 0.03));
 
+        // nothing has moved yet
+        memcpy(lkPoints[1] + start, lkPoints[0] + start, found * sizeof(lkPoints[0][0]));
+        memset(lkFeatureError + start, 0, found * sizeof(lkFeatureError[0]));
     }
 
-    CV_SWAP(lkPrevGrey, lkGrey, lkSwapTemp);
-    CV_SWAP(lkPrevPyramid, lkPyramid, lkSwapTemp);
-    CV_SWAP(lkPoints[0], lkPoints[1], lkSwapPoints);
-
-    printf("Done swapping...\n");
+    cvReleaseImage(&mask);
+    cvReleaseImage(&eig);
+    cvReleaseImage(&temp);
 
-    count++;
+    return start + found;
 
-} // end lkOpticalFlow
+} // end findFeatures
 
 
 ///////////////////////////////////////////////////////////////////////////////
@@ -146,20 +220,7 @@ void KLT::lkOpticalFlow (IplImage *frame)
 
 void KLT::lkResetOpticalFlow ()
 {
-    if (lkRanOnce == true) {
-        lkInitialized = false;
-        lkRanOnce = false;
-
-        cvReleaseImage(&lkGrey);
-        cvReleaseImage(&lkPrevGrey);
-        cvReleaseImage(&lkPyramid);
-        cvReleaseImage(&lkPrevPyramid);
-
-        cvFree(&lkPoints[1]);
-        cvFree(&lkPoints[0]);
-        cvFree(&lkStatus);
-
-    }
+    reset(0);
 
 } // end lkResetOpticalFlow
 
@@ -168,24 +229,22 @@ void KLT::lkResetOpticalFlow ()
 //
 // reset
 //
+// The next frame finds new features.  The buffers are kept, whatever
+//  releaseMemory says, since the frames are the same size from one reset to
+//  the next.
+//
 ///////////////////////////////////////////////////////////////////////////////
 
 void KLT::reset (int releaseMemory)
 {
-    if (lkRanOnce == true) {
-        lkInitialized = false;
-        lkRanOnce = false;
-
-        cvReleaseImage(&lkGrey);
-        cvReleaseImage(&lkPrevGrey);
-        cvReleaseImage(&lkPyramid);
-        cvReleaseImage(&lkPrevPyramid);
-
-        cvFree(&lkPoints[1]);
-        cvFree(&lkPoints[0]);
-        cvFree(&lkStatus);
+    lkInitialized = false;
+    lkRanOnce = false;
+    lkFlags = 0;
+    lkCount = 0;
+    lkTracked = 0;
 
-    }
+    lkFrames[0].clear();
+    lkFrames[1].clear();
 
 } // end reset
 
@@ -201,10 +260,8 @@ void KLT::reset (int releaseMemory)
 void KLT::drawFeatures (IplImage *draw)
 {
     printf("KLT :: drawing %d features...\n", lkCount);
-    int i=0, k=0;
-    for (k=i=0; i<lkCount; i++) {
-        lkPoints[1][k++] = lkPoints[1][i];
-        cvCircle(draw, cvPointFrom32f(lkPoints[1][i]), 3, CV_RGB(0,0,255), -1, 8, 0);
+    for (int i=0; i<lkCount; i++) {
+        cvCircle(draw, cvPointFrom32f(lkPoints[0][i]), 3, CV_RGB(0,0,255), -1, 8, 0);
     }
 
 } // end drawFeatures
@@ -9,8 +9,13 @@
 #include <gsl/gsl_matrix.h>
 #include <gsl/gsl_blas.h>
 
+#include "tracking_algorithms/Optical_Flow/Flow_Frame/Flow_Frame.h"
+
 #define MAX_COUNT 500
 
+// below this many features, new ones are found to make up the numbers
+#define MIN_COUNT (MAX_COUNT / 4)
+
 class KLT
 {
     public:
@@ -21,11 +26,9 @@ class KLT
         bool lkInitialized;
         bool lkRanOnce;
 
-        IplImage *lkGrey;
-        IplImage *lkPrevGrey;
-        IplImage *lkPyramid;
-        IplImage *lkPrevPyramid;
-        IplImage *lkSwapTemp;
+        // the frames of lkOpticalFlow (IplImage *), used in turn
+        FlowFrame lkFrames[2];
+        int lkCurrent;
 
         char *lkStatus;
 
@@ -33,10 +36,14 @@ class KLT
         //  between the template and the matched region
         float *lkFeatureError;
 
+        // after each call lkPoints[0] holds where the features are, and
+        //  lkPoints[1] where the same features were in the previous frame;
+        //  the first lkTracked of them were tracked, and the rest were found
+        //  on this frame, so have not moved
         int lkCount;
+        int lkTracked;
         int lkFlags;
         CvPoint2D32f *lkPoints[2], *lkSwapPoints;
-        IplImage *lkImage;
 
         double quality;
         double minDistance;
@@ -50,12 +57,17 @@ class KLT
 
         int findGoodFeatures (IplImage *);
         void lkOpticalFlow (IplImage *);
+        // the same on frames already made grey with their pyramids; previous
+        //  is NULL or empty for the first frame
+        void lkOpticalFlow (const FlowFrame *previous, const FlowFrame *current);
         void lkResetOpticalFlow();
         void drawFeatures(IplImage *);
         void reset(int releaseMemory);
 
     private:
 
+        int findFeatures (IplImage *grey, int start);
+
 };
 
 #endif
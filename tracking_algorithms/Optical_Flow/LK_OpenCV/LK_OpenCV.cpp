@@ -1,4 +1,3 @@
-
 ///////////////////////////////////////////////////////////////////////////////
 //
 // LK_OpenCV.cpp
@@ -9,18 +8,22 @@
 
 #include "LK_OpenCV.h"
 
-IplImage *image = 0, *grey = 0, *prev_grey = 0, *pyramid = 0, *prev_pyramid = 0, *swap_temp;
+#include<algorithm>
+
+// the state is kept here between frames, and is private to this file
+static IplImage *image = 0;
+static FlowFrame frames[2];
+static int current_frame = 0;
 
-int win_size = 10;
-const int MAX_COUNT = 500;
-CvPoint2D32f* points[2] = {0,0}, *swap_points;
-char* status = 0;
-//int count = 0;
-int need_to_init = 1;
-int night_mode = 0;
-int flags = 0;
-int add_remove_pt = 0;
-CvPoint pt;
+static int win_size = 10;
+static const int MAX_COUNT = 500;
+static CvPoint2D32f* points[2] = {0,0}, *swap_points;
+static char* status = 0;
+static int count = 0;
+static int need_to_init = 1;
+static int night_mode = 0;
+static int add_remove_pt = 0;
+static CvPoint pt;
 
 void initLKOpenCV ()
 {
@@ -35,28 +38,66 @@ void endLKOpenCV ()
 
 int runLKOpenCV (IplImage *imgA)
 {
-    int i=0, k=0, c=0;
-
+    int c=0;
 
     if (!image) {
-        // allocate all the buffers
         image = cvCreateImage(cvGetSize(imgA), 8, 3);
         image->origin = imgA->origin;
-        grey = cvCreateImage(cvGetSize(imgA), 8, 1);
-        prev_grey = cvCreateImage(cvGetSize(imgA), 8, 1);
-        pyramid = cvCreateImage(cvGetSize(imgA), 8, 1);
-        prev_pyramid = cvCreateImage(cvGetSize(imgA), 8, 1);
+    }
+
+    // convert to grayscale, with the pyramid
+    int previous = current_frame;
+    current_frame = 1 - current_frame;
+    frames[current_frame].set(imgA, 4);
+
+    runLKOpenCV(&frames[previous], &frames[current_frame]);
+
+    cvCopy(imgA, image, 0);
+    if (night_mode) {
+        cvZero(image);
+    }
+    drawLKOpenCV(image);
+
+    cvShowImage("LK_OpenCV", image);
+    c = cvWaitKey(10);
+//
+//    if ((char)c == 27) {
+//        break;
+//    }
+    switch ((char) c) {
+    case 'r':
+        need_to_init = 1;
+        break;
+    case 'c':
+        count = 0;
+        break;
+    case 'n':
+        night_mode ^= 1;
+        break;
+    default:
+        ;
+    }
+
+    return 0;
+}
+
+int runLKOpenCV (const FlowFrame *previous, const FlowFrame *current)
+{
+    int i=0, k=0;
+    IplImage *grey = current->getGrey();
+
+    if (!points[0]) {
+        // allocate the buffers
         points[0] = (CvPoint2D32f*)cvAlloc(MAX_COUNT * sizeof(points[0][0]));
         points[1] = (CvPoint2D32f*)cvAlloc(MAX_COUNT * sizeof(points[0][0]));
         status = (char*)cvAlloc(MAX_COUNT);
-        flags = 0;
     }
 
-    // convert to grayscale
-    cvCopy(imgA, image, 0);
-    cvCvtColor(image, grey, CV_BGR2GRAY);
+    bool have_previous = previous != NULL && previous->isValid() &&
+                         previous->getWidth() == current->getWidth() &&
+                         previous->getHeight() == current->getHeight();
 
-    if (need_to_init) {
+    if (need_to_init || !have_previous) {
 
         // automatic initialization
         IplImage *eig  = cvCreateImage(cvGetSize(grey), 32, 1);
@@ -64,21 +105,24 @@ int runLKOpenCV (IplImage *imgA)
         double quality = 0.01;
         double min_distance = 10;
 
-        //count = MAX_COUNT;
-        //cvGoodFeaturesToTrack(grey, eig, temp, points[1], &count, quality, min_distance, 0, 3, 0, 0.04);
-        //cvFindCornerSubPix(grey, points[1], count, cvSize(win_size,win_size), cvSize(-1,-1),
-        //        cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,20,0.03));
+        count = MAX_COUNT;
+        cvGoodFeaturesToTrack(grey, eig, temp, points[1], &count, quality, min_distance, 0, 3, 0, 0.04);
+        cvFindCornerSubPix(grey, points[1], count, cvSize(win_size,win_size), cvSize(-1,-1),
+                cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,20,0.03));
         cvReleaseImage(&eig);
         cvReleaseImage(&temp);
 
         add_remove_pt = 0;
 
-    } /* else if (count > 0) {
+    } else if (count > 0) {
+
+        // both pyramids are already made
+        int level = std::min(3, std::min(previous->getLevels(), current->getLevels()) - 1);
 
-        cvCalcOpticalFlowPyrLK( prev_grey, grey, prev_pyramid, pyramid,
-                points[0], points[1], count, cvSize(win_size,win_size), 3, status, 0,
-                cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,20,0.03), flags );
-        flags |= CV_LKFLOW_PYR_A_READY;
+        cvCalcOpticalFlowPyrLK( previous->getGrey(), grey, previous->getPyramid(), current->getPyramid(),
+                points[0], points[1], count, cvSize(win_size,win_size), level, status, 0,
+                cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,20,0.03),
+                CV_LKFLOW_PYR_A_READY | CV_LKFLOW_PYR_B_READY );
 
         for (i = k = 0; i < count; i++) {
 
@@ -98,50 +142,39 @@ int runLKOpenCV (IplImage *imgA)
             }
 
             points[1][k++] = points[1][i];
-            cvCircle( image, cvPointFrom32f(points[1][i]), 3, CV_RGB(0,255,0), -1, 8,0);
         }
         count = k;
     }
-    */
 
-    /*
     if (add_remove_pt && count < MAX_COUNT) {
         points[1][count++] = cvPointTo32f(pt);
         cvFindCornerSubPix( grey, points[1] + count - 1, 1, cvSize(win_size,win_size), cvSize(-1,-1),
                 cvTermCriteria(CV_TERMCRIT_ITER|CV_TERMCRIT_EPS,20,0.03));
         add_remove_pt = 0;
     }
-    */
 
-    CV_SWAP(prev_grey, grey, swap_temp);
-    CV_SWAP(prev_pyramid, pyramid, swap_temp);
     CV_SWAP(points[0], points[1], swap_points);
 
     need_to_init = 0;
-    cvShowImage("LK_OpenCV", image);
-    c = cvWaitKey(10);
-//
-//    if ((char)c == 27) {
-//        break;
-//    }
-    switch ((char) c) {
-    case 'r':
-        need_to_init = 1;
-        break;
-    case 'c':
-        //count = 0;
-        break;
-    case 'n':
-        night_mode ^= 1;
-        break;
-    default:
-        ;
-    }
 
-    return 0;
+    return count;
 }
 
+void drawLKOpenCV (IplImage *dst)
+{
+    for (int i = 0; i < count; i++) {
+        cvCircle( dst, cvPointFrom32f(points[0][i]), 3, CV_RGB(0,255,0), -1, 8,0);
+    }
+}
 
+void resetLKOpenCV ()
+{
+    need_to_init = 1;
+    count = 0;
+
+    frames[0].clear();
+    frames[1].clear();
+}
 
 void on_mouse( int event, int x, int y, int flags, void* param )
 {
@@ -1,4 +1,3 @@
-
 #ifndef LK_OPENCV_H
 #define LK_OPENCV_H
 
@@ -7,9 +6,17 @@
 #include <math.h>
 #include <stdio.h>
 
+#include "tracking_algorithms/Optical_Flow/Flow_Frame/Flow_Frame.h"
+
 void initLKOpenCV ();
 void endLKOpenCV ();
 int runLKOpenCV (IplImage *imgA);
 void on_mouse (int event, int x, int y, int flags, void *param);
 
+// tracks the points from previous to current, both already made grey with
+//  their pyramids; finds new points when there are none, or previous is NULL
+int runLKOpenCV (const FlowFrame *previous, const FlowFrame *current);
+void drawLKOpenCV (IplImage *dst);
+void resetLKOpenCV ();
+
 #endif
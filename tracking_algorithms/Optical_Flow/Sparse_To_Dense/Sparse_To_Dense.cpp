@@ -0,0 +1,382 @@
+///////////////////////////////////////////////////////////////////////////////
+//
+// Sparse_To_Dense
+//
+// Dense optical flow interpolated from sparse feature tracks, for when
+//  Horn_Schunck or Farneback on every pixel costs too much.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+#include "Sparse_To_Dense.h"
+
+#include<algorithm>
+
+using namespace std;
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// helpers
+//
+///////////////////////////////////////////////////////////////////////////////
+
+// weighted sums for the least squares fit of an affine motion
+//  (u, v) = (a*dx + b*dy + c, d*dx + e*dy + f)
+struct AffineSums {
+    double s, sx, sy, sxx, sxy, syy;
+    double su, sux, suy, sv, svx, svy;
+
+    AffineSums () { memset(this, 0, sizeof(*this)); }
+
+    inline void add (double w, double dx, double dy, double u, double v)
+    {
+        s += w; sx += w * dx; sy += w * dy;
+        sxx += w * dx * dx; sxy += w * dx * dy; syy += w * dy * dy;
+        su += w * u; sux += w * u * dx; suy += w * u * dy;
+        sv += w * v; svx += w * v * dx; svy += w * v * dy;
+    }
+};
+
+
+static inline double det3 (double a, double b, double c,
+                           double d, double e, double f,
+                           double g, double h, double i)
+{
+    return a * (e * i - f * h) - b * (d * i - f * g) + c * (d * h - e * g);
+}
+
+
+// solves the normal equations for (a, b, c) and (d, e, f); the ridge pulls
+//  the linear terms towards zero, so that a few tracks in a line, or only
+//  one, give a translation
+static bool solveAffine (const AffineSums &m, double ridge, double *u, double *v)
+{
+    double xx = m.sxx + ridge, yy = m.syy + ridge;
+    double det = det3(xx, m.sxy, m.sx, m.sxy, yy, m.sy, m.sx, m.sy, m.s);
+
+    if (fabs(det) < 1e-12) {
+        return false;
+    }
+
+    u[0] = det3(m.sux, m.sxy, m.sx, m.suy, yy, m.sy, m.su, m.sy, m.s) / det;
+    u[1] = det3(xx, m.sux, m.sx, m.sxy, m.suy, m.sy, m.sx, m.su, m.s) / det;
+    u[2] = det3(xx, m.sxy, m.sux, m.sxy, yy, m.suy, m.sx, m.sy, m.su) / det;
+    v[0] = det3(m.svx, m.sxy, m.sx, m.svy, yy, m.sy, m.sv, m.sy, m.s) / det;
+    v[1] = det3(xx, m.svx, m.sx, m.sxy, m.svy, m.sy, m.sx, m.sv, m.s) / det;
+    v[2] = det3(xx, m.sxy, m.svx, m.sxy, yy, m.svy, m.sx, m.sy, m.sv) / det;
+    return true;
+
+} // end solveAffine
+
+
+// nearest pixel of a pyramid level, for full size coordinates
+static inline float sampleLevel (const CvMat &level, int shift, float x, float y)
+{
+    int lx = min(max(cvRound(x / (1 << shift)), 0), level.cols - 1);
+    int ly = min(max(cvRound(y / (1 << shift)), 0), level.rows - 1);
+
+    return level.data.ptr[ly * level.step + lx];
+
+} // end sampleLevel
+
+
+// positions of the grid nodes along one axis, every step pixels and at the
+//  last pixel
+static void placeNodes (int size, int step, vector<int> &nodes)
+{
+    nodes.clear();
+    for (int p = 0; p < size - 1; p += step) {
+        nodes.push_back(p);
+    }
+    nodes.push_back(size - 1);
+
+} // end placeNodes
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// constructor
+//
+///////////////////////////////////////////////////////////////////////////////
+
+SparseToDense::SparseToDense()
+{
+    gridStep = 8;
+    sigma = 24.0;
+    sigmaIntensity = 20.0;
+    maxError = 0;
+    maxResidual = 2.0;
+    minTracks = 3;
+    refineSweeps = 0;
+
+    // the refinement only polishes the full size flow it is given
+    refiner.levels = 1;
+    refiner.warmLevels = 1;
+    refiner.warps = 1;
+
+    memset(global, 0, sizeof(global));
+
+    velx = NULL;
+    vely = NULL;
+
+} // end constructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// destructor
+//
+///////////////////////////////////////////////////////////////////////////////
+
+SparseToDense::~SparseToDense()
+{
+    cvReleaseImage(&velx);
+    cvReleaseImage(&vely);
+
+} // end destructor
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// allocate
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void SparseToDense::allocate (int width, int height)
+{
+    if (velx != NULL && velx->width == width && velx->height == height) {
+        return;
+    }
+
+    cvReleaseImage(&velx);
+    cvReleaseImage(&vely);
+    velx = cvCreateImage(cvSize(width, height), IPL_DEPTH_32F, 1);
+    vely = cvCreateImage(cvSize(width, height), IPL_DEPTH_32F, 1);
+
+} // end allocate
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// fitAt
+//
+// Fits an affine motion to the tracks around (x, y), leaving out track skip,
+//  and returns the motion at (x, y).  Returns false if no track is close
+//  enough.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+bool SparseToDense::fitAt (float x, float y, float grey, int skip, float &fx, float &fy) const
+{
+    double spatial = 1.0 / (2.0 * sigma * sigma);
+    double tonal = sigmaIntensity > 0 ? 1.0 / (2.0 * sigmaIntensity * sigmaIntensity) : 0.0;
+    double cutoff = 9.0 * sigma * sigma;
+
+    AffineSums sums;
+    for (int i = 0; i < (int)tracks.size(); i++) {
+        const Track &t = tracks[i];
+        double dx = t.x - x, dy = t.y - y;
+        double d2 = dx * dx + dy * dy;
+
+        if (d2 > cutoff || i == skip) {
+            continue;
+        }
+
+        double dg = t.grey - grey;
+        double w = exp(-d2 * spatial - dg * dg * tonal);
+        sums.add(w, dx, dy, t.dx, t.dy);
+    }
+
+    double u[3], v[3];
+    if (sums.s < 1e-6 || solveAffine(sums, 0.1 * sigma * sigma * sums.s, u, v) == false) {
+        return false;
+    }
+
+    fx = (float)u[2];
+    fy = (float)v[2];
+    return true;
+
+} // end fitAt
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// fitGlobal
+//
+// The affine motion of all the tracks, for the parts of the image no track
+//  is near.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+void SparseToDense::fitGlobal ()
+{
+    double cx = 0.5 * velx->width, cy = 0.5 * velx->height;
+    double scale = cx * cx + cy * cy;
+
+    AffineSums sums;
+    for (int i = 0; i < (int)tracks.size(); i++) {
+        const Track &t = tracks[i];
+        sums.add(1.0, t.x - cx, t.y - cy, t.dx, t.dy);
+    }
+
+    memset(global, 0, sizeof(global));
+    if (sums.s > 0) {
+        solveAffine(sums, 0.01 * scale * sums.s, &global[0], &global[3]);
+    }
+
+} // end fitGlobal
+
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// computeFlow
+//
+// Checks the tracks, fits the motion at the grid nodes, and interpolates the
+//  grid bilinearly to every pixel.  The flow is given at the pixels of
+//  frameA, as with Horn_Schunck and Farneback.  With fewer than minTracks
+//  tracks left there is nothing to fit, so the flow is zeroed and false is
+//  returned rather than passing off no motion as a measurement.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+bool SparseToDense::computeFlow (const CvPoint2D32f *from, const CvPoint2D32f *to, const float *error,
+                                 int count, const FlowFrame *frameA, const FlowFrame *frameB)
+{
+    int width = frameA->getWidth(), height = frameA->getHeight();
+    allocate(width, height);
+
+    // the intensity weight compares a level of the pyramid, which is
+    //  smoother than the image
+    int shift = min(2, frameA->getLevels() - 1);
+    CvMat level = frameA->getLevel(shift);
+
+    // tracks with a small enough error, inside the image
+    tracks.clear();
+    for (int i = 0; i < count; i++) {
+        if (error != NULL && maxError > 0 && error[i] > maxError) {
+            continue;
+        }
+        if (from[i].x < 0 || from[i].y < 0 || from[i].x > width - 1 || from[i].y > height - 1) {
+            continue;
+        }
+
+        Track t;
+        t.x = from[i].x;
+        t.y = from[i].y;
+        t.dx = to[i].x - from[i].x;
+        t.dy = to[i].y - from[i].y;
+        t.grey = sampleLevel(level, shift, t.x, t.y);
+        tracks.push_back(t);
+    }
+
+    // tracks that do not move with their neighbours
+    if (maxResidual > 0) {
+        vector<char> keep(tracks.size(), 1);
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+        for (int i = 0; i < (int)tracks.size(); i++) {
+            const Track &t = tracks[i];
+            float fx, fy;
+            if (fitAt(t.x, t.y, t.grey, i, fx, fy) == true) {
+                float ex = t.dx - fx, ey = t.dy - fy;
+                keep[i] = ex * ex + ey * ey <= maxResidual * maxResidual;
+            }
+        }
+
+        int k = 0;
+        for (int i = 0; i < (int)tracks.size(); i++) {
+            if (keep[i]) {
+                tracks[k++] = tracks[i];
+            }
+        }
+        tracks.resize(k);
+    }
+
+    if ((int)tracks.size() < max(minTracks, 1)) {
+        cvZero(velx);
+        cvZero(vely);
+        return false;
+    }
+
+    fitGlobal();
+
+    // the motion at each grid node
+    placeNodes(width, max(gridStep, 1), nodeX);
+    placeNodes(height, max(gridStep, 1), nodeY);
+    int nodesWide = (int)nodeX.size(), nodesHigh = (int)nodeY.size();
+    gridX.resize(nodesWide * nodesHigh);
+    gridY.resize(nodesWide * nodesHigh);
+
+    double cx = 0.5 * width, cy = 0.5 * height;
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int j = 0; j < nodesHigh; j++) {
+        for (int i = 0; i < nodesWide; i++) {
+            float x = (float)nodeX[i], y = (float)nodeY[j];
+            float fx, fy;
+
+            if (fitAt(x, y, sampleLevel(level, shift, x, y), -1, fx, fy) == false) {
+                fx = (float)(global[0] * (x - cx) + global[1] * (y - cy) + global[2]);
+                fy = (float)(global[3] * (x - cx) + global[4] * (y - cy) + global[5]);
+            }
+            gridX[j * nodesWide + i] = fx;
+            gridY[j * nodesWide + i] = fy;
+        }
+    }
+
+    // the cell and the weight of each column
+    vector<int> cell(width);
+    vector<float> across(width);
+    for (int i = 0, x = 0; x < width; x++) {
+        while (i < nodesWide - 2 && x > nodeX[i + 1]) {
+            i++;
+        }
+        cell[x] = i;
+        across[x] = nodesWide > 1 ? (float)(x - nodeX[i]) / (nodeX[i + 1] - nodeX[i]) : 0.0f;
+    }
+
+#ifdef _OPENMP
+#pragma omp parallel for
+#endif
+    for (int y = 0; y < height; y++) {
+        int j = 0;
+        while (j < nodesHigh - 2 && y > nodeY[j + 1]) {
+            j++;
+        }
+        int j1 = min(j + 1, nodesHigh - 1);
+        float down = nodesHigh > 1 ? (float)(y - nodeY[j]) / (nodeY[j1] - nodeY[j]) : 0.0f;
+
+        const float *gx0 = &gridX[j * nodesWide], *gx1 = &gridX[j1 * nodesWide];
+        const float *gy0 = &gridY[j * nodesWide], *gy1 = &gridY[j1 * nodesWide];
+        float *px = (float*)(velx->imageData + velx->widthStep * y);
+        float *py = (float*)(vely->imageData + vely->widthStep * y);
+
+        for (int x = 0; x < width; x++) {
+            int i = cell[x], i1 = min(i + 1, nodesWide - 1);
+            float a = across[x];
+            float top = gx0[i] + a * (gx0[i1] - gx0[i]);
+            float bottom = gx1[i] + a * (gx1[i1] - gx1[i]);
+            px[x] = top + down * (bottom - top);
+            top = gy0[i] + a * (gy0[i1] - gy0[i]);
+            bottom = gy1[i] + a * (gy1[i1] - gy1[i]);
+            py[x] = top + down * (bottom - top);
+        }
+    }
+
+    // a few sweeps against the images, starting from the interpolated flow
+    if (refineSweeps > 0 && frameB != NULL) {
+        refiner.maxSweeps = refineSweeps;
+        refiner.warmStart = true;
+        refiner.setFlow(velx, vely);
+        refiner.computeFlow(frameA, frameB);
+        cvCopy(refiner.getVelX(), velx);
+        cvCopy(refiner.getVelY(), vely);
+    }
+
+    return true;
+
+} // end computeFlow
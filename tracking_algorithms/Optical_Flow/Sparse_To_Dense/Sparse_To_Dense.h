@@ -0,0 +1,98 @@
+#ifndef SPARSE_TO_DENSE_H
+#define SPARSE_TO_DENSE_H
+
+#include "cv.h"
+#include <math.h>
+#include <stdio.h>
+
+#include <vector>
+
+#include "tracking_algorithms/Optical_Flow/Flow_Frame/Flow_Frame.h"
+#include "tracking_algorithms/Optical_Flow/Horn_Schunck/Horn_Schunck.h"
+
+///////////////////////////////////////////////////////////////////////////////
+//
+// SparseToDense
+//
+// Dense optical flow interpolated from tracked features, as from KLT.  The
+//  tracks are checked against their neighbours, then an affine motion is
+//  fitted around each node of a coarse grid, weighted by distance and by how
+//  alike the image is at the node and at the track, so that the flow does
+//  not bleed across intensity edges.  The grid is interpolated to every
+//  pixel, and a few Horn and Schunck sweeps can refine the result against
+//  the images.
+//
+///////////////////////////////////////////////////////////////////////////////
+
+class SparseToDense
+{
+    public:
+
+        // spacing of the grid the motion is fitted on, in pixels
+        int gridStep;
+
+        // width of the distance weight, in pixels; tracks further than three
+        //  of these from a node are not used for it
+        double sigma;
+
+        // width of the intensity weight, in grey levels, 0 to leave it out
+        double sigmaIntensity;
+
+        // tracks with a larger KLT error are not used, 0 to use them all
+        double maxError;
+
+        // tracks further than this from the motion fitted to their
+        //  neighbours are not used, in pixels, 0 to use them all
+        double maxResidual;
+
+        // fewer tracks than this passing the checks give no flow; an affine
+        //  motion needs 3
+        int minTracks;
+
+        // Horn and Schunck sweeps refining the interpolated flow, 0 for none;
+        //  the other parameters of the refinement are set on refiner
+        int refineSweeps;
+        HornSchunck refiner;
+
+        SparseToDense();
+        ~SparseToDense();
+
+        // flow from frameA to frameB given count features that moved from
+        //  from[i] to to[i]; error is the KLT error of each, or NULL.  Returns
+        //  false, with the flow zero, if too few tracks were usable
+        bool computeFlow (const CvPoint2D32f *from, const CvPoint2D32f *to, const float *error,
+                          int count, const FlowFrame *frameA, const FlowFrame *frameB);
+
+        // 32-bit float velocities of the last pair, owned by the object
+        IplImage *getVelX () { return velx; }
+        IplImage *getVelY () { return vely; }
+
+        // tracks that passed the checks for the last pair
+        int getTracksUsed () const { return (int)tracks.size(); }
+
+    private:
+
+        struct Track {
+            float x, y;
+            float dx, dy;
+            float grey;
+        };
+
+        void allocate (int width, int height);
+        bool fitAt (float x, float y, float grey, int skip, float &fx, float &fy) const;
+        void fitGlobal ();
+
+        std::vector<Track> tracks;
+
+        // grid node positions along each axis, and the node flow
+        std::vector<int> nodeX, nodeY;
+        std::vector<float> gridX, gridY;
+
+        // the affine motion of all the tracks, about the image centre
+        double global[6];
+
+        IplImage *velx, *vely;
+
+};
+
+#endif
@@ -6,6 +6,17 @@
 #include <assert.h>
 #include <math.h>
 #include <stdlib.h>   /* malloc(), realloc() */
+#include <string.h>   /* memset() */
+
+/* Vector extensions, used by the convolution inner loops if available */
+#if defined(__AVX__)
+#include <immintrin.h>
+#define KLT_USE_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define KLT_USE_SSE2
+#endif
 
 /* Our includes */
 #include "base.h"
@@ -14,6 +25,7 @@
 #include "klt_util.h"   /* printing */
 
 #define MAX_KERNEL_WIDTH 	71
+#define CONV_BAND_ROWS  	32	/* output rows per cache block */
 
 
 typedef struct  {
@@ -131,138 +143,225 @@ void _KLTGetKernelWidths(
 
 
 /*********************************************************************
- * _convolveImageHoriz
+ * _convolveRowHoriz
+ *
+ * Convolves one image row with a kernel.  The leftmost and rightmost
+ * radius columns are zeroed, as the kernel does not fit there.  The
+ * vector loops accumulate the taps in the same order as the scalar
+ * loop, so all paths produce identical results.
  */
 
-static void _convolveImageHoriz(
-  _KLT_FloatImage imgin,
-  ConvolutionKernel kernel,
-  _KLT_FloatImage imgout)
+static void _convolveRowHoriz(
+  const float *ptrrow,
+  int ncols,
+  const ConvolutionKernel *kernel,
+  float *ptrout)
 {
-  float *ptrrow = imgin->data;           /* Points to row's first pixel */
-  register float *ptrout = imgout->data, /* Points to next output pixel */
-    *ppp;
-  register float sum;
-  register int radius = kernel.width / 2;
-  register int ncols = imgin->ncols, nrows = imgin->nrows;
-  register int i, j, k;
+  const float *kdata = kernel->data;
+  const float *ppp;
+  int width = kernel->width;
+  int radius = width / 2;
+  int i = 0, k;
+  float sum;
+
+  /* Zero leftmost columns */
+  for ( ; i < radius && i < ncols ; i++)
+    ptrout[i] = 0.0;
+
+  /* Convolve middle columns with kernel */
+#ifdef KLT_USE_AVX
+  for ( ; i + 8 <= ncols - radius ; i += 8)  {
+    __m256 vsum = _mm256_setzero_ps();
+    ppp = ptrrow + i - radius;
+    for (k = width-1 ; k >= 0 ; k--, ppp++)
+      vsum = _mm256_add_ps(vsum, _mm256_mul_ps(_mm256_loadu_ps(ppp),
+                                               _mm256_set1_ps(kdata[k])));
+    _mm256_storeu_ps(ptrout + i, vsum);
+  }
+#endif
+#ifdef KLT_USE_SSE2
+  for ( ; i + 4 <= ncols - radius ; i += 4)  {
+    __m128 vsum = _mm_setzero_ps();
+    ppp = ptrrow + i - radius;
+    for (k = width-1 ; k >= 0 ; k--, ppp++)
+      vsum = _mm_add_ps(vsum, _mm_mul_ps(_mm_loadu_ps(ppp),
+                                         _mm_set1_ps(kdata[k])));
+    _mm_storeu_ps(ptrout + i, vsum);
+  }
+#endif
+  for ( ; i < ncols - radius ; i++)  {
+    ppp = ptrrow + i - radius;
+    sum = 0.0;
+    for (k = width-1 ; k >= 0 ; k--)
+      sum += *ppp++ * kdata[k];
+    ptrout[i] = sum;
+  }
 
-  /* Kernel width must be odd */
-  assert(kernel.width % 2 == 1);
+  /* Zero rightmost columns */
+  for ( ; i < ncols ; i++)
+    ptrout[i] = 0.0;
+}
 
-  /* Must read from and write to different images */
-  assert(imgin != imgout);
 
-  /* Output image must be large enough to hold result */
-  assert(imgout->ncols >= imgin->ncols);
-  assert(imgout->nrows >= imgin->nrows);
-
-  /* For each row, do ... */
-  for (j = 0 ; j < nrows ; j++)  {
-
-    /* Zero leftmost columns */
-    for (i = 0 ; i < radius ; i++)
-      *ptrout++ = 0.0;
-
-    /* Convolve middle columns with kernel */
-    for ( ; i < ncols - radius ; i++)  {
-      ppp = ptrrow + i - radius;
-      sum = 0.0;
-      for (k = kernel.width-1 ; k >= 0 ; k--)
-        sum += *ppp++ * kernel.data[k];
-      *ptrout++ = sum;
-    }
-
-    /* Zero rightmost columns */
-    for ( ; i < ncols ; i++)
-      *ptrout++ = 0.0;
+/*********************************************************************
+ * _convolveRowVert
+ *
+ * Computes one output row of a vertical convolution.  ptrcol points
+ * to the first of the kernel.width input rows (i.e., row j - radius
+ * for output row j); rows are ncols floats apart.  Columns are
+ * processed side by side, so the image is read row-major.
+ */
 
-    ptrrow += ncols;
+static void _convolveRowVert(
+  const float *ptrcol,
+  int ncols,
+  const ConvolutionKernel *kernel,
+  float *ptrout)
+{
+  const float *kdata = kernel->data;
+  const float *ppp;
+  int width = kernel->width;
+  int i = 0, k;
+  float sum;
+
+#ifdef KLT_USE_AVX
+  for ( ; i + 8 <= ncols ; i += 8)  {
+    __m256 vsum = _mm256_setzero_ps();
+    ppp = ptrcol + i;
+    for (k = width-1 ; k >= 0 ; k--, ppp += ncols)
+      vsum = _mm256_add_ps(vsum, _mm256_mul_ps(_mm256_loadu_ps(ppp),
+                                               _mm256_set1_ps(kdata[k])));
+    _mm256_storeu_ps(ptrout + i, vsum);
+  }
+#endif
+#ifdef KLT_USE_SSE2
+  for ( ; i + 4 <= ncols ; i += 4)  {
+    __m128 vsum = _mm_setzero_ps();
+    ppp = ptrcol + i;
+    for (k = width-1 ; k >= 0 ; k--, ppp += ncols)
+      vsum = _mm_add_ps(vsum, _mm_mul_ps(_mm_loadu_ps(ppp),
+                                         _mm_set1_ps(kdata[k])));
+    _mm_storeu_ps(ptrout + i, vsum);
+  }
+#endif
+  for ( ; i < ncols ; i++)  {
+    ppp = ptrcol + i;
+    sum = 0.0;
+    for (k = width-1 ; k >= 0 ; k--)  {
+      sum += *ppp * kdata[k];
+      ppp += ncols;
+    }
+    ptrout[i] = sum;
   }
 }
 
 
 /*********************************************************************
- * _convolveImageVert
+ * _convolveSeparateFused
+ *
+ * Computes any combination of
+ *        smooth = gauss(vert)      * gauss(horiz)      * img
+ *        gradx  = gauss(vert)      * gaussderiv(horiz) * img
+ *        grady  = gaussderiv(vert) * gauss(horiz)      * img
+ * in one sweep over the image.  Outputs that are not wanted are NULL.
+ *
+ * The image is processed in bands of CONV_BAND_ROWS output rows.  For
+ * each band the horizontal passes (which are shared by the outputs)
+ * are run over the band plus a halo of kernel radius rows into small
+ * buffers that stay in cache, and the vertical passes are run from
+ * those buffers.  This replaces the full-size temporary image and the
+ * column-major vertical pass of the original implementation, and
+ * yields the same values, including the zeroed borders.
  */
 
-static void _convolveImageVert(
+static void _convolveSeparateFused(
   _KLT_FloatImage imgin,
-  ConvolutionKernel kernel,
-  _KLT_FloatImage imgout)
+  const ConvolutionKernel *gauss,
+  const ConvolutionKernel *gaussderiv,
+  _KLT_FloatImage smooth,
+  _KLT_FloatImage gradx,
+  _KLT_FloatImage grady)
 {
-  float *ptrcol = imgin->data;            /* Points to row's first pixel */
-  register float *ptrout = imgout->data,  /* Points to next output pixel */
-    *ppp;
-  register float sum;
-  register int radius = kernel.width / 2;
-  register int ncols = imgin->ncols, nrows = imgin->nrows;
-  register int i, j, k;
-
-  /* Kernel width must be odd */
-  assert(kernel.width % 2 == 1);
+  int ncols = imgin->ncols, nrows = imgin->nrows;
+  int radius_g = gauss->width / 2;
+  int radius_d = gaussderiv->width / 2;
+  KLT_BOOL need_hg = (smooth != NULL || grady != NULL);
+  KLT_BOOL need_hd = (gradx != NULL);
+  int halo = 0;
+  int bufrows;
+  float *buf_hg = NULL, *buf_hd = NULL;
+  int j0, j1, r0, r1, j;
+
+  /* Kernel widths must be odd */
+  assert(gauss->width % 2 == 1);
+  assert(gaussderiv->width % 2 == 1);
 
   /* Must read from and write to different images */
-  assert(imgin != imgout);
+  assert(imgin != smooth && imgin != gradx && imgin != grady);
 
-  /* Output image must be large enough to hold result */
-  assert(imgout->ncols >= imgin->ncols);
-  assert(imgout->nrows >= imgin->nrows);
+  if (smooth != NULL || gradx != NULL)  halo = max(halo, radius_g);
+  if (grady != NULL)  halo = max(halo, radius_d);
 
-  /* For each column, do ... */
-  for (i = 0 ; i < ncols ; i++)  {
+  /* Allocate band buffers for the horizontal passes */
+  bufrows = min(CONV_BAND_ROWS + 2*halo, nrows);
+  if (need_hg)  {
+    buf_hg = (float *) malloc(bufrows * ncols * sizeof(float));
+    if (buf_hg == NULL)
+      KLTError("(_convolveSeparateFused) Out of memory");
+  }
+  if (need_hd)  {
+    buf_hd = (float *) malloc(bufrows * ncols * sizeof(float));
+    if (buf_hd == NULL)
+      KLTError("(_convolveSeparateFused) Out of memory");
+  }
 
-    /* Zero topmost rows */
-    for (j = 0 ; j < radius ; j++)  {
-      *ptrout = 0.0;
-      ptrout += ncols;
+  /* For each band of output rows, do ... */
+  for (j0 = 0 ; j0 < nrows ; j0 = j1)  {
+    j1 = min(j0 + CONV_BAND_ROWS, nrows);
+
+    /* Horizontal passes over the band and its halo */
+    r0 = max(j0 - halo, 0);
+    r1 = min(j1 + halo, nrows);
+    for (j = r0 ; j < r1 ; j++)  {
+      const float *ptrrow = imgin->data + j * ncols;
+      if (need_hg)
+        _convolveRowHoriz(ptrrow, ncols, gauss, buf_hg + (j - r0) * ncols);
+      if (need_hd)
+        _convolveRowHoriz(ptrrow, ncols, gaussderiv, buf_hd + (j - r0) * ncols);
     }
 
-    /* Convolve middle rows with kernel */
-    for ( ; j < nrows - radius ; j++)  {
-      ppp = ptrcol + ncols * (j - radius);
-      sum = 0.0;
-      for (k = kernel.width-1 ; k >= 0 ; k--)  {
-        sum += *ppp * kernel.data[k];
-        ppp += ncols;
+    /* Vertical passes; the topmost and bottommost radius rows are zeroed */
+    for (j = j0 ; j < j1 ; j++)  {
+      if (smooth != NULL)  {
+        float *ptrout = smooth->data + j * ncols;
+        if (j < radius_g || j >= nrows - radius_g)
+          memset(ptrout, 0, ncols * sizeof(float));
+        else
+          _convolveRowVert(buf_hg + (j - radius_g - r0) * ncols, ncols,
+                           gauss, ptrout);
+      }
+      if (gradx != NULL)  {
+        float *ptrout = gradx->data + j * ncols;
+        if (j < radius_g || j >= nrows - radius_g)
+          memset(ptrout, 0, ncols * sizeof(float));
+        else
+          _convolveRowVert(buf_hd + (j - radius_g - r0) * ncols, ncols,
+                           gauss, ptrout);
+      }
+      if (grady != NULL)  {
+        float *ptrout = grady->data + j * ncols;
+        if (j < radius_d || j >= nrows - radius_d)
+          memset(ptrout, 0, ncols * sizeof(float));
+        else
+          _convolveRowVert(buf_hg + (j - radius_d - r0) * ncols, ncols,
+                           gaussderiv, ptrout);
       }
-      *ptrout = sum;
-      ptrout += ncols;
-    }
-
-    /* Zero bottommost rows */
-    for ( ; j < nrows ; j++)  {
-      *ptrout = 0.0;
-      ptrout += ncols;
     }
-
-    ptrcol++;
-    ptrout -= nrows * ncols - 1;
   }
-}
-
-
-/*********************************************************************
- * _convolveSeparate
- */
-
-static void _convolveSeparate(
-  _KLT_FloatImage imgin,
-  ConvolutionKernel horiz_kernel,
-  ConvolutionKernel vert_kernel,
-  _KLT_FloatImage imgout)
-{
-  /* Create temporary image */
-  _KLT_FloatImage tmpimg;
-  tmpimg = _KLTCreateFloatImage(imgin->ncols, imgin->nrows);
-  
-  /* Do convolution */
-  _convolveImageHoriz(imgin, horiz_kernel, tmpimg);
-
-  _convolveImageVert(tmpimg, vert_kernel, imgout);
 
   /* Free memory */
-  _KLTFreeFloatImage(tmpimg);
+  free(buf_hg);
+  free(buf_hd);
 }
 
 	
@@ -287,8 +386,8 @@ void _KLTComputeGradients(
   if (fabs(sigma - sigma_last) > 0.05)
     _computeKernels(sigma, &gauss_kernel, &gaussderiv_kernel);
 	
-  _convolveSeparate(img, gaussderiv_kernel, gauss_kernel, gradx);
-  _convolveSeparate(img, gauss_kernel, gaussderiv_kernel, grady);
+  _convolveSeparateFused(img, &gauss_kernel, &gaussderiv_kernel,
+                         NULL, gradx, grady);
 
 }
 	
@@ -310,7 +409,39 @@ void _KLTComputeSmoothedImage(
   if (fabs(sigma - sigma_last) > 0.05)
     _computeKernels(sigma, &gauss_kernel, &gaussderiv_kernel);
 
-  _convolveSeparate(img, gauss_kernel, gauss_kernel, smooth);
+  _convolveSeparateFused(img, &gauss_kernel, &gaussderiv_kernel,
+                         smooth, NULL, NULL);
+}
+
+
+/*********************************************************************
+ * _KLTComputeSmoothedImageAndGradients
+ *
+ * Computes the smoothed image and both gradients with the same sigma
+ * in a single sweep.  Any of the outputs may be NULL.
+ */
+
+void _KLTComputeSmoothedImageAndGradients(
+  _KLT_FloatImage img,
+  float sigma,
+  _KLT_FloatImage smooth,
+  _KLT_FloatImage gradx,
+  _KLT_FloatImage grady)
+{
+  /* Output images must be large enough to hold result */
+  assert(smooth == NULL || smooth->ncols >= img->ncols);
+  assert(smooth == NULL || smooth->nrows >= img->nrows);
+  assert(gradx == NULL || gradx->ncols >= img->ncols);
+  assert(gradx == NULL || gradx->nrows >= img->nrows);
+  assert(grady == NULL || grady->ncols >= img->ncols);
+  assert(grady == NULL || grady->nrows >= img->nrows);
+
+  /* Compute kernels, if necessary */
+  if (fabs(sigma - sigma_last) > 0.05)
+    _computeKernels(sigma, &gauss_kernel, &gaussderiv_kernel);
+
+  _convolveSeparateFused(img, &gauss_kernel, &gaussderiv_kernel,
+                         smooth, gradx, grady);
 }
 
 
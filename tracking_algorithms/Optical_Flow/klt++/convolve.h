@@ -29,4 +29,11 @@ void _KLTComputeSmoothedImage(
   float sigma,
   _KLT_FloatImage smooth);
 
+void _KLTComputeSmoothedImageAndGradients(
+  _KLT_FloatImage img,
+  float sigma,
+  _KLT_FloatImage smooth,
+  _KLT_FloatImage gradx,
+  _KLT_FloatImage grady);
+
 #endif
@@ -30,6 +30,7 @@ static const float pyramid_sigma_fact = 0.9f;
 static const float step_factor = 1.0f;
 static const KLT_BOOL sequentialMode = FALSE;
 static const KLT_BOOL lighting_insensitive = FALSE;
+static const int nThreads = 0;
 /* for affine mapping*/
 static const int affineConsistencyCheck = -1;
 static const int affine_window_size = 15;
@@ -102,6 +103,7 @@ KLT_TrackingContext KLTCreateTrackingContext()
   tc->smoothBeforeSelecting = smoothBeforeSelecting;
   tc->writeInternalImages = writeInternalImages;
   tc->lighting_insensitive = lighting_insensitive;
+  tc->nThreads = nThreads;
   tc->min_eigenvalue = min_eigenvalue;
   tc->min_determinant = min_determinant;
   tc->max_iterations = max_iterations;
@@ -155,6 +157,7 @@ KLT_FeatureList KLTCreateFeatureList(
 	
   /* Set parameters */
   fl->nFeatures = nFeatures; 
+  fl->aff_patches = NULL;
 
   /* Set pointers */
   fl->feature = (KLT_Feature *) (fl + 1);
@@ -253,6 +256,7 @@ void KLTPrintTrackingContext(
           tc->smoothBeforeSelecting ? "TRUE" : "FALSE");
   fprintf(stderr, "\twriteInternalImages = %s\n",
           tc->writeInternalImages ? "TRUE" : "FALSE");
+  fprintf(stderr, "\tnThreads = %d\n", tc->nThreads);
 
   fprintf(stderr, "\tmin_eigenvalue = %d\n", tc->min_eigenvalue);
   fprintf(stderr, "\tmin_determinant = %f\n", tc->min_determinant);
@@ -454,16 +458,8 @@ void KLTFreeFeatureList(
   KLT_FeatureList fl)
 {
   /* for affine mapping */
-  int indx;
-  for (indx = 0 ; indx < fl->nFeatures ; indx++)  {
-    /* free image and gradient  */
-    _KLTFreeFloatImage(fl->feature[indx]->aff_img);
-    _KLTFreeFloatImage(fl->feature[indx]->aff_img_gradx);
-    _KLTFreeFloatImage(fl->feature[indx]->aff_img_grady);
-    fl->feature[indx]->aff_img = NULL;
-    fl->feature[indx]->aff_img_gradx = NULL;
-    fl->feature[indx]->aff_img_grady = NULL;
-  }
+  if (fl->aff_patches)
+    _KLTFreePatchArena((_KLT_PatchArena) fl->aff_patches);
   
   free(fl);
 }
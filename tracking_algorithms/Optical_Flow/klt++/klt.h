@@ -50,6 +50,8 @@ typedef struct  {
   KLT_BOOL writeInternalImages;	/* whether to write internal images */
   /* tracking features */
   KLT_BOOL lighting_insensitive;  /* whether to normalize for gain and bias (not in original algorithm) */
+  int nThreads;			/* # of threads tracking features (0 = one per processor); */
+  /* only used if compiled with OpenMP */
   
   /* Available, but hopefully can ignore */
   int min_eigenvalue;		/* smallest eigenvalue allowed for selecting */
@@ -108,6 +110,8 @@ typedef struct  {
 typedef struct  {
   int nFeatures;
   KLT_Feature *feature;
+  /* User must not touch this */
+  void *aff_patches;       /* reference patches for affine mapping */
 }  KLT_FeatureListRec, *KLT_FeatureList;
 
 typedef struct  {
@@ -121,6 +125,9 @@ typedef struct  {
   KLT_Feature **feature;
 }  KLT_FeatureTableRec, *KLT_FeatureTable;
 
+/* Append-only binary log of feature lists; see trackLog.cpp */
+typedef struct _KLT_TrackLogRec *KLT_TrackLog;
+
 
 
 /*******************
@@ -231,6 +238,29 @@ KLT_FeatureHistory KLTReadFeatureHistory(
 KLT_FeatureTable KLTReadFeatureTable(
   KLT_FeatureTable ft,
   char *filename);
+
+/* Track log */
+KLT_TrackLog KLTCreateTrackLog(
+  char *filename,
+  int nFeatures,
+  KLT_BOOL affine);
+void KLTAppendTrackLog(
+  KLT_TrackLog tl,
+  KLT_FeatureList fl,
+  int frame);
+KLT_TrackLog KLTOpenTrackLog(
+  char *filename);
+void KLTCloseTrackLog(
+  KLT_TrackLog tl);
+int KLTCountTrackLogFrames(
+  KLT_TrackLog tl);
+int KLTTrackLogFrame(
+  KLT_TrackLog tl,
+  int i);
+KLT_FeatureList KLTReadTrackLogFrame(
+  KLT_TrackLog tl,
+  int frame,
+  KLT_FeatureList fl);
 #ifdef __cplusplus
 }
 #endif
@@ -58,6 +58,56 @@ void _KLTFreeFloatImage(
 }
 
 
+/*********************************************************************
+ * _KLTCreatePatchArena
+ *
+ * Allocates nPatches float images of ncols x nrows with one malloc,
+ * so that the affine consistency check can keep a reference patch
+ * per feature without allocating while tracking.  Each patch is
+ * written in full before it is read, so the data is not cleared.
+ */
+
+_KLT_PatchArena _KLTCreatePatchArena(
+  int nPatches,
+  int ncols,
+  int nrows)
+{
+  _KLT_PatchArena arena;
+  float *data;
+  int nbytes = sizeof(_KLT_PatchArenaRec) +
+    nPatches * sizeof(_KLT_FloatImageRec) +
+    nPatches * ncols * nrows * sizeof(float);
+  int i;
+
+  arena = (_KLT_PatchArena)  malloc(nbytes);
+  if (arena == NULL)
+    KLTError("(_KLTCreatePatchArena)  Out of memory");
+  arena->nPatches = nPatches;
+  arena->ncols = ncols;
+  arena->nrows = nrows;
+  arena->img = (_KLT_FloatImageRec *)  (arena + 1);
+  data = (float *)  (arena->img + nPatches);
+  for (i = 0 ; i < nPatches ; i++)  {
+    arena->img[i].ncols = ncols;
+    arena->img[i].nrows = nrows;
+    arena->img[i].data = data + i * ncols * nrows;
+  }
+
+  return(arena);
+}
+
+
+/*********************************************************************
+ * _KLTFreePatchArena
+ */
+
+void _KLTFreePatchArena(
+  _KLT_PatchArena arena)
+{
+  free(arena);
+}
+
+
 /*********************************************************************
  * _KLTPrintSubFloatImage
  */
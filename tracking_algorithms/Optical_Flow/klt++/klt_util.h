@@ -17,6 +17,22 @@ _KLT_FloatImage _KLTCreateFloatImage(
 
 void _KLTFreeFloatImage(
   _KLT_FloatImage);
+
+/* for affine mapping: fixed-size patches in a single block */
+typedef struct  {
+  int nPatches;
+  int ncols;
+  int nrows;
+  _KLT_FloatImageRec *img;
+}  _KLT_PatchArenaRec, *_KLT_PatchArena;
+
+_KLT_PatchArena _KLTCreatePatchArena(
+  int nPatches,
+  int ncols,
+  int nrows);
+
+void _KLTFreePatchArena(
+  _KLT_PatchArena);
 	
 void _KLTPrintSubFloatImage(
   _KLT_FloatImage floatimg,
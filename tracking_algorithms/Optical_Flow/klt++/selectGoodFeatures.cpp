@@ -25,75 +25,68 @@ typedef enum {SELECTING_ALL, REPLACING_SOME} selectionMode;
 
 
 /*********************************************************************
- * _quicksort
- * Replacement for qsort().  Computing time is decreased by taking
- * advantage of specific knowledge of our array (that there are 
- * three ints associated with each point).
+ * _betterPoint
  *
- * This routine generously provided by 
- *      Manolis Lourakis <lourakis@csi.forth.gr>
- *
- * NOTE: The results of this function may be slightly different from
- * those of qsort().  This is due to the fact that different sort 
- * algorithms have different behaviours when sorting numbers with the 
- * same value: Some leave them in the same relative positions in the 
- * array, while others change their relative positions. For example, 
- * if you have the array [c d b1 a b2] with b1=b2, it may be sorted as 
- * [a b1 b2 c d] or [a b2 b1 c d].
+ * Ordering of the point list: higher trackability first.  Ties are
+ * broken by raster order so that the selection is deterministic.
  */
 
+static int _betterPoint(const int *a, const int *b)
+{
+  if (a[2] != b[2])  return a[2] > b[2];
+  if (a[1] != b[1])  return a[1] < b[1];
+  return a[0] < b[0];
+}
+
 #define SWAP3(list, i, j)               \
-{register int *pi, *pj, tmp;            \
+{int *pi, *pj, tmp;                     \
      pi=list+3*(i); pj=list+3*(j);      \
-                                        \
-     tmp=*pi;    \
-     *pi++=*pj;  \
-     *pj++=tmp;  \
-                 \
-     tmp=*pi;    \
-     *pi++=*pj;  \
-     *pj++=tmp;  \
-                 \
-     tmp=*pi;    \
-     *pi=*pj;    \
-     *pj=tmp;    \
+     tmp=pi[0]; pi[0]=pj[0]; pj[0]=tmp; \
+     tmp=pi[1]; pi[1]=pj[1]; pj[1]=tmp; \
+     tmp=pi[2]; pi[2]=pj[2]; pj[2]=tmp; \
 }
 
-void _quicksort(int *pointlist, int n)
+
+/*********************************************************************
+ * _siftDownPoint
+ * _buildPointHeap
+ * _popBestPoint
+ *
+ * Binary max-heap over the point list (three ints per point).  Only
+ * as many points as _enforceMinimumDistance actually visits are
+ * extracted, so selection costs O(n + k log n) instead of sorting
+ * every candidate pixel of the image.
+ */
+
+static void _siftDownPoint(int *pointlist, int i, int n)
 {
-  unsigned int i, j, ln, rn;
+  int child;
 
-  while (n > 1)
-  {
-    SWAP3(pointlist, 0, n/2);
-    for (i = 0, j = n; ; )
-    {
-      do
-        --j;
-      while (pointlist[3*j+2] < pointlist[2]);
-      do
-        ++i;
-      while (i < j && pointlist[3*i+2] > pointlist[2]);
-      if (i >= j)
-        break;
-      SWAP3(pointlist, i, j);
-    }
-    SWAP3(pointlist, j, 0);
-    ln = j;
-    rn = n - ++j;
-    if (ln < rn)
-    {
-      _quicksort(pointlist, ln);
-      pointlist += 3*j;
-      n = rn;
-    }
-    else
-    {
-      _quicksort(pointlist + 3*j, rn);
-      n = ln;
-    }
+  while ((child = 2*i + 1) < n)  {
+    if (child + 1 < n &&
+        _betterPoint(pointlist + 3*(child+1), pointlist + 3*child))
+      child++;
+    if (!_betterPoint(pointlist + 3*child, pointlist + 3*i))
+      break;
+    SWAP3(pointlist, i, child);
+    i = child;
   }
 }
+
+static void _buildPointHeap(int *pointlist, int n)
+{
+  int i;
+
+  for (i = n/2 - 1 ; i >= 0 ; i--)
+    _siftDownPoint(pointlist, i, n);
+}
+
+/* Moves the best of the n points to position n-1 */
+static void _popBestPoint(int *pointlist, int n)
+{
+  SWAP3(pointlist, 0, n-1);
+  _siftDownPoint(pointlist, 0, n-1);
+}
 #undef SWAP3
 
 
@@ -121,6 +114,8 @@ static void _fillFeaturemap(
  * Removes features that are within close proximity to better features.
  *
  * INPUTS
+ * pointlist:    Candidate points, arranged as a heap by _buildPointHeap.
+ *               Is overwritten.
  * featurelist:  A list of features.  The nFeatures property
  *               is used.
  *
@@ -145,6 +140,7 @@ static void _enforceMinimumDistance(
   int x, y, val;     /* Location and trackability of pixel under consideration */
   uchar *featuremap; /* Boolean array recording proximity of features */
   int *ptr;
+  int nremaining = npoints;
 	
   /* Cannot add features with an eigenvalue less than one */
   if (min_eigenvalue < 1)  min_eigenvalue = 1;
@@ -166,13 +162,12 @@ static void _enforceMinimumDistance(
       }
 
   /* For each feature point, in descending order of importance, do ... */
-  ptr = pointlist;
   indx = 0;
   while (1)  {
 
     /* If we can't add all the points, then fill in the rest
        of the featurelist with -1's */
-    if (ptr >= pointlist + 3*npoints)  {
+    if (nremaining == 0)  {
       while (indx < featurelist->nFeatures)  {	
         if (overwriteAllFeatures || 
             featurelist->feature[indx]->val < 0) {
@@ -194,6 +189,9 @@ static void _enforceMinimumDistance(
       break;
     }
 
+    _popBestPoint(pointlist, nremaining);
+    nremaining--;
+    ptr = pointlist + 3*nremaining;
     x   = *ptr++;
     y   = *ptr++;
     val = *ptr++;
@@ -240,57 +238,160 @@ static void _enforceMinimumDistance(
 
 
 /*********************************************************************
- * _comparePoints
+ * _minEigenvalue
  *
- * Used by qsort (in _KLTSelectGoodFeatures) to determine
- * which feature is better.
- * By switching the '>' with the '<', qsort is fooled into sorting 
- * in descending order.
+ * Given the three distinct elements of the symmetric 2x2 matrix
+ *                     [gxx gxy]
+ *                     [gxy gyy],
+ * Returns the minimum eigenvalue of the matrix.  
  */
 
-#ifdef KLT_USE_QSORT
-static int _comparePoints(const void *a, const void *b)
+static float _minEigenvalue(float gxx, float gxy, float gyy)
 {
-  int v1 = *(((int *) a) + 2);
-  int v2 = *(((int *) b) + 2);
-
-  if (v1 > v2)  return(-1);
-  else if (v1 < v2)  return(1);
-  else return(0);
+  return (float) ((gxx + gyy - sqrt((gxx - gyy)*(gxx - gyy) + 4*gxy*gxy))/2.0f);
 }
-#endif
-
+	
 
 /*********************************************************************
- * _sortPointList
+ * _addGradientRow
+ *
+ * Adds (sign = 1) or removes (sign = -1) row y of the gradient
+ * products to the per-column sums, for columns x0 .. x1-1.
  */
 
-static void _sortPointList(
-  int *pointlist,
-  int npoints)
+static void _addGradientRow(
+  _KLT_FloatImage gradx,
+  _KLT_FloatImage grady,
+  int y,
+  int x0, int x1,
+  double sign,
+  double *cxx, double *cxy, double *cyy)
 {
-#ifdef KLT_USE_QSORT
-  qsort(pointlist, npoints, 3*sizeof(int), _comparePoints);
-#else
-  _quicksort(pointlist, npoints);
-#endif
+  const float *gxrow = gradx->data + y * gradx->ncols;
+  const float *gyrow = grady->data + y * grady->ncols;
+  double gx, gy;
+  int x;
+
+  for (x = x0 ; x < x1 ; x++)  {
+    gx = gxrow[x];
+    gy = gyrow[x];
+    cxx[x] += sign * gx * gx;
+    cxy[x] += sign * gx * gy;
+    cyy[x] += sign * gy * gy;
+  }
 }
 
 
 /*********************************************************************
- * _minEigenvalue
+ * _computeTrackability
  *
- * Given the three distinct elements of the symmetric 2x2 matrix
- *                     [gxx gxy]
- *                     [gxy gyy],
- * Returns the minimum eigenvalue of the matrix.  
+ * Computes the minimum eigenvalue of the gradient matrix summed over a
+ * (2*window_hw+1) x (2*window_hh+1) window around every step-th pixel
+ * inside the border, and appends (x, y, value) to pointlist for each
+ * pixel whose value is at least min_eigenvalue (the others can never
+ * be selected).
+ *
+ * The window sums of gx*gx, gx*gy and gy*gy are separable running
+ * sums: per-column sums over the window rows are updated by one row
+ * as y advances, and each image row is then swept with a sliding
+ * horizontal window, so the cost per pixel does not depend on the
+ * window size.  Sums are kept in double precision so that the
+ * add/subtract updates do not drift.
+ *
+ * RETURNS
+ * The number of points written to pointlist.
  */
 
-static float _minEigenvalue(float gxx, float gxy, float gyy)
+static int _computeTrackability(
+  _KLT_FloatImage gradx,
+  _KLT_FloatImage grady,
+  int ncols, int nrows,
+  int window_hw, int window_hh,
+  int borderx, int bordery,
+  int step,
+  int min_eigenvalue,
+  int *pointlist)
 {
-  return (float) ((gxx + gyy - sqrt((gxx - gyy)*(gxx - gyy) + 4*gxy*gxy))/2.0f);
+  int x0 = borderx - window_hw;       /* columns touched by the windows */
+  int x1 = ncols - borderx + window_hw;
+  double *colsum, *cxx, *cxy, *cyy;
+  double sxx, sxy, syy;
+  unsigned int limit = 1;
+  int *ptr = pointlist;
+  int npoints = 0;
+  float val;
+  int x, y, i;
+
+  if (nrows - bordery <= bordery || ncols - borderx <= borderx)
+    return 0;
+
+  /* Find largest value of an int */
+  for (i = 0 ; i < (int) sizeof(int) ; i++)  limit *= 256;
+  limit = limit/2 - 1;
+
+  colsum = (double *) calloc(3 * ncols, sizeof(double));
+  if (colsum == NULL)
+    KLTError("(_computeTrackability) Out of memory");
+  cxx = colsum;
+  cxy = colsum + ncols;
+  cyy = colsum + 2*ncols;
+
+  /* Column sums over the window rows of the first row of pixels */
+  for (y = bordery - window_hh ; y < bordery + window_hh ; y++)
+    _addGradientRow(gradx, grady, y, x0, x1, 1.0, cxx, cxy, cyy);
+
+  /* For most of the pixels in the image, do ... */
+  for (y = bordery ; y < nrows - bordery ; y++)  {
+
+    /* Slide the column sums down to rows y-window_hh .. y+window_hh */
+    _addGradientRow(gradx, grady, y + window_hh, x0, x1, 1.0, cxx, cxy, cyy);
+    if (y > bordery)
+      _addGradientRow(gradx, grady, y - window_hh - 1, x0, x1, -1.0,
+                      cxx, cxy, cyy);
+
+    if ((y - bordery) % step != 0)  continue;
+
+    /* Sum the column sums in the window around the first pixel */
+    sxx = 0;  sxy = 0;  syy = 0;
+    for (i = x0 ; i < x0 + 2*window_hw ; i++)  {
+      sxx += cxx[i];  sxy += cxy[i];  syy += cyy[i];
+    }
+
+    for (x = borderx ; x < ncols - borderx ; x++)  {
+
+      /* Slide the window to columns x-window_hw .. x+window_hw */
+      sxx += cxx[x + window_hw];
+      sxy += cxy[x + window_hw];
+      syy += cyy[x + window_hw];
+      if (x > borderx)  {
+        sxx -= cxx[x - window_hw - 1];
+        sxy -= cxy[x - window_hw - 1];
+        syy -= cyy[x - window_hw - 1];
+      }
+
+      if ((x - borderx) % step != 0)  continue;
+
+      /* Store the trackability of the pixel as the minimum
+         of the two eigenvalues */
+      val = _minEigenvalue((float) sxx, (float) sxy, (float) syy);
+      if (val > limit)  {
+        KLTWarning("(_KLTSelectGoodFeatures) minimum eigenvalue %f is "
+                   "greater than the capacity of an int; setting "
+                   "to maximum value", val);
+        val = (float) limit;
+      }
+      if ((int) val < min_eigenvalue)  continue;
+      *ptr++ = x;
+      *ptr++ = y;
+      *ptr++ = (int) val;
+      npoints++;
+    }
+  }
+
+  free(colsum);
+  return npoints;
 }
-	
+
 
 /*********************************************************************/
 
@@ -373,58 +474,21 @@ void _KLTSelectGoodFeatures(
   /* Compute trackability of each image pixel as the minimum
      of the two eigenvalues of the Z matrix */
   {
-    register float gx, gy;
-    register float gxx, gxy, gyy;
-    register int xx, yy;
-    register int *ptr;
-    float val;
-    unsigned int limit = 1;
     int borderx = tc->borderx;	/* Must not touch cols */
     int bordery = tc->bordery;	/* lost by convolution */
-    int x, y;
-    int i;
+    int min_eigenvalue = max(tc->min_eigenvalue, 1);
 	
     if (borderx < window_hw)  borderx = window_hw;
     if (bordery < window_hh)  bordery = window_hh;
 
-    /* Find largest value of an int */
-    for (i = 0 ; i < sizeof(int) ; i++)  limit *= 256;
-    limit = limit/2 - 1;
-		
-    /* For most of the pixels in the image, do ... */
-    ptr = pointlist;
-    for (y = bordery ; y < nrows - bordery ; y += tc->nSkippedPixels + 1)
-      for (x = borderx ; x < ncols - borderx ; x += tc->nSkippedPixels + 1)  {
-
-        /* Sum the gradients in the surrounding window */
-        gxx = 0;  gxy = 0;  gyy = 0;
-        for (yy = y-window_hh ; yy <= y+window_hh ; yy++)
-          for (xx = x-window_hw ; xx <= x+window_hw ; xx++)  {
-            gx = *(gradx->data + ncols*yy+xx);
-            gy = *(grady->data + ncols*yy+xx);
-            gxx += gx * gx;
-            gxy += gx * gy;
-            gyy += gy * gy;
-          }
-
-        /* Store the trackability of the pixel as the minimum
-           of the two eigenvalues */
-        *ptr++ = x;
-        *ptr++ = y;
-        val = _minEigenvalue(gxx, gxy, gyy);
-        if (val > limit)  {
-          KLTWarning("(_KLTSelectGoodFeatures) minimum eigenvalue %f is "
-                     "greater than the capacity of an int; setting "
-                     "to maximum value", val);
-          val = (float) limit;
-        }
-        *ptr++ = (int) val;
-        npoints++;
-      }
+    npoints = _computeTrackability(gradx, grady, ncols, nrows,
+                                   window_hw, window_hh, borderx, bordery,
+                                   tc->nSkippedPixels + 1, min_eigenvalue,
+                                   pointlist);
   }
 			
-  /* Sort the features  */
-  _sortPointList(pointlist, npoints);
+  /* Arrange the features so the best ones can be extracted in order */
+  _buildPointHeap(pointlist, npoints);
 
   /* Check tc->mindist */
   if (tc->mindist < 0)  {
@@ -8,6 +8,9 @@
 #include <math.h>		/* fabs() */
 #include <stdlib.h>		/* malloc() */
 #include <stdio.h>		/* fflush() */
+#ifdef _OPENMP
+#include <omp.h>		/* omp_get_num_procs() */
+#endif
 
 /* Our includes */
 #include "base.h"
@@ -396,9 +399,11 @@ static int _trackFeature(
   float small,         /* determinant threshold for declaring KLT_SMALL_DET */
   float th,            /* displacement threshold for stopping               */
   float max_residue,   /* residue threshold for declaring KLT_LARGE_RESIDUE */
-  int lighting_insensitive)  /* whether to normalize for gain and bias */
+  int lighting_insensitive,  /* whether to normalize for gain and bias */
+  _FloatWindow imgdiff,      /* scratch windows of at least width*height */
+  _FloatWindow gradx,
+  _FloatWindow grady)
 {
-  _FloatWindow imgdiff, gradx, grady;
   float gxx, gxy, gyy, ex, ey, dx, dy;
   int iteration = 0;
   int status;
@@ -408,12 +413,6 @@ static int _trackFeature(
   int nr = img1->nrows;
   float one_plus_eps = 1.001f;   /* To prevent rounding errors */
 
-	
-  /* Allocate memory for windows */
-  imgdiff = _allocateFloatWindow(width, height);
-  gradx   = _allocateFloatWindow(width, height);
-  grady   = _allocateFloatWindow(width, height);
-
   /* Iteratively update the window position */
   do  {
 
@@ -473,9 +472,6 @@ static int _trackFeature(
       status = KLT_LARGE_RESIDUE;
   }
 
-  /* Free memory */
-  free(imgdiff);  free(gradx);  free(grady);
-
   /* Return appropriate value */
   if (status == KLT_SMALL_DET)  return KLT_SMALL_DET;
   else if (status == KLT_OOB)  return KLT_OOB;
@@ -524,83 +520,121 @@ static KLT_BOOL _outOfBounds(
 * Thanks to Kevin Koeser (koeser@mip.informatik.uni-kiel.de) for fixing a bug 
 */
 
-#define SWAP_ME(X,Y) {temp=(X);(X)=(Y);(Y)=temp;}
+/*********************************************************************
+ * _am_solveCholesky
+ *
+ * Solves T a = e in place for the symmetric n x n (n <= 6) system in
+ * the top-left corner of T, by Cholesky decomposition in double
+ * precision on the stack.  T is a sum of outer products of gradient
+ * terms and hence positive semi-definite; if it is numerically
+ * singular the feature cannot be tracked.
+ *
+ * RETURNS
+ * KLT_SMALL_DET if T is not positive definite, KLT_TRACKED otherwise
+ * (in which case e holds the solution).
+ */
 
-static float **_am_matrix(long nr, long nc)
+static int _am_solveCholesky(float T[6][6], float e[6], int n)
 {
-  float **m;
-  int a;
-  m = (float **) malloc((size_t)(nr*sizeof(float*)));
-  m[0] = (float *) malloc((size_t)((nr*nc)*sizeof(float)));
-  for(a = 1; a < nr; a++) m[a] = m[a-1]+nc;
-  return m;
+  double L[6][6];
+  double y[6];
+  double sum;
+  int i, j, k;
+
+  assert(n <= 6);
+
+  /* T = L L' */
+  for (j = 0 ; j < n ; j++)  {
+    sum = T[j][j];
+    for (k = 0 ; k < j ; k++)  sum -= L[j][k] * L[j][k];
+    if (sum <= 0.0)  return KLT_SMALL_DET;
+    L[j][j] = sqrt(sum);
+    for (i = j+1 ; i < n ; i++)  {
+      sum = T[i][j];
+      for (k = 0 ; k < j ; k++)  sum -= L[i][k] * L[j][k];
+      L[i][j] = sum / L[j][j];
+    }
+  }
+
+  /* L y = e */
+  for (i = 0 ; i < n ; i++)  {
+    sum = e[i];
+    for (k = 0 ; k < i ; k++)  sum -= L[i][k] * y[k];
+    y[i] = sum / L[i][i];
+  }
+
+  /* L' a = y */
+  for (i = n-1 ; i >= 0 ; i--)  {
+    sum = y[i];
+    for (k = i+1 ; k < n ; k++)  sum -= L[k][i] * y[k];
+    y[i] = sum / L[i][i];
+  }
+
+  for (i = 0 ; i < n ; i++)  e[i] = (float) y[i];
+
+  return KLT_TRACKED;
 }
 
-static void _am_free_matrix(float **m)
+/*********************************************************************
+ * _am_acquirePatch
+ * _am_releasePatch
+ *
+ * Point a feature at its slot of the arena, or detach it.
+ */
+
+static void _am_acquirePatch(
+  _KLT_PatchArena patches,
+  int indx,
+  KLT_Feature feature)
 {
-  free(m[0]);
-  free(m);
+  assert(patches != NULL && 3*indx+2 < patches->nPatches);
+  feature->aff_img = &patches->img[3*indx];
+  feature->aff_img_gradx = &patches->img[3*indx+1];
+  feature->aff_img_grady = &patches->img[3*indx+2];
 }
 
-
-static int _am_gauss_jordan_elimination(float **a, int n, float **b, int m)
+static void _am_releasePatch(
+  KLT_Feature feature)
 {
-  /* re-implemented from Numerical Recipes in C */
-  int *indxc,*indxr,*ipiv;
-  int i,j,k,l,ll;
-  float big,dum,pivinv,temp;
-  int col = 0;
-  int row = 0;
-
-  indxc=(int *)malloc((size_t) (n*sizeof(int)));
-  indxr=(int *)malloc((size_t) (n*sizeof(int)));
-  ipiv=(int *)malloc((size_t) (n*sizeof(int)));
-  for (j=0;j<n;j++) ipiv[j]=0;
-  for (i=0;i<n;i++) {
-    big=0.0;
-    for (j=0;j<n;j++)
-      if (ipiv[j] != 1)
-	for (k=0;k<n;k++) {
-	  if (ipiv[k] == 0) {
-	    if (fabs(a[j][k]) >= big) {
-	      big= (float) fabs(a[j][k]);
-	      row=j;
-	      col=k;
-	    }
-	  } else if (ipiv[k] > 1) return KLT_SMALL_DET;
-	}
-    ++(ipiv[col]);
-    if (row != col) {
-      for (l=0;l<n;l++) SWAP_ME(a[row][l],a[col][l])
-			  for (l=0;l<m;l++) SWAP_ME(b[row][l],b[col][l])
-					      }
-    indxr[i]=row;
-    indxc[i]=col;
-    if (a[col][col] == 0.0) return KLT_SMALL_DET;
-    pivinv=1.0f/a[col][col];
-    a[col][col]=1.0;
-    for (l=0;l<n;l++) a[col][l] *= pivinv;
-    for (l=0;l<m;l++) b[col][l] *= pivinv;
-    for (ll=0;ll<n;ll++)
-      if (ll != col) {
-	dum=a[ll][col];
-	a[ll][col]=0.0;
-	for (l=0;l<n;l++) a[ll][l] -= a[col][l]*dum;
-	for (l=0;l<m;l++) b[ll][l] -= b[col][l]*dum;
-      }
-  }
-  for (l=n-1;l>=0;l--) {
-    if (indxr[l] != indxc[l])
-      for (k=0;k<n;k++)
-	SWAP_ME(a[k][indxr[l]],a[k][indxc[l]]);
-  }
-  free(ipiv);
-  free(indxr);
-  free(indxc);
+  feature->aff_img = NULL;
+  feature->aff_img_gradx = NULL;
+  feature->aff_img_grady = NULL;
+}
 
-  return KLT_TRACKED;
+
+/*********************************************************************
+ * _am_preparePatchArena
+ *
+ * The reference patches (image, gradx, grady) that the affine check
+ * keeps for each feature live in one arena per feature list, with one
+ * fixed slot per feature, so that losing and replacing features does
+ * not allocate.  Creates the arena, or recreates it if the affine
+ * window size has changed (in which case the features restart their
+ * reference patches).
+ */
+
+static void _am_preparePatchArena(
+  KLT_TrackingContext tc,
+  KLT_FeatureList featurelist)
+{
+  int border = 2; /* add border for interpolation */
+  int ncols = tc->affine_window_width + border;
+  int nrows = tc->affine_window_height + border;
+  _KLT_PatchArena patches = (_KLT_PatchArena) featurelist->aff_patches;
+  int indx;
+
+  if (patches != NULL && patches->nPatches == 3*featurelist->nFeatures &&
+      patches->ncols == ncols && patches->nrows == nrows)
+    return;
+
+  for (indx = 0 ; indx < featurelist->nFeatures ; indx++)
+    _am_releasePatch(featurelist->feature[indx]);
+  if (patches != NULL)  _KLTFreePatchArena(patches);
+  featurelist->aff_patches =
+    _KLTCreatePatchArena(3*featurelist->nFeatures, ncols, nrows);
 }
 
+
 /*********************************************************************
  * _am_getGradientWinAffine
  *
@@ -732,7 +766,7 @@ static void _am_compute6by6GradientMatrix(
 					  _FloatWindow grady,
 					  int width,   /* size of window */
 					  int height,
-					  float **T)  /* return values */
+					  float T[6][6])  /* return values */
 {
   register int hw = width/2, hh = height/2;
   register int i, j;
@@ -809,14 +843,14 @@ static void _am_compute6by1ErrorVector(
 				       _FloatWindow grady,
 				       int width,   /* size of window */
 				       int height,
-				       float **e)  /* return values */
+				       float e[6])  /* return values */
 {
   register int hw = width/2, hh = height/2;
   register int i, j;
   register float diff,  diffgradx,  diffgrady;
 
   /* Set values to zero */  
-  for(i = 0; i < 6; i++) e[i][0] = 0.0; 
+  for(i = 0; i < 6; i++) e[i] = 0.0; 
   
   /* Compute values */
   for (j = -hh ; j <= hh ; j++) {
@@ -824,16 +858,16 @@ static void _am_compute6by1ErrorVector(
       diff = *imgdiff++;
       diffgradx = diff * (*gradx++);
       diffgrady = diff * (*grady++);
-      e[0][0] += diffgradx * i;
-      e[1][0] += diffgrady * i;
-      e[2][0] += diffgradx * j; 
-      e[3][0] += diffgrady * j; 
-      e[4][0] += diffgradx;
-      e[5][0] += diffgrady; 
+      e[0] += diffgradx * i;
+      e[1] += diffgrady * i;
+      e[2] += diffgradx * j; 
+      e[3] += diffgrady * j; 
+      e[4] += diffgradx;
+      e[5] += diffgrady; 
     }
   }
   
-  for(i = 0; i < 6; i++) e[i][0] *= 0.5;
+  for(i = 0; i < 6; i++) e[i] *= 0.5;
   
 }
 
@@ -848,7 +882,7 @@ static void _am_compute4by4GradientMatrix(
 					  _FloatWindow grady,
 					  int width,   /* size of window */
 					  int height,
-					  float **T)  /* return values */
+					  float T[6][6])  /* return values */
 {
   register int hw = width/2, hh = height/2;
   register int i, j;
@@ -903,14 +937,14 @@ static void _am_compute4by1ErrorVector(
 				       _FloatWindow grady,
 				       int width,   /* size of window */
 				       int height,
-				       float **e)  /* return values */
+				       float e[6])  /* return values */
 {
   register int hw = width/2, hh = height/2;
   register int i, j;
   register float diff,  diffgradx,  diffgrady;
 
   /* Set values to zero */  
-  for(i = 0; i < 4; i++) e[i][0] = 0.0; 
+  for(i = 0; i < 4; i++) e[i] = 0.0; 
   
   /* Compute values */
   for (j = -hh ; j <= hh ; j++) {
@@ -918,14 +952,14 @@ static void _am_compute4by1ErrorVector(
       diff = *imgdiff++;
       diffgradx = diff * (*gradx++);
       diffgrady = diff * (*grady++);
-      e[0][0] += diffgradx * i + diffgrady * j;
-      e[1][0] += diffgrady * i - diffgradx * j;
-      e[2][0] += diffgradx;
-      e[3][0] += diffgrady;
+      e[0] += diffgradx * i + diffgrady * j;
+      e[1] += diffgrady * i - diffgradx * j;
+      e[2] += diffgradx;
+      e[3] += diffgrady;
     }
   }
   
-  for(i = 0; i < 4; i++) e[i][0] *= 0.5;
+  for(i = 0; i < 4; i++) e[i] *= 0.5;
   
 }
 
@@ -972,11 +1006,13 @@ static int _am_trackFeatureAffine(
 				  int affine_map,      /* whether to evaluates the consistency of features with affine mapping */
 				  float mdd,           /* difference between the displacements */
 				  float *Axx, float *Ayx, 
-				  float *Axy, float *Ayy)        /* used affine mapping */
+				  float *Axy, float *Ayy,        /* used affine mapping */
+				  _FloatWindow imgdiff,          /* scratch windows of at least width*height */
+				  _FloatWindow gradx,
+				  _FloatWindow grady)
 {
 
 
-  _FloatWindow imgdiff, gradx, grady;
   float gxx, gxy, gyy, ex, ey, dx, dy;
   int iteration = 0;
   int status = 0;
@@ -986,8 +1022,8 @@ static int _am_trackFeatureAffine(
   int nr1 = img1->nrows;
   int nc2 = img2->ncols;
   int nr2 = img2->nrows;
-  float **a;
-  float **T; 
+  float a[6];
+  float T[6][6]; 
   float one_plus_eps = 1.001f;   /* To prevent rounding errors */
   float old_x2 = *x2;
   float old_y2 = *y2;
@@ -999,13 +1035,6 @@ static int _am_trackFeatureAffine(
   printf("starting location x2=%f y2=%f\n", *x2, *y2);
 #endif
   
-  /* Allocate memory for windows */
-  imgdiff = _allocateFloatWindow(width, height);
-  gradx   = _allocateFloatWindow(width, height);
-  grady   = _allocateFloatWindow(width, height);
-  T = _am_matrix(6,6);
-  a = _am_matrix(6,1);
-
   /* Iteratively update the window position */
   do  {
     if(!affine_map) {
@@ -1116,30 +1145,30 @@ static int _am_trackFeatureAffine(
 	_am_compute4by1ErrorVector(imgdiff, gradx, grady, width, height, a);
 	_am_compute4by4GradientMatrix(gradx, grady, width, height, T);
 	
-	status = _am_gauss_jordan_elimination(T,4,a,1);
+	status = _am_solveCholesky(T,a,4);
 	
-	*Axx += a[0][0];
-	*Ayx += a[1][0];
+	*Axx += a[0];
+	*Ayx += a[1];
 	*Ayy = *Axx;
 	*Axy = -(*Ayx);
 	
-	dx = a[2][0];
-	dy = a[3][0];
+	dx = a[2];
+	dy = a[3];
 	
 	break;
       case 2:
 	_am_compute6by1ErrorVector(imgdiff, gradx, grady, width, height, a);
 	_am_compute6by6GradientMatrix(gradx, grady, width, height, T);
       
-	status = _am_gauss_jordan_elimination(T,6,a,1);
+	status = _am_solveCholesky(T,a,6);
 	
-	*Axx += a[0][0];
-	*Ayx += a[1][0];
-	*Axy += a[2][0];
-	*Ayy += a[3][0];
+	*Axx += a[0];
+	*Ayx += a[1];
+	*Axy += a[2];
+	*Ayy += a[3];
 
-	dx = a[4][0];
-	dy = a[5][0];
+	dx = a[4];
+	dy = a[5];
       
 	break;
       }
@@ -1179,8 +1208,6 @@ static int _am_trackFeatureAffine(
 #endif   
     }  while ( !convergence  && iteration < max_iterations); 
     /*}  while ( (fabs(dx)>=th || fabs(dy)>=th || (affine_map && iteration < 8) ) && iteration < max_iterations); */
-  _am_free_matrix(T);
-  _am_free_matrix(a);
 
   /* Check whether window is out of bounds */
   if (*x2-hw < 0.0f || nc2-(*x2+hw) < one_plus_eps || 
@@ -1207,9 +1234,6 @@ static int _am_trackFeatureAffine(
       status = KLT_LARGE_RESIDUE;
   }
 
-  /* Free memory */
-  free(imgdiff);  free(gradx);  free(grady);
-
 #ifdef DEBUG_AFFINE_MAPPING
   printf("iter = %d status=%d\n", iteration, status);
   _KLTFreeFloatImage( aff_diff_win );
@@ -1225,6 +1249,182 @@ static int _am_trackFeatureAffine(
 
 
 
+/*********************************************************************
+ * _trackFeatureInPyramids
+ *
+ * Tracks one feature coarse-to-fine through the pyramids, runs the
+ * affine consistency check if enabled, and records the outcome in the
+ * feature.  Touches nothing but the feature and the scratch windows,
+ * so different features may be tracked concurrently.
+ */
+
+static void _trackFeatureInPyramids(
+	KLT_TrackingContext tc,
+	KLT_Feature feature,
+	int indx,                       /* index of feature in its list */
+	_KLT_PatchArena patches,        /* reference patches for affine mapping */
+	_KLT_Pyramid pyramid1,
+	_KLT_Pyramid pyramid1_gradx,
+	_KLT_Pyramid pyramid1_grady,
+	_KLT_Pyramid pyramid2,
+	_KLT_Pyramid pyramid2_gradx,
+	_KLT_Pyramid pyramid2_grady,
+	int ncols,
+	int nrows,
+	_FloatWindow imgdiff,           /* scratch windows */
+	_FloatWindow gradx,
+	_FloatWindow grady)
+{
+	float subsampling = (float) tc->subsampling;
+	float xloc, yloc, xlocout, ylocout;
+	int val = KLT_TRACKED;
+	int r;
+
+	xloc = feature->x;
+	yloc = feature->y;
+
+	/* Transform location to coarsest resolution */
+	for (r = tc->nPyramidLevels - 1 ; r >= 0 ; r--)  {
+		xloc /= subsampling;  yloc /= subsampling;
+	}
+	xlocout = xloc;  ylocout = yloc;
+
+	/* Beginning with coarsest resolution, do ... */
+	for (r = tc->nPyramidLevels - 1 ; r >= 0 ; r--)  {
+
+		/* Track feature at current resolution */
+		xloc *= subsampling;  yloc *= subsampling;
+		xlocout *= subsampling;  ylocout *= subsampling;
+
+		val = _trackFeature(xloc, yloc, 
+			&xlocout, &ylocout,
+			pyramid1->img[r], 
+			pyramid1_gradx->img[r], pyramid1_grady->img[r], 
+			pyramid2->img[r], 
+			pyramid2_gradx->img[r], pyramid2_grady->img[r],
+			tc->window_width, tc->window_height,
+			tc->step_factor,
+			tc->max_iterations,
+			tc->min_determinant,
+			tc->min_displacement,
+			tc->max_residue,
+			tc->lighting_insensitive,
+			imgdiff, gradx, grady);
+
+		if (val==KLT_SMALL_DET || val==KLT_OOB)
+			break;
+	}
+
+	/* Record feature */
+	if (val == KLT_OOB) {
+		feature->x   = -1.0;
+		feature->y   = -1.0;
+		feature->val = KLT_OOB;
+		_am_releasePatch(feature);
+
+	} else if (_outOfBounds(xlocout, ylocout, ncols, nrows, tc->borderx, tc->bordery))  {
+		feature->x   = -1.0;
+		feature->y   = -1.0;
+		feature->val = KLT_OOB;
+		_am_releasePatch(feature);
+	} else if (val == KLT_SMALL_DET)  {
+		feature->x   = -1.0;
+		feature->y   = -1.0;
+		feature->val = KLT_SMALL_DET;
+		_am_releasePatch(feature);
+	} else if (val == KLT_LARGE_RESIDUE)  {
+		feature->x   = -1.0;
+		feature->y   = -1.0;
+		feature->val = KLT_LARGE_RESIDUE;
+		_am_releasePatch(feature);
+	} else if (val == KLT_MAX_ITERATIONS)  {
+		feature->x   = -1.0;
+		feature->y   = -1.0;
+		feature->val = KLT_MAX_ITERATIONS;
+		_am_releasePatch(feature);
+	} else  {
+		feature->x = xlocout;
+		feature->y = ylocout;
+		feature->val = KLT_TRACKED;
+		if (tc->affineConsistencyCheck >= 0 && val == KLT_TRACKED)  { /*for affine mapping*/
+			int border = 2; /* add border for interpolation */
+
+#ifdef DEBUG_AFFINE_MAPPING	  
+			glob_index = indx;
+#endif
+
+			if(!feature->aff_img){
+				/* save image and gradient for each feature at finest resolution after first successful track */
+				_am_acquirePatch(patches, indx, feature);
+				_am_getSubFloatImage(pyramid1->img[0],xloc,yloc,feature->aff_img);
+				_am_getSubFloatImage(pyramid1_gradx->img[0],xloc,yloc,feature->aff_img_gradx);
+				_am_getSubFloatImage(pyramid1_grady->img[0],xloc,yloc,feature->aff_img_grady);
+				feature->aff_x = xloc - (int) xloc + (tc->affine_window_width+border)/2;
+				feature->aff_y = yloc - (int) yloc + (tc->affine_window_height+border)/2;;
+			}else{
+				/* affine tracking */
+				val = _am_trackFeatureAffine(feature->aff_x, feature->aff_y,
+					&xlocout, &ylocout,
+					feature->aff_img, 
+					feature->aff_img_gradx, 
+					feature->aff_img_grady,
+					pyramid2->img[0], 
+					pyramid2_gradx->img[0], pyramid2_grady->img[0],
+					tc->affine_window_width, tc->affine_window_height,
+					tc->step_factor,
+					tc->affine_max_iterations,
+					tc->min_determinant,
+					tc->min_displacement,
+					tc->affine_min_displacement,
+					tc->affine_max_residue, 
+					tc->lighting_insensitive,
+					tc->affineConsistencyCheck,
+					tc->affine_max_displacement_differ,
+					&feature->aff_Axx,
+					&feature->aff_Ayx,
+					&feature->aff_Axy,
+					&feature->aff_Ayy,
+					imgdiff, gradx, grady
+					);
+				feature->val = val;
+				if(val != KLT_TRACKED){
+					feature->x   = -1.0;
+					feature->y   = -1.0;
+					feature->aff_x = -1.0;
+					feature->aff_y = -1.0;
+					/* drop image and gradient for lost feature */
+					_am_releasePatch(feature);
+				}else{
+					/*feature->x = xlocout;*/
+					/*feature->y = ylocout;*/
+				}
+			}
+		}
+
+	}
+}
+
+
+/*********************************************************************
+ * _numTrackingThreads
+ *
+ * Number of threads to track nFeatures features with, given
+ * tc->nThreads (0 = one per processor).  Always 1 without OpenMP.
+ */
+
+static int _numTrackingThreads(
+	KLT_TrackingContext tc,
+	int nFeatures)
+{
+#ifdef _OPENMP
+	int nThreads = (tc->nThreads > 0) ? tc->nThreads : omp_get_num_procs();
+	return max(1, min(nThreads, nFeatures));
+#else
+	return 1;
+#endif
+}
+
+
 /*********************************************************************
  * KLTTrackFeatures
  *
@@ -1243,9 +1443,7 @@ void KLTTrackFeatures(
 	_KLT_Pyramid pyramid1, pyramid1_gradx, pyramid1_grady,
 		pyramid2, pyramid2_gradx, pyramid2_grady;
 	float subsampling = (float) tc->subsampling;
-	float xloc, yloc, xlocout, ylocout;
-	int val;
-	int indx, r;
+	int indx;
 	KLT_BOOL floatimg1_created = FALSE;
 	int i;
 
@@ -1339,164 +1537,43 @@ void KLTTrackFeatures(
 		}
 	}
 
-	/* For each feature, do ... */
-	for (indx = 0 ; indx < featurelist->nFeatures ; indx++)  {
-
-		/* Only track features that are not lost */
-		if (featurelist->feature[indx]->val >= 0)  {
-
-			xloc = featurelist->feature[indx]->x;
-			yloc = featurelist->feature[indx]->y;
-
-			/* Transform location to coarsest resolution */
-			for (r = tc->nPyramidLevels - 1 ; r >= 0 ; r--)  {
-				xloc /= subsampling;  yloc /= subsampling;
-			}
-			xlocout = xloc;  ylocout = yloc;
-
-			/* Beginning with coarsest resolution, do ... */
-			for (r = tc->nPyramidLevels - 1 ; r >= 0 ; r--)  {
-
-				/* Track feature at current resolution */
-				xloc *= subsampling;  yloc *= subsampling;
-				xlocout *= subsampling;  ylocout *= subsampling;
-
-				val = _trackFeature(xloc, yloc, 
-					&xlocout, &ylocout,
-					pyramid1->img[r], 
-					pyramid1_gradx->img[r], pyramid1_grady->img[r], 
-					pyramid2->img[r], 
-					pyramid2_gradx->img[r], pyramid2_grady->img[r],
-					tc->window_width, tc->window_height,
-					tc->step_factor,
-					tc->max_iterations,
-					tc->min_determinant,
-					tc->min_displacement,
-					tc->max_residue,
-					tc->lighting_insensitive);
-
-				if (val==KLT_SMALL_DET || val==KLT_OOB)
-					break;
-			}
-
-			/* Record feature */
-			if (val == KLT_OOB) {
-				featurelist->feature[indx]->x   = -1.0;
-				featurelist->feature[indx]->y   = -1.0;
-				featurelist->feature[indx]->val = KLT_OOB;
-				if( featurelist->feature[indx]->aff_img ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-				if( featurelist->feature[indx]->aff_img_gradx ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-				if( featurelist->feature[indx]->aff_img_grady ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-				featurelist->feature[indx]->aff_img = NULL;
-				featurelist->feature[indx]->aff_img_gradx = NULL;
-				featurelist->feature[indx]->aff_img_grady = NULL;
-
-			} else if (_outOfBounds(xlocout, ylocout, ncols, nrows, tc->borderx, tc->bordery))  {
-				featurelist->feature[indx]->x   = -1.0;
-				featurelist->feature[indx]->y   = -1.0;
-				featurelist->feature[indx]->val = KLT_OOB;
-				if( featurelist->feature[indx]->aff_img ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-				if( featurelist->feature[indx]->aff_img_gradx ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-				if( featurelist->feature[indx]->aff_img_grady ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-				featurelist->feature[indx]->aff_img = NULL;
-				featurelist->feature[indx]->aff_img_gradx = NULL;
-				featurelist->feature[indx]->aff_img_grady = NULL;
-			} else if (val == KLT_SMALL_DET)  {
-				featurelist->feature[indx]->x   = -1.0;
-				featurelist->feature[indx]->y   = -1.0;
-				featurelist->feature[indx]->val = KLT_SMALL_DET;
-				if( featurelist->feature[indx]->aff_img ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-				if( featurelist->feature[indx]->aff_img_gradx ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-				if( featurelist->feature[indx]->aff_img_grady ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-				featurelist->feature[indx]->aff_img = NULL;
-				featurelist->feature[indx]->aff_img_gradx = NULL;
-				featurelist->feature[indx]->aff_img_grady = NULL;
-			} else if (val == KLT_LARGE_RESIDUE)  {
-				featurelist->feature[indx]->x   = -1.0;
-				featurelist->feature[indx]->y   = -1.0;
-				featurelist->feature[indx]->val = KLT_LARGE_RESIDUE;
-				if( featurelist->feature[indx]->aff_img ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-				if( featurelist->feature[indx]->aff_img_gradx ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-				if( featurelist->feature[indx]->aff_img_grady ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-				featurelist->feature[indx]->aff_img = NULL;
-				featurelist->feature[indx]->aff_img_gradx = NULL;
-				featurelist->feature[indx]->aff_img_grady = NULL;
-			} else if (val == KLT_MAX_ITERATIONS)  {
-				featurelist->feature[indx]->x   = -1.0;
-				featurelist->feature[indx]->y   = -1.0;
-				featurelist->feature[indx]->val = KLT_MAX_ITERATIONS;
-				if( featurelist->feature[indx]->aff_img ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-				if( featurelist->feature[indx]->aff_img_gradx ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-				if( featurelist->feature[indx]->aff_img_grady ) _KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-				featurelist->feature[indx]->aff_img = NULL;
-				featurelist->feature[indx]->aff_img_gradx = NULL;
-				featurelist->feature[indx]->aff_img_grady = NULL;
-			} else  {
-				featurelist->feature[indx]->x = xlocout;
-				featurelist->feature[indx]->y = ylocout;
-				featurelist->feature[indx]->val = KLT_TRACKED;
-				if (tc->affineConsistencyCheck >= 0 && val == KLT_TRACKED)  { /*for affine mapping*/
-					int border = 2; /* add border for interpolation */
+	/* Make sure there is a reference patch for every feature */
+	if (tc->affineConsistencyCheck >= 0)
+		_am_preparePatchArena(tc, featurelist);
 
-#ifdef DEBUG_AFFINE_MAPPING	  
-					glob_index = indx;
+	/* For each feature, do ... */
+	/* Features are independent once the pyramids are built, so they are */
+	/* distributed over threads; each thread owns its scratch windows and */
+	/* each feature's result is written to its own slot, so the output */
+	/* does not depend on the number of threads. */
+	{
+		int win_width = max(tc->window_width, tc->affine_window_width);
+		int win_height = max(tc->window_height, tc->affine_window_height);
+		int nThreads = _numTrackingThreads(tc, featurelist->nFeatures);
+
+#ifdef _OPENMP
+#pragma omp parallel num_threads(nThreads)
 #endif
+		{
+			_FloatWindow imgdiff = _allocateFloatWindow(win_width, win_height);
+			_FloatWindow gradx   = _allocateFloatWindow(win_width, win_height);
+			_FloatWindow grady   = _allocateFloatWindow(win_width, win_height);
 
-					if(!featurelist->feature[indx]->aff_img){
-						/* save image and gradient for each feature at finest resolution after first successful track */
-						featurelist->feature[indx]->aff_img = _KLTCreateFloatImage((tc->affine_window_width+border), (tc->affine_window_height+border));
-						featurelist->feature[indx]->aff_img_gradx = _KLTCreateFloatImage((tc->affine_window_width+border), (tc->affine_window_height+border));
-						featurelist->feature[indx]->aff_img_grady = _KLTCreateFloatImage((tc->affine_window_width+border), (tc->affine_window_height+border));
-						_am_getSubFloatImage(pyramid1->img[0],xloc,yloc,featurelist->feature[indx]->aff_img);
-						_am_getSubFloatImage(pyramid1_gradx->img[0],xloc,yloc,featurelist->feature[indx]->aff_img_gradx);
-						_am_getSubFloatImage(pyramid1_grady->img[0],xloc,yloc,featurelist->feature[indx]->aff_img_grady);
-						featurelist->feature[indx]->aff_x = xloc - (int) xloc + (tc->affine_window_width+border)/2;
-						featurelist->feature[indx]->aff_y = yloc - (int) yloc + (tc->affine_window_height+border)/2;;
-					}else{
-						/* affine tracking */
-						val = _am_trackFeatureAffine(featurelist->feature[indx]->aff_x, featurelist->feature[indx]->aff_y,
-							&xlocout, &ylocout,
-							featurelist->feature[indx]->aff_img, 
-							featurelist->feature[indx]->aff_img_gradx, 
-							featurelist->feature[indx]->aff_img_grady,
-							pyramid2->img[0], 
-							pyramid2_gradx->img[0], pyramid2_grady->img[0],
-							tc->affine_window_width, tc->affine_window_height,
-							tc->step_factor,
-							tc->affine_max_iterations,
-							tc->min_determinant,
-							tc->min_displacement,
-							tc->affine_min_displacement,
-							tc->affine_max_residue, 
-							tc->lighting_insensitive,
-							tc->affineConsistencyCheck,
-							tc->affine_max_displacement_differ,
-							&featurelist->feature[indx]->aff_Axx,
-							&featurelist->feature[indx]->aff_Ayx,
-							&featurelist->feature[indx]->aff_Axy,
-							&featurelist->feature[indx]->aff_Ayy 
-							);
-						featurelist->feature[indx]->val = val;
-						if(val != KLT_TRACKED){
-							featurelist->feature[indx]->x   = -1.0;
-							featurelist->feature[indx]->y   = -1.0;
-							featurelist->feature[indx]->aff_x = -1.0;
-							featurelist->feature[indx]->aff_y = -1.0;
-							/* free image and gradient for lost feature */
-							_KLTFreeFloatImage(featurelist->feature[indx]->aff_img);
-							_KLTFreeFloatImage(featurelist->feature[indx]->aff_img_gradx);
-							_KLTFreeFloatImage(featurelist->feature[indx]->aff_img_grady);
-							featurelist->feature[indx]->aff_img = NULL;
-							featurelist->feature[indx]->aff_img_gradx = NULL;
-							featurelist->feature[indx]->aff_img_grady = NULL;
-						}else{
-							/*featurelist->feature[indx]->x = xlocout;*/
-							/*featurelist->feature[indx]->y = ylocout;*/
-						}
-					}
-				}
-
+#ifdef _OPENMP
+#pragma omp for schedule(dynamic, 8)
+#endif
+			for (indx = 0 ; indx < featurelist->nFeatures ; indx++)  {
+
+				/* Only track features that are not lost */
+				if (featurelist->feature[indx]->val >= 0)
+					_trackFeatureInPyramids(tc, featurelist->feature[indx], indx,
+						(_KLT_PatchArena) featurelist->aff_patches,
+						pyramid1, pyramid1_gradx, pyramid1_grady,
+						pyramid2, pyramid2_gradx, pyramid2_grady,
+						ncols, nrows, imgdiff, gradx, grady);
 			}
+
+			free(imgdiff);  free(gradx);  free(grady);
 		}
 	}
 
@@ -0,0 +1,479 @@
+/*********************************************************************
+ * trackLog.c
+ *
+ * Append-only binary log of tracked features, written one frame at
+ * a time while tracking, so that long sequences do not have to be
+ * kept in a KLT_FeatureTable.  The file is
+ *
+ *   header   magic "KLTTL1\0\0", nFeatures, flags, nFrames,
+ *            reserved, offset of the index (8 bytes)
+ *   records  one per frame: frame, nEntries, then nEntries times
+ *            id, x, y, val [, Axx, Ayx, Axy, Ayy if KLT_TL_AFFINE]
+ *   index    nFrames times frame, nEntries, offset (8 bytes)
+ *
+ * A record lists only the features that are tracked (val >= 0) and
+ * those that were lost in that frame, so a frame costs in proportion
+ * to the features alive in it.  nFrames and the index offset are
+ * filled in by KLTCloseTrackLog; a log that was never closed (e.g. the
+ * program crashed) is still readable, its index is rebuilt by walking
+ * the records.  All values are in native byte order, like the other
+ * KLT binary files.
+ *********************************************************************/
+
+/* Standard includes */
+#include <assert.h>
+#include <stdio.h>		/* fopen(), fwrite() */
+#include <stdlib.h>		/* malloc(), realloc() */
+#include <string.h>		/* memcpy(), memcmp() */
+#ifdef _WIN32
+#include <windows.h>	/* CreateFileMapping(), MapViewOfFile() */
+#else
+#include <fcntl.h>		/* open() */
+#include <sys/mman.h>	/* mmap() */
+#include <sys/stat.h>	/* fstat() */
+#include <unistd.h>		/* close() */
+#endif
+
+/* Our includes */
+#include "base.h"
+#include "error.h"
+#include "klt.h"
+
+#define TL_MAGICLENGTH		8
+#define TL_HEADERLENGTH		32
+#define TL_NFRAMES_POS		16
+#define TL_INDEXENTRYLENGTH	16
+#define TL_RECORDHEADERLENGTH	8
+#define KLT_TL_AFFINE		1
+
+extern int KLT_verbose;
+
+static char tl_magic[TL_MAGICLENGTH] = {'K','L','T','T','L','1','\0','\0'};
+
+typedef struct  {
+  int frame;
+  int nEntries;
+  long long offset;
+}  _KLT_TrackLogIndexRec;
+
+struct _KLT_TrackLogRec  {
+  int nFeatures;
+  int flags;
+  int nFrames;
+  _KLT_TrackLogIndexRec *index;
+  int indexSize;		/* allocated entries of index */
+
+  /* writing */
+  FILE *fp;
+  long long offset;		/* current end of file */
+  int *lastVal;			/* val of each feature in the previous record */
+  char *buffer;			/* one record */
+
+  /* reading */
+  const char *map;
+  long long mapSize;
+#ifdef _WIN32
+  HANDLE file;
+  HANDLE mapping;
+#endif
+};
+
+
+static int _entryLength(
+  int flags)
+{
+  return (flags & KLT_TL_AFFINE) ? 8 * 4 : 4 * 4;
+}
+
+
+static void _addIndexEntry(
+  KLT_TrackLog tl,
+  int frame,
+  int nEntries,
+  long long offset)
+{
+  if (tl->nFrames == tl->indexSize)  {
+    tl->indexSize = (tl->indexSize == 0) ? 1024 : 2 * tl->indexSize;
+    tl->index = (_KLT_TrackLogIndexRec *)
+      realloc(tl->index, tl->indexSize * sizeof(_KLT_TrackLogIndexRec));
+    if (tl->index == NULL)
+      KLTError("(KLTTrackLog) Out of memory");
+  }
+  tl->index[tl->nFrames].frame = frame;
+  tl->index[tl->nFrames].nEntries = nEntries;
+  tl->index[tl->nFrames].offset = offset;
+  tl->nFrames++;
+}
+
+
+/*********************************************************************
+ * KLTCreateTrackLog
+ *
+ * Creates (or truncates) the log file fname for feature lists of
+ * nFeatures features.  If affine is TRUE, the affine parameters
+ * (aff_Axx, aff_Ayx, aff_Axy, aff_Ayy) are stored with each entry.
+ */
+
+KLT_TrackLog KLTCreateTrackLog(
+  char *fname,
+  int nFeatures,
+  KLT_BOOL affine)
+{
+  KLT_TrackLog tl;
+  char header[TL_HEADERLENGTH];
+  int i;
+
+  tl = (KLT_TrackLog) calloc(1, sizeof(struct _KLT_TrackLogRec));
+  if (tl == NULL)  KLTError("(KLTCreateTrackLog) Out of memory");
+  tl->nFeatures = nFeatures;
+  tl->flags = affine ? KLT_TL_AFFINE : 0;
+
+  tl->fp = fopen(fname, "wb");
+  if (tl->fp == NULL)
+    KLTError("(KLTCreateTrackLog) Can't open file '%s' for writing", fname);
+
+  tl->lastVal = (int *) malloc(nFeatures * sizeof(int));
+  tl->buffer = (char *) malloc(TL_RECORDHEADERLENGTH +
+                               nFeatures * _entryLength(tl->flags));
+  if (tl->lastVal == NULL || tl->buffer == NULL)
+    KLTError("(KLTCreateTrackLog) Out of memory");
+  for (i = 0 ; i < nFeatures ; i++)
+    tl->lastVal[i] = KLT_NOT_FOUND;
+
+  memset(header, 0, TL_HEADERLENGTH);
+  memcpy(header, tl_magic, TL_MAGICLENGTH);
+  memcpy(header + 8, &tl->nFeatures, sizeof(int));
+  memcpy(header + 12, &tl->flags, sizeof(int));
+  fwrite(header, 1, TL_HEADERLENGTH, tl->fp);
+  tl->offset = TL_HEADERLENGTH;
+
+  if (KLT_verbose >= 1)
+    fprintf(stderr, "(KLT) Writing track log to '%s'\n", fname);
+
+  return tl;
+}
+
+
+/*********************************************************************
+ * KLTAppendTrackLog
+ *
+ * Appends the features of fl as frame number 'frame'.  Frame numbers
+ * must increase from one call to the next.
+ */
+
+void KLTAppendTrackLog(
+  KLT_TrackLog tl,
+  KLT_FeatureList fl,
+  int frame)
+{
+  int entryLength = _entryLength(tl->flags);
+  char *ptr = tl->buffer + TL_RECORDHEADERLENGTH;
+  int nEntries = 0;
+  int indx;
+
+  if (tl->fp == NULL)
+    KLTError("(KLTAppendTrackLog) Track log is not open for writing");
+  if (fl->nFeatures != tl->nFeatures)
+    KLTError("(KLTAppendTrackLog) FeatureList and track log must "
+             "have the same number of features");
+  if (tl->nFrames > 0 && frame <= tl->index[tl->nFrames-1].frame)
+    KLTError("(KLTAppendTrackLog) Frame %d does not follow frame %d",
+             frame, tl->index[tl->nFrames-1].frame);
+
+  for (indx = 0 ; indx < fl->nFeatures ; indx++)  {
+    KLT_Feature feat = fl->feature[indx];
+    if (feat->val >= 0 || tl->lastVal[indx] >= 0)  {
+      memcpy(ptr,      &indx,      sizeof(int));
+      memcpy(ptr + 4,  &feat->x,   sizeof(KLT_locType));
+      memcpy(ptr + 8,  &feat->y,   sizeof(KLT_locType));
+      memcpy(ptr + 12, &feat->val, sizeof(int));
+      if (tl->flags & KLT_TL_AFFINE)  {
+        memcpy(ptr + 16, &feat->aff_Axx, sizeof(KLT_locType));
+        memcpy(ptr + 20, &feat->aff_Ayx, sizeof(KLT_locType));
+        memcpy(ptr + 24, &feat->aff_Axy, sizeof(KLT_locType));
+        memcpy(ptr + 28, &feat->aff_Ayy, sizeof(KLT_locType));
+      }
+      ptr += entryLength;
+      nEntries++;
+    }
+    tl->lastVal[indx] = feat->val;
+  }
+
+  memcpy(tl->buffer,     &frame,    sizeof(int));
+  memcpy(tl->buffer + 4, &nEntries, sizeof(int));
+  if (fwrite(tl->buffer, 1, ptr - tl->buffer, tl->fp) != (size_t) (ptr - tl->buffer))
+    KLTError("(KLTAppendTrackLog) Can't write frame %d", frame);
+
+  _addIndexEntry(tl, frame, nEntries, tl->offset);
+  tl->offset += ptr - tl->buffer;
+}
+
+
+/*********************************************************************
+ * _rebuildIndex
+ *
+ * Walks the records of a log that was not closed.  A record cut
+ * short at the end of the file is ignored.
+ */
+
+static void _rebuildIndex(
+  KLT_TrackLog tl,
+  long long end)
+{
+  int entryLength = _entryLength(tl->flags);
+  long long offset = TL_HEADERLENGTH;
+  int frame, nEntries;
+
+  while (offset + TL_RECORDHEADERLENGTH <= end)  {
+    memcpy(&frame, tl->map + offset, sizeof(int));
+    memcpy(&nEntries, tl->map + offset + 4, sizeof(int));
+    if (nEntries < 0 || nEntries > tl->nFeatures ||
+        offset + TL_RECORDHEADERLENGTH + (long long) nEntries * entryLength > end)
+      break;
+    _addIndexEntry(tl, frame, nEntries, offset);
+    offset += TL_RECORDHEADERLENGTH + (long long) nEntries * entryLength;
+  }
+}
+
+
+/*********************************************************************
+ * _mapFile
+ * _unmapFile
+ */
+
+static void _mapFile(
+  KLT_TrackLog tl,
+  char *fname)
+{
+#ifdef _WIN32
+  LARGE_INTEGER size;
+
+  tl->file = CreateFileA(fname, GENERIC_READ, FILE_SHARE_READ, NULL,
+                         OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+  if (tl->file == INVALID_HANDLE_VALUE)
+    KLTError("(KLTOpenTrackLog) Can't open file '%s' for reading", fname);
+  GetFileSizeEx(tl->file, &size);
+  tl->mapSize = size.QuadPart;
+  if (tl->mapSize < TL_HEADERLENGTH)
+    KLTError("(KLTOpenTrackLog) File '%s' is not a track log", fname);
+  tl->mapping = CreateFileMapping(tl->file, NULL, PAGE_READONLY, 0, 0, NULL);
+  if (tl->mapping == NULL)
+    KLTError("(KLTOpenTrackLog) Can't map file '%s'", fname);
+  tl->map = (const char *) MapViewOfFile(tl->mapping, FILE_MAP_READ, 0, 0, 0);
+  if (tl->map == NULL)
+    KLTError("(KLTOpenTrackLog) Can't map file '%s'", fname);
+#else
+  struct stat st;
+  void *map;
+  int fd;
+
+  fd = open(fname, O_RDONLY);
+  if (fd < 0)
+    KLTError("(KLTOpenTrackLog) Can't open file '%s' for reading", fname);
+  if (fstat(fd, &st) != 0 || st.st_size < TL_HEADERLENGTH)
+    KLTError("(KLTOpenTrackLog) File '%s' is not a track log", fname);
+  tl->mapSize = st.st_size;
+  map = mmap(NULL, (size_t) tl->mapSize, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED)
+    KLTError("(KLTOpenTrackLog) Can't map file '%s'", fname);
+  tl->map = (const char *) map;
+#endif
+}
+
+
+static void _unmapFile(
+  KLT_TrackLog tl)
+{
+#ifdef _WIN32
+  UnmapViewOfFile(tl->map);
+  CloseHandle(tl->mapping);
+  CloseHandle(tl->file);
+#else
+  munmap((void *) tl->map, (size_t) tl->mapSize);
+#endif
+}
+
+
+/*********************************************************************
+ * KLTOpenTrackLog
+ *
+ * Memory-maps an existing log for reading.
+ */
+
+KLT_TrackLog KLTOpenTrackLog(
+  char *fname)
+{
+  KLT_TrackLog tl;
+  long long indexOffset;
+  int nFrames;
+  int i;
+
+  tl = (KLT_TrackLog) calloc(1, sizeof(struct _KLT_TrackLogRec));
+  if (tl == NULL)  KLTError("(KLTOpenTrackLog) Out of memory");
+
+  if (KLT_verbose >= 1)
+    fprintf(stderr, "(KLT) Reading track log from '%s'\n", fname);
+
+  _mapFile(tl, fname);
+  if (memcmp(tl->map, tl_magic, TL_MAGICLENGTH) != 0)
+    KLTError("(KLTOpenTrackLog) File '%s' is not a track log", fname);
+  memcpy(&tl->nFeatures, tl->map + 8, sizeof(int));
+  memcpy(&tl->flags, tl->map + 12, sizeof(int));
+  memcpy(&nFrames, tl->map + TL_NFRAMES_POS, sizeof(int));
+  memcpy(&indexOffset, tl->map + 24, sizeof(long long));
+
+  if (indexOffset >= TL_HEADERLENGTH &&
+      indexOffset + (long long) nFrames * TL_INDEXENTRYLENGTH <= tl->mapSize)  {
+    const char *ptr = tl->map + indexOffset;
+    for (i = 0 ; i < nFrames ; i++)  {
+      int frame, nEntries;
+      long long offset;
+      memcpy(&frame, ptr, sizeof(int));
+      memcpy(&nEntries, ptr + 4, sizeof(int));
+      memcpy(&offset, ptr + 8, sizeof(long long));
+      _addIndexEntry(tl, frame, nEntries, offset);
+      ptr += TL_INDEXENTRYLENGTH;
+    }
+  } else  {
+    if (KLT_verbose >= 1)
+      fprintf(stderr, "(KLT) Track log '%s' was not closed; "
+              "rebuilding its index\n", fname);
+    _rebuildIndex(tl, tl->mapSize);
+  }
+
+  return tl;
+}
+
+
+/*********************************************************************
+ * KLTCloseTrackLog
+ *
+ * When writing, appends the index and completes the header.  Frees
+ * the log in either case.
+ */
+
+void KLTCloseTrackLog(
+  KLT_TrackLog tl)
+{
+  if (tl->fp != NULL)  {
+    char entry[TL_INDEXENTRYLENGTH];
+    int i;
+
+    for (i = 0 ; i < tl->nFrames ; i++)  {
+      memcpy(entry,     &tl->index[i].frame,    sizeof(int));
+      memcpy(entry + 4, &tl->index[i].nEntries, sizeof(int));
+      memcpy(entry + 8, &tl->index[i].offset,   sizeof(long long));
+      fwrite(entry, 1, TL_INDEXENTRYLENGTH, tl->fp);
+    }
+    fseek(tl->fp, TL_NFRAMES_POS, SEEK_SET);
+    fwrite(&tl->nFrames, sizeof(int), 1, tl->fp);
+    fseek(tl->fp, 24, SEEK_SET);
+    fwrite(&tl->offset, sizeof(long long), 1, tl->fp);
+    fclose(tl->fp);
+    free(tl->lastVal);
+    free(tl->buffer);
+  }
+  if (tl->map != NULL)
+    _unmapFile(tl);
+
+  free(tl->index);
+  free(tl);
+}
+
+
+/*********************************************************************
+ * KLTCountTrackLogFrames
+ * KLTTrackLogFrame
+ *
+ * Number of frames in the log, and the frame number of the i'th one.
+ */
+
+int KLTCountTrackLogFrames(
+  KLT_TrackLog tl)
+{
+  return tl->nFrames;
+}
+
+
+int KLTTrackLogFrame(
+  KLT_TrackLog tl,
+  int i)
+{
+  if (i < 0 || i >= tl->nFrames)
+    KLTError("(KLTTrackLogFrame) Index %d is not between 0 and %d",
+             i, tl->nFrames - 1);
+  return tl->index[i].frame;
+}
+
+
+/*********************************************************************
+ * KLTReadTrackLogFrame
+ *
+ * Reads frame number 'frame' into fl; features that have no entry in
+ * that frame are set to (-1,-1) with val KLT_NOT_FOUND.  Finding the
+ * frame is a binary search in the index, and only its record is
+ * touched.  If fl is NULL, a feature list is created.
+ */
+
+KLT_FeatureList KLTReadTrackLogFrame(
+  KLT_TrackLog tl,
+  int frame,
+  KLT_FeatureList fl_in)
+{
+  KLT_FeatureList fl;
+  int entryLength = _entryLength(tl->flags);
+  const char *ptr;
+  int lo = 0, hi = tl->nFrames - 1, mid = -1;
+  int indx, i;
+
+  if (tl->map == NULL)
+    KLTError("(KLTReadTrackLogFrame) Track log is not open for reading");
+
+  while (lo <= hi)  {
+    mid = (lo + hi) / 2;
+    if (tl->index[mid].frame == frame)  break;
+    if (tl->index[mid].frame < frame)  lo = mid + 1;
+    else  hi = mid - 1;
+  }
+  if (lo > hi)
+    KLTError("(KLTReadTrackLogFrame) Frame %d is not in the track log", frame);
+
+  if (fl_in == NULL)
+    fl = KLTCreateFeatureList(tl->nFeatures);
+  else  {
+    fl = fl_in;
+    if (fl->nFeatures != tl->nFeatures)
+      KLTError("(KLTReadTrackLogFrame) The feature list passed "
+               "does not contain the same number of features as "
+               "the track log");
+  }
+
+  for (indx = 0 ; indx < fl->nFeatures ; indx++)  {
+    fl->feature[indx]->x = -1.0;
+    fl->feature[indx]->y = -1.0;
+    fl->feature[indx]->val = KLT_NOT_FOUND;
+  }
+
+  ptr = tl->map + tl->index[mid].offset + TL_RECORDHEADERLENGTH;
+  for (i = 0 ; i < tl->index[mid].nEntries ; i++)  {
+    KLT_Feature feat;
+    memcpy(&indx, ptr, sizeof(int));
+    if (indx < 0 || indx >= fl->nFeatures)
+      KLTError("(KLTReadTrackLogFrame) Bad feature index %d in frame %d",
+               indx, frame);
+    feat = fl->feature[indx];
+    memcpy(&feat->x,   ptr + 4,  sizeof(KLT_locType));
+    memcpy(&feat->y,   ptr + 8,  sizeof(KLT_locType));
+    memcpy(&feat->val, ptr + 12, sizeof(int));
+    if (tl->flags & KLT_TL_AFFINE)  {
+      memcpy(&feat->aff_Axx, ptr + 16, sizeof(KLT_locType));
+      memcpy(&feat->aff_Ayx, ptr + 20, sizeof(KLT_locType));
+      memcpy(&feat->aff_Axy, ptr + 24, sizeof(KLT_locType));
+      memcpy(&feat->aff_Ayy, ptr + 28, sizeof(KLT_locType));
+    }
+    ptr += entryLength;
+  }
+
+  return fl;
+}
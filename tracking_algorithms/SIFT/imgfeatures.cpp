@@ -13,6 +13,20 @@ Copyright (C) 2006  Rob Hess <hess@eecs.oregonstate.edu>
 //#include <cxcore.h>
 
 #include <math.h>
+#include <string.h>
+
+/* Vector extensions, used by the descriptor distance kernels if available */
+#if defined(__AVX__)
+#include <immintrin.h>
+#define FEATURE_USE_AVX
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define FEATURE_USE_SSE2
+#endif
+
+/* row alignment of a descr_matrix, in bytes */
+#define DESCR_MATRIX_ALIGN 32
 
 int import_oxfd_features( char*, struct feature** );
 int export_oxfd_features( char*, struct feature*, int );
@@ -24,6 +38,8 @@ int export_lowe_features( char*, struct feature*, int );
 void draw_lowe_features( IplImage*, struct feature*, int );
 void draw_lowe_feature( IplImage*, struct feature*, CvScalar );
 
+int descr_dist_sq_u8( const unsigned char*, const unsigned char*, int );
+
 
 /*
 Reads image features from file.  The file should be formatted as from
@@ -159,19 +175,65 @@ f1 and f2.
 */
 double descr_dist_sq( struct feature* f1, struct feature* f2 )
 {
-	double diff, dsq = 0;
-	double* descr1, * descr2;
-	int i, d;
+	int d;
 
 	d = f1->d;
 	if( f2->d != d )
 		return DBL_MAX;
-	descr1 = f1->descr;
-	descr2 = f2->descr;
+	return descr_dist_sq_f( f1->descr, f2->descr, d );
+}
+
+
+
+/*
+Calculates the squared Euclidian distance between two descriptor vectors.
+Descriptors computed by sift_features() are integers in [0,255], so the
+float sums here are exact and match a computation in double precision.
+
+@param d1 first descriptor
+@param d2 second descriptor
+@param d descriptor length
+
+@return Returns the squared Euclidian distance between d1 and d2.
+*/
+float descr_dist_sq_f( const float* d1, const float* d2, int d )
+{
+	float diff, dsq;
+	int i = 0;
+
+#if defined(FEATURE_USE_AVX)
+	__m256 acc = _mm256_setzero_ps();
+	__m128 sum;
 
-	for( i = 0; i < d; i++ )
+	for( ; i + 8 <= d; i += 8 )
+	{
+		__m256 t = _mm256_sub_ps( _mm256_loadu_ps( d1 + i ),
+								  _mm256_loadu_ps( d2 + i ) );
+		acc = _mm256_add_ps( acc, _mm256_mul_ps( t, t ) );
+	}
+	sum = _mm_add_ps( _mm256_castps256_ps128( acc ),
+					  _mm256_extractf128_ps( acc, 1 ) );
+	sum = _mm_add_ps( sum, _mm_movehl_ps( sum, sum ) );
+	sum = _mm_add_ss( sum, _mm_shuffle_ps( sum, sum, 1 ) );
+	dsq = _mm_cvtss_f32( sum );
+#elif defined(FEATURE_USE_SSE2)
+	__m128 acc = _mm_setzero_ps();
+
+	for( ; i + 4 <= d; i += 4 )
+	{
+		__m128 t = _mm_sub_ps( _mm_loadu_ps( d1 + i ), _mm_loadu_ps( d2 + i ) );
+		acc = _mm_add_ps( acc, _mm_mul_ps( t, t ) );
+	}
+	acc = _mm_add_ps( acc, _mm_movehl_ps( acc, acc ) );
+	acc = _mm_add_ss( acc, _mm_shuffle_ps( acc, acc, 1 ) );
+	dsq = _mm_cvtss_f32( acc );
+#else
+	dsq = 0;
+#endif
+
+	for( ; i < d; i++ )
 	{
-		diff = descr1[i] - descr2[i];
+		diff = d1[i] - d2[i];
 		dsq += diff*diff;
 	}
 	return dsq;
@@ -179,6 +241,137 @@ double descr_dist_sq( struct feature* f1, struct feature* f2 )
 
 
 
+/*
+Copies the descriptors of a set of features into a descriptor matrix.
+
+@param feat feature array
+@param n number of features
+@param quantize if nonzero, also store the descriptors as bytes
+
+@return Returns a new descriptor matrix or NULL on error.
+*/
+struct descr_matrix* descr_matrix_build( struct feature* feat, int n,
+										int quantize )
+{
+	struct descr_matrix* mat;
+	size_t size_f, size_u8;
+	char* base;
+	int i, j, d;
+
+	d = ( n > 0 )? feat[0].d : 0;
+	for( i = 1; i < n; i++ )
+		if( feat[i].d != d )
+		{
+			fprintf( stderr, "Warning: descriptors of different lengths, %s," \
+					" line %d\n", __FILE__, __LINE__ );
+			return NULL;
+		}
+
+	mat = (struct descr_matrix*) calloc( 1, sizeof( struct descr_matrix ) );
+	mat->n = n;
+	mat->d = d;
+	mat->stride = ( d + 7 ) & ~7;
+	mat->stride_u8 = ( d + 31 ) & ~31;
+	size_f = (size_t)n * mat->stride * sizeof( float );
+	size_u8 = ( quantize )? (size_t)n * mat->stride_u8 : 0;
+
+	/* one block for both copies; the float rows start on an aligned address
+	and the byte rows follow them, which keeps them aligned too */
+	mat->mem = calloc( size_f + size_u8 + DESCR_MATRIX_ALIGN, 1 );
+	if( ! mat->mem )
+	{
+		fprintf( stderr, "Warning: unable to allocate memory, %s, line %d\n",
+				__FILE__, __LINE__ );
+		free( mat );
+		return NULL;
+	}
+	base = (char*)mat->mem + DESCR_MATRIX_ALIGN -
+		( (size_t)mat->mem & ( DESCR_MATRIX_ALIGN - 1 ) );
+	mat->data = (float*)base;
+	mat->data_u8 = ( quantize )? (unsigned char*)( base + size_f ) : NULL;
+
+	for( i = 0; i < n; i++ )
+	{
+		memcpy( mat->data + (size_t)i * mat->stride, feat[i].descr,
+				d * sizeof( float ) );
+		if( quantize )
+			for( j = 0; j < d; j++ )
+				mat->data_u8[(size_t)i * mat->stride_u8 + j] = (unsigned char)
+					MIN( 255, MAX( 0, cvRound( feat[i].descr[j] ) ) );
+	}
+
+	return mat;
+}
+
+
+
+/*
+Calculates the squared distances from one descriptor to a block of
+consecutive rows of a descriptor matrix.
+
+@param q query descriptor
+@param mat descriptor matrix
+@param first first row
+@param count number of rows
+@param dist array in which to store the distances
+*/
+void descr_dist_sq_batch( const float* q, struct descr_matrix* mat,
+						 int first, int count, float* dist )
+{
+	const float* row = mat->data + (size_t)first * mat->stride;
+	int i;
+
+	for( i = 0; i < count; i++, row += mat->stride )
+		dist[i] = descr_dist_sq_f( q, row, mat->d );
+}
+
+
+
+/*
+Calculates the squared distances from one quantized descriptor to a block
+of consecutive rows of a quantized descriptor matrix.
+
+@param q query descriptor
+@param mat descriptor matrix
+@param first first row
+@param count number of rows
+@param dist array in which to store the distances
+*/
+void descr_dist_sq_batch_u8( const unsigned char* q, struct descr_matrix* mat,
+							int first, int count, int* dist )
+{
+	const unsigned char* row;
+	int i;
+
+	if( ! mat->data_u8 )
+	{
+		fprintf( stderr, "Warning: descriptor matrix is not quantized, %s," \
+				" line %d\n", __FILE__, __LINE__ );
+		return;
+	}
+	row = mat->data_u8 + (size_t)first * mat->stride_u8;
+	for( i = 0; i < count; i++, row += mat->stride_u8 )
+		dist[i] = descr_dist_sq_u8( q, row, mat->d );
+}
+
+
+
+/*
+De-allocates a descriptor matrix.
+
+@param mat pointer to a descriptor matrix
+*/
+void descr_matrix_release( struct descr_matrix** mat )
+{
+	if( ! mat  ||  ! *mat )
+		return;
+	free( (*mat)->mem );
+	free( *mat );
+	*mat = NULL;
+}
+
+
+
 /***************************** Local Functions *******************************/
 
 
@@ -599,3 +792,44 @@ void draw_lowe_feature( IplImage* img, struct feature* feat, CvScalar color )
 }
 
 
+
+/*
+Calculates the squared Euclidian distance between two byte descriptors.
+
+@param d1 first descriptor
+@param d2 second descriptor
+@param d descriptor length
+
+@return Returns the squared Euclidian distance between d1 and d2.
+*/
+int descr_dist_sq_u8( const unsigned char* d1, const unsigned char* d2, int d )
+{
+	int diff, dsq = 0, i = 0;
+
+#ifdef FEATURE_USE_SSE2
+	__m128i zero = _mm_setzero_si128();
+	__m128i acc = _mm_setzero_si128();
+
+	for( ; i + 16 <= d; i += 16 )
+	{
+		__m128i a = _mm_loadu_si128( (const __m128i*)( d1 + i ) );
+		__m128i b = _mm_loadu_si128( (const __m128i*)( d2 + i ) );
+		__m128i lo = _mm_sub_epi16( _mm_unpacklo_epi8( a, zero ),
+									_mm_unpacklo_epi8( b, zero ) );
+		__m128i hi = _mm_sub_epi16( _mm_unpackhi_epi8( a, zero ),
+									_mm_unpackhi_epi8( b, zero ) );
+		acc = _mm_add_epi32( acc, _mm_madd_epi16( lo, lo ) );
+		acc = _mm_add_epi32( acc, _mm_madd_epi16( hi, hi ) );
+	}
+	acc = _mm_add_epi32( acc, _mm_shuffle_epi32( acc, _MM_SHUFFLE( 1, 0, 3, 2 ) ) );
+	acc = _mm_add_epi32( acc, _mm_shuffle_epi32( acc, _MM_SHUFFLE( 2, 3, 0, 1 ) ) );
+	dsq = _mm_cvtsi128_si32( acc );
+#endif
+
+	for( ; i < d; i++ )
+	{
+		diff = (int)d1[i] - (int)d2[i];
+		dsq += diff*diff;
+	}
+	return dsq;
+}
@@ -35,6 +35,25 @@ enum feature_match_type
 #define FEATURE_MAX_D 128
 
 
+/**
+Descriptors of a set of features, one row per feature, in one contiguous
+block for the distance kernels.  Rows are 32-byte aligned and padded with
+zeros to a multiple of 8 floats.  If the matrix was built with
+quantization, \a data_u8 holds the same descriptors rounded to bytes
+(exact for SIFT descriptors, which are integers in [0,255]).
+*/
+struct descr_matrix
+{
+	int n;                         /**< number of rows */
+	int d;                         /**< descriptor length */
+	int stride;                    /**< floats per row of \a data */
+	int stride_u8;                 /**< bytes per row of \a data_u8 */
+	float* data;                   /**< n x stride descriptors */
+	unsigned char* data_u8;        /**< n x stride_u8 descriptors, or NULL */
+	void* mem;                     /**< allocation holding the rows */
+};
+
+
 /**
 Structure to represent an affine invariant image feature.  The fields
 x, y, a, b, c represent the affine region around the feature:
@@ -51,7 +70,7 @@ struct feature
 	double scl;                    /**< scale of a Lowe-style feature */
 	double ori;                    /**< orientation of a Lowe-style feature */
 	int d;                         /**< descriptor length */
-	double descr[FEATURE_MAX_D];   /**< descriptor */
+	float descr[FEATURE_MAX_D];    /**< descriptor */
 	int type;                      /**< feature type, OXFD or LOWE */
 	int category;                  /**< all-purpose feature category */
 	struct feature* fwd_match;     /**< matching feature from forward image */
@@ -118,4 +137,68 @@ Calculates the squared Euclidian distance between two feature descriptors.
 extern double descr_dist_sq( struct feature* f1, struct feature* f2 );
 
 
+/**
+Calculates the squared Euclidian distance between two descriptor vectors,
+using SSE/AVX where available.
+
+@param d1 first descriptor
+@param d2 second descriptor
+@param d descriptor length
+
+@return Returns the squared Euclidian distance between \a d1 and \a d2.
+*/
+extern float descr_dist_sq_f( const float* d1, const float* d2, int d );
+
+
+/**
+Copies the descriptors of a set of features into a descriptor matrix.
+Row i of the matrix is the descriptor of \a feat[i].
+
+@param feat feature array; all features must have the same descriptor length
+@param n number of features
+@param quantize if nonzero, also store the descriptors as bytes
+
+@return Returns a new descriptor matrix or NULL on error.
+*/
+extern struct descr_matrix* descr_matrix_build( struct feature* feat, int n,
+											   int quantize );
+
+
+/**
+Calculates the squared distances from one descriptor to a block of
+consecutive rows of a descriptor matrix.
+
+@param q query descriptor of length \a mat->d
+@param mat descriptor matrix
+@param first first row
+@param count number of rows
+@param dist array of \a count floats in which to store the distances
+*/
+extern void descr_dist_sq_batch( const float* q, struct descr_matrix* mat,
+								int first, int count, float* dist );
+
+
+/**
+Calculates the squared distances from one quantized descriptor to a block
+of consecutive rows of a descriptor matrix built with quantization.
+
+@param q query descriptor of length \a mat->d
+@param mat descriptor matrix
+@param first first row
+@param count number of rows
+@param dist array of \a count ints in which to store the distances
+*/
+extern void descr_dist_sq_batch_u8( const unsigned char* q,
+								   struct descr_matrix* mat,
+								   int first, int count, int* dist );
+
+
+/**
+De-allocates a descriptor matrix.
+
+@param mat pointer to a descriptor matrix
+*/
+extern void descr_matrix_release( struct descr_matrix** mat );
+
+
 #endif
@@ -19,11 +19,13 @@ Copyright (C) 2006  Rob Hess <hess@eecs.oregonstate.edu>
 #define KDTREE_H
 
 #include "cxcore.h"
+#include "minpq.h"
 
 
 /********************************* Structures ********************************/
 
 struct feature;
+struct descr_matrix;
 
 /** a node in a k-d tree */
 struct kd_node
@@ -38,6 +40,48 @@ struct kd_node
 };
 
 
+/**
+A node of a read-only kd tree stored as an array.  Nodes are in depth-first
+order, so the left child of an internal node directly follows it.
+*/
+struct kd_flat_node
+{
+	int ki;                      /**< partition key index, or -1 at a leaf */
+	double kv;                   /**< partition key value */
+	int right;                   /**< index of the right child */
+	int first;                   /**< first descriptor row under this node */
+	int n;                       /**< number of descriptor rows under this node */
+};
+
+
+/**
+A read-only kd tree over the descriptors of an array of features.  Row
+\a r of \a descr is the descriptor of \a features[r], and the rows under
+every node are contiguous.  Any number of threads may query the tree at
+once, each with its own kd_query_ctx.
+*/
+struct kd_flat_tree
+{
+	struct kd_flat_node* nodes;  /**< nodes, root first */
+	int n_nodes;                 /**< number of nodes */
+	struct feature* features;    /**< features, in the order of the rows */
+	int n;                       /**< number of features */
+	struct descr_matrix* descr;  /**< descriptors of \a features */
+};
+
+
+/**
+Scratch space for kd_flat_tree queries, owned by the caller and reused
+from one query to the next so that queries do not allocate.
+*/
+struct kd_query_ctx
+{
+	struct min_pq* min_pq;       /**< nodes waiting to be explored */
+	float* dist;                 /**< distances to the rows of a leaf */
+	int dist_nallocd;            /**< number of elements allocated in \a dist */
+};
+
+
 /*************************** Function Prototypes *****************************/
 
 /**
@@ -102,4 +146,89 @@ De-allocates memory held by a kd tree
 extern void kdtree_release( struct kd_node* kd_root );
 
 
+/**
+Builds a read-only kd tree from the features in an array.  Like
+kdtree_build(), this reorders \a features, which must then stay in place
+for as long as the tree is used.
+
+@param features an array of features
+@param n the number of features in \a features
+
+@return Returns a kd tree built from \a features, or NULL on error.
+*/
+extern struct kd_flat_tree* kdtree_build_flat( struct feature* features,
+											  int n );
+
+
+/**
+Creates the scratch space for querying kd_flat_trees.
+
+@return Returns a new query context.
+*/
+extern struct kd_query_ctx* kd_query_ctx_init( void );
+
+
+/**
+De-allocates a query context.
+
+@param ctx pointer to a query context
+*/
+extern void kd_query_ctx_release( struct kd_query_ctx** ctx );
+
+
+/**
+Finds a descriptor's approximate k nearest neighbors in a read-only kd tree
+using Best Bin First search.
+
+@param tree a kd tree built with kdtree_build_flat()
+@param descr descriptor for whose neighbors to search, of length
+	\a tree->descr->d
+@param k number of neighbors to find
+@param max_nn_chks search is cut off after examining this many tree entries
+@param ctx query context of the calling thread
+@param nbrs array of at least \a k ints in which to store the indices into
+	\a tree->features of the neighbors, in order of increasing distance
+@param nbr_dist array of at least \a k floats in which to store the squared
+	descriptor distances of the neighbors, or NULL
+
+@return Returns the number of neighbors found, or -1 on error.
+*/
+extern int kdtree_flat_bbf_knn( struct kd_flat_tree* tree, const float* descr,
+							   int k, int max_nn_chks,
+							   struct kd_query_ctx* ctx, int* nbrs,
+							   float* nbr_dist );
+
+
+/**
+Finds the approximate k nearest neighbors of every feature in an array,
+dividing the queries between threads if OpenMP is available.
+
+@param tree a kd tree built with kdtree_build_flat()
+@param feat array of features for whose neighbors to search
+@param n number of features in \a feat
+@param k number of neighbors to find for each feature
+@param max_nn_chks search is cut off after examining this many tree entries
+@param nbrs array of \a n * \a k ints; the neighbors of \a feat[i] are
+	stored from \a nbrs[i*k], as by kdtree_flat_bbf_knn()
+@param nbr_dist array of \a n * \a k floats for the neighbors' distances,
+	or NULL
+@param n_nbrs array of \a n ints in which to store the number of neighbors
+	found for each feature
+
+@return Returns 0 on success or -1 on error.
+*/
+extern int kdtree_flat_bbf_knn_batch( struct kd_flat_tree* tree,
+									 struct feature* feat, int n, int k,
+									 int max_nn_chks, int* nbrs,
+									 float* nbr_dist, int* n_nbrs );
+
+
+/**
+De-allocates a read-only kd tree.
+
+@param tree pointer to a kd tree
+*/
+extern void kdtree_release_flat( struct kd_flat_tree** tree );
+
+
 #endif
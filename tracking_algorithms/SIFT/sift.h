@@ -37,6 +37,44 @@ struct detection_data
 struct feature;
 
 
+/** per-thread scratch space of a sift_workspace */
+struct sift_thread_buf
+{
+	CvMat* band;             /**< one blurred band of rows plus its halo */
+	struct feature** found;  /**< features detected by this thread */
+	int n_found;             /**< number of features in \a found */
+	int nallocd;             /**< allocated length of \a found */
+	double* hist;            /**< flat descriptor histogram */
+	int hist_len;            /**< allocated length of \a hist */
+	double* weights;         /**< Gaussian weights of descriptor samples */
+	int weights_len;         /**< allocated length of \a weights */
+};
+
+
+/**
+Buffers for scale space construction that are reused by _sift_features_ws()
+for as long as the input images keep the same size, so that a video stream
+allocates its pyramids once rather than once per frame.
+*/
+struct sift_workspace
+{
+	int width;                 /**< width of the images the buffers fit */
+	int height;                /**< height of the images the buffers fit */
+	int img_dbl;               /**< 1 if the base image is doubled */
+	int intvls;                /**< intervals per octave */
+	int octvs;                 /**< octaves of scale space */
+	IplImage* gray8;           /**< 8-bit gray copy of a color input */
+	IplImage* gray32;          /**< 32-bit gray copy of the input */
+	IplImage*** gauss_pyr;     /**< octvs x (intvls + 3) Gaussian pyramid */
+	IplImage*** dog_pyr;       /**< octvs x (intvls + 2) DoG pyramid */
+	IplImage*** grad_mag;      /**< gradient magnitudes of gauss_pyr levels */
+	IplImage*** grad_ori;      /**< gradient orientations of gauss_pyr levels */
+	CvMemStorage* storage;     /**< storage for detected features */
+	struct sift_thread_buf* thread_bufs; /**< one per thread */
+	int n_threads;             /**< number of entries in \a thread_bufs */
+};
+
+
 /******************************* Defs and macros *****************************/
 
 /** default number of sampled intervals per octave */
@@ -93,6 +131,10 @@ struct feature;
 /* factor used to convert floating-point descriptor to unsigned char */
 #define SIFT_INT_DESCR_FCTR 512.0
 
+/** a level is only blurred in parallel bands if each band has at least
+this many times as many rows as the Gaussian kernel radius */
+#define SIFT_BAND_MIN_RADII 8
+
 /* returns a feature's detection data */
 #define feat_detection_data(f) ( (struct detection_data*)(f->feature_data) )
 
@@ -142,4 +184,70 @@ extern int _sift_features( IplImage* img, struct feature** feat, int intvls,
 						  double sigma, double contr_thr, int curv_thr,
 						  int img_dbl, int descr_width, int descr_hist_bins );
 
+
+
+/**
+Creates an empty workspace for _sift_features_ws().  Its buffers are
+allocated on first use and re-allocated whenever the image size changes.
+
+@return Returns a new SIFT workspace.
+*/
+extern struct sift_workspace* sift_workspace_init( void );
+
+
+
+/**
+Like sift_features(), but builds the scale space in the buffers of a
+workspace instead of allocating them for every image.
+
+@param img the image in which to detect features
+@param feat a pointer to an array in which to store detected features
+@param ws a workspace created by sift_workspace_init()
+
+@return Returns the number of features stored in \a feat or -1 on failure
+@see _sift_features_ws()
+*/
+extern int sift_features_ws( IplImage* img, struct feature** feat,
+							struct sift_workspace* ws );
+
+
+
+/**
+Like _sift_features(), but builds the scale space in the buffers of a
+workspace instead of allocating them for every image.  Blurring and the
+search for scale space extrema are spread over OpenMP threads when
+available; the detected features do not depend on the number of threads.
+
+@param img the image in which to detect features
+@param feat a pointer to an array in which to store detected features
+@param intvls the number of intervals sampled per octave of scale space
+@param sigma the amount of Gaussian smoothing applied to each image level
+	before building the scale space representation for an octave
+@param contr_thr a threshold on the value of the scale space function
+@param curv_thr threshold on a feature's ratio of principle curvatures
+@param img_dbl should be 1 if image doubling prior to scale space
+	construction is desired or 0 if not
+@param descr_width the width of the array of orientation histograms used
+	to compute a feature's descriptor
+@param descr_hist_bins the number of orientations in each of the
+	histograms used to compute a feature's descriptor
+@param ws a workspace created by sift_workspace_init()
+
+@return Returns the number of keypoints stored in \a feat or -1 on failure
+@see _sift_features()
+*/
+extern int _sift_features_ws( IplImage* img, struct feature** feat,
+							 int intvls, double sigma, double contr_thr,
+							 int curv_thr, int img_dbl, int descr_width,
+							 int descr_hist_bins, struct sift_workspace* ws );
+
+
+
+/**
+De-allocates a SIFT workspace and all the buffers it holds.
+
+@param ws pointer to a workspace
+*/
+extern void sift_workspace_release( struct sift_workspace** ws );
+
 #endif
@@ -25,13 +25,21 @@ Copyright (C) 2006  Rob Hess <hess@eecs.oregonstate.edu>
 static __inline struct feature* get_match( struct feature*, int );
 int get_matched_features( struct feature*, int, int, struct feature*** );
 int calc_min_inliers( int, int, double, double );
-struct feature** draw_ransac_sample( struct feature**, int, int, gsl_rng* );
-void extract_corresp_pts( struct feature**, int, int, CvPoint2D64f**,
-						 CvPoint2D64f** );
-int find_consensus( struct feature**, int, int, CvMat*, ransac_err_fn,
-				   double, struct feature*** );
-static __inline void release_mem( CvPoint2D64f*, CvPoint2D64f*,
-struct feature** );
+void draw_ransac_sample( int, int, gsl_rng*, int* );
+void extract_corresp_pts( struct feature**, int, int, CvPoint2D64f*,
+						 CvPoint2D64f* );
+int eval_hypothesis( CvPoint2D64f*, CvPoint2D64f*, int, int*, int,
+					ransac_xform_fn, ransac_err_fn, double, int, double*,
+					CvMat** );
+int homog_4pt( CvPoint2D64f*, CvPoint2D64f*, int*, double* );
+int basis_to_pts( CvPoint2D64f*, CvPoint2D64f*, CvPoint2D64f*,
+				 CvPoint2D64f*, double* );
+int score_hypothesis( CvPoint2D64f*, CvPoint2D64f*, int, CvMat*,
+					 ransac_err_fn, double, int );
+int find_consensus( CvPoint2D64f*, CvPoint2D64f*, int, CvMat*, ransac_err_fn,
+				   double, int* );
+void gather_pts( CvPoint2D64f*, CvPoint2D64f*, int*, int, CvPoint2D64f*,
+				CvPoint2D64f* );
 
 /********************** Functions prototyped in xform.h **********************/
 
@@ -79,90 +87,138 @@ CvMat* ransac_xform( struct feature* features, int n, int mtype,
 					ransac_err_fn err_fn, double err_tol,
 struct feature*** inliers, int* n_in )
 {
-	struct feature** matched, ** sample, ** consensus, ** consensus_max = NULL;
-	struct ransac_data* rdata;
-	CvPoint2D64f* pts, * mpts;
-	CvMat* M = NULL;
+	struct feature** matched;
+	CvPoint2D64f* pts, * mpts, * cpts, * cmpts;
+	CvMat* M = NULL, * M_best = NULL, H_best;
+	CvMat* hyp_M[RANSAC_BATCH_SIZE];
 	gsl_rng* rng;
-	double p, in_frac = RANSAC_INLIER_FRAC_EST;
-	int i, nm, in, in_min, in_max = 0, k = 0;
+	double hyp_H[RANSAC_BATCH_SIZE * 9], h_best[9];
+	double p, k_max, in_frac = RANSAC_INLIER_FRAC_EST;
+	int hyp_in[RANSAC_BATCH_SIZE];
+	int* samples, * consensus;
+	int i, b, nb, nm, in, in_min, in_max = 0, closed_form, k = 0;
 
 	nm = get_matched_features( features, n, mtype, &matched );
 	if( nm < m )
 	{
 		fprintf( stderr, "Warning: not enough matches to compute xform, %s" \
 			" line %d\n", __FILE__, __LINE__ );
-		goto end;
+		free( matched );
+		return NULL;
 	}
 
+	/* correspondences are extracted once; hypotheses only index into them */
+	pts = (CvPoint2D64f*) malloc( nm * sizeof( CvPoint2D64f ) );
+	mpts = (CvPoint2D64f*) malloc( nm * sizeof( CvPoint2D64f ) );
+	extract_corresp_pts( matched, nm, mtype, pts, mpts );
+	samples = (int*) malloc( RANSAC_BATCH_SIZE * m * sizeof( int ) );
+	closed_form = ( xform_fn == lsq_homog  &&  m == 4 );
+
 	/* initialize random number generator */
 	rng = gsl_rng_alloc( gsl_rng_mt19937 );
 	gsl_rng_set( rng, time(NULL) );
 
 	in_min = calc_min_inliers( nm, m, RANSAC_PROB_BAD_SUPP, p_badxform );
 	p = pow( 1.0 - pow( in_frac, m ), k );
-	i = 0;
 	while( p > p_badxform )
 	{
-		sample = draw_ransac_sample( matched, nm, m, rng );
-		extract_corresp_pts( sample, m, mtype, &pts, &mpts );
-		M = xform_fn( pts, mpts, m );
-		if( ! M )
-			goto iteration_end;
-		in = find_consensus( matched, nm, mtype, M, err_fn, err_tol, &consensus);
-		if( in > in_max )
+		/*
+		Draw no more hypotheses than the current inlier fraction says are
+		still needed.  Samples are drawn serially and every hypothesis of a
+		batch is scored against the best consensus from before the batch, so
+		the result does not depend on the number of threads.
+		*/
+		k_max = log( p_badxform ) / log( 1.0 - pow( in_frac, m ) );
+		nb = ( k_max - k < RANSAC_BATCH_SIZE )? (int)ceil( k_max - k ) : RANSAC_BATCH_SIZE;
+		nb = MAX( nb, 1 );
+		for( b = 0; b < nb; b++ )
+			draw_ransac_sample( nm, m, rng, samples + b * m );
+
+#ifdef _OPENMP
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+		for( b = 0; b < nb; b++ )
+			hyp_in[b] = eval_hypothesis( pts, mpts, nm, samples + b * m, m,
+				xform_fn, err_fn, err_tol, in_max, hyp_H + b * 9, hyp_M + b );
+
+		/*
+		Take up the hypotheses in the order they were drawn, updating the
+		inlier fraction and with it the number of iterations needed, and stop
+		exactly where a one-at-a-time loop would have stopped.  A hypothesis
+		whose scoring bailed out early reports at most in_max inliers, so it
+		can never be taken for the best.
+		*/
+		for( b = 0; b < nb; b++ )
 		{
-			if( consensus_max )
-				free( consensus_max );
-			consensus_max = consensus;
-			in_max = in;
-			in_frac = (double)in_max / nm;
+			if( p > p_badxform  &&  hyp_in[b] > in_max )
+			{
+				in_max = hyp_in[b];
+				in_frac = (double)in_max / nm;
+				if( closed_form )
+					memcpy( h_best, hyp_H + b * 9, 9 * sizeof( double ) );
+				else
+				{
+					if( M_best )
+						cvReleaseMat( &M_best );
+					M_best = hyp_M[b];
+					hyp_M[b] = NULL;
+				}
+			}
+			if( p > p_badxform )
+				p = pow( 1.0 - pow( in_frac, m ), ++k );
+			if( hyp_M[b] )
+				cvReleaseMat( &hyp_M[b] );
 		}
-		else
-			free( consensus );
-		cvReleaseMat( &M );
-
-iteration_end:
-		release_mem( pts, mpts, sample );
-		p = pow( 1.0 - pow( in_frac, m ), ++k );
 	}
 
 	/* calculate final transform based on best consensus set */
 	if( in_max >= in_min )
 	{
-		extract_corresp_pts( consensus_max, in_max, mtype, &pts, &mpts );
-		M = xform_fn( pts, mpts, in_max );
-		in = find_consensus( matched, nm, mtype, M, err_fn, err_tol, &consensus);
+		consensus = (int*) malloc( nm * sizeof( int ) );
+		cpts = (CvPoint2D64f*) malloc( nm * sizeof( CvPoint2D64f ) );
+		cmpts = (CvPoint2D64f*) malloc( nm * sizeof( CvPoint2D64f ) );
+		if( closed_form )
+		{
+			H_best = cvMat( 3, 3, CV_64FC1, h_best );
+			M_best = &H_best;
+		}
+
+		in = find_consensus( pts, mpts, nm, M_best, err_fn, err_tol, consensus );
+		gather_pts( pts, mpts, consensus, in, cpts, cmpts );
+		M = xform_fn( cpts, cmpts, in );
+		in = find_consensus( pts, mpts, nm, M, err_fn, err_tol, consensus );
 		cvReleaseMat( &M );
-		release_mem( pts, mpts, consensus_max );
-		extract_corresp_pts( consensus, in, mtype, &pts, &mpts );
-		M = xform_fn( pts, mpts, in );
+		gather_pts( pts, mpts, consensus, in, cpts, cmpts );
+		M = xform_fn( cpts, cmpts, in );
 		if( inliers )
 		{
-			*inliers = consensus;
-			consensus = NULL;
+			*inliers = (feature**) calloc( in, sizeof( struct feature* ) );
+			for( i = 0; i < in; i++ )
+				(*inliers)[i] = matched[consensus[i]];
 		}
 		if( n_in )
 			*n_in = in;
-		release_mem( pts, mpts, consensus );
+
+		if( closed_form )
+			M_best = NULL;
+		free( consensus );
+		free( cpts );
+		free( cmpts );
 	}
-	else if( consensus_max )
+	else if( in_max > 0 )
 	{
 		if( inliers )
 			*inliers = NULL;
 		if( n_in )
 			*n_in = 0;
-		free( consensus_max );
 	}
 
+	if( M_best )
+		cvReleaseMat( &M_best );
 	gsl_rng_free( rng );
-end:
-	for( i = 0; i < nm; i++ )
-	{
-		rdata = feat_ransac_data( matched[i] );
-		matched[i]->feature_data = rdata->orig_feat_data;
-		free( rdata );
-	}
+	free( samples );
+	free( pts );
+	free( mpts );
 	free( matched );
 	return M;
 }
@@ -306,8 +362,7 @@ static __inline struct feature* get_match( struct feature* feat, int mtype )
 
 /*
 Finds all features with a match of a specified type and stores pointers
-to them in an array.  Additionally initializes each matched feature's
-feature_data field with a ransac_data structure.
+to them in an array.
 
 @param features array of features
 @param n number of features in features
@@ -321,22 +376,14 @@ int get_matched_features( struct feature* features, int n, int mtype,
 struct feature*** matched )
 {
 	struct feature** _matched;
-	struct ransac_data* rdata;
 	int i, m = 0;
 
 	_matched = (feature**) calloc( n, sizeof( struct feature* ) );
 	for( i = 0; i < n; i++ )
 		if( get_match( features + i, mtype ) )
-		{
-			rdata = (ransac_data*) malloc( sizeof( struct ransac_data ) );
-			memset( rdata, 0, sizeof( struct ransac_data ) );
-			rdata->orig_feat_data = features[i].feature_data;
-			_matched[m] = features + i;
-			_matched[m]->feature_data = rdata;
-			m++;
-		}
-		*matched = _matched;
-		return m;
+			_matched[m++] = features + i;
+	*matched = _matched;
+	return m;
 }
 
 
@@ -381,44 +428,29 @@ int calc_min_inliers( int n, int m, double p_badsupp, double p_badxform )
 
 
 /*
-Draws a RANSAC sample from a set of features.
+Draws a RANSAC sample of distinct correspondences.
 
-@param features array of pointers to features from which to sample
-@param n number of features in features
+@param n number of correspondences from which to sample
 @param m size of the sample
 @param rng random number generator used to sample
-
-@return Returns an array of pointers to the sampled features; the sampled
-	field of each sampled feature's ransac_data is set to 1
+@param sample output as the indices of the m sampled correspondences
 */
-struct feature** draw_ransac_sample( struct feature** features, int n,
-									int m, gsl_rng* rng )
+void draw_ransac_sample( int n, int m, gsl_rng* rng, int* sample )
 {
-	struct feature** sample, * feat;
-	struct ransac_data* rdata;
-	int i, x;
-
-	for( i = 0; i < n; i++ )
-	{
-		rdata = feat_ransac_data( features[i] );
-		rdata->sampled = 0;
-	}
+	int i, j, x;
 
-	sample = (feature**) calloc( m, sizeof( struct feature* ) );
 	for( i = 0; i < m; i++ )
 	{
 		do
 		{
 			x = gsl_rng_uniform_int( rng, n );
-			feat = features[x];
-			rdata = feat_ransac_data( feat );
+			for( j = 0; j < i; j++ )
+				if( sample[j] == x )
+					break;
 		}
-		while( rdata->sampled );
-		sample[i] = feat;
-		rdata->sampled = 1;
+		while( j < i );
+		sample[i] = x;
 	}
-
-	return sample;
 }
 
 
@@ -432,124 +464,266 @@ Extrancs raw point correspondence locations from a set of features
 @param mtype match type; if FEATURE_MDL_MATCH correspondences are assumed
 	to be between each feature's img_pt field and it's match's mdl_pt field,
 	otherwise, correspondences are assumed to be between img_pt and img_pt
-@param pts output as an array of raw point locations from features
-@param mpts output as an array of raw point locations from features' matches
+@param pts array of n points in which to store the features' locations
+@param mpts array of n points in which to store the matches' locations
 */
 void extract_corresp_pts( struct feature** features, int n, int mtype,
-						 CvPoint2D64f** pts, CvPoint2D64f** mpts )
+						 CvPoint2D64f* pts, CvPoint2D64f* mpts )
 {
 	struct feature* match;
-	CvPoint2D64f* _pts, * _mpts;
 	int i;
 
-	_pts = (CvPoint2D64f*) calloc( n, sizeof( CvPoint2D64f ) );
-	_mpts = (CvPoint2D64f*) calloc( n, sizeof( CvPoint2D64f ) );
+	for( i = 0; i < n; i++ )
+	{
+		match = get_match( features[i], mtype );
+		if( ! match )
+			fatal_error( "feature does not have match of type %d, %s line %d",
+						mtype, __FILE__, __LINE__ );
+		pts[i] = features[i]->img_pt;
+		mpts[i] = ( mtype == FEATURE_MDL_MATCH )? match->mdl_pt : match->img_pt;
+	}
+}
 
-	if( mtype == FEATURE_MDL_MATCH )
+
+
+/*
+Instantiates and scores the model of one RANSAC sample.  A homography from
+four correspondences is computed in closed form into H; any other model is
+computed by xform_fn and returned in M.
+
+@param pts array of points
+@param mpts array of corresponding points
+@param n number of correspondences
+@param sample indices of the m sampled correspondences
+@param m size of the sample
+@param xform_fn function used to compute the model
+@param err_fn error function used to measure distance from the model
+@param err_tol correspondences within this distance of the model are inliers
+@param in_best number of inliers of the best model so far
+@param H array of 9 doubles in which a closed-form homography is stored
+@param M output as the model computed by xform_fn, or NULL
+
+@return Returns the number of inliers of the model, which is at most in_best
+	if scoring stopped early, or -1 if no model could be instantiated.
+*/
+int eval_hypothesis( CvPoint2D64f* pts, CvPoint2D64f* mpts, int n,
+					int* sample, int m, ransac_xform_fn xform_fn,
+					ransac_err_fn err_fn, double err_tol, int in_best,
+					double* H, CvMat** M )
+{
+	CvPoint2D64f* spts, * smpts;
+	CvMat H_hdr;
+
+	*M = NULL;
+	if( xform_fn == lsq_homog  &&  m == 4 )
+	{
+		if( ! homog_4pt( pts, mpts, sample, H ) )
+			return -1;
+		H_hdr = cvMat( 3, 3, CV_64FC1, H );
+		return score_hypothesis( pts, mpts, n, &H_hdr, err_fn, err_tol, in_best );
+	}
+
+	spts = (CvPoint2D64f*) malloc( m * sizeof( CvPoint2D64f ) );
+	smpts = (CvPoint2D64f*) malloc( m * sizeof( CvPoint2D64f ) );
+	gather_pts( pts, mpts, sample, m, spts, smpts );
+	*M = xform_fn( spts, smpts, m );
+	free( spts );
+	free( smpts );
+	if( ! *M )
+		return -1;
+	return score_hypothesis( pts, mpts, n, *M, err_fn, err_tol, in_best );
+}
+
+
+
+/*
+Computes in closed form the planar homography that maps four points exactly
+onto their correspondences.  Each set of points is the image of the
+projective basis e1, e2, e3, (1,1,1) under some homography A (resp. B), so
+the homography is B * adj(A), scaled so that its last element is 1.
+
+@param pts array of points
+@param mpts array of corresponding points
+@param idx indices of the four correspondences to use
+@param H array of 9 doubles in which to store the homography in row-major
+	order
+
+@return Returns 1 on success or 0 if three of the points are collinear.
+*/
+int homog_4pt( CvPoint2D64f* pts, CvPoint2D64f* mpts, int* idx, double* H )
+{
+	double A[9], B[9], adj[9];
+	int i, j;
+
+	if( ! basis_to_pts( pts + idx[0], pts + idx[1], pts + idx[2],
+		pts + idx[3], A ) )
+		return 0;
+	if( ! basis_to_pts( mpts + idx[0], mpts + idx[1], mpts + idx[2],
+		mpts + idx[3], B ) )
+		return 0;
+
+	adj[0] = A[4]*A[8] - A[5]*A[7];
+	adj[1] = A[2]*A[7] - A[1]*A[8];
+	adj[2] = A[1]*A[5] - A[2]*A[4];
+	adj[3] = A[5]*A[6] - A[3]*A[8];
+	adj[4] = A[0]*A[8] - A[2]*A[6];
+	adj[5] = A[2]*A[3] - A[0]*A[5];
+	adj[6] = A[3]*A[7] - A[4]*A[6];
+	adj[7] = A[1]*A[6] - A[0]*A[7];
+	adj[8] = A[0]*A[4] - A[1]*A[3];
+
+	for( i = 0; i < 3; i++ )
+		for( j = 0; j < 3; j++ )
+			H[i*3+j] = B[i*3] * adj[j] + B[i*3+1] * adj[3+j] +
+				B[i*3+2] * adj[6+j];
+
+	if( H[8] == 0.0 )
+		return 0;
+	for( i = 0; i < 8; i++ )
+		H[i] /= H[8];
+	H[8] = 1.0;
+	return 1;
+}
+
+
+
+/*
+Computes the homography that maps the projective basis e1, e2, e3, (1,1,1)
+onto four points, i.e. the matrix whose columns are the homogeneous
+coordinates of the first three points scaled so that they sum to the fourth.
+
+@param p0 first point
+@param p1 second point
+@param p2 third point
+@param p3 fourth point
+@param A array of 9 doubles in which to store the homography in row-major
+	order
+
+@return Returns 1 on success or 0 if three of the points are collinear.
+*/
+int basis_to_pts( CvPoint2D64f* p0, CvPoint2D64f* p1, CvPoint2D64f* p2,
+				 CvPoint2D64f* p3, double* A )
+{
+	double l0, l1, l2;
+
+	/* scales solve [p0 p1 p2] * l = p3, by Cramer's rule up to a common factor */
+	l0 = p3->x * ( p1->y - p2->y ) + p1->x * ( p2->y - p3->y ) +
+		p2->x * ( p3->y - p1->y );
+	l1 = p0->x * ( p3->y - p2->y ) + p3->x * ( p2->y - p0->y ) +
+		p2->x * ( p0->y - p3->y );
+	l2 = p0->x * ( p1->y - p3->y ) + p1->x * ( p3->y - p0->y ) +
+		p3->x * ( p0->y - p1->y );
+	/* a zero scale means p3 is in line with two of the others, and a zero sum,
+	   which is det[p0 p1 p2], means p0, p1 and p2 are in line */
+	if( l0 == 0.0  ||  l1 == 0.0  ||  l2 == 0.0  ||  l0 + l1 + l2 == 0.0 )
+		return 0;
+
+	A[0] = l0 * p0->x;  A[1] = l1 * p1->x;  A[2] = l2 * p2->x;
+	A[3] = l0 * p0->y;  A[4] = l1 * p1->y;  A[5] = l2 * p2->y;
+	A[6] = l0;          A[7] = l1;          A[8] = l2;
+	return 1;
+}
+
+
+
+/*
+Counts the correspondences that agree with a model, giving up as soon as the
+model can no longer have more inliers than the best model so far.  The
+transfer error of a homography is evaluated inline.
+
+@param pts array of points
+@param mpts array of corresponding points
+@param n number of correspondences
+@param M model to score
+@param err_fn error function used to measure distance from M
+@param err_tol correspondences within this distance of M are inliers
+@param in_best number of inliers of the best model so far
+
+@return Returns the number of inliers of M, or a number no greater than
+	in_best if M cannot beat the best model.
+*/
+int score_hypothesis( CvPoint2D64f* pts, CvPoint2D64f* mpts, int n,
+					 CvMat* M, ransac_err_fn err_fn, double err_tol,
+					 int in_best )
+{
+	double* H = M->data.db;
+	double u, v, w;
+	int i, in = 0;
+
+	if( err_fn == homog_xfer_err )
+	{
 		for( i = 0; i < n; i++ )
 		{
-			match = get_match( features[i], mtype );
-			if( ! match )
-				fatal_error( "feature does not have match of type %d, %s line %d",
-							mtype, __FILE__, __LINE__ );
-			_pts[i] = features[i]->img_pt;
-			_mpts[i] = match->mdl_pt;
+			w = H[6] * pts[i].x + H[7] * pts[i].y + H[8];
+			u = ( H[0] * pts[i].x + H[1] * pts[i].y + H[2] ) / w - mpts[i].x;
+			v = ( H[3] * pts[i].x + H[4] * pts[i].y + H[5] ) / w - mpts[i].y;
+			if( sqrt( u*u + v*v ) <= err_tol )
+				in++;
+			else if( in + n - 1 - i <= in_best )
+				return in;
 		}
-
+	}
 	else
 		for( i = 0; i < n; i++ )
 		{
-			match = get_match( features[i], mtype );
-			if( ! match )
-				fatal_error( "feature does not have match of type %d, %s line %d",
-							mtype, __FILE__, __LINE__ );
-			_pts[i] = features[i]->img_pt;
-			_mpts[i] = match->img_pt;
+			if( err_fn( pts[i], mpts[i], M ) <= err_tol )
+				in++;
+			else if( in + n - 1 - i <= in_best )
+				return in;
 		}
 
-		*pts = _pts;
-		*mpts = _mpts;
+	return in;
 }
 
 
 
 /*
 For a given model and error function, finds a consensus from a set of
-feature correspondences.
+point correspondences.
 
-@param features set of pointers to features; every feature is assumed to
-	have a match of type mtype
-@param n number of features in features
-@param mtype determines the match field of each feature against which to
-	measure error; if this is FEATURE_MDL_MATCH, correspondences are assumed
-	to be between the feature's img_pt field and the match's mdl_pt field;
-	otherwise matches are assumed to be between img_pt and img_pt
+@param pts array of points
+@param mpts array of corresponding points
+@param n number of correspondences
 @param M model for which a consensus set is being found
 @param err_fn error function used to measure distance from M
 @param err_tol correspondences within this distance of M are added to the
 	consensus set
-@param consensus output as an array of pointers to features in the
-	consensus set
+@param consensus array of n ints in which to store the indices of the
+	correspondences in the consensus set
 
 @return Returns the number of points in the consensus set
 */
-int find_consensus( struct feature** features, int n, int mtype,
-				   CvMat* M, ransac_err_fn err_fn, double err_tol,
-				   struct feature*** consensus )
+int find_consensus( CvPoint2D64f* pts, CvPoint2D64f* mpts, int n, CvMat* M,
+				   ransac_err_fn err_fn, double err_tol, int* consensus )
 {
-	struct feature** _consensus;
-	struct feature* match;
-	CvPoint2D64f pt, mpt;
-	double err;
 	int i, in = 0;
 
-	_consensus = (feature**) calloc( n, sizeof( struct feature* ) );
-
-	if( mtype == FEATURE_MDL_MATCH )
-		for( i = 0; i < n; i++ )
-		{
-			match = get_match( features[i], mtype );
-			if( ! match )
-				fatal_error( "feature does not have match of type %d, %s line %d",
-							mtype, __FILE__, __LINE__ );
-			pt = features[i]->img_pt;
-			mpt = match->mdl_pt;
-			err = err_fn( pt, mpt, M );
-			if( err <= err_tol )
-				_consensus[in++] = features[i];
-		}
-
-	else
-		for( i = 0; i < n; i++ )
-		{
-			match = get_match( features[i], mtype );
-			if( ! match )
-				fatal_error( "feature does not have match of type %d, %s line %d",
-							mtype, __FILE__, __LINE__ );
-			pt = features[i]->img_pt;
-			mpt = match->img_pt;
-			err = err_fn( pt, mpt, M );
-			if( err <= err_tol )
-				_consensus[in++] = features[i];
-		}
-	*consensus = _consensus;
+	for( i = 0; i < n; i++ )
+		if( err_fn( pts[i], mpts[i], M ) <= err_tol )
+			consensus[in++] = i;
 	return in;
 }
 
 
 
 /*
-Releases memory and reduces code size above
+Copies a subset of point correspondences.
 
-@param pts1 an array of points
-@param pts2 an array of points
-@param features an array of pointers to features; can be NULL
+@param pts array of points
+@param mpts array of corresponding points
+@param idx indices of the correspondences to copy
+@param n number of indices in idx
+@param spts array of n points in which to store the selected points
+@param smpts array of n points in which to store their correspondences
 */
-static __inline void release_mem( CvPoint2D64f* pts1, CvPoint2D64f* pts2,
-struct feature** features )
+void gather_pts( CvPoint2D64f* pts, CvPoint2D64f* mpts, int* idx, int n,
+				CvPoint2D64f* spts, CvPoint2D64f* smpts )
 {
-	free( pts1 );
-	free( pts2 );
-	if( features )
-		free( features );
+	int i;
+
+	for( i = 0; i < n; i++ )
+	{
+		spts[i] = pts[idx[i]];
+		smpts[i] = mpts[idx[i]];
+	}
 }
@@ -15,13 +15,6 @@ Copyright (C) 2006  Rob Hess <hess@eecs.oregonstate.edu>
 
 struct feature;
 
-/** holds feature data relevant to ransac */
-struct ransac_data
-{
-	void* orig_feat_data;
-	int sampled;
-};
-
 /******************************* Defs and macros *****************************/
 
 /* RANSAC error tolerance in pixels */
@@ -33,8 +26,8 @@ struct ransac_data
 /** estimate of the probability that a correspondence supports a bad model */
 #define RANSAC_PROB_BAD_SUPP 0.10
 
-/* extracts a feature's RANSAC data */
-#define feat_ransac_data( feat ) ( (struct ransac_data*) (feat)->feature_data )
+/** number of RANSAC hypotheses drawn and scored together */
+#define RANSAC_BATCH_SIZE 32
 
 
 /**
@@ -83,6 +76,13 @@ Fischler, M. A. and Bolles, R. C.  Random sample consensus: a paradigm for
 model fitting with applications to image analysis and automated cartography.
 <EM>Communications of the ACM, 24</EM>, 6 (1981), pp. 381--395.
 
+Hypotheses are drawn in batches of RANSAC_BATCH_SIZE and scored in parallel
+when OpenMP is available, so \a xform_fn and \a err_fn must be safe to call
+from several threads at once.  Scoring a hypothesis stops as soon as it can
+no longer beat the best one, and a homography from four correspondences
+(\a xform_fn lsq_homog, \a m 4) is computed in closed form.  The result is
+the same as scoring the hypotheses one at a time.
+
 @param features an array of features; only features with a non-NULL match
 	of type \a mtype are used in homography computation
 @param n number of features in \a feat